@@ -0,0 +1,10 @@
+
+$(BuildDir)/run_main.o: $(TopDir)/src/run/main.c
+	@$(ECHO) "  [COMPILE] run/main.c"
+	@$(COMPILE) $(TopDir)/src/run/main.c -o $(BuildDir)/run_main.o
+
+
+$(BuildDir)/run.a:  $(BuildDir)/run_main.o
+	@$(ECHO) "  [ARCHIVE] run.a"
+	@$(AR) $(BuildDir)/run.a  $(BuildDir)/run_main.o
+
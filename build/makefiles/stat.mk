@@ -0,0 +1,10 @@
+
+$(BuildDir)/stat_main.o: $(TopDir)/src/stat/main.c
+	@$(ECHO) "  [COMPILE] stat/main.c"
+	@$(COMPILE) $(TopDir)/src/stat/main.c -o $(BuildDir)/stat_main.o
+
+
+$(BuildDir)/stat.a:  $(BuildDir)/stat_main.o
+	@$(ECHO) "  [ARCHIVE] stat.a"
+	@$(AR) $(BuildDir)/stat.a  $(BuildDir)/stat_main.o
+
@@ -0,0 +1,10 @@
+
+$(BuildDir)/trace_main.o: $(TopDir)/src/trace/main.c
+	@$(ECHO) "  [COMPILE] trace/main.c"
+	@$(COMPILE) $(TopDir)/src/trace/main.c -o $(BuildDir)/trace_main.o
+
+
+$(BuildDir)/trace.a:  $(BuildDir)/trace_main.o
+	@$(ECHO) "  [ARCHIVE] trace.a"
+	@$(AR) $(BuildDir)/trace.a  $(BuildDir)/trace_main.o
+
@@ -0,0 +1,70 @@
+
+$(BuildDir)/vm_columns.o: $(TopDir)/src/vm/columns.c
+	@$(ECHO) "  [COMPILE] vm/columns.c"
+	@$(COMPILE) $(TopDir)/src/vm/columns.c -o $(BuildDir)/vm_columns.o
+
+
+$(BuildDir)/vm_constants.o: $(TopDir)/src/vm/constants.c
+	@$(ECHO) "  [COMPILE] vm/constants.c"
+	@$(COMPILE) $(TopDir)/src/vm/constants.c -o $(BuildDir)/vm_constants.o
+
+
+$(BuildDir)/vm_dfa.o: $(TopDir)/src/vm/dfa.c
+	@$(ECHO) "  [COMPILE] vm/dfa.c"
+	@$(COMPILE) $(TopDir)/src/vm/dfa.c -o $(BuildDir)/vm_dfa.o
+
+
+$(BuildDir)/vm_loader.o: $(TopDir)/src/vm/loader.c
+	@$(ECHO) "  [COMPILE] vm/loader.c"
+	@$(COMPILE) $(TopDir)/src/vm/loader.c -o $(BuildDir)/vm_loader.o
+
+
+$(BuildDir)/vm_plugin.o: $(TopDir)/src/vm/plugin.c
+	@$(ECHO) "  [COMPILE] vm/plugin.c"
+	@$(COMPILE) $(TopDir)/src/vm/plugin.c -o $(BuildDir)/vm_plugin.o
+
+
+$(BuildDir)/vm_predicates.o: $(TopDir)/src/vm/predicates.c
+	@$(ECHO) "  [COMPILE] vm/predicates.c"
+	@$(COMPILE) $(TopDir)/src/vm/predicates.c -o $(BuildDir)/vm_predicates.o
+
+
+$(BuildDir)/vm_ring.o: $(TopDir)/src/vm/ring.c
+	@$(ECHO) "  [COMPILE] vm/ring.c"
+	@$(COMPILE) $(TopDir)/src/vm/ring.c -o $(BuildDir)/vm_ring.o
+
+
+$(BuildDir)/vm_set.o: $(TopDir)/src/vm/set.c
+	@$(ECHO) "  [COMPILE] vm/set.c"
+	@$(COMPILE) $(TopDir)/src/vm/set.c -o $(BuildDir)/vm_set.o
+
+
+$(BuildDir)/vm_stats.o: $(TopDir)/src/vm/stats.c
+	@$(ECHO) "  [COMPILE] vm/stats.c"
+	@$(COMPILE) $(TopDir)/src/vm/stats.c -o $(BuildDir)/vm_stats.o
+
+
+$(BuildDir)/vm_trace.o: $(TopDir)/src/vm/trace.c
+	@$(ECHO) "  [COMPILE] vm/trace.c"
+	@$(COMPILE) $(TopDir)/src/vm/trace.c -o $(BuildDir)/vm_trace.o
+
+
+$(BuildDir)/vm_trie.o: $(TopDir)/src/vm/trie.c
+	@$(ECHO) "  [COMPILE] vm/trie.c"
+	@$(COMPILE) $(TopDir)/src/vm/trie.c -o $(BuildDir)/vm_trie.o
+
+
+$(BuildDir)/vm_tuples.o: $(TopDir)/src/vm/tuples.c
+	@$(ECHO) "  [COMPILE] vm/tuples.c"
+	@$(COMPILE) $(TopDir)/src/vm/tuples.c -o $(BuildDir)/vm_tuples.o
+
+
+$(BuildDir)/vm_vm.o: $(TopDir)/src/vm/vm.c
+	@$(ECHO) "  [COMPILE] vm/vm.c"
+	@$(COMPILE) $(TopDir)/src/vm/vm.c -o $(BuildDir)/vm_vm.o
+
+
+$(BuildDir)/vm.a:  $(BuildDir)/vm_columns.o $(BuildDir)/vm_constants.o $(BuildDir)/vm_dfa.o $(BuildDir)/vm_loader.o $(BuildDir)/vm_plugin.o $(BuildDir)/vm_predicates.o $(BuildDir)/vm_ring.o $(BuildDir)/vm_set.o $(BuildDir)/vm_stats.o $(BuildDir)/vm_trace.o $(BuildDir)/vm_trie.o $(BuildDir)/vm_tuples.o $(BuildDir)/vm_vm.o
+	@$(ECHO) "  [ARCHIVE] vm.a"
+	@$(AR) $(BuildDir)/vm.a  $(BuildDir)/vm_columns.o $(BuildDir)/vm_constants.o $(BuildDir)/vm_dfa.o $(BuildDir)/vm_loader.o $(BuildDir)/vm_plugin.o $(BuildDir)/vm_predicates.o $(BuildDir)/vm_ring.o $(BuildDir)/vm_set.o $(BuildDir)/vm_stats.o $(BuildDir)/vm_trace.o $(BuildDir)/vm_trie.o $(BuildDir)/vm_tuples.o $(BuildDir)/vm_vm.o
+
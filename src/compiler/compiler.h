@@ -71,11 +71,12 @@
  * unused nodes, to avoid invoking the operating system for dynamical memory
  * too often. There is a specific section that outligths memory management.
  *
- * There are four different types of p_node:
+ * There are five different types of p_node:
  *
  * <pre>
  *   unused     : managed by the unused node cache
  *   lexeme     : references a lexeme
+ *   set        : references a set of strings being parsed
  *   complete   : references a complete code block
  *   comparison : references a comparison code block
  * </pre>
@@ -124,6 +125,8 @@ typedef enum vm_opcode {
     VM_NOP,
     /** Execute an external program. */
     VM_EXEC,
+    /** Call another function. */
+    VM_CALL,
     /** Set trueflag if two strings equal. */
     VM_EQ,
     /** Set trueflag if the first string is major than the second. */
@@ -136,6 +139,24 @@ typedef enum vm_opcode {
     VM_MIEQ,
     /** Set trueflag if two strings differ. */
     VM_NEQ,
+    /** Set trueflag if two numbers equal. */
+    VM_IEQ,
+    /** Set trueflag if the first number is major than the second. */
+    VM_IMAG,
+    /** Set trueflag if the first number is minor than the second. */
+    VM_IMIN,
+    /** Set trueflag if the first number is not minor than the second. */
+    VM_IMAEQ,
+    /** Set trueflag if the first number is not major than the second. */
+    VM_IMIEQ,
+    /** Set trueflag if two numbers differ. */
+    VM_INEQ,
+    /** Set trueflag if string belongs to a set in the constant pool. */
+    VM_IN,
+    /** Set trueflag if the first string matches the glob in the second. */
+    VM_MATCH,
+    /** Set trueflag if the first string is an address in the second. */
+    VM_INNET,
     /** Jump to location if trueflag is set. */
     VM_JTRUE,
     /** Jump to location if trueflag isn't set. */
@@ -160,12 +181,26 @@ typedef struct vm_instr {
             char * arg1;
             /** Second argument for comparison instructions. */
             char * arg2;
+            /** Constant pool entry for set membership instructions. */
+            unsigned pool;
         };
         /** Location to jump to. */
         unsigned location;
     };
 } vm_instr;
 
+/** Constant pool entry: a sorted set of distinct strings. */
+typedef struct vm_set {
+    /** Index of this set in the constant pool. */
+    unsigned index;
+    /** Number of strings in this set. */
+    unsigned count;
+    /** Size of strings vector. */
+    unsigned size;
+    /** Vector of strings. */
+    char **strings;
+} vm_set;
+
 /** Entry in backpatch list. */
 typedef struct bp_entry {
     /** Next entry in backpatch list. */
@@ -188,6 +223,8 @@ typedef struct p_node {
     vm_instr *code;
     /** Lexeme referenced by this node, for lexeme nodes only. */
     char *lexeme;
+    /** Set of strings referenced by this node, for set nodes only. */
+    vm_set *set;
 } p_node;
 
 /**
@@ -197,6 +234,14 @@ typedef struct p_node {
  * @{
  */
 
+/**
+ * Record the parameter name of the function being parsed, so that the
+ * calls in its body may only pass that name.
+ * @param param Lexeme node that references function parameter name.
+ * @returns @a param.
+ */
+extern p_node *code_eval_PARAM(p_node *param);
+
 /**
  * Install an entry for function @a name in symbol table.
  * @param name Lexeme node that references function name.
@@ -205,6 +250,15 @@ typedef struct p_node {
  */
 extern void code_eval_FUNC(p_node *name, p_node *param, p_node *body);
 
+/**
+ * Install an entry for static function @a name in symbol table. A static
+ * function is not run against each record: it only runs when called.
+ * @param name Lexeme node that references function name.
+ * @param param Lexeme node that references function parameter name.
+ * @param body Complete node that references a code block.
+ */
+extern void code_eval_STATIC_FUNC(p_node *name, p_node *param, p_node *body);
+
 /**
  * Chain two complete nodes into another complete node.
  * @param body Complete node.
@@ -320,6 +374,46 @@ extern p_node *code_gen_MIEQ(p_node *l, p_node *r);
  */
 extern p_node *code_gen_NEQ(p_node *l, p_node *r);
 
+/**
+ * Generate code for MATCH instruction.
+ * @param l Lexeme node for left parameter.
+ * @param r Lexeme node for left operator.
+ * @returns Comparison node merge of @a l and @a r.
+ */
+extern p_node *code_gen_MATCH(p_node *l, p_node *r);
+
+/**
+ * Generate code for INNET instruction.
+ * @param l Lexeme node for left parameter.
+ * @param r Lexeme node for left operator.
+ * @returns Comparison node merge of @a l and @a r.
+ */
+extern p_node *code_gen_INNET(p_node *l, p_node *r);
+
+/**
+ * Generate code for IN instruction. The set is interned into the constant
+ * pool, so that equal sets share the same pool entry.
+ * @param l Lexeme node for left parameter, which must be a register.
+ * @param set Set node for right operand.
+ * @returns Comparison node that tests @a l membership to @a set.
+ */
+extern p_node *code_gen_IN(p_node *l, p_node *set);
+
+/**
+ * Create a set node.
+ * @param string Lexeme node for the first string in the set.
+ * @returns Set node containing @a string.
+ */
+extern p_node *code_gen_SET(p_node *string);
+
+/**
+ * Add a string to a set node.
+ * @param set Set node.
+ * @param string Lexeme node for the string to add.
+ * @returns @a set, with @a string added.
+ */
+extern p_node *code_eval_SET(p_node *set, p_node *string);
+
 /**
  * Generate code for NOP instruction.
  * @returns Complete node that references VM_NOP instruction.
@@ -333,6 +427,15 @@ extern p_node *code_gen_NOP(void);
  */
 extern p_node *code_gen_EXEC(p_node *node_string);
 
+/**
+ * Generate code for CALL instruction.
+ * @param name Lexeme node containing the name of the function to call.
+ * @param arg Lexeme node that references the argument, which must be the
+ *        parameter of the caller.
+ * @returns Complete node that references VM_CALL instruction.
+ */
+extern p_node *code_gen_CALL(p_node *name, p_node *arg);
+
 /**
  * Maps function parameter field to VM register.
  * @param param Lexeme node that references function parameter name.
@@ -356,8 +459,12 @@ extern p_node *p_node_create(const char * lexeme);
 /** Initialize code generation subsystem. */
 extern void subsys_code_init(void);
 
-/** Output all the code generated so far. */
-extern void code_generate(void);
+/**
+ * Output all the code generated so far.
+ * @param first Non zero for first match mode, in which the global offset
+ *        table lists functions in the order in which they were defined.
+ */
+extern void code_generate(int first);
 
 /** This is the type that will be used in parser and scanner. */
 #define YYSTYPE p_node *
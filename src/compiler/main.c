@@ -21,6 +21,10 @@
  */
 
 #include<compiler/compiler.h>
+#include<ctype.h>
+#include<errno.h>
+#include<limits.h>
+#include<arpa/inet.h>
 
 /**
  * @defgroup compiler_impl Compiler implementation
@@ -393,6 +397,8 @@ typedef struct sym_table_entry {
     vm_instr *instr;
     /** Name of this function. */
     char * name;
+    /** Non zero for static functions. */
+    int local;
 } sym_table_entry;
 
 /** Symbol table. */
@@ -455,8 +461,10 @@ static sym_table_entry *sym_table_lookup(sym_table *t, char *s, unsigned *h)
  * @param t Symbol table.
  * @param name Function name.
  * @param instr First instruction for function.
+ * @param local Non zero for static functions.
  */
-static void sym_table_install(sym_table *t, char *name, vm_instr *instr)
+static void sym_table_install(sym_table *t, char *name, vm_instr *instr,
+                              int local)
 {
     struct sym_table_entry *e;
     unsigned hashval;
@@ -469,10 +477,166 @@ static void sym_table_install(sym_table *t, char *name, vm_instr *instr)
     e = p_storage_alloc(t->storage, sizeof (sym_table_entry));
     e->name = p_storage_strdup(t->storage, name);
     e->instr = instr;
+    e->local = local;
     e->next = t->table[hashval];
     t->table[hashval] = e;
 }
 
+/**
+ * Compare two symbol table entries by entry point, for qsort().
+ * @param a Pointer to pointer to first entry.
+ * @param b Pointer to pointer to second entry.
+ * @returns Less than, equal to or greater than zero.
+ */
+static int sym_table_entry_compare(const void *a, const void *b)
+{
+    const sym_table_entry *x = *(sym_table_entry * const *) a;
+    const sym_table_entry *y = *(sym_table_entry * const *) b;
+
+    return (x->instr->offset > y->instr->offset) -
+           (x->instr->offset < y->instr->offset);
+}
+
+/**
+ * @}
+ * @defgroup CPM Constant pool management
+ * @{
+ * The constant pool contains the sets of strings referenced by set
+ * membership instructions. Each set is sorted and its duplicates are
+ * removed before being interned, so that the virtual machine could build
+ * a perfect hash for it, and so that two sets that contain the same
+ * strings share the same pool entry, regardless of the order in which
+ * strings were written.
+ *
+ * @warning Interning is O(N) in the number of sets, because we compare
+ * the new set with all the sets in the pool. However, it seems N is not
+ * going to be big.
+ */
+
+/** Constant pool. */
+typedef struct vm_pool {
+    /** Storage for sets and strings. */
+    p_storage *storage;
+    /** Base of sets vector. */
+    vm_set **base;
+    /** Number of sets in the pool. */
+    unsigned count;
+    /** Sets vector size. */
+    unsigned size;
+} vm_pool;
+
+/** Initial size of sets vector. */
+#define VM_POOL_SIZE 64
+
+/** Initial size of strings vector for a set. */
+#define VM_SET_SIZE 8
+
+/**
+ * Create constant pool.
+ * @returns Constant pool.
+ */
+static vm_pool *vm_pool_create(void)
+{
+    p_storage *s = p_storage_create();
+    vm_pool *pool = p_storage_alloc(s, sizeof (vm_pool));
+    pool->storage = s;
+    pool->base = calloc(VM_POOL_SIZE, sizeof (vm_set *));
+    if (!pool->base) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    pool->size = VM_POOL_SIZE;
+    return pool;
+}
+
+/**
+ * Compare two strings referenced by a set, for qsort().
+ * @param a Pointer to first string.
+ * @param b Pointer to second string.
+ * @returns Less than, equal to or greater than zero, like strcmp().
+ */
+static int vm_set_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Sort @a set and remove duplicate strings.
+ * @param set Set of strings.
+ */
+static void vm_set_normalize(vm_set *set)
+{
+    unsigned i, n;
+
+    qsort(set->strings, set->count, sizeof (char *), vm_set_compare);
+    for (i = 1, n = 1; i < set->count; ++i) {
+        if (strcmp(set->strings[i], set->strings[n - 1]) != 0) {
+            set->strings[n++] = set->strings[i];
+        }
+    }
+    set->count = n;
+}
+
+/**
+ * Check whether two normalized sets contain the same strings.
+ * @param a Set of strings.
+ * @param b Set of strings.
+ * @returns Non zero if @a a equals @a b.
+ */
+static int vm_set_equal(vm_set *a, vm_set *b)
+{
+    unsigned i;
+
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (i = 0; i < a->count; ++i) {
+        if (strcmp(a->strings[i], b->strings[i]) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Intern a set in the constant pool.
+ * @param pool Constant pool.
+ * @param set Set of strings, allocated in temporary storage.
+ * @returns Index of the pool entry equal to @a set.
+ */
+static unsigned vm_pool_intern(vm_pool *pool, vm_set *set)
+{
+    vm_set *entry;
+    unsigned i;
+
+    vm_set_normalize(set);
+    for (i = 0; i < pool->count; ++i) {
+        if (vm_set_equal(pool->base[i], set)) {
+            return i;
+        }
+    }
+
+    if (pool->count >= pool->size) {
+        pool->size *= 2;
+        pool->base = realloc(pool->base, pool->size * sizeof (vm_set *));
+        if (!pool->base) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    entry = p_storage_alloc(pool->storage, sizeof (vm_set));
+    entry->index = pool->count;
+    entry->count = entry->size = set->count;
+    entry->strings = p_storage_alloc(pool->storage,
+                                     set->count * sizeof (char *));
+    for (i = 0; i < set->count; ++i) {
+        entry->strings[i] = p_storage_strdup(pool->storage, set->strings[i]);
+    }
+    pool->base[pool->count++] = entry;
+    return entry->index;
+}
+
 /**
  * @}
  */
@@ -483,20 +647,59 @@ static sym_table *SymbolTable;
 static p_storage *Storage;
 /** Code manager that contains all the generated code. */
 static vm_code *Code;
+/** Constant pool that contains all the sets referenced by code. */
+static vm_pool *Pool;
+/** Parameter name of the function being parsed. */
+static const char *Param;
 
 /**
  * @}
  */
 
-void code_eval_FUNC(p_node *name, p_node *param, p_node *body)
+/**
+ * Terminate a function and install it in symbol table.
+ * @param name Lexeme node that references function name.
+ * @param body Complete node that references a code block.
+ * @param local Non zero for static functions.
+ */
+static void code_eval_func(p_node *name, p_node *body, int local)
 {
     vm_instr * instr = vm_instr_create(Code);
     instr->opcode = VM_RETURN;
     bp_backpatch(body->nextlist, instr);
-    sym_table_install(SymbolTable, name->lexeme, body->code);
+    sym_table_install(SymbolTable, name->lexeme, body->code, local);
     p_storage_clear(Storage);
 }
 
+/**
+ * Check that a parameter name is the one of the function being parsed,
+ * exiting on error.
+ * @param param Lexeme node that references a parameter name.
+ */
+static void code_check_param(p_node *param)
+{
+    if (strcmp(param->lexeme, Param) != 0) {
+        fprintf(stderr, "unknown parameter: %s\n", param->lexeme);
+        exit(1);
+    }
+}
+
+p_node *code_eval_PARAM(p_node *param)
+{
+    Param = param->lexeme;
+    return param;
+}
+
+void code_eval_FUNC(p_node *name, p_node *param, p_node *body)
+{
+    code_eval_func(name, body, 0);
+}
+
+void code_eval_STATIC_FUNC(p_node *name, p_node *param, p_node *body)
+{
+    code_eval_func(name, body, 1);
+}
+
 p_node *code_eval_BODY(p_node *body, p_node *if_or_exec)
 {
     p_node *p = p_storage_node_alloc(Storage);
@@ -554,13 +757,179 @@ p_node *code_eval_NOT(p_node *node)
     return p;
 }
 
+/**
+ * Choose the opcode for a comparison: when an operand is a number, the
+ * fields are compared as numbers rather than as strings.
+ * @param opcode String comparison opcode.
+ * @param l Lexeme node for left parameter.
+ * @param r Lexeme node for right parameter.
+ * @returns @a opcode, or the corresponding numeric comparison opcode.
+ */
+static vm_opcode code_cmp_opcode(vm_opcode opcode, p_node *l, p_node *r)
+{
+    unsigned long number;
+
+    if (!isdigit((unsigned char) l->lexeme[0]) &&
+        !isdigit((unsigned char) r->lexeme[0])) {
+        return opcode;
+    }
+    if (l->lexeme[0] != '$' || !isdigit((unsigned char) r->lexeme[0])) {
+        fprintf(stderr, "numeric comparison needs a field on the left and "
+                "a number on the right: %s %s\n", l->lexeme, r->lexeme);
+        exit(1);
+    }
+    errno = 0;
+    number = strtoul(r->lexeme, NULL, 10);
+    if (errno == ERANGE || number > UINT_MAX) {
+        fprintf(stderr, "number out of range: %s\n", r->lexeme);
+        exit(1);
+    }
+
+    switch (opcode) {
+        case VM_EQ:
+            return VM_IEQ;
+        case VM_MAG:
+            return VM_IMAG;
+        case VM_MIN:
+            return VM_IMIN;
+        case VM_MAEQ:
+            return VM_IMAEQ;
+        case VM_MIEQ:
+            return VM_IMIEQ;
+        case VM_NEQ:
+            return VM_INEQ;
+        default:
+            fprintf(stderr, "invalid numeric operand: %s\n", r->lexeme);
+            exit(1);
+    }
+}
+
+/**
+ * Tell whether a pattern is a valid glob, like the virtual machine does
+ * when it compiles patterns into a DFA: a character class must be closed
+ * and can't be empty, since a closing bracket right after the opening is
+ * a literal.
+ * @param s Pattern, quotes included.
+ * @returns Non zero if @a s is valid.
+ */
+static int code_pattern_valid(const char *s)
+{
+    const char *p = s + 1, *end = s + strlen(s) - 1;
+
+    while (p < end) {
+        if (*p == '[') {
+            ++p;
+            if (p < end && (*p == '!' || *p == '^')) {
+                ++p;
+            }
+            do {
+                if (p >= end) {
+                    return 0;
+                }
+                ++p;
+                if (p + 1 < end && *p == '-' && p[1] != ']') {
+                    p += 2;
+                }
+            } while (p >= end || *p != ']');
+            ++p;
+        } else {
+            if (*p == '\\' && p + 1 < end) {
+                ++p;
+            }
+            ++p;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Tell whether a network is valid, like the virtual machine does when it
+ * builds the radix trie: an IPv4 or IPv6 address, optionally followed by
+ * a slash and a prefix length no longer than the address.
+ * @param s Network, quotes included.
+ * @returns Non zero if @a s is valid.
+ */
+static int code_network_valid(const char *s)
+{
+    char buf[64], *slash, *end;
+    unsigned char addr[16];
+    unsigned long bits, plen;
+    size_t len = strlen(s) - 2;
+
+    if (len >= sizeof (buf)) {
+        return 0;
+    }
+    memcpy(buf, s + 1, len);
+    buf[len] = '\0';
+    slash = strchr(buf, '/');
+    if (slash) {
+        *slash++ = '\0';
+    }
+    if (inet_pton(AF_INET, buf, addr) == 1) {
+        plen = 32;
+    } else if (inet_pton(AF_INET6, buf, addr) == 1) {
+        plen = 128;
+    } else {
+        return 0;
+    }
+    if (slash) {
+        bits = strtoul(slash, &end, 10);
+        if (*slash == '\0' || *end != '\0' || bits > plen) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check the operands of comparisons that the virtual machine can only
+ * perform between a field and a string constant, exiting on error.
+ * @param opcode String comparison opcode.
+ * @param l Lexeme node for left parameter.
+ * @param r Lexeme node for right parameter.
+ */
+static void code_cmp_check(vm_opcode opcode, p_node *l, p_node *r)
+{
+    const char *op;
+
+    switch (opcode) {
+        case VM_MATCH:
+            op = "~";
+            break;
+        case VM_INNET:
+            op = "in_net";
+            break;
+        default:
+            return;
+    }
+    if (l->lexeme[0] != '$') {
+        fprintf(stderr, "left operand of %s must be a field: %s\n", op,
+                l->lexeme);
+        exit(1);
+    }
+    if (r->lexeme[0] != '"') {
+        fprintf(stderr, "right operand of %s must be a string: %s\n", op,
+                r->lexeme);
+        exit(1);
+    }
+    if (opcode == VM_MATCH && !code_pattern_valid(r->lexeme)) {
+        fprintf(stderr, "invalid pattern: %s\n", r->lexeme);
+        exit(1);
+    }
+    if (opcode == VM_INNET && !code_network_valid(r->lexeme)) {
+        fprintf(stderr, "invalid network: %s\n", r->lexeme);
+        exit(1);
+    }
+}
+
 #define CODE_GEN_CMP(_opcode_)                                              \
 p_node *code_gen_##_opcode_(p_node *l, p_node *r)                           \
 {                                                                           \
     vm_instr *instr = vm_instr_create(Code);                                \
     p_node *p = p_storage_node_alloc(Storage);                              \
                                                                             \
-    instr->opcode = VM_##_opcode_;                                          \
+    code_cmp_check(VM_##_opcode_, l, r);                                    \
+    instr->opcode = code_cmp_opcode(VM_##_opcode_, l, r);                   \
     instr->arg1 = vm_instr_strdup(Code, l->lexeme);                         \
     instr->arg2 = vm_instr_strdup(Code, r->lexeme);                         \
     p->code = instr;                                                        \
@@ -582,6 +951,64 @@ CODE_GEN_CMP(MIN)
 CODE_GEN_CMP(MAEQ)
 CODE_GEN_CMP(MIEQ)
 CODE_GEN_CMP(NEQ)
+CODE_GEN_CMP(MATCH)
+CODE_GEN_CMP(INNET)
+
+p_node *code_gen_IN(p_node *l, p_node *set)
+{
+    vm_instr *instr;
+    p_node *p;
+
+    if (l->lexeme[0] != '$') {
+        fprintf(stderr, "left operand of in must be a field: %s\n",
+                l->lexeme);
+        exit(1);
+    }
+
+    instr = vm_instr_create(Code);
+    p = p_storage_node_alloc(Storage);
+    instr->opcode = VM_IN;
+    instr->arg1 = vm_instr_strdup(Code, l->lexeme);
+    instr->pool = vm_pool_intern(Pool, set->set);
+    p->code = instr;
+
+    instr = vm_instr_create(Code);
+    instr->opcode = VM_JTRUE;
+    p->truelist = bp_entry_create(Storage, instr);
+
+    instr = vm_instr_create(Code);
+    instr->opcode = VM_JFALSE;
+    p->falselist = bp_entry_create(Storage, instr);
+
+    return p;
+}
+
+p_node *code_gen_SET(p_node *string)
+{
+    p_node *p = p_storage_node_alloc(Storage);
+    p->set = p_storage_alloc(Storage, sizeof (vm_set));
+    p->set->size = VM_SET_SIZE;
+    p->set->strings = p_storage_alloc(Storage, VM_SET_SIZE * sizeof (char *));
+    return code_eval_SET(p, string);
+}
+
+p_node *code_eval_SET(p_node *set, p_node *string)
+{
+    vm_set *s = set->set;
+
+    /* Strings vector lives in temporary storage, so we cannot realloc()
+     * it: just allocate a bigger one and let the old one be collected
+     * when the current function has been parsed. */
+    if (s->count >= s->size) {
+        char **strings = p_storage_alloc(Storage,
+                                         2 * s->size * sizeof (char *));
+        memcpy(strings, s->strings, s->count * sizeof (char *));
+        s->strings = strings;
+        s->size *= 2;
+    }
+    s->strings[s->count++] = string->lexeme;
+    return set;
+}
 
 p_node * code_gen_NOP(void)
 {
@@ -608,6 +1035,24 @@ p_node * code_gen_EXEC(p_node * node_string)
     return node;
 }
 
+p_node *code_gen_CALL(p_node *name, p_node *arg)
+{
+    vm_instr *instr;
+    vm_instr *jmp;
+    p_node *node;
+
+    code_check_param(arg);
+    instr = vm_instr_create(Code);
+    jmp = vm_instr_create(Code);
+    node = p_node_alloc(Storage);
+    instr->opcode = VM_CALL;
+    jmp->opcode = VM_JMP;
+    instr->arg1 = vm_instr_strdup(Code, name->lexeme);
+    node->code = instr;
+    node->nextlist = bp_entry_create(Storage, jmp);
+    return node;
+}
+
 /* WARNING! In this function we also need to check that we're using the
  * right parameter name.
  */
@@ -642,6 +1087,85 @@ p_node *p_node_create(const char * value)
     return p;
 }
 
+/**
+ * Check that no function calls itself, directly or through the functions
+ * it calls, exiting on error. Calls may go back to functions defined
+ * earlier, so the call graph is walked depth first, with an explicit
+ * stack of the functions being visited, rather than by recursion.
+ * @param functions Functions, in any order.
+ * @param count Number of functions.
+ */
+static void code_check_recursion(sym_table_entry **functions, unsigned count)
+{
+    sym_table_entry **entries = malloc((count + 1) *
+                                       sizeof (sym_table_entry *));
+    unsigned *stack = malloc((count + 1) * sizeof (unsigned));
+    unsigned *next = malloc((count + 1) * sizeof (unsigned));
+    char *state = calloc(count + 1, 1);
+    unsigned root, depth, end, hashval;
+
+    if (!entries || !stack || !next || !state) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* Sorted by entry point, each function ends where the next starts. */
+    memcpy(entries, functions, count * sizeof (sym_table_entry *));
+    qsort(entries, count, sizeof (sym_table_entry *),
+          sym_table_entry_compare);
+
+    /* A function is 1 while on the stack, 2 once its callees are done. */
+    for (root = 0; root < count; ++root) {
+        if (state[root]) {
+            continue;
+        }
+        stack[0] = root;
+        next[0] = entries[root]->instr->offset;
+        state[root] = 1;
+        for (depth = 1; depth > 0; ) {
+            unsigned f = stack[depth - 1], callee, k;
+            sym_table_entry *e, **found;
+
+            end = (f + 1 < count) ? entries[f + 1]->instr->offset
+                                  : Code->offset;
+            while (next[depth - 1] < end &&
+                   Code->base[next[depth - 1]].opcode != VM_CALL) {
+                ++next[depth - 1];
+            }
+            if (next[depth - 1] == end) {
+                state[f] = 2;
+                --depth;
+                continue;
+            }
+            e = sym_table_lookup(SymbolTable,
+                                 Code->base[next[depth - 1]++].arg1,
+                                 &hashval);
+            found = bsearch(&e, entries, count, sizeof (sym_table_entry *),
+                            sym_table_entry_compare);
+            callee = (unsigned) (found - entries);
+            if (state[callee] == 1) {
+                for (k = 0; stack[k] != callee; ++k) {
+                }
+                fprintf(stderr, "error: recursive call:");
+                for (; k < depth; ++k) {
+                    fprintf(stderr, " %s ->", entries[stack[k]]->name);
+                }
+                fprintf(stderr, " %s\n", e->name);
+                exit(1);
+            }
+            if (state[callee] == 0) {
+                state[callee] = 1;
+                stack[depth] = callee;
+                next[depth++] = e->instr->offset;
+            }
+        }
+    }
+    free(entries);
+    free(stack);
+    free(next);
+    free(state);
+}
+
 /* Main: open all files passed on standard input and parse all of them,
  * exiting in case of parse error. On successful parsing, print on
  * standard output the compiled code.
@@ -652,12 +1176,16 @@ void subsys_code_init(void)         /* To be called to initialize           */
     SymbolTable = sym_table_create();
     Storage = p_storage_create();
     Code = vm_code_create();
+    Pool = vm_pool_create();
 }
 
-void code_generate(void)            /* Generate code on standard output     */
+void code_generate(int first)       /* Generate code on standard output     */
 {
+    sym_table_entry **entries;
+    unsigned count = 0;
     unsigned hashval;
     unsigned offset;
+    unsigned index;
 
     /* Don't generate code in case there was nothing in input. */
     if (Code->offset == 0) {
@@ -665,12 +1193,60 @@ void code_generate(void)            /* Generate code on standard output     */
         return;
     }
 
-    printf(".got\n");
+    /* Functions may be called before being defined, so we check that
+     * all the called functions exist only now. */
+    for (offset = 0; offset < Code->offset; ++offset) {
+        vm_instr *instr = &Code->base[offset];
+        if (instr->opcode == VM_CALL &&
+            !sym_table_lookup(SymbolTable, instr->arg1, &hashval)) {
+            fprintf(stderr, "error: function %s does not exist\n",
+                    instr->arg1);
+            exit(1);
+        }
+    }
+
+    /* In first match mode, the order of functions matters: since code is
+     * generated as functions are defined, sort them by entry point. */
     for (hashval = 0; hashval < SYM_TABLE_HASHSIZE; ++hashval) {
-        sym_table_entry * e = SymbolTable->table[hashval];
-        while ((e)) {
-            printf("\t%s %d\n", e->name, e->instr->offset);
-            e = e->next;
+        sym_table_entry * e;
+        for (e = SymbolTable->table[hashval]; (e); e = e->next) {
+            ++count;
+        }
+    }
+    entries = malloc(count * sizeof (sym_table_entry *));
+    if (!entries) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (count = 0, hashval = 0; hashval < SYM_TABLE_HASHSIZE; ++hashval) {
+        sym_table_entry * e;
+        for (e = SymbolTable->table[hashval]; (e); e = e->next) {
+            entries[count++] = e;
+        }
+    }
+    code_check_recursion(entries, count);
+    if (first) {
+        qsort(entries, count, sizeof (sym_table_entry *),
+              sym_table_entry_compare);
+    }
+
+    printf(".got%s\n", (first) ? " first" : "");
+    for (index = 0; index < count; ++index) {
+        printf("\t%s %d%s\n", entries[index]->name,
+               entries[index]->instr->offset,
+               (entries[index]->local) ? " static" : "");
+    }
+    free(entries);
+
+    if (Pool->count > 0) {
+        printf("\n.pool\n");
+        for (index = 0; index < Pool->count; ++index) {
+            vm_set *set = Pool->base[index];
+            printf("\t%d", index);
+            for (offset = 0; offset < set->count; ++offset) {
+                printf(" %s", set->strings[offset]);
+            }
+            putchar('\n');
         }
     }
 
@@ -685,6 +1261,9 @@ void code_generate(void)            /* Generate code on standard output     */
             case VM_EXEC:
                 printf("VM_EXEC %s", instr->arg1);
                 break;
+            case VM_CALL:
+                printf("VM_CALL %s", instr->arg1);
+                break;
             case VM_EQ:
                 printf("VM_EQ %s %s", instr->arg1, instr->arg2);
                 break;
@@ -703,6 +1282,33 @@ void code_generate(void)            /* Generate code on standard output     */
             case VM_NEQ:
                 printf("VM_NEQ %s %s", instr->arg1, instr->arg2);
                 break;
+            case VM_IEQ:
+                printf("VM_IEQ %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_IMAG:
+                printf("VM_IMAG %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_IMIN:
+                printf("VM_IMIN %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_IMAEQ:
+                printf("VM_IMAEQ %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_IMIEQ:
+                printf("VM_IMIEQ %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_INEQ:
+                printf("VM_INEQ %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_IN:
+                printf("VM_IN %s %d", instr->arg1, instr->pool);
+                break;
+            case VM_MATCH:
+                printf("VM_MATCH %s %s", instr->arg1, instr->arg2);
+                break;
+            case VM_INNET:
+                printf("VM_INNET %s %s", instr->arg1, instr->arg2);
+                break;
             case VM_JTRUE:
                 printf("VM_JTRUE %d", instr->location);
                 break;
@@ -734,8 +1340,15 @@ void yyerror (char const * str)
 int main(int argc, char ** argv)
 {
     char * prog = argv[0];
+    int first = 0;
     ++argv, --argc;
 
+    /* With -f, the program runs in first match mode. */
+    if (argc > 0 && strcmp(argv[0], "-f") == 0) {
+        first = 1;
+        ++argv, --argc;
+    }
+
     subsys_code_init();
 
     if (argc > 0) {
@@ -753,7 +1366,7 @@ int main(int argc, char ** argv)
         yyparse();
     }
 
-    code_generate();
+    code_generate(first);
 
     return 0;
 }
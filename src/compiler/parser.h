@@ -1,97 +0,0 @@
-/* A Bison parser, made by GNU Bison 2.3.  */
-
-/* Skeleton interface for Bison's Yacc-like parsers in C
-
-   Copyright (C) 1984, 1989, 1990, 2000, 2001, 2002, 2003, 2004, 2005, 2006
-   Free Software Foundation, Inc.
-
-   This program is free software; you can redistribute it and/or modify
-   it under the terms of the GNU General Public License as published by
-   the Free Software Foundation; either version 2, or (at your option)
-   any later version.
-
-   This program is distributed in the hope that it will be useful,
-   but WITHOUT ANY WARRANTY; without even the implied warranty of
-   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-   GNU General Public License for more details.
-
-   You should have received a copy of the GNU General Public License
-   along with this program; if not, write to the Free Software
-   Foundation, Inc., 51 Franklin Street, Fifth Floor,
-   Boston, MA 02110-1301, USA.  */
-
-/* As a special exception, you may create a larger work that contains
-   part or all of the Bison parser skeleton and distribute that work
-   under terms of your choice, so long as that work isn't itself a
-   parser generator using the skeleton or a modified version thereof
-   as a parser skeleton.  Alternatively, if you modify or redistribute
-   the parser skeleton itself, you may (at your option) remove this
-   special exception, which will cause the skeleton and the resulting
-   Bison output files to be licensed under the GNU General Public
-   License without this special exception.
-
-   This special exception was added by the Free Software Foundation in
-   version 2.2 of Bison.  */
-
-/* Tokens.  */
-#ifndef YYTOKENTYPE
-# define YYTOKENTYPE
-   /* Put the tokens into the symbol table, so that GDB and other debuggers
-      know about them.  */
-   enum yytokentype {
-     STRING = 258,
-     IF = 259,
-     ELSE = 260,
-     EXEC = 261,
-     TO = 262,
-     TC = 263,
-     GO = 264,
-     GC = 265,
-     PV = 266,
-     P = 267,
-     ID = 268,
-     AND = 269,
-     OR = 270,
-     NOT = 271,
-     EQ = 272,
-     MAG = 273,
-     MIN = 274,
-     MAEQ = 275,
-     MIEQ = 276,
-     NEQ = 277
-   };
-#endif
-/* Tokens.  */
-#define STRING 258
-#define IF 259
-#define ELSE 260
-#define EXEC 261
-#define TO 262
-#define TC 263
-#define GO 264
-#define GC 265
-#define PV 266
-#define P 267
-#define ID 268
-#define AND 269
-#define OR 270
-#define NOT 271
-#define EQ 272
-#define MAG 273
-#define MIN 274
-#define MAEQ 275
-#define MIEQ 276
-#define NEQ 277
-
-
-
-
-#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
-typedef int YYSTYPE;
-# define yystype YYSTYPE /* obsolescent; will be withdrawn */
-# define YYSTYPE_IS_DECLARED 1
-# define YYSTYPE_IS_TRIVIAL 1
-#endif
-
-extern YYSTYPE yylval;
-
@@ -20,6 +20,8 @@
  */
 
 #include <optimizer/optimizer.h>
+#include <errno.h>
+#include <unistd.h>
 
 /**
  * @defgroup optimpl Optimizer implementation
@@ -45,6 +47,1115 @@ static codeListNode *CodeTail;
 static gotListNode *GotHead;
 /** Tail in linked list of got lines. */
 static gotListNode *GotTail;
+/** Head in linked list of pool lines. */
+static poolListNode *PoolHead;
+/** Tail in linked list of pool lines. */
+static poolListNode *PoolTail;
+
+/** Maximum number of instructions, VM_NOP excluded, of inlined functions. */
+#define INLINE_MAX_SIZE 16
+
+/** Non zero if the program runs in first match mode. */
+static int FirstMatch;
+
+/** Non zero if non static functions are fused into a single entry. */
+static int Fused;
+
+/** Suffix of the name of the static copy of a fused function. */
+#define FUSE_CALL_SUFFIX ".call"
+
+/** Metrics of the cost of running code. */
+typedef enum costMetric {
+    /** Instructions executed. */
+    COST_INSNS,
+    /** Comparison instructions executed. */
+    COST_COMPARES,
+    /** Bytes of string constants compared with fields. */
+    COST_BYTES,
+    /** Commands executed. */
+    COST_EXECS,
+    /** Number of metrics. */
+    COST_METRICS
+} costMetric;
+
+/** Names of metrics, in reports and budgets. */
+static const char *CostNames[COST_METRICS] = {
+    "insns", "compares", "bytes", "execs"
+};
+
+/** Worst case cost of running code. */
+typedef struct costInfo {
+    /** Value of each metric. */
+    long value[COST_METRICS];
+} costInfo;
+
+/** Budget of each metric for a record, or -1 if there is none. */
+static long Budget[COST_METRICS] = { -1, -1, -1, -1 };
+
+/** Non zero if costs are printed on standard error. */
+static int CostReport;
+
+/** Non zero if costs are computed, for a report or a budget. */
+static int CostCheck;
+
+/** Function in global offset table, with the extent of its code. */
+typedef struct funcInfo {
+    /** Function entry in global offset table. */
+    gotListNode *got;
+    /** Offset of the first line after the function. */
+    int end;
+    /** Non zero if calls to this function are replaced by its code. */
+    int inlined;
+    /** Number of calls to this function that are not inlined. */
+    int calls;
+} funcInfo;
+
+/** Functions in global offset table, indexed by name. */
+typedef struct funcTable {
+    /** Functions, in global offset table order. */
+    funcInfo *info;
+    /** Number of functions. */
+    int count;
+    /** Hash table of functions by name: index plus one, or zero. */
+    int *slots;
+    /** Size of hash table, which is a power of two. */
+    int size;
+} funcTable;
+
+/** Code lines indexed by offset, or NULL if the code has changed. */
+static codeListNode **Lines;
+/** Number of lines in Lines. */
+static int LineCount;
+/** Functions of the code indexed by Lines. */
+static funcTable Funcs;
+
+/**
+ * Allocate a zero filled vector, exiting if we run out of memory.
+ * @param count Number of elements.
+ * @param size Size of an element.
+ * @returns The vector.
+ */
+static void *vector_alloc(size_t count, size_t size)
+{
+    void *p = calloc((count) ? count : 1, size);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * Tell whether a line is a jump.
+ * @param line Code line.
+ * @returns Non zero for VM_JMP, VM_JTRUE and VM_JFALSE.
+ */
+static int code_line_is_jump(const codeLine *line)
+{
+    return strcmp(line->opcode, "VM_JMP") == 0 ||
+           strcmp(line->opcode, "VM_JTRUE") == 0 ||
+           strcmp(line->opcode, "VM_JFALSE") == 0;
+}
+
+/** Initial value of string hashes. */
+#define HASH_BASIS 0x811c9dc5
+
+/**
+ * Hash a string (FNV-1a), continuing from a previous hash.
+ * @param hash Previous hash, or HASH_BASIS.
+ * @param s String.
+ * @returns Hash value.
+ */
+static unsigned string_hash(unsigned hash, const char *s)
+{
+    const unsigned char *p = (const unsigned char *) s;
+
+    for (; *p != '\0'; ++p) {
+        hash = (hash ^ *p) * 0x01000193;
+    }
+    return (hash ^ 0xff) * 0x01000193;
+}
+
+/**
+ * Find the slot of a function in the hash table of functions.
+ * @param t Functions.
+ * @param name Function name.
+ * @returns Slot of the function, or of the empty slot where it would go.
+ */
+static int func_table_slot(const funcTable *t, const char *name)
+{
+    int mask = t->size - 1, slot;
+
+    for (slot = (int) (string_hash(HASH_BASIS, name) & (unsigned) mask);
+         t->slots[slot];
+         slot = (slot + 1) & mask) {
+        if (strcmp(t->info[t->slots[slot] - 1].got->content.id, name) == 0) {
+            break;
+        }
+    }
+    return slot;
+}
+
+/**
+ * Find the function called by a line.
+ * @param t Functions.
+ * @param line Code line.
+ * @returns Index of the called function, or -1 if @a line isn't a call.
+ */
+static int code_line_callee(const funcTable *t, const codeLine *line)
+{
+    int i;
+
+    if (strcmp(line->opcode, "VM_CALL") != 0) {
+        return -1;
+    }
+    i = t->slots[func_table_slot(t, line->string)] - 1;
+    if (i < 0) {
+        fprintf(stderr, "Call to undefined function %s\n", line->string);
+        exit(1);
+    }
+    return i;
+}
+
+/**
+ * Index code lines by offset.
+ * @param nlines In output, number of lines.
+ * @returns Vector of lines, where missing offsets are NULL.
+ */
+static codeListNode **code_lines(int *nlines)
+{
+    codeListNode **lines, *code;
+
+    *nlines = CodeTail->content.offset + 1;
+    lines = vector_alloc(*nlines, sizeof (codeListNode *));
+    for (code = CodeHead; code != NULL; code = code->nextPtr) {
+        lines[code->content.offset] = code;
+    }
+    return lines;
+}
+
+/**
+ * Compare two functions by entry point, for qsort().
+ * @param a Pointer to pointer to first function.
+ * @param b Pointer to pointer to second function.
+ * @returns Less than, equal to or greater than zero.
+ */
+static int func_compare(const void *a, const void *b)
+{
+    const funcInfo *x = *(funcInfo * const *) a;
+    const funcInfo *y = *(funcInfo * const *) b;
+
+    return (x->got->content.start > y->got->content.start) -
+           (x->got->content.start < y->got->content.start);
+}
+
+/**
+ * Find the functions in global offset table, in order, and the extent of
+ * their code, which ends at the next entry point. Here we rely on the
+ * compiler, that emits the code of each function contiguously.
+ * @param t In output, the functions.
+ * @param nlines Number of lines.
+ */
+static void func_table_build(funcTable *t, int nlines)
+{
+    gotListNode *got;
+    funcInfo **order;
+    int i, end, slot;
+
+    for (got = GotHead, t->count = 0; got != NULL; got = got->nextPtr) {
+        ++t->count;
+    }
+    t->info = vector_alloc(t->count, sizeof (funcInfo));
+    order = vector_alloc(t->count, sizeof (funcInfo *));
+    for (got = GotHead, i = 0; got != NULL; got = got->nextPtr, ++i) {
+        t->info[i].got = got;
+        order[i] = &t->info[i];
+    }
+
+    /* In order of entry point, each function ends where the next one
+     * with a greater entry point starts. */
+    qsort(order, t->count, sizeof (funcInfo *), func_compare);
+    for (i = t->count, end = nlines; i-- > 0; ) {
+        order[i]->end = end;
+        if (i > 0 && order[i - 1]->got->content.start <
+                     order[i]->got->content.start) {
+            end = order[i]->got->content.start;
+        }
+    }
+    free(order);
+
+    /* At most half full, so that misses stop early. When two functions
+     * have the same name, the first one wins. */
+    for (t->size = 4; t->size < 2 * t->count; t->size *= 2)
+        ;
+    t->slots = vector_alloc(t->size, sizeof (int));
+    for (i = 0; i < t->count; ++i) {
+        slot = func_table_slot(t, t->info[i].got->content.id);
+        if (!t->slots[slot]) {
+            t->slots[slot] = i + 1;
+        }
+    }
+}
+
+/**
+ * Free the functions built by func_table_build().
+ * @param t Functions.
+ */
+static void func_table_free(funcTable *t)
+{
+    free(t->slots);
+    free(t->info);
+    memset(t, 0, sizeof (*t));
+}
+
+/**
+ * Index the code and its functions, unless the code hasn't changed since
+ * they were indexed last time.
+ */
+static void code_index(void)
+{
+    if (Lines == NULL) {
+        Lines = code_lines(&LineCount);
+        func_table_build(&Funcs, LineCount);
+    }
+}
+
+/** Forget the index of the code, after the code has changed. */
+static void code_changed(void)
+{
+    free(Lines);
+    Lines = NULL;
+    func_table_free(&Funcs);
+}
+
+/**
+ * Tell whether the code of a function is self contained.
+ * @param lines Lines indexed by offset.
+ * @param f Function.
+ * @returns Non zero if all the lines of @a f exist, and its jumps don't
+ *          leave it.
+ */
+static int function_is_closed(codeListNode **lines, const funcInfo *f)
+{
+    int k;
+
+    for (k = f->got->content.start; k < f->end; ++k) {
+        const codeLine *line;
+
+        if (lines[k] == NULL) {
+            return 0;
+        }
+        line = &lines[k]->content;
+        if (code_line_is_jump(line) &&
+            (line->jump < f->got->content.start || line->jump >= f->end)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Inline the calls to small functions that don't call other functions,
+ * and remove static functions that are no longer called.
+ * @returns Non zero if the code has changed.
+ */
+static int inline_calls(void)
+{
+    codeListNode **lines;
+    gotListNode *got, **prev;
+    funcInfo *info;
+    codeLine copy;
+    char *skip;
+    int nlines, count, changed = 0, i, j, k, n, *vec;
+
+    if (CodeTail == NULL) {
+        return 0;
+    }
+    code_index();
+    lines = Lines;
+    nlines = LineCount;
+    info = Funcs.info;
+    count = Funcs.count;
+
+    /* Inline small functions that don't call other ones and don't jump
+     * outside of themselves. */
+    for (i = 0; i < count; ++i) {
+        int size = 0;
+
+        info[i].inlined = 0;
+        info[i].calls = 0;
+        if (!function_is_closed(lines, &info[i])) {
+            continue;
+        }
+        info[i].inlined = 1;
+        for (k = info[i].got->content.start; k < info[i].end; ++k) {
+            if (strcmp(lines[k]->content.opcode, "VM_CALL") == 0) {
+                info[i].inlined = 0;
+                break;
+            }
+            if (strcmp(lines[k]->content.opcode, "VM_NOP") != 0) {
+                ++size;
+            }
+        }
+        if (size > INLINE_MAX_SIZE) {
+            info[i].inlined = 0;
+        }
+    }
+    for (k = 0; k < nlines; ++k) {
+        if (lines[k] != NULL) {
+            i = code_line_callee(&Funcs, &lines[k]->content);
+            if (i >= 0 && !info[i].inlined) {
+                info[i].calls++;
+            }
+        }
+    }
+
+    /* Skip the code of static functions that are no longer called. */
+    skip = vector_alloc(nlines, sizeof (char));
+    for (i = 0; i < count; ++i) {
+        if (info[i].got->content.local && info[i].calls == 0) {
+            memset(skip + info[i].got->content.start, 1,
+                   info[i].end - info[i].got->content.start);
+            ++changed;
+        }
+    }
+
+    /* Compute the new offset of each line. */
+    vec = vector_alloc(nlines, sizeof (int));
+    for (k = 0, n = 0; k < nlines; ++k) {
+        vec[k] = n;
+        if (lines[k] == NULL || skip[k]) {
+            continue;
+        }
+        i = code_line_callee(&Funcs, &lines[k]->content);
+        if (i >= 0 && info[i].inlined) {
+            n += info[i].end - info[i].got->content.start;
+            ++changed;
+        } else {
+            ++n;
+        }
+    }
+    if (!changed) {
+        free(vec);
+        free(skip);
+        return 0;
+    }
+
+    /* Rewrite the code, copying the inlined functions in place of calls:
+     * their jumps are relocated, and VM_RETURN jumps past the copy. */
+    CodeHead = CodeTail = NULL;
+    for (k = 0; k < nlines; ++k) {
+        if (lines[k] == NULL || skip[k]) {
+            continue;
+        }
+        i = code_line_callee(&Funcs, &lines[k]->content);
+        if (i < 0 || !info[i].inlined) {
+            copy = lines[k]->content;
+            copy.offset = vec[k];
+            if (code_line_is_jump(&copy)) {
+                copy.jump = vec[copy.jump];
+            }
+            code_line_add(&copy);
+            continue;
+        }
+        n = info[i].end - info[i].got->content.start;
+        for (j = 0; j < n; ++j) {
+            copy = lines[info[i].got->content.start + j]->content;
+            copy.offset = vec[k] + j;
+            if (code_line_is_jump(&copy)) {
+                copy.jump += vec[k] - info[i].got->content.start;
+            } else if (strcmp(copy.opcode, "VM_RETURN") == 0) {
+                if (j == n - 1) {
+                    copy.opcode = strdup("VM_NOP");
+                } else {
+                    copy.opcode = strdup("VM_JMP");
+                    copy.jump = vec[k] + n;
+                }
+            }
+            code_line_add(&copy);
+        }
+    }
+
+    /* Rewrite global offset table, without removed functions. */
+    for (prev = &GotHead; *prev != NULL; ) {
+        got = *prev;
+        if (skip[got->content.start]) {
+            *prev = got->nextPtr;
+        } else {
+            got->content.start = vec[got->content.start];
+            GotTail = got;
+            prev = &got->nextPtr;
+        }
+    }
+    if (GotHead == NULL) {
+        GotTail = NULL;
+    }
+
+    free(vec);
+    free(skip);
+    code_changed();
+    return 1;
+}
+
+/**
+ * Tell whether a function executes a command on every record. Calls are
+ * not followed, so the answer is conservative.
+ * @param lines Lines indexed by offset.
+ * @param f Function, whose code is self contained.
+ * @returns Non zero if each path from the entry point meets VM_EXEC
+ *          before VM_RETURN.
+ */
+static int function_always_execs(codeListNode **lines, const funcInfo *f)
+{
+    int start = f->got->content.start;
+    char *seen = vector_alloc(f->end - start, sizeof (char));
+    int *todo = vector_alloc(f->end - start, sizeof (int));
+    int ntodo = 0, result = 1;
+
+    seen[0] = 1;
+    todo[ntodo++] = f->got->content.start;
+    while (ntodo > 0 && result) {
+        const codeLine *line = &lines[todo[--ntodo]]->content;
+        int next[2], n = 0, i;
+
+        if (strcmp(line->opcode, "VM_EXEC") == 0) {
+            continue;
+        } else if (strcmp(line->opcode, "VM_RETURN") == 0) {
+            result = 0;
+        } else if (strcmp(line->opcode, "VM_JMP") == 0) {
+            next[n++] = line->jump;
+        } else if (code_line_is_jump(line)) {
+            next[n++] = line->jump;
+            next[n++] = line->offset + 1;
+        } else {
+            next[n++] = line->offset + 1;
+        }
+        for (i = 0; i < n; ++i) {
+            if (next[i] >= f->end) {
+                result = 0;
+            } else if (!seen[next[i] - start]) {
+                seen[next[i] - start] = 1;
+                todo[ntodo++] = next[i];
+            }
+        }
+    }
+
+    free(todo);
+    free(seen);
+    return result;
+}
+
+/**
+ * Tell whether two functions have the same code, but for the commands
+ * that they execute: then, the second executes something on a record
+ * only if the first does.
+ * @param lines Lines indexed by offset.
+ * @param a First function, whose code is self contained.
+ * @param b Second function, whose code is self contained.
+ * @returns Non zero if @a a and @a b have the same shape.
+ */
+static int function_same_shape(codeListNode **lines, const funcInfo *a,
+                               const funcInfo *b)
+{
+    int start_a = a->got->content.start, start_b = b->got->content.start;
+    int k;
+
+    if (a->end - start_a != b->end - start_b) {
+        return 0;
+    }
+    for (k = 0; k < a->end - start_a; ++k) {
+        const codeLine *x = &lines[start_a + k]->content;
+        const codeLine *y = &lines[start_b + k]->content;
+
+        if (strcmp(x->opcode, y->opcode) != 0) {
+            return 0;
+        }
+        if (code_line_is_jump(x)) {
+            if (x->jump - start_a != y->jump - start_b) {
+                return 0;
+            }
+        } else if (strcmp(x->opcode, "VM_EXEC") != 0 &&
+                   ((x->reg && strcmp(x->reg, y->reg) != 0) ||
+                    (x->string && strcmp(x->string, y->string) != 0))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Hash the shape of a function, so that functions with the same shape, as
+ * told by function_same_shape(), have the same hash.
+ * @param lines Lines indexed by offset.
+ * @param f Function, whose code is self contained.
+ * @returns Hash value.
+ */
+static unsigned function_shape_hash(codeListNode **lines, const funcInfo *f)
+{
+    unsigned hash = HASH_BASIS;
+    int start = f->got->content.start, k;
+    char jump[32];
+
+    for (k = start; k < f->end; ++k) {
+        const codeLine *x = &lines[k]->content;
+
+        hash = string_hash(hash, x->opcode);
+        if (code_line_is_jump(x)) {
+            sprintf(jump, "%d", x->jump - start);
+            hash = string_hash(hash, jump);
+        } else if (strcmp(x->opcode, "VM_EXEC") != 0) {
+            hash = string_hash(hash, (x->reg) ? x->reg : "");
+            hash = string_hash(hash, (x->string) ? x->string : "");
+        }
+    }
+    return hash;
+}
+
+/**
+ * In first match mode, remove the functions that can't execute anything
+ * because an earlier function always executes a command, or because an
+ * earlier function has the same shape. A removed function that is still
+ * called keeps its code as a static function.
+ * @returns Non zero if the code has changed.
+ */
+static int shadow_functions(void)
+{
+    codeListNode **lines;
+    gotListNode *got, **prev;
+    funcInfo *info;
+    char *closed, *removed;
+    unsigned *hashes;
+    int nlines, count, changed = 0, always = 0, i, j, k, size, slot = 0;
+    int *shapes;
+
+    if (!FirstMatch || CodeTail == NULL) {
+        return 0;
+    }
+    code_index();
+    lines = Lines;
+    nlines = LineCount;
+    info = Funcs.info;
+    count = Funcs.count;
+    closed = vector_alloc(count, sizeof (char));
+    removed = vector_alloc(count, sizeof (char));
+    hashes = vector_alloc(count, sizeof (unsigned));
+    for (size = 4; size < 2 * count; size *= 2)
+        ;
+    shapes = vector_alloc(size, sizeof (int));
+
+    for (i = 0; i < count; ++i) {
+        info[i].calls = 0;
+    }
+    for (k = 0; k < nlines; ++k) {
+        if (lines[k] != NULL) {
+            i = code_line_callee(&Funcs, &lines[k]->content);
+            if (i >= 0) {
+                info[i].calls++;
+            }
+        }
+    }
+
+    /* The functions that may shadow later ones are kept in a hash table,
+     * by shape: index plus one, or zero. A function with the same shape
+     * as a removed one also has the same shape as the function that
+     * shadowed it, so removed functions need not be kept. */
+    for (i = 0; i < count; ++i) {
+        closed[i] = function_is_closed(lines, &info[i]);
+        if (info[i].got->content.local) {
+            continue;
+        }
+        j = i;
+        if (!always && closed[i]) {
+            hashes[i] = function_shape_hash(lines, &info[i]);
+            for (slot = hashes[i] & (size - 1); shapes[slot];
+                 slot = (slot + 1) & (size - 1)) {
+                j = shapes[slot] - 1;
+                if (hashes[j] == hashes[i] &&
+                    function_same_shape(lines, &info[j], &info[i])) {
+                    break;
+                }
+                j = i;
+            }
+        }
+        if (always || j < i) {
+            ++changed;
+            if (info[i].calls > 0) {
+                /* It no longer runs on its own, only for its callers. */
+                info[i].got->content.local = 1;
+                continue;
+            }
+            removed[i] = 1;
+            if (closed[i]) {
+                for (k = info[i].got->content.start; k < info[i].end; ++k) {
+                    lines[k]->content.opcode = strdup("VM_NOP");
+                    lines[k]->content.jump = -1;
+                    lines[k]->content.reg = NULL;
+                    lines[k]->content.string = NULL;
+                }
+            }
+        } else if (closed[i]) {
+            shapes[slot] = i + 1;
+            always = function_always_execs(lines, &info[i]);
+        }
+    }
+
+    /* Rewrite global offset table, without removed functions. */
+    for (prev = &GotHead, i = 0; *prev != NULL; ++i) {
+        got = *prev;
+        if (removed[i]) {
+            *prev = got->nextPtr;
+        } else {
+            GotTail = got;
+            prev = &got->nextPtr;
+        }
+    }
+    if (GotHead == NULL) {
+        GotTail = NULL;
+    }
+
+    free(shapes);
+    free(hashes);
+    free(removed);
+    free(closed);
+    if (changed) {
+        code_changed();
+    }
+    return changed;
+}
+
+/**
+ * Chain the non static functions into a single stream of code, in the
+ * order in which they are run: the VM_RETURN of each function becomes a
+ * jump to the next one, and the last one reaches a single VM_RETURN.
+ * Static functions follow the chain. A non static function that is also
+ * called gets a static copy, named after it with FUSE_CALL_SUFFIX, that
+ * returns to its callers.
+ */
+static void fuse_functions(void)
+{
+    codeListNode **lines;
+    funcInfo *info;
+    gotLine entry;
+    codeLine copy;
+    char *name;
+    int nlines, count, i, j, k, n, ret = 0, size, pass, *base, *copied;
+
+    code_index();
+    lines = Lines;
+    nlines = LineCount;
+    info = Funcs.info;
+    count = Funcs.count;
+    base = vector_alloc(count, sizeof (int));
+    copied = vector_alloc(count, sizeof (int));
+
+    for (i = 0; i < count; ++i) {
+        if (!function_is_closed(lines, &info[i])) {
+            fprintf(stderr, "Can't fuse %s: its code is not self "
+                    "contained\n", info[i].got->content.id);
+            exit(1);
+        }
+    }
+    for (k = 0; k < nlines; ++k) {
+        i = (lines[k]) ? code_line_callee(&Funcs, &lines[k]->content) : -1;
+        if (i >= 0 && !info[i].got->content.local) {
+            copied[i] = 1;
+        }
+    }
+
+    /* Lay out the chain, then its VM_RETURN, then static functions, then
+     * the copies of called functions. */
+    for (pass = 0, n = 0; pass < 3; ++pass) {
+        for (i = 0; i < count; ++i) {
+            size = info[i].end - info[i].got->content.start;
+            if (pass == 0 && !info[i].got->content.local) {
+                base[i] = n;
+                n += size;
+            } else if (pass == 1 && info[i].got->content.local) {
+                base[i] = n;
+                n += size;
+            } else if (pass == 2 && copied[i]) {
+                copied[i] = n;
+                n += size;
+            }
+        }
+        if (pass == 0) {
+            ret = n++;
+        }
+    }
+
+    /* Rewrite the code: jumps are relocated, calls to non static
+     * functions go to their copies and, in the chain, VM_RETURN goes on
+     * with the next function, which starts right past the current one. */
+    CodeHead = CodeTail = NULL;
+    for (pass = 0; pass < 3; ++pass) {
+        for (i = 0; i < count; ++i) {
+            int start = info[i].got->content.start, at = base[i];
+
+            if (pass == 0 && info[i].got->content.local) {
+                continue;
+            } else if (pass == 1 && !info[i].got->content.local) {
+                continue;
+            } else if (pass == 2) {
+                if (!copied[i]) {
+                    continue;
+                }
+                at = copied[i];
+            }
+            size = info[i].end - start;
+            for (j = 0; j < size; ++j) {
+                copy = lines[start + j]->content;
+                copy.offset = at + j;
+                k = code_line_callee(&Funcs, &copy);
+                if (code_line_is_jump(&copy)) {
+                    copy.jump += at - start;
+                } else if (k >= 0 && !info[k].got->content.local) {
+                    name = vector_alloc(strlen(copy.string) +
+                                        sizeof (FUSE_CALL_SUFFIX), 1);
+                    sprintf(name, "%s%s", copy.string, FUSE_CALL_SUFFIX);
+                    copy.string = name;
+                } else if (pass == 0 &&
+                           strcmp(copy.opcode, "VM_RETURN") == 0) {
+                    if (j == size - 1) {
+                        copy.opcode = strdup("VM_NOP");
+                    } else {
+                        copy.opcode = strdup("VM_JMP");
+                        copy.jump = at + size;
+                    }
+                }
+                code_line_add(&copy);
+            }
+        }
+        if (pass == 0) {
+            memset(&copy, 0, sizeof (copy));
+            copy.offset = ret;
+            copy.opcode = strdup("VM_RETURN");
+            copy.jump = -1;
+            code_line_add(&copy);
+        }
+    }
+
+    /* Rewrite global offset table, and add the copies as static
+     * functions. */
+    for (i = 0; i < count; ++i) {
+        info[i].got->content.start = base[i];
+    }
+    for (i = 0; i < count; ++i) {
+        if (copied[i]) {
+            name = vector_alloc(strlen(info[i].got->content.id) +
+                                sizeof (FUSE_CALL_SUFFIX), 1);
+            sprintf(name, "%s%s", info[i].got->content.id, FUSE_CALL_SUFFIX);
+            entry.id = name;
+            entry.start = copied[i];
+            entry.local = 1;
+            got_line_add(&entry);
+        }
+    }
+
+    free(copied);
+    free(base);
+    code_changed();
+}
+
+/**
+ * Make jumps go straight to their final target, past VM_NOP lines and
+ * through VM_JMP lines, and turn jumps to VM_RETURN into VM_RETURN. In a
+ * fused program, a function that doesn't match a record then goes on
+ * with the next one in a single jump.
+ */
+static void thread_jumps(void)
+{
+    codeListNode **lines;
+    codeLine *line;
+    const codeLine *target;
+    int nlines, hops, k;
+
+    code_index();
+    lines = Lines;
+    nlines = LineCount;
+    for (k = 0; k < nlines; ++k) {
+        line = &lines[k]->content;
+        if (!code_line_is_jump(line)) {
+            continue;
+        }
+        for (hops = 0; hops < nlines; ++hops) {
+            target = &lines[line->jump]->content;
+            if (strcmp(target->opcode, "VM_NOP") == 0 &&
+                line->jump + 1 < nlines) {
+                line->jump++;
+            } else if (strcmp(target->opcode, "VM_JMP") == 0) {
+                line->jump = target->jump;
+            } else {
+                break;
+            }
+        }
+        if (strcmp(line->opcode, "VM_JMP") == 0 &&
+            strcmp(lines[line->jump]->content.opcode, "VM_RETURN") == 0) {
+            line->opcode = strdup("VM_RETURN");
+            line->jump = -1;
+        }
+    }
+    code_changed();
+}
+
+/**
+ * Get the length of the longest string in a constant pool entry.
+ * @param index Pool index, as written in a VM_IN line.
+ * @returns Length, quotes excluded, or zero if there is no such entry.
+ */
+static long pool_max_length(const char *index)
+{
+    poolListNode *pool;
+    const char *s;
+    long len, max = 0;
+
+    for (pool = PoolHead; pool != NULL; pool = pool->nextPtr) {
+        if (pool->content.index == atoi(index)) {
+            break;
+        }
+    }
+    if (pool == NULL) {
+        return 0;
+    }
+    for (s = pool->content.strings; *s != '\0'; ) {
+        if (*s++ != '"') {
+            continue;
+        }
+        for (len = 0; *s != '\0' && *s != '"'; ++s, ++len) {
+            if (*s == '\\' && s[1] != '\0') {
+                ++s;
+            }
+        }
+        if (*s == '"') {
+            ++s;
+        }
+        if (len > max) {
+            max = len;
+        }
+    }
+    return max;
+}
+
+/**
+ * Find the lines that run right after a line, hence whose cost adds to
+ * the cost of the line.
+ * @param t Functions.
+ * @param line Code line.
+ * @param next In output, the following lines: the callee comes first.
+ * @returns Number of following lines.
+ */
+static int cost_next(const funcTable *t, const codeLine *line, int *next)
+{
+    int n = 0, i;
+
+    if (strcmp(line->opcode, "VM_RETURN") == 0) {
+        /* Nothing more. */
+    } else if (strcmp(line->opcode, "VM_EXEC") == 0) {
+        if (!FirstMatch) {
+            next[n++] = line->offset + 1;
+        }
+    } else if (strcmp(line->opcode, "VM_JMP") == 0) {
+        next[n++] = line->jump;
+    } else if (code_line_is_jump(line)) {
+        next[n++] = line->jump;
+        next[n++] = line->offset + 1;
+    } else {
+        i = code_line_callee(t, line);
+        if (i >= 0) {
+            next[n++] = t->info[i].got->content.start;
+        }
+        next[n++] = line->offset + 1;
+    }
+    return n;
+}
+
+/**
+ * Compute the worst case cost of running the code from an instruction
+ * to the end of its function, or of the record in first match mode.
+ * Each metric is maximized on its own, so the result bounds every path.
+ * Code is visited depth first, with a stack rather than recursion, since
+ * a path may be as long as the code.
+ * @param lines Lines indexed by offset, VM_NOP excluded.
+ * @param nlines Number of lines.
+ * @param t Functions.
+ * @param state For each line: zero if not visited yet, one if being
+ *        visited, two if its cost is known.
+ * @param costs Cost of each line, once known.
+ * @param stack Stack of lines to visit, three times as long as the code.
+ * @param k Offset of the instruction.
+ * @returns Cost from @a k.
+ */
+static const costInfo *cost_from(codeListNode **lines, int nlines,
+                                 const funcTable *t, char *state,
+                                 costInfo *costs, int *stack, int k)
+{
+    const codeLine *line;
+    costInfo *cost;
+    int next[3], start = k, depth = 0, i, m, n;
+
+    stack[depth++] = k;
+    while (depth > 0) {
+        k = stack[depth - 1];
+        if (k < 0 || k >= nlines) {
+            fprintf(stderr, "Code runs past its end at %d\n", k);
+            exit(1);
+        }
+        if (state[k] == 2) {
+            --depth;
+            continue;
+        }
+        line = &lines[k]->content;
+        n = cost_next(t, line, next);
+
+        /* First visit: visit the following lines, then come back. */
+        if (state[k] == 0) {
+            state[k] = 1;
+            for (i = 0; i < n; ++i) {
+                if (next[i] >= 0 && next[i] < nlines && state[next[i]] == 1) {
+                    fprintf(stderr, "Cost is unbounded: loop at %d\n",
+                            next[i]);
+                    exit(1);
+                }
+                if (next[i] < 0 || next[i] >= nlines || state[next[i]] == 0) {
+                    stack[depth++] = next[i];
+                }
+            }
+            continue;
+        }
+        --depth;
+
+        /* A call costs its callee, plus the call itself. */
+        cost = &costs[k];
+        i = 0;
+        if (strcmp(line->opcode, "VM_CALL") == 0) {
+            *cost = costs[next[i++]];
+        }
+        cost->value[COST_INSNS]++;
+
+        if (strcmp(line->opcode, "VM_EXEC") == 0) {
+            cost->value[COST_EXECS] = 1;
+        } else if (strcmp(line->opcode, "VM_RETURN") != 0 &&
+                   strcmp(line->opcode, "VM_CALL") != 0 &&
+                   !code_line_is_jump(line)) {
+            /* A comparison: against a string constant, a set, whose
+             * strings are hashed and compared once, or something parsed
+             * or scanned once per record. */
+            cost->value[COST_COMPARES] = 1;
+            if (strcmp(line->opcode, "VM_IN") == 0) {
+                cost->value[COST_BYTES] = pool_max_length(line->string);
+            } else if (line->string[0] == '"' &&
+                       strcmp(line->opcode, "VM_MATCH") != 0 &&
+                       strcmp(line->opcode, "VM_INNET") != 0) {
+                cost->value[COST_BYTES] = (long) strlen(line->string) - 2;
+            }
+        }
+
+        /* Add the worst of the successors, metric by metric. */
+        for (m = 0; m < COST_METRICS; ++m) {
+            long worst = 0;
+            int j;
+            for (j = i; j < n; ++j) {
+                if (costs[next[j]].value[m] > worst) {
+                    worst = costs[next[j]].value[m];
+                }
+            }
+            cost->value[m] += worst;
+        }
+        state[k] = 2;
+    }
+    return &costs[start];
+}
+
+/**
+ * Compute the worst case cost of each function and of a record, print
+ * them if asked to, and fail if the cost of a record exceeds a budget.
+ * Called once jumps and entry points point past VM_NOP lines.
+ * @param nlines Number of lines, VM_NOP excluded.
+ */
+static void cost_check(int nlines)
+{
+    codeListNode **lines, *code;
+    gotListNode *got;
+    funcTable funcs;
+    costInfo *costs, total, worst;
+    const costInfo *cost;
+    const char *owner[COST_METRICS];
+    char *state;
+    int m, chained = 0, *stack;
+
+    lines = vector_alloc(nlines, sizeof (codeListNode *));
+    for (code = CodeHead; code != NULL; code = code->nextPtr) {
+        if (strcmp(code->content.opcode, "VM_NOP") != 0) {
+            lines[code->content.offset] = code;
+        }
+    }
+    func_table_build(&funcs, nlines);
+    state = vector_alloc(nlines, sizeof (char));
+    costs = vector_alloc(nlines, sizeof (costInfo));
+    stack = vector_alloc(3 * (size_t) nlines + 1, sizeof (int));
+    memset(&total, 0, sizeof (total));
+    memset(&worst, 0, sizeof (worst));
+    memset(owner, 0, sizeof (owner));
+
+    if (CostReport) {
+        fprintf(stderr, "%-24s", "function");
+        for (m = 0; m < COST_METRICS; ++m) {
+            fprintf(stderr, " %10s", CostNames[m]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    /* A record runs through each non static function in turn or, when
+     * they are fused, through the first one, that goes on with the
+     * others. */
+    for (got = GotHead; got != NULL; got = got->nextPtr) {
+        int counted = !got->content.local && !chained;
+
+        cost = cost_from(lines, nlines, &funcs, state, costs, stack,
+                         got->content.start);
+        if (Fused && !got->content.local) {
+            chained = 1;
+        }
+        for (m = 0; m < COST_METRICS && counted; ++m) {
+            total.value[m] += cost->value[m];
+            if (!owner[m] || cost->value[m] > worst.value[m]) {
+                worst.value[m] = cost->value[m];
+                owner[m] = got->content.id;
+            }
+        }
+        if (CostReport) {
+            fprintf(stderr, "%-24s", got->content.id);
+            for (m = 0; m < COST_METRICS; ++m) {
+                fprintf(stderr, " %10ld", cost->value[m]);
+            }
+            fprintf(stderr, "%s\n", (got->content.local) ? " static" : "");
+        }
+    }
+    if (FirstMatch && total.value[COST_EXECS] > 1) {
+        total.value[COST_EXECS] = 1;
+    }
+    if (CostReport) {
+        fprintf(stderr, "%-24s", "record");
+        for (m = 0; m < COST_METRICS; ++m) {
+            fprintf(stderr, " %10ld", total.value[m]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    for (m = 0; m < COST_METRICS; ++m) {
+        if (Budget[m] >= 0 && total.value[m] > Budget[m]) {
+            fprintf(stderr, "Cost of a record exceeds budget: %s %ld > %ld, "
+                    "of which %ld in %s\n", CostNames[m], total.value[m],
+                    Budget[m], worst.value[m], owner[m]);
+            exit(1);
+        }
+    }
+
+    free(stack);
+    free(costs);
+    free(state);
+    func_table_free(&funcs);
+    free(lines);
+}
 
 /** Delete useless lines from the code and print the output. */
 static void optimize_code(void)
@@ -53,14 +1164,31 @@ static void optimize_code(void)
     gotListNode *got;
     int *vec, n;
 
+    /* Inline calls until there is nothing left to inline, then remove
+     * shadowed functions, which may leave more static functions unused. */
+    do {
+        while (inline_calls())
+            ;
+    } while (shadow_functions());
+    if (Fused && CodeTail != NULL) {
+        fuse_functions();
+        thread_jumps();
+    }
+    code_changed();
+
     /* Make sure we don't segfault if the input was empty. */
     if (CodeTail == NULL) {
         fprintf(stderr, "[warning] Nothing of interesting to optimize\n");
         return;
     }
 
-    /* Allocate a vector to exchange line numbers. */
-    vec = calloc(CodeTail->content.offset, sizeof (int));
+    /* Allocate a vector to exchange line numbers (offsets are zero based,
+     * so we need one more element than the last offset). */
+    vec = calloc(CodeTail->content.offset + 1, sizeof (int));
+    if (vec == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
 
     /* Filter out VM_NOP lines. */
     for (code = CodeHead, n = 0; code != NULL; code = code->nextPtr) {
@@ -93,10 +1221,26 @@ static void optimize_code(void)
         got->content.start = vec[got->content.start];
     }
 
+    /* Check costs before printing, so that nothing is printed if the
+     * program is rejected. */
+    if (CostCheck) {
+        cost_check(n);
+    }
+
     /* Print global offset table. */
-    printf(".got\n");
+    printf(".got%s%s\n", (FirstMatch) ? " first" : "",
+           (Fused) ? " fused" : "");
     for (; GotHead != NULL; GotHead = GotHead->nextPtr) {
-        printf("%s %d\n", GotHead->content.id, GotHead->content.start);
+        printf("%s %d%s\n", GotHead->content.id, GotHead->content.start,
+               (GotHead->content.local) ? " static" : "");
+    }
+
+    /* Print .pool section, which is left untouched. */
+    if (PoolHead != NULL) {
+        printf(".pool\n");
+    }
+    for (; PoolHead != NULL; PoolHead = PoolHead->nextPtr) {
+        printf("%d %s\n", PoolHead->content.index, PoolHead->content.strings);
     }
 
     /* Print .code section. */
@@ -111,7 +1255,8 @@ static void optimize_code(void)
             printf("%d ", CodeHead->content.jump);
         } else if(CodeHead->content.reg != NULL) {
             printf("%s %s", CodeHead->content.reg, CodeHead->content.string);
-        } else if (strcmp("VM_EXEC", CodeHead->content.opcode) == 0) {
+        } else if (strcmp("VM_EXEC", CodeHead->content.opcode) == 0 ||
+                   strcmp("VM_CALL", CodeHead->content.opcode) == 0) {
             printf("%s", CodeHead->content.string);
         }
         printf("\n");
@@ -132,6 +1277,7 @@ void code_line_add(codeLine *current)
         n->content.jump = current->jump;
         n->content.reg = current->reg;
         n->content.string = current->string;
+        n->nextPtr = NULL;
     } else {
         fprintf(stderr, "Out of memory\n");
         exit(1);
@@ -145,6 +1291,11 @@ void code_line_add(codeLine *current)
     }
 }
 
+void got_first_match(void)
+{
+    FirstMatch = 1;
+}
+
 void got_line_add(gotLine *current)
 {
     gotListNode* n = malloc(sizeof (gotListNode));
@@ -152,6 +1303,8 @@ void got_line_add(gotLine *current)
     if (n != NULL) {
         n->content.id = current->id;
         n->content.start = current->start;
+        n->content.local = current->local;
+        n->nextPtr = NULL;
     } else {
         fprintf(stderr, "Out of memory\n");
         exit(1);
@@ -165,6 +1318,27 @@ void got_line_add(gotLine *current)
     }
 }
 
+void pool_line_add(poolLine *current)
+{
+    poolListNode* n = malloc(sizeof (poolListNode));
+
+    if (n != NULL) {
+        n->content.index = current->index;
+        n->content.strings = current->strings;
+        n->nextPtr = NULL;
+    } else {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    if (PoolTail != NULL) {
+        PoolTail->nextPtr = n;
+        PoolTail = n;
+    } else {
+        PoolTail = PoolHead = n;
+    }
+}
+
 int yywrap(void)
 {
     return 1;
@@ -179,7 +1353,55 @@ void yyerror (char const * str)
 int main(int argc, char ** argv)
 {
     char * prog = argv[0];
-    ++argv, --argc;
+    const char *value;
+    char *end;
+    long budget;
+    int ch, m;
+
+    while ((ch = getopt(argc, argv, "b:cl")) != -1) {
+        switch (ch) {
+            case 'b':
+                value = strchr(optarg, '=');
+                for (m = 0; value != NULL && m < COST_METRICS; ++m) {
+                    if (strncmp(optarg, CostNames[m],
+                                (size_t) (value - optarg)) == 0 &&
+                        CostNames[m][value - optarg] == '\0') {
+                        break;
+                    }
+                }
+                /* A budget is a whole non negative number, and nothing
+                 * else. */
+                budget = -1;
+                if (value != NULL && m < COST_METRICS) {
+                    errno = 0;
+                    budget = strtol(value + 1, &end, 10);
+                    if (end == value + 1 || *end != '\0' || errno != 0) {
+                        budget = -1;
+                    }
+                }
+                if (budget < 0) {
+                    fprintf(stderr, "%s: error - invalid budget %s\n", prog,
+                            optarg);
+                    exit(1);
+                }
+                Budget[m] = budget;
+                CostCheck = 1;
+                break;
+            case 'c':
+                CostReport = 1;
+                CostCheck = 1;
+                break;
+            case 'l':
+                Fused = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-cl] [-b metric=budget] "
+                        "[file ...]\n", prog);
+                exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
 
     if (argc > 0) {
         for (; argc > 0; ++argv, --argc) {
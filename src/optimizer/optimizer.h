@@ -34,6 +34,7 @@
  *
  * <ul>
  *   <li>Replace with <code>VM_NOP</code> all redundant instructions;</li>
+ *   <li>Inline small functions where they are called;</li>
  *   <li>Rewrite the code, removing all <code>VM_NOP</code>.
  * </ul>
  *
@@ -65,6 +66,44 @@
  * rule. An alternative design, e.g. allowing unpaired conditional jumps, is
  * possible, but slower. Infact we'd need to scan the code in search for
  * paired jumps, while with current design we optimize in the semantic rule.
+ *
+ * A function is inlined when it is small and it doesn't call other
+ * functions: each <code>VM_CALL</code> is replaced with a copy of its code,
+ * where <code>VM_RETURN</code> becomes a jump past the copy. Bigger
+ * functions stay out of line, so that their code isn't duplicated. Once a
+ * static function is no longer called, it is removed, and inlining is
+ * repeated, because the caller may have become small enough in turn.
+ *
+ * In first match mode, where a record stops at the first
+ * <code>VM_EXEC</code>, we also remove the functions that are shadowed by
+ * earlier ones. A function is shadowed when an earlier function executes a
+ * command on each path, or when an earlier function has the same code but
+ * for the commands that it executes.
+ *
+ * Finally, before printing, we bound the cost of a record. Since jumps
+ * only go forward and calls are not recursive, the worst case from each
+ * instruction is computed once, following both branches of conditional
+ * jumps and the code of called functions: the number of instructions,
+ * of comparisons, of bytes of string constants compared, and of commands
+ * executed. Option <code>-c</code> prints these for each function and for
+ * a record, which runs through all the non static functions, and option
+ * <code>-b</code>, e.g. <code>-b compares=100</code>, rejects the program
+ * if a record may exceed the budget. Pattern and network matching scan a
+ * field once per record, whatever the patterns, so they count as
+ * comparisons only.
+ *
+ * With option <code>-l</code>, before printing, the non static functions
+ * are fused into a single stream of code, in the order in which they
+ * run: the <code>VM_RETURN</code> of each one becomes a jump to the next
+ * one, and the global offset table is marked <code>fused</code>, so that
+ * the VM enters the first function only and runs the record through to
+ * a single <code>VM_RETURN</code>. Jumps are then threaded: a jump to a
+ * <code>VM_JMP</code> goes straight to its target, so a function that
+ * doesn't match a record goes on with the next one in one jump, across
+ * function boundaries. Since the code of a fused function doesn't
+ * return, a non static function that is also called gets a static copy,
+ * named after it with a <code>.call</code> suffix. The cost of a record
+ * is then the cost of the first function.
  */
 
 /** A line in the <code>.code</code> section. */
@@ -95,6 +134,8 @@ typedef struct gotLine {
     char *id;
     /** Function offset in code. */
     int start;
+    /** Non zero for static functions. */
+    int local;
 } gotLine;
 
 /** Linked list of lines in the <code>.got</code> section. */
@@ -105,12 +146,34 @@ typedef struct gotListNode {
     struct gotListNode *nextPtr;
 } gotListNode;
 
+/** Line in the <code>.pool</code> section. */
+typedef struct poolLine {
+    /** Index of this set in the constant pool. */
+    int index;
+    /** Strings in this set, separated by a space. */
+    char *strings;
+} poolLine;
+
+/** Linked list of lines in the <code>.pool</code> section. */
+typedef struct poolListNode {
+    /** Line in the <code>.pool</code> section. */
+    struct poolLine content;
+    /** Next line in linked list. */
+    struct poolListNode *nextPtr;
+} poolListNode;
+
 /** Add data from a code line to the proper linked list. */
 void code_line_add(codeLine *current);
 
 /** Add data from a got line to the proper linked list. */
 void got_line_add(gotLine *current);
 
+/** Mark the program as running in first match mode. */
+void got_first_match(void);
+
+/** Add data from a pool line to the proper linked list. */
+void pool_line_add(poolLine *current);
+
 /** This is the type that will be used in parser and scanner. */
 #define YYSTYPE const char*
 
@@ -1,93 +0,0 @@
-/* A Bison parser, made by GNU Bison 2.3.  */
-
-/* Skeleton interface for Bison's Yacc-like parsers in C
-
-   Copyright (C) 1984, 1989, 1990, 2000, 2001, 2002, 2003, 2004, 2005, 2006
-   Free Software Foundation, Inc.
-
-   This program is free software; you can redistribute it and/or modify
-   it under the terms of the GNU General Public License as published by
-   the Free Software Foundation; either version 2, or (at your option)
-   any later version.
-
-   This program is distributed in the hope that it will be useful,
-   but WITHOUT ANY WARRANTY; without even the implied warranty of
-   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-   GNU General Public License for more details.
-
-   You should have received a copy of the GNU General Public License
-   along with this program; if not, write to the Free Software
-   Foundation, Inc., 51 Franklin Street, Fifth Floor,
-   Boston, MA 02110-1301, USA.  */
-
-/* As a special exception, you may create a larger work that contains
-   part or all of the Bison parser skeleton and distribute that work
-   under terms of your choice, so long as that work isn't itself a
-   parser generator using the skeleton or a modified version thereof
-   as a parser skeleton.  Alternatively, if you modify or redistribute
-   the parser skeleton itself, you may (at your option) remove this
-   special exception, which will cause the skeleton and the resulting
-   Bison output files to be licensed under the GNU General Public
-   License without this special exception.
-
-   This special exception was added by the Free Software Foundation in
-   version 2.2 of Bison.  */
-
-/* Tokens.  */
-#ifndef YYTOKENTYPE
-# define YYTOKENTYPE
-   /* Put the tokens into the symbol table, so that GDB and other debuggers
-      know about them.  */
-   enum yytokentype {
-     STRING = 258,
-     REGNAME = 259,
-     OFFSET = 260,
-     ID = 261,
-     VM_NOP = 262,
-     VM_EXEC = 263,
-     VM_EQ = 264,
-     VM_MAG = 265,
-     VM_MIN = 266,
-     VM_MAEQ = 267,
-     VM_MIEQ = 268,
-     VM_NEQ = 269,
-     VM_JTRUE = 270,
-     VM_JFALSE = 271,
-     VM_JMP = 272,
-     VM_RETURN = 273,
-     SECT_CODE = 274,
-     SECT_GOT = 275
-   };
-#endif
-/* Tokens.  */
-#define STRING 258
-#define REGNAME 259
-#define OFFSET 260
-#define ID 261
-#define VM_NOP 262
-#define VM_EXEC 263
-#define VM_EQ 264
-#define VM_MAG 265
-#define VM_MIN 266
-#define VM_MAEQ 267
-#define VM_MIEQ 268
-#define VM_NEQ 269
-#define VM_JTRUE 270
-#define VM_JFALSE 271
-#define VM_JMP 272
-#define VM_RETURN 273
-#define SECT_CODE 274
-#define SECT_GOT 275
-
-
-
-
-#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
-typedef int YYSTYPE;
-# define yystype YYSTYPE /* obsolescent; will be withdrawn */
-# define YYSTYPE_IS_DECLARED 1
-# define YYSTYPE_IS_TRIVIAL 1
-#endif
-
-extern YYSTYPE yylval;
-
@@ -19,6 +19,7 @@
 
 static codeLine CodeLineCurrent;       /* Buffer for current .code line */
 static gotLine GotLineCurrent;         /* Buffer for current .got line  */
+static poolLine PoolLineCurrent;       /* Buffer for current .pool line */
 %}
 
 %error-verbose
@@ -30,22 +31,35 @@ static gotLine GotLineCurrent;         /* Buffer for current .got line  */
 %token  ID
 %token  VM_NOP
 %token  VM_EXEC
+%token  VM_CALL
 %token  VM_EQ
 %token  VM_MAG
 %token  VM_MIN
 %token  VM_MAEQ
 %token  VM_MIEQ
 %token  VM_NEQ
+%token  VM_IEQ
+%token  VM_IMAG
+%token  VM_IMIN
+%token  VM_IMAEQ
+%token  VM_IMIEQ
+%token  VM_INEQ
+%token  VM_IN
+%token  VM_MATCH
+%token  VM_INNET
 %token  VM_JTRUE
 %token  VM_JFALSE
 %token  VM_JMP
 %token  VM_RETURN
 %token  SECT_CODE
 %token  SECT_GOT
+%token  SECT_GOT_FIRST
+%token  SECT_POOL
+%token  STATIC
 
 %%
 
-full: | SECT_GOT SECT_CODE | got code
+full: | SECT_GOT SECT_CODE | got code | got pool code
 {
     debug("full");
 };
@@ -53,27 +67,87 @@ full: | SECT_GOT SECT_CODE | got code
 got: SECT_GOT body_SECT_GOT
 {
     debug("SECT_GOT body_SECT_GOT");
+}
+| SECT_GOT_FIRST body_SECT_GOT
+{
+    debug("SECT_GOT_FIRST body_SECT_GOT");
+    got_first_match();
 };
 
-body_SECT_GOT: ID OFFSET
+body_SECT_GOT: line_SECT_GOT
 {
     debug("body SECT_GOT");
+}
+| body_SECT_GOT line_SECT_GOT
+{
+    debug("body SECT_GOT ricorsivo");
+};
+
+line_SECT_GOT: ID OFFSET
+{
+    debug("line_SECT_GOT");
 
     GotLineCurrent.id    = strdup($1);
     GotLineCurrent.start = atoi($2);
+    GotLineCurrent.local = 0;
 
     got_line_add(&GotLineCurrent);
 }
-| body_SECT_GOT ID OFFSET
+| ID OFFSET STATIC
 {
-    debug("body SECT_GOT ricorsivo");
+    debug("line_SECT_GOT STATIC");
 
-    GotLineCurrent.id    = strdup($2);
-    GotLineCurrent.start = atoi($3);
+    GotLineCurrent.id    = strdup($1);
+    GotLineCurrent.start = atoi($2);
+    GotLineCurrent.local = 1;
 
     got_line_add(&GotLineCurrent);
 };
 
+pool: SECT_POOL body_SECT_POOL
+{
+    debug("SECT_POOL body_SECT_POOL");
+};
+
+body_SECT_POOL: line_SECT_POOL
+{
+    debug("body SECT_POOL");
+}
+| body_SECT_POOL line_SECT_POOL
+{
+    debug("body SECT_POOL recursive");
+};
+
+line_SECT_POOL: OFFSET strings_SECT_POOL
+{
+    debug("line_SECT_POOL");
+
+    PoolLineCurrent.index   = atoi($1);
+    PoolLineCurrent.strings = strdup($2);
+
+    pool_line_add(&PoolLineCurrent);
+};
+
+strings_SECT_POOL: STRING
+{
+    debug("strings_SECT_POOL");
+    $$ = $1;
+}
+| strings_SECT_POOL STRING
+{
+    char *strings;
+
+    debug("strings_SECT_POOL recursive");
+
+    strings = malloc(strlen($1) + strlen($2) + 2);
+    if (strings == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    sprintf(strings, "%s %s", $1, $2);
+    $$ = strings;
+};
+
 code: SECT_CODE body_SECT_CODE 
 {
     debug("sect_SECT_CODE body_SECT_CODE");
@@ -210,6 +284,126 @@ line_SECT_CODE: OFFSET VM_NOP
 
     code_line_add(&CodeLineCurrent);
 }
+| OFFSET VM_MATCH REGNAME STRING
+{
+    debug("line_SECT_CODE VM_MATCH");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_MATCH");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_INNET REGNAME STRING
+{
+    debug("line_SECT_CODE VM_INNET");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_INNET");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IEQ REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IEQ");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IEQ");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IMAG REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IMAG");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IMAG");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IMIN REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IMIN");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IMIN");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IMAEQ REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IMAEQ");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IMAEQ");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IMIEQ REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IMIEQ");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IMIEQ");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_INEQ REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_INEQ");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_INEQ");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_IN REGNAME OFFSET
+{
+    debug("line_SECT_CODE VM_IN");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_IN");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = strdup($3);
+    CodeLineCurrent.string = strdup($4);
+
+    code_line_add(&CodeLineCurrent);
+}
+| OFFSET VM_CALL ID
+{
+    debug("line_SECT_CODE VM_CALL");
+
+    CodeLineCurrent.offset = atoi($1);
+    CodeLineCurrent.opcode = strdup("VM_CALL");
+    CodeLineCurrent.jump   = -1;
+    CodeLineCurrent.reg    = NULL;
+    CodeLineCurrent.string = strdup($3);
+
+    code_line_add(&CodeLineCurrent);
+}
 | OFFSET VM_EXEC STRING
 {
     debug("line_SECT_CODE VM_EXEC");
@@ -0,0 +1,2382 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file run/main.c
+ * Virtual machine driver main file.
+ */
+
+#define _GNU_SOURCE
+#include<vm/vm.h>
+#include<dirent.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<pthread.h>
+#include<sched.h>
+#include<unistd.h>
+#include<spawn.h>
+#include<time.h>
+#include<sys/inotify.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/wait.h>
+
+/**
+ * @defgroup run Virtual machine driver
+ * @{
+ *
+ * The program <b>ucc-run</b> loads a program and filters through it the
+ * records read from standard input (or from the files passed on the
+ * command line), one per line. The six fields of ucc_input_t are separated
+ * by tabs, in the same order as VM registers; missing fields are empty.
+ *
+ * By default, each <code>VM_EXEC</code> runs its command line with the
+ * shell. With <code>-n</code>, the name of the function and the command
+ * line are printed on standard output instead, which is useful to check
+ * what a program would do.
+ *
+ * Option <code>-p</code> opens a plugin, and may be repeated: commands
+ * written as <code>plugin:name args</code> run the action exported by one
+ * of them, in process. With <code>-n</code>, plugin commands are printed
+ * like the others.
+ *
+ * With <code>-r</code>, input is read and split by a child process,
+ * that hands records to the virtual machine through a shared memory ring,
+ * so that parsing and filtering run in parallel.
+ *
+ * With <code>-u</code>, records are received as datagrams on a UNIX
+ * socket, one record per datagram, in batches of up to RUN_BATCH with a
+ * single recvmmsg(). Each record is split in place in its receive buffer,
+ * and the batch is filtered through the program; then the replies to all
+ * the senders with a bound address are sent with a single sendmmsg().
+ * A reply lists the function and the command line of each exec of the
+ * record, one per line, and is empty if nothing matched.
+ *
+ * With <code>-s</code>, hit counters of functions and execs are kept in
+ * the given file, which <b>uccstat</b> reads while we run. With
+ * <code>-t</code>, one record every RUN_SAMPLE, or every the number given
+ * with <code>-T</code>, is traced into the given file, which
+ * <b>ucctrace</b> reads.
+ *
+ * Fields that the program never reads are not split: without plugins,
+ * each line is handed whole to vm_run_line(), that locates the fields
+ * lazily; otherwise, and when pushing into the ring, the line is split
+ * up to the last field that the program reads, and the fields it doesn't
+ * read are passed as missing.
+ *
+ * With <code>-w</code>, the program argument is a directory of source
+ * files, named <code>*.src</code>. Each one is compiled on its own, by
+ * running RUN_COMPILER and RUN_OPTIMIZER, into a program that is loaded
+ * into shared constants, and the programs are linked into the one that
+ * filters records, in file name order. A thread then watches the
+ * directory with inotify: when files are written, renamed or removed, it
+ * compiles just those files again, links, and hands the new program to
+ * the filter, that switches to it before the next record. A file that
+ * fails to compile, or a link that fails, leaves the running program
+ * alone. Since calls are resolved by the compiler, a file can't call the
+ * functions of another.
+ *
+ * With <code>-j</code>, commands don't block the filter: they are queued,
+ * and a thread runs them with at most the given number of children at
+ * once. The queue holds RUN_QUEUE commands, or the number given with
+ * <code>-q</code>; when it is full, commands are shed according to the
+ * policy given with <code>-S</code>: <code>newest</code>, the default,
+ * sheds the new command, <code>oldest</code> sheds the command that has
+ * waited longest, and <code>sample</code> queues one new command every
+ * RUN_SHED_EVERY in place of the oldest, and sheds the others. Either
+ * way, the filter goes on at its own pace: the function and the exec are
+ * still counted as hit, replies of <code>-u</code> still list the exec,
+ * and, with <code>-s</code>, the shed counter of the exec is bumped.
+ * Any filtering thread may shed, under the lock of the engine, so shed
+ * counters live in a block of their own, after those of the threads.
+ * There, the engine also counts the commands it runs by how long they
+ * waited in the queue, so that <b>uccstat</b> shows the percentiles of
+ * the wait: shedding bounds them however fast commands come. On
+ * the way in, records are already bounded by the ring of <code>-r</code>,
+ * whose reader waits while it is full, and by the receive buffer of the
+ * socket of <code>-u</code>.
+ *
+ * With <code>-a</code>, the records read are also archived into the
+ * given columns file, written at the end, so that they can be filtered
+ * again with <code>-c</code>, e.g. when rules change: then, each input
+ * file is an archive, mapped and filtered with vm_run_columns(), without
+ * parsing records again. With <code>-w</code>, a new program is picked
+ * up at the next archive.
+ *
+ * With <code>-m</code>, records are filtered by the given number of
+ * worker threads, each with its own probe, and its own block of counters
+ * and ring of traces. The reader hashes a field of each record, the
+ * hostname or the one named with <code>-k</code>, to pick its worker, and
+ * hands records over in batches of RUN_SHARD_BATCH, through a queue of
+ * RUN_SHARD_QUEUE batches per worker; it waits while the queue is full.
+ * Hence, the records with the same key are filtered by the same worker,
+ * in input order. With <code>-x</code>, a worker that has nothing to do
+ * takes the oldest batch of the worker with the fullest queue, if more
+ * than half full: a hot key then no longer stalls the reader, but its
+ * records may be filtered out of order. With <code>-u</code>, replies
+ * are sent once the workers have filtered the whole batch of datagrams.
+ *
+ * With <code>-E</code>, commands are neither run nor printed: instead,
+ * a line is printed for each record, with a bitmap of the execs that it
+ * fired, numbered in code order like the counters of <code>-s</code>:
+ * exec <i>i</i> is bit <i>i</i> % 8 of byte <i>i</i> / 8, and each byte
+ * is printed as two hexadecimal digits.
+ *
+ * With <code>-P</code>, the input files are mapped and filtered by the
+ * given number of threads, each with its own probe, counters and traces,
+ * which requires <code>-n</code> or <code>-E</code>. The files are cut
+ * into chunks of about RUN_CHUNK bytes, ending at a line, that threads
+ * take in order as they become idle, so that no thread waits while there
+ * is work left; what each chunk prints is buffered, and written in input
+ * order, hence the output is the same as without <code>-P</code>.
+ * Threads take chunks at most RUN_CHUNK_AHEAD per thread ahead of the
+ * one being written, which bounds the memory used by buffers.
+ *
+ * With <code>-L</code>, each record is filtered by a team of the given
+ * number of threads at once, for latency rather than throughput: the
+ * functions are split with vm_program_partition() into as many groups of
+ * about the same static cost, each run by vm_run_group() in a thread of
+ * the team, pinned to its own processor. The thread that reads records
+ * runs the first group, and wakes up the others by bumping a generation
+ * number that they spin on, yielding after RUN_SPIN looks; after RUN_SPIN
+ * yields without a record, they sleep a millisecond between looks, so
+ * that an idle team doesn't burn its processors. Each group
+ * collects its execs, and the reader handles them once all the groups
+ * are done, in global offset table order, so that commands run in the
+ * same order as without <code>-L</code>; in first match mode, only the
+ * first exec is handled. Since the groups read the same line, each
+ * locates the fields it reads on its own. In first match mode, groups
+ * past the one that stopped ran for nothing, and must not count: with
+ * <code>-s</code>, each group counts a record into a scratch block, that
+ * the reader then adds to the counters of the group, or drops.
+ */
+
+/** Number of slots of the ring used with -r. */
+#define RUN_RING_SLOTS 4096
+
+/** Default number of records for each traced one, with -t. */
+#define RUN_SAMPLE 1000
+
+/** Number of words of the trace ring, with -t. */
+#define RUN_TRACE_WORDS 65536
+
+/** Maximum number of datagrams received at once with -u. */
+#define RUN_BATCH 32
+
+/** Maximum size of a datagram, both a record and a reply. */
+#define RUN_DATAGRAM 1024
+
+/** Compiler run by -w, searched in PATH. */
+#define RUN_COMPILER "compiler"
+
+/** Optimizer run by -w, searched in PATH. */
+#define RUN_OPTIMIZER "optimizer"
+
+/** Suffix of the source files watched by -w. */
+#define RUN_SUFFIX ".src"
+
+/** Default number of commands queued with -j. */
+#define RUN_QUEUE 1024
+
+/** With -S sample, one command every this many is queued when full. */
+#define RUN_SHED_EVERY 16
+
+/** Milliseconds between looks for exited children, with -j. */
+#define RUN_REAP_MS 5
+
+/** Records in a batch handed to a shard, with -m. */
+#define RUN_SHARD_BATCH 64
+
+/** Batches queued for each shard, with -m. */
+#define RUN_SHARD_QUEUE 16
+
+/** Bytes in a chunk of the input of -P, up to the end of a line. */
+#define RUN_CHUNK (256 * 1024)
+
+/** Chunks of -P filtered ahead of the one being written, per thread. */
+#define RUN_CHUNK_AHEAD 4
+
+/** Looks at the generation of -L before yielding the processor. */
+#define RUN_SPIN 1024
+
+/** Output of a chunk of -P, buffered until it is written. */
+typedef struct run_output {
+    /** Bytes. */
+    char *data;
+    /** Bytes used. */
+    size_t len;
+    /** Bytes allocated. */
+    size_t size;
+} run_output;
+
+/** Reply to a datagram. */
+typedef struct run_reply {
+    /** Reply text. */
+    char data[RUN_DATAGRAM];
+    /** Length of reply text. */
+    size_t len;
+} run_reply;
+
+/** Where the execs of a record go. */
+typedef struct run_sink {
+    /** Instrumentation of the filtering thread, that holds the number of
+     *  the exec being handled. */
+    vm_probe *probe;
+    /** Reply to append commands to, or NULL. */
+    run_reply *reply;
+    /** Buffer to print into, or NULL for standard output. */
+    run_output *output;
+    /** Bitmap of the execs fired by the record, with -E, or NULL. */
+    unsigned char *fired;
+} run_sink;
+
+/** Source file compiled on its own, with -w. */
+typedef struct run_module {
+    /** File name, in the watched directory. */
+    char *name;
+    /** Loaded program. */
+    vm_program *program;
+} run_module;
+
+/** State of -w. */
+typedef struct run_watch {
+    /** Name of this program, for error messages. */
+    const char *prog;
+    /** Watched directory. */
+    const char *dir;
+    /** Plugins to resolve actions with, or NULL. */
+    const vm_plugins *plugins;
+    /** Constants shared by modules and linked programs. */
+    vm_constants *constants;
+    /** Modules, sorted by file name. */
+    run_module *modules;
+    /** Number of modules. */
+    unsigned count;
+    /** Inotify descriptor. */
+    int fd;
+    /** Serializes interning into constants, and destroying programs. */
+    pthread_mutex_t lock;
+    /** Linked program handed to the filter, not taken yet, or NULL. */
+    vm_program *next;
+    /** Program the filter is running. */
+    vm_program *current;
+} run_watch;
+
+/** What to shed when the queue of -j is full. */
+typedef enum run_policy {
+    /** Shed the new command. */
+    RUN_SHED_NEWEST,
+    /** Shed the command that has waited longest. */
+    RUN_SHED_OLDEST,
+    /** Queue one new command every RUN_SHED_EVERY in place of the oldest,
+     *  and shed the others. */
+    RUN_SHED_SAMPLE
+} run_policy;
+
+/** Command queued with -j. */
+typedef struct run_command {
+    /** Command line. */
+    char *line;
+    /** Exec number, for its shed counter. */
+    unsigned exec;
+    /** When the command was queued, with wait counters. */
+    struct timespec queued;
+} run_command;
+
+/** Exec engine of -j. */
+typedef struct run_engine {
+    /** Maximum number of children at once. */
+    unsigned jobs;
+    /** What to shed when the queue is full. */
+    run_policy policy;
+    /** Queued commands, a circular buffer. */
+    run_command *queue;
+    /** Maximum number of queued commands. */
+    unsigned size;
+    /** Index of the oldest queued command. */
+    unsigned head;
+    /** Number of queued commands. */
+    unsigned count;
+    /** Running children. */
+    pid_t *children;
+    /** Number of running children. */
+    unsigned running;
+    /** Number of commands offered while the queue was full, to sample. */
+    unsigned offered;
+    /** Number of commands submitted. */
+    unsigned long long submitted;
+    /** Number of commands shed. */
+    unsigned long long shed;
+    /** Shed counters of execs, or NULL. */
+    unsigned long long *counters;
+    /** Wait counters of commands, or NULL. */
+    unsigned long long *waits;
+    /** Non zero once no more commands will be submitted. */
+    int closing;
+    /** Protects the engine, shared by the filter and the thread. */
+    pthread_mutex_t lock;
+    /** Signaled when a command is queued, or the engine is closing. */
+    pthread_cond_t cond;
+    /** Thread running commands. */
+    pthread_t thread;
+} run_engine;
+
+/** Records of the same shard, handed over at once with -m. */
+typedef struct run_batch {
+    /** Records, each a reply pointer followed by a line and by a NUL. */
+    char *data;
+    /** Bytes used. */
+    size_t len;
+    /** Bytes allocated. */
+    size_t size;
+    /** Number of records. */
+    unsigned count;
+} run_batch;
+
+/** Worker thread of -m, that filters the records whose key hashes to it. */
+typedef struct run_shard {
+    /** Sharding this worker belongs to. */
+    struct run_shards *owner;
+    /** Queued batches, a circular buffer. */
+    run_batch *queue[RUN_SHARD_QUEUE];
+    /** Index of the oldest queued batch. */
+    unsigned head;
+    /** Number of queued batches. */
+    unsigned count;
+    /** Batch being filled by the reader, or NULL. */
+    run_batch *filling;
+    /** Instrumentation of this worker. */
+    vm_probe probe;
+    /** Signaled when a batch is queued, or when closing. */
+    pthread_cond_t cond;
+    /** Thread. */
+    pthread_t thread;
+} run_shard;
+
+/** Chunk of the input of -P. */
+typedef struct run_chunk {
+    /** First line. */
+    const char *data;
+    /** Bytes, up to the end of the last line. */
+    size_t len;
+    /** What filtering the chunk printed. */
+    run_output output;
+    /** Non zero once filtered. */
+    int done;
+} run_chunk;
+
+/** Threads of -P, and the chunks they filter. */
+typedef struct run_pool {
+    /** Program to run. */
+    const vm_program *program;
+    /** Chunks, in input order. */
+    run_chunk *chunks;
+    /** Number of chunks. */
+    unsigned count;
+    /** Next chunk to take, updated atomically. */
+    unsigned next;
+    /** Number of chunks written. */
+    unsigned written;
+    /** Number of chunks taken ahead of the one being written. */
+    unsigned ahead;
+    /** Protects done flags and the number of chunks written. */
+    pthread_mutex_t lock;
+    /** Signaled when a chunk is filtered. */
+    pthread_cond_t done;
+    /** Signaled when a chunk is written. */
+    pthread_cond_t space;
+} run_pool;
+
+/** Thread of -P. */
+typedef struct run_worker {
+    /** Pool this thread belongs to. */
+    run_pool *pool;
+    /** Instrumentation of this thread. */
+    vm_probe probe;
+    /** Thread. */
+    pthread_t thread;
+} run_worker;
+
+/** Exec collected by a group of -L. */
+typedef struct run_call {
+    /** Function that contains the exec. */
+    const vm_function *function;
+    /** Command line. */
+    const char *command;
+    /** Number of the exec. */
+    unsigned exec;
+} run_call;
+
+/** Group of functions of -L, and the thread that runs it. */
+typedef struct run_group {
+    /** Team this group belongs to. */
+    struct run_team *team;
+    /** First function of the group. */
+    unsigned first;
+    /** Function past the group. */
+    unsigned last;
+    /** Execs of the current record. */
+    run_call *calls;
+    /** Number of execs of the current record. */
+    unsigned count;
+    /** Number of execs allocated. */
+    unsigned size;
+    /** Non zero if the current record stopped at an exec. */
+    int stopped;
+    /** Counters of this thread, when the probe counts into scratch. */
+    unsigned long long *counters;
+    /** Counts of the current record, with -s in first match mode, or
+     *  NULL. */
+    unsigned long long *scratch;
+    /** Number of counters of scratch, for functions and execs. */
+    unsigned counted;
+    /** Instrumentation of this thread. */
+    vm_probe probe;
+    /** Thread, except for the first group, run by the reader. */
+    pthread_t thread;
+} run_group;
+
+/** Team of threads of -L, that filter each record together. */
+typedef struct run_team {
+    /** Program to run. */
+    const vm_program *program;
+    /** Groups, allocated one by one so that they don't share lines. */
+    run_group **groups;
+    /** Number of groups. */
+    unsigned count;
+    /** Line being filtered. */
+    const char *line;
+    /** Length of the line. */
+    size_t len;
+    /** Bumped to start a record, read and written atomically. */
+    unsigned generation;
+    /** Number of groups still running, read and written atomically. */
+    unsigned running;
+    /** Non zero once the threads should exit. */
+    int closing;
+} run_team;
+
+/** Sharding of -m. */
+typedef struct run_shards {
+    /** Program to run. */
+    const vm_program *program;
+    /** Workers, allocated one by one so that they don't share lines. */
+    run_shard **shards;
+    /** Number of workers. */
+    unsigned count;
+    /** Register whose field is hashed to pick a worker. */
+    unsigned key;
+    /** Non zero if idle workers take batches from overloaded ones. */
+    int steal;
+    /** Number of records handed over and not filtered yet. */
+    unsigned long long pending;
+    /** Number of batches taken from another worker. */
+    unsigned long long stolen;
+    /** Non zero once no more records will be added. */
+    int closing;
+    /** Protects the queues of all workers. */
+    pthread_mutex_t lock;
+    /** Signaled when a batch is taken, or filtered. */
+    pthread_cond_t space;
+} run_shards;
+
+/** Whether we should print commands rather than executing them. */
+static int DryRun;
+
+/** Ring to push records into, in the child process of -r, or NULL. */
+static vm_ring *Ring;
+
+/** Instrumentation of vm_run(). */
+static vm_probe Probe;
+
+/** Registers read by the program, whose fields are split. */
+static unsigned Live = VM_LIVE_ALL;
+
+/** Whether lines are run whole, since no plugin action reads the input. */
+static int Lazy;
+
+/** Bitmap of the execs fired by the record being filtered, with -E. */
+static unsigned char *Fired;
+
+/** State of -w, or NULL. */
+static run_watch *Watch;
+
+/** Archive written with -a, or NULL. */
+static vm_columns_writer *Archive;
+
+/** Exec engine of -j, or NULL to run commands in the filter. */
+static run_engine *Engine;
+
+/** Sharding of -m, or NULL to filter records as they are read. */
+static run_shards *Shards;
+
+/** Team of -L, or NULL to filter records in a single thread. */
+static run_team *Team;
+
+/** Names of the fields, in register order, for -k. */
+static const char *RunKeys[VM_REGISTERS] = {
+    "monitor_type", "port", "group", "label", "hostname", "family"
+};
+
+/**
+ * Get the program to filter the next record with: with -w, switch to the
+ * program last linked by the watcher, if any, and destroy the old one.
+ * @param program Loaded program.
+ * @returns The program to run.
+ */
+static const vm_program *run_current(const vm_program *program)
+{
+    vm_program *next;
+
+    if (!Watch) {
+        return program;
+    }
+    next = __atomic_exchange_n(&Watch->next, NULL, __ATOMIC_ACQUIRE);
+    if (next) {
+        pthread_mutex_lock(&Watch->lock);
+        vm_program_destroy(Watch->current);
+        pthread_mutex_unlock(&Watch->lock);
+        Watch->current = next;
+    }
+    return Watch->current;
+}
+
+/**
+ * Compile a source file with the compiler and the optimizer, and load
+ * the result. Called with the lock held.
+ * @param w State of -w.
+ * @param name File name, in the watched directory.
+ * @returns The loaded program, or NULL on error.
+ */
+static vm_program *run_compile(run_watch *w, const char *name)
+{
+    char path[PATH_MAX];
+    vm_program *program = NULL;
+    int compile[2], optimize[2], status, ok = 1;
+    pid_t pids[2];
+    unsigned i;
+    FILE *fp;
+
+    snprintf(path, sizeof (path), "%s/%s", w->dir, name);
+    /* Commands started meanwhile by other threads must not hold the
+     * pipes open, or the optimizer would never see the end of input. */
+    if (pipe2(compile, O_CLOEXEC) == -1) {
+        return NULL;
+    }
+    pids[0] = fork();
+    if (pids[0] == 0) {
+        dup2(compile[1], 1);
+        close(compile[0]);
+        close(compile[1]);
+        execlp(RUN_COMPILER, RUN_COMPILER, path, (char *) NULL);
+        _exit(127);
+    }
+    close(compile[1]);
+    if (pids[0] == -1 || pipe2(optimize, O_CLOEXEC) == -1) {
+        close(compile[0]);
+        pids[1] = -1;
+    } else {
+        pids[1] = fork();
+        if (pids[1] == 0) {
+            dup2(compile[0], 0);
+            dup2(optimize[1], 1);
+            close(compile[0]);
+            close(optimize[0]);
+            close(optimize[1]);
+            execlp(RUN_OPTIMIZER, RUN_OPTIMIZER, (char *) NULL);
+            _exit(127);
+        }
+        close(compile[0]);
+        close(optimize[1]);
+        fp = fdopen(optimize[0], "r");
+        if (fp) {
+            program = vm_program_load_shared(fp, w->plugins, w->constants);
+            fclose(fp);
+        } else {
+            close(optimize[0]);
+        }
+    }
+
+    for (i = 0; i < 2; ++i) {
+        if (pids[i] == -1 || waitpid(pids[i], &status, 0) == -1 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ok = 0;
+        }
+    }
+    if (!ok && program) {
+        vm_program_destroy(program);
+        program = NULL;
+    }
+    if (!program) {
+        fprintf(stderr, "%s: error - can't compile %s\n", w->prog, path);
+    }
+    return program;
+}
+
+/**
+ * Compile a source file again, or forget it if it is gone. Called with
+ * the lock held.
+ * @param w State of -w.
+ * @param name File name, in the watched directory.
+ * @param removed Non zero if the file was removed or renamed away.
+ * @returns Non zero if the modules changed.
+ */
+static int run_update(run_watch *w, const char *name, int removed)
+{
+    vm_program *program = NULL;
+    unsigned i;
+    int diff = 1;
+
+    for (i = 0; i < w->count; ++i) {
+        diff = strcmp(w->modules[i].name, name);
+        if (diff >= 0) {
+            break;
+        }
+    }
+    if (!removed) {
+        program = run_compile(w, name);
+        if (!program) {
+            return 0;
+        }
+    }
+
+    if (i < w->count && diff == 0) {
+        vm_program_destroy(w->modules[i].program);
+        if (program) {
+            w->modules[i].program = program;
+            return 1;
+        }
+        free(w->modules[i].name);
+        memmove(&w->modules[i], &w->modules[i + 1],
+                (w->count - i - 1) * sizeof (run_module));
+        w->count--;
+        return 1;
+    }
+    if (!program) {
+        return 0;
+    }
+    w->modules = realloc(w->modules, (w->count + 1) * sizeof (run_module));
+    if (!w->modules) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memmove(&w->modules[i + 1], &w->modules[i],
+            (w->count - i) * sizeof (run_module));
+    w->modules[i].name = strdup(name);
+    w->modules[i].program = program;
+    w->count++;
+    return 1;
+}
+
+/**
+ * Link the modules. Called with the lock held.
+ * @param w State of -w.
+ * @returns The linked program, or NULL on error.
+ */
+static vm_program *run_link(run_watch *w)
+{
+    vm_program **programs = vm_alloc((w->count + 1) * sizeof (vm_program *));
+    vm_program *program;
+    unsigned i;
+
+    for (i = 0; i < w->count; ++i) {
+        programs[i] = w->modules[i].program;
+    }
+    program = vm_program_link(programs, w->count, w->constants);
+    free(programs);
+    if (!program) {
+        fprintf(stderr, "%s: error - can't link %s\n", w->prog, w->dir);
+    }
+    return program;
+}
+
+/**
+ * Tell whether a file is a source file.
+ * @param name File name.
+ * @returns Non zero if @a name ends with RUN_SUFFIX.
+ */
+static int run_source(const char *name)
+{
+    size_t len = strlen(name), suffix = strlen(RUN_SUFFIX);
+
+    return name[0] != '.' && len > suffix &&
+           strcmp(name + len - suffix, RUN_SUFFIX) == 0;
+}
+
+/**
+ * Watch the directory, compile the files that change and link them,
+ * handing each linked program to the filter.
+ * @param opaque State of -w.
+ * @returns NULL, if the directory can't be watched any more.
+ */
+static void *run_watcher(void *opaque)
+{
+    char buf[65536]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    run_watch *w = opaque;
+    vm_program *program, *old;
+    ssize_t n;
+    char *p;
+
+    for (;;) {
+        int changed = 0;
+
+        n = read(w->fd, buf, sizeof (buf));
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: error - can't watch %s\n", w->prog, w->dir);
+            return NULL;
+        }
+
+        /* Saving a file may raise many events: handle all the events
+         * read at once, then link once. */
+        pthread_mutex_lock(&w->lock);
+        for (p = buf; p < buf + n; ) {
+            const struct inotify_event *event = (const void *) p;
+            p += sizeof (struct inotify_event) + event->len;
+            if (event->len > 0 && run_source(event->name)) {
+                changed |= run_update(w, event->name, (event->mask &
+                                      (IN_DELETE | IN_MOVED_FROM)) != 0);
+            }
+        }
+        if (changed && (program = run_link(w))) {
+            old = __atomic_exchange_n(&w->next, program, __ATOMIC_RELEASE);
+            if (old) {
+                vm_program_destroy(old);
+            }
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/**
+ * Compile all the source files of a directory, link them, and start the
+ * thread that watches the directory.
+ * @param prog Name of this program.
+ * @param dir Directory.
+ * @param plugins Plugins to resolve actions with, or NULL.
+ * @returns The linked program.
+ */
+static vm_program *run_watch_start(const char *prog, const char *dir,
+                                   const vm_plugins *plugins)
+{
+    run_watch *w = vm_alloc(sizeof (run_watch));
+    struct dirent *entry;
+    pthread_t thread;
+    DIR *dp;
+
+    w->prog = prog;
+    w->dir = dir;
+    w->plugins = plugins;
+    w->constants = vm_constants_create();
+    pthread_mutex_init(&w->lock, NULL);
+
+    /* Watch first, so that no change is lost while we compile. */
+    w->fd = inotify_init1(IN_CLOEXEC);
+    if (w->fd == -1 ||
+        inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                                      IN_MOVED_FROM | IN_DELETE) == -1) {
+        fprintf(stderr, "%s: error - can't watch %s\n", prog, dir);
+        exit(1);
+    }
+    dp = opendir(dir);
+    if (!dp) {
+        fprintf(stderr, "%s: error - can't open %s\n", prog, dir);
+        exit(1);
+    }
+    while ((entry = readdir(dp))) {
+        if (run_source(entry->d_name) && !run_update(w, entry->d_name, 0)) {
+            exit(1);
+        }
+    }
+    closedir(dp);
+
+    w->current = run_link(w);
+    if (!w->current) {
+        exit(1);
+    }
+    if (pthread_create(&thread, NULL, run_watcher, w) != 0) {
+        fprintf(stderr, "%s: error - can't start watcher\n", prog);
+        exit(1);
+    }
+    pthread_detach(thread);
+    Watch = w;
+    return w->current;
+}
+
+/**
+ * Count a command as shed. Called by the filter, with the lock held.
+ * @param e Exec engine.
+ * @param exec Exec number of the command.
+ */
+static void run_shed(run_engine *e, unsigned exec)
+{
+    e->shed++;
+    if (e->counters) {
+        e->counters[exec]++;
+    }
+}
+
+/**
+ * Queue a command for the exec engine, shedding a command according to
+ * the policy if the queue is full. Called by the filter.
+ * @param e Exec engine.
+ * @param command Command line.
+ * @param exec Exec number of the command.
+ */
+static void run_submit(run_engine *e, const char *command, unsigned exec)
+{
+    run_command *slot;
+
+    pthread_mutex_lock(&e->lock);
+    e->submitted++;
+    if (e->count == e->size) {
+        if (e->policy == RUN_SHED_NEWEST ||
+            (e->policy == RUN_SHED_SAMPLE && e->offered++ % RUN_SHED_EVERY)) {
+            run_shed(e, exec);
+            pthread_mutex_unlock(&e->lock);
+            return;
+        }
+        slot = &e->queue[e->head];
+        run_shed(e, slot->exec);
+        free(slot->line);
+        e->head = (e->head + 1) % e->size;
+        e->count--;
+    }
+    slot = &e->queue[(e->head + e->count) % e->size];
+    slot->line = strdup(command);
+    slot->exec = exec;
+    if (e->waits) {
+        clock_gettime(CLOCK_MONOTONIC, &slot->queued);
+    }
+    if (!slot->line) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    e->count++;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+}
+
+/**
+ * Forget the children that have exited. Called with the lock held.
+ * @param e Exec engine.
+ */
+static void run_reap(run_engine *e)
+{
+    unsigned i;
+    int status;
+
+    for (i = 0; i < e->running; ) {
+        pid_t pid = waitpid(e->children[i], &status, WNOHANG);
+        if (pid == 0 || (pid == -1 && errno == EINTR)) {
+            ++i;
+            continue;
+        }
+        e->children[i] = e->children[--e->running];
+    }
+}
+
+/**
+ * Count how long a command waited in the queue, if the engine has wait
+ * counters. Called with the lock held.
+ * @param e Exec engine.
+ * @param command Command about to run.
+ */
+static void run_waited(run_engine *e, const run_command *command)
+{
+    struct timespec now;
+    long long usec;
+
+    if (!e->waits) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usec = (long long) (now.tv_sec - command->queued.tv_sec) * 1000000 +
+           (now.tv_nsec - command->queued.tv_nsec) / 1000;
+    e->waits[vm_stats_wait((usec > 0) ? (unsigned long long) usec : 0)]++;
+}
+
+/**
+ * Run queued commands, with at most the given number of children at
+ * once, until the engine is stopped and the queue is empty.
+ * @param opaque Exec engine.
+ * @returns NULL.
+ */
+static void *run_engine_main(void *opaque)
+{
+    run_engine *e = opaque;
+    char *argv[] = { "sh", "-c", NULL, NULL };
+    struct timespec deadline;
+    pid_t pid;
+
+    pthread_mutex_lock(&e->lock);
+    for (;;) {
+        run_reap(e);
+        while (e->running < e->jobs && e->count > 0) {
+            argv[2] = e->queue[e->head].line;
+            run_waited(e, &e->queue[e->head]);
+            e->head = (e->head + 1) % e->size;
+            e->count--;
+            pthread_mutex_unlock(&e->lock);
+            if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv,
+                            environ) != 0) {
+                fprintf(stderr, "ucc-run: can't execute %s\n", argv[2]);
+                pid = -1;
+            }
+            free(argv[2]);
+            pthread_mutex_lock(&e->lock);
+            if (pid != -1) {
+                e->children[e->running++] = pid;
+            }
+        }
+        if (e->closing && e->count == 0 && e->running == 0) {
+            break;
+        }
+
+        /* Children don't wake us up: look for exited ones every now and
+         * then, while some run. */
+        if (e->running > 0) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += RUN_REAP_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&e->cond, &e->lock, &deadline);
+        } else {
+            pthread_cond_wait(&e->cond, &e->lock);
+        }
+    }
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+/**
+ * Start the exec engine of -j.
+ * @param prog Name of this program.
+ * @param jobs Maximum number of children at once.
+ * @param size Maximum number of queued commands.
+ * @param policy What to shed when the queue is full.
+ * @param counters Shed counters of execs, followed by wait counters, or
+ *        NULL.
+ * @param execs Number of execs.
+ * @returns The engine.
+ */
+static run_engine *run_engine_start(const char *prog, unsigned jobs,
+                                    unsigned size, run_policy policy,
+                                    unsigned long long *counters,
+                                    unsigned execs)
+{
+    run_engine *e = vm_alloc(sizeof (run_engine));
+
+    e->jobs = jobs;
+    e->size = size;
+    e->policy = policy;
+    e->counters = counters;
+    e->waits = (counters) ? counters + execs : NULL;
+    e->queue = vm_alloc(size * sizeof (run_command));
+    e->children = vm_alloc(jobs * sizeof (pid_t));
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    if (pthread_create(&e->thread, NULL, run_engine_main, e) != 0) {
+        fprintf(stderr, "%s: error - can't start exec engine\n", prog);
+        exit(1);
+    }
+    return e;
+}
+
+/**
+ * Stop the exec engine, once it has run all the queued commands and
+ * they have exited, and tell how many were shed.
+ * @param prog Name of this program.
+ * @param e Exec engine.
+ */
+static void run_engine_stop(const char *prog, run_engine *e)
+{
+    pthread_mutex_lock(&e->lock);
+    e->closing = 1;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+    if (e->shed > 0) {
+        fprintf(stderr, "%s: shed %llu of %llu commands\n", prog, e->shed,
+                e->submitted);
+    }
+    free(e->queue);
+    free(e->children);
+    free(e);
+}
+
+/**
+ * Append bytes to a buffer.
+ * @param output Buffer.
+ * @param data Bytes.
+ * @param len Number of bytes.
+ */
+static void run_output_add(run_output *output, const char *data, size_t len)
+{
+    if (output->len + len > output->size) {
+        output->size = 2 * (output->len + len);
+        output->data = realloc(output->data, output->size);
+        if (!output->data) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(output->data + output->len, data, len);
+    output->len += len;
+}
+
+/**
+ * Handler for VM_EXEC instructions.
+ * @param opaque Sink of the record.
+ * @param function Function that contains the instruction.
+ * @param command Command line to execute.
+ */
+static void run_exec(void *opaque, const vm_function *function,
+                     const char *command)
+{
+    run_sink *sink = opaque;
+    run_reply *reply = sink->reply;
+
+    if (reply) {
+        int n = snprintf(reply->data + reply->len,
+                         sizeof (reply->data) - reply->len, "%s\t%s\n",
+                         function->name, command);
+        if (n > 0) {
+            reply->len += (size_t) n;
+            if (reply->len >= sizeof (reply->data)) {
+                reply->len = sizeof (reply->data) - 1;
+            }
+        }
+    }
+    if (sink->fired) {
+        sink->fired[sink->probe->exec / 8] |= 1U << (sink->probe->exec % 8);
+    } else if (sink->output) {
+        run_output_add(sink->output, function->name, strlen(function->name));
+        run_output_add(sink->output, "\t", 1);
+        run_output_add(sink->output, command, strlen(command));
+        run_output_add(sink->output, "\n", 1);
+    } else if (DryRun) {
+        printf("%s\t%s\n", function->name, command);
+    } else if (Engine) {
+        run_submit(Engine, command, sink->probe->exec);
+    } else if (system(command) == -1) {
+        fprintf(stderr, "ucc-run: can't execute %s\n", command);
+    }
+}
+
+/**
+ * Add a line to Archive, split into all its fields.
+ * @param line Line, without line terminator.
+ * @param len Length of @a line.
+ */
+static void run_archive(const char *line, size_t len)
+{
+    vm_field fields[VM_REGISTERS];
+    const char *end = line + len, *tab;
+    unsigned i;
+
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        tab = memchr(line, '\t', (size_t) (end - line));
+        fields[i].data = line;
+        fields[i].len = (size_t) (((tab) ? tab : end) - line);
+        line = (tab) ? tab + 1 : end;
+    }
+    vm_columns_add(Archive, fields);
+}
+
+/**
+ * Print the bitmap of the execs fired by a record, with -E, and clear it.
+ * @param program Loaded program.
+ * @param sink Sink of the record.
+ */
+static void run_fired(const vm_program *program, run_sink *sink)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned i, bytes = (program->exec_count + 7) / 8;
+    char hex[2];
+
+    for (i = 0; i < bytes; ++i) {
+        hex[0] = digits[sink->fired[i] >> 4];
+        hex[1] = digits[sink->fired[i] & 15];
+        if (sink->output) {
+            run_output_add(sink->output, hex, 2);
+        } else {
+            fwrite(hex, 1, 2, stdout);
+        }
+    }
+    if (sink->output) {
+        run_output_add(sink->output, "\n", 1);
+    } else {
+        putchar('\n');
+    }
+    memset(sink->fired, 0, bytes);
+}
+
+/**
+ * Split a line into fields and filter it through the program, or push
+ * it into Ring if we are the reader of -r.
+ * @param program Program to run, NULL if we are the reader of -r.
+ * @param line Line to process, without line terminator, which is
+ *        modified.
+ * @param len Length of @a line.
+ * @param sink Sink of the record.
+ */
+static void run_filter(const vm_program *program, char *line, size_t len,
+                       run_sink *sink)
+{
+    const char *fields[VM_REGISTERS];
+    ucc_input_t input;
+    unsigned i;
+
+    if (!Ring && Lazy) {
+        vm_run_line(program, line, len, sink->probe, run_exec, sink);
+        return;
+    }
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        if (!(Live >> i)) {
+            fields[i] = NULL;
+            continue;
+        }
+        fields[i] = (Live & (1U << i)) ? line : NULL;
+        line += strcspn(line, "\t");
+        if (*line != '\0') {
+            *line++ = '\0';
+        }
+    }
+
+    input.monitor_type = fields[0];
+    input.port = fields[1];
+    input.group = fields[2];
+    input.label = fields[3];
+    input.hostname = fields[4];
+    input.family = fields[5];
+
+    if (!Ring) {
+        vm_run(program, &input, sink->probe, run_exec, sink);
+    } else if (!vm_ring_push(Ring, &input)) {
+        fprintf(stderr, "ucc-run: record too long\n");
+    }
+}
+
+/**
+ * Hash the key of a record, to pick its shard.
+ * @param s Sharding.
+ * @param line Line, without line terminator.
+ * @param len Length of @a line.
+ * @returns Hash value of the key field (FNV-1a).
+ */
+static unsigned run_shards_hash(const run_shards *s, const char *line,
+                                size_t len)
+{
+    const char *end = line + len, *tab;
+    unsigned hash = 0x811c9dc5, i;
+
+    for (i = 0; i < s->key; ++i) {
+        tab = memchr(line, '\t', (size_t) (end - line));
+        line = (tab) ? tab + 1 : end;
+    }
+    for (; line < end && *line != '\t'; ++line) {
+        hash = (hash ^ (unsigned char) *line) * 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Take the next batch for a worker: its own oldest one or, if it has none
+ * and stealing is allowed, the oldest one of the worker with most batches,
+ * provided that its queue is more than half full. Called with the lock
+ * held.
+ * @param s Sharding.
+ * @param shard Worker.
+ * @returns The batch, or NULL if there is none.
+ */
+static run_batch *run_shards_take(run_shards *s, run_shard *shard)
+{
+    run_shard *victim = shard;
+    run_batch *batch;
+    unsigned i;
+
+    if (shard->count == 0 && s->steal) {
+        victim = NULL;
+        for (i = 0; i < s->count; ++i) {
+            run_shard *other = s->shards[i];
+            if (other->count > RUN_SHARD_QUEUE / 2 &&
+                (!victim || other->count > victim->count)) {
+                victim = other;
+            }
+        }
+        if (!victim) {
+            return NULL;
+        }
+        s->stolen++;
+    }
+    if (victim->count == 0) {
+        return NULL;
+    }
+    batch = victim->queue[victim->head];
+    victim->head = (victim->head + 1) % RUN_SHARD_QUEUE;
+    victim->count--;
+    pthread_cond_signal(&s->space);
+    return batch;
+}
+
+/**
+ * Body of a worker: filter batches until closing.
+ * @param opaque Worker.
+ * @returns NULL.
+ */
+static void *run_shard_main(void *opaque)
+{
+    run_shard *shard = opaque;
+    run_shards *s = shard->owner;
+    run_sink sink = { &shard->probe, NULL, NULL, NULL };
+    run_batch *batch;
+    char *cursor;
+    size_t len;
+    unsigned i;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!(batch = run_shards_take(s, shard)) && !s->closing) {
+            pthread_cond_wait(&shard->cond, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (!batch) {
+            break;
+        }
+
+        for (i = 0, cursor = batch->data; i < batch->count; ++i) {
+            memcpy(&sink.reply, cursor, sizeof (run_reply *));
+            cursor += sizeof (run_reply *);
+            len = strlen(cursor);
+            run_filter(s->program, cursor, len, &sink);
+            cursor += len + 1;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->pending -= batch->count;
+        if (s->pending == 0) {
+            pthread_cond_signal(&s->space);
+        }
+        pthread_mutex_unlock(&s->lock);
+        free(batch->data);
+        free(batch);
+    }
+    return NULL;
+}
+
+/**
+ * Queue the batch being filled for a worker, waiting while its queue is
+ * full. If its queue is then more than half full, and stealing is
+ * allowed, wake up all the workers, so that idle ones take from it.
+ * @param s Sharding.
+ * @param shard Worker.
+ */
+static void run_shards_flush(run_shards *s, run_shard *shard)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&s->lock);
+    while (shard->count == RUN_SHARD_QUEUE) {
+        pthread_cond_wait(&s->space, &s->lock);
+    }
+    shard->queue[(shard->head + shard->count++) % RUN_SHARD_QUEUE] =
+        shard->filling;
+    s->pending += shard->filling->count;
+    pthread_cond_signal(&shard->cond);
+    if (s->steal && shard->count > RUN_SHARD_QUEUE / 2) {
+        for (i = 0; i < s->count; ++i) {
+            pthread_cond_signal(&s->shards[i]->cond);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    shard->filling = NULL;
+}
+
+/**
+ * Hand a record over to the worker that its key hashes to, in a batch.
+ * @param s Sharding.
+ * @param line Line, without line terminator.
+ * @param len Length of @a line.
+ * @param reply Reply to append commands to, or NULL.
+ */
+static void run_shards_add(run_shards *s, const char *line, size_t len,
+                           run_reply *reply)
+{
+    run_shard *shard = s->shards[run_shards_hash(s, line, len) % s->count];
+    run_batch *batch = shard->filling;
+    size_t need;
+
+    if (!batch) {
+        batch = shard->filling = vm_alloc(sizeof (run_batch));
+    }
+    need = batch->len + sizeof (run_reply *) + len + 1;
+    if (need > batch->size) {
+        batch->size = 2 * need;
+        batch->data = realloc(batch->data, batch->size);
+        if (!batch->data) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(batch->data + batch->len, &reply, sizeof (run_reply *));
+    memcpy(batch->data + batch->len + sizeof (run_reply *), line, len);
+    batch->data[need - 1] = '\0';
+    batch->len = need;
+    if (++batch->count == RUN_SHARD_BATCH) {
+        run_shards_flush(s, shard);
+    }
+}
+
+/**
+ * Hand over the batches being filled, and wait until the workers have
+ * filtered all the records.
+ * @param s Sharding.
+ */
+static void run_shards_drain(run_shards *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->count; ++i) {
+        if (s->shards[i]->filling) {
+            run_shards_flush(s, s->shards[i]);
+        }
+    }
+    pthread_mutex_lock(&s->lock);
+    while (s->pending > 0) {
+        pthread_cond_wait(&s->space, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Start the workers of -m.
+ * @param prog Name of this program.
+ * @param program Program to run.
+ * @param count Number of workers.
+ * @param key Register whose field picks the worker of a record.
+ * @param steal Non zero if idle workers take from overloaded ones.
+ * @param stats Counters with a block for each worker, or NULL.
+ * @param traces Traces with a ring for each worker, or NULL.
+ * @returns The sharding.
+ */
+static run_shards *run_shards_start(const char *prog,
+                                    const vm_program *program,
+                                    unsigned count, unsigned key, int steal,
+                                    vm_stats *stats, vm_traces *traces)
+{
+    run_shards *s = vm_alloc(sizeof (run_shards));
+    unsigned i;
+
+    s->program = program;
+    s->count = count;
+    s->key = key;
+    s->steal = steal;
+    s->shards = vm_alloc(count * sizeof (run_shard *));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->space, NULL);
+    /* Workers look at each other's queues when stealing. */
+    for (i = 0; i < count; ++i) {
+        s->shards[i] = vm_alloc(sizeof (run_shard));
+    }
+    for (i = 0; i < count; ++i) {
+        run_shard *shard = s->shards[i];
+
+        shard->owner = s;
+        shard->probe.sample = Probe.sample;
+        if (stats) {
+            shard->probe.counters = vm_stats_counters(stats, i);
+        }
+        if (traces) {
+            shard->probe.trace = vm_traces_ring(traces, i);
+        }
+        pthread_cond_init(&shard->cond, NULL);
+        if (pthread_create(&shard->thread, NULL, run_shard_main, shard)) {
+            fprintf(stderr, "%s: error - can't start worker\n", prog);
+            exit(1);
+        }
+    }
+    return s;
+}
+
+/**
+ * Filter the records handed over, and stop the workers of -m. With
+ * stealing, report how many batches were stolen.
+ * @param prog Name of this program.
+ * @param s Sharding.
+ */
+static void run_shards_stop(const char *prog, run_shards *s)
+{
+    unsigned i;
+
+    run_shards_drain(s);
+    pthread_mutex_lock(&s->lock);
+    s->closing = 1;
+    for (i = 0; i < s->count; ++i) {
+        pthread_cond_signal(&s->shards[i]->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    for (i = 0; i < s->count; ++i) {
+        pthread_join(s->shards[i]->thread, NULL);
+        pthread_cond_destroy(&s->shards[i]->cond);
+        free(s->shards[i]);
+    }
+    if (s->steal) {
+        fprintf(stderr, "%s: %llu batches stolen\n", prog, s->stolen);
+    }
+    pthread_cond_destroy(&s->space);
+    pthread_mutex_destroy(&s->lock);
+    free(s->shards);
+    free(s);
+}
+
+/**
+ * Handler for VM_EXEC instructions of a group of -L: collect the exec.
+ * @param opaque Group.
+ * @param function Function that contains the instruction.
+ * @param command Command line.
+ */
+static void run_collect(void *opaque, const vm_function *function,
+                        const char *command)
+{
+    run_group *group = opaque;
+
+    if (group->count == group->size) {
+        group->size = (group->size) ? 2 * group->size : 16;
+        group->calls = realloc(group->calls, group->size * sizeof (run_call));
+        if (!group->calls) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    group->calls[group->count].function = function;
+    group->calls[group->count].command = command;
+    group->calls[group->count].exec = group->probe.exec;
+    group->count++;
+}
+
+/**
+ * Filter the current line of the team through the functions of a group.
+ * @param group Group.
+ */
+static void run_group_run(run_group *group)
+{
+    run_team *team = group->team;
+
+    group->count = 0;
+    group->stopped = vm_run_group(team->program, team->line, team->len,
+                                  group->first, group->last, &group->probe,
+                                  run_collect, group);
+}
+
+/**
+ * Pin a thread to a processor.
+ * @param thread Thread.
+ * @param cpu Processor number, modulo the number of online processors.
+ */
+static void run_pin(pthread_t thread, unsigned cpu)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (online > 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu % (unsigned) online, &set);
+        pthread_setaffinity_np(thread, sizeof (set), &set);
+    }
+}
+
+/**
+ * Body of a thread of -L: run its group each time the generation changes,
+ * until closing.
+ * @param opaque Group.
+ * @returns NULL.
+ */
+static void *run_group_main(void *opaque)
+{
+    run_group *group = opaque;
+    run_team *team = group->team;
+    struct timespec idle = { 0, 1000000 };
+    unsigned seen = 0, spins = 0;
+
+    for (;;) {
+        unsigned generation = __atomic_load_n(&team->generation,
+                                              __ATOMIC_ACQUIRE);
+        if (generation == seen) {
+            /* Spin, then yield, then sleep when there is no input. */
+            if (++spins % RUN_SPIN == 0) {
+                if (spins < RUN_SPIN * RUN_SPIN) {
+                    sched_yield();
+                } else {
+                    nanosleep(&idle, NULL);
+                }
+            }
+            continue;
+        }
+        seen = generation;
+        spins = 0;
+        if (team->closing) {
+            break;
+        }
+        run_group_run(group);
+        __atomic_sub_fetch(&team->running, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * Start the team of -L.
+ * @param prog Name of this program.
+ * @param program Program to run, not fused.
+ * @param count Number of threads, the reader included.
+ * @param stats Counters with a block for each thread, or NULL.
+ * @param traces Traces with a ring for each thread, or NULL.
+ * @returns The team.
+ */
+static run_team *run_team_start(const char *prog, const vm_program *program,
+                                unsigned count, vm_stats *stats,
+                                vm_traces *traces)
+{
+    run_team *team = vm_alloc(sizeof (run_team));
+    unsigned *bounds = vm_alloc((count + 1) * sizeof (unsigned));
+    unsigned i;
+
+    team->program = program;
+    team->count = count;
+    team->groups = vm_alloc(count * sizeof (run_group *));
+    vm_program_partition(program, count, bounds);
+    for (i = 0; i < count; ++i) {
+        run_group *group = team->groups[i] = vm_alloc(sizeof (run_group));
+
+        group->team = team;
+        group->first = bounds[i];
+        group->last = bounds[i + 1];
+        group->probe.sample = Probe.sample;
+        if (stats) {
+            group->probe.counters = vm_stats_counters(stats, i);
+        }
+        if (stats && program->first) {
+            group->counters = group->probe.counters;
+            group->counted = program->got_count + program->exec_count;
+            group->scratch = vm_alloc(group->counted *
+                                      sizeof (unsigned long long));
+            group->probe.counters = group->scratch;
+        }
+        if (traces) {
+            group->probe.trace = vm_traces_ring(traces, i);
+        }
+    }
+    free(bounds);
+
+    run_pin(pthread_self(), 0);
+    for (i = 1; i < count; ++i) {
+        if (pthread_create(&team->groups[i]->thread, NULL, run_group_main,
+                           team->groups[i])) {
+            fprintf(stderr, "%s: error - can't start thread\n", prog);
+            exit(1);
+        }
+        run_pin(team->groups[i]->thread, i);
+    }
+    return team;
+}
+
+/**
+ * Add the counts of a group for the current record to its counters, or
+ * drop them, and clear them for the next record. Called by the reader,
+ * once the group is done.
+ * @param group Group, whose probe counts into scratch.
+ * @param keep Non zero to add the counts, zero to drop them.
+ */
+static void run_group_count(run_group *group, int keep)
+{
+    unsigned i;
+
+    for (i = 0; i < group->counted; ++i) {
+        if (keep) {
+            group->counters[i] += group->scratch[i];
+        }
+        group->scratch[i] = 0;
+    }
+}
+
+/**
+ * Filter a line with the team of -L, and hand its execs to a sink in
+ * global offset table order.
+ * @param team Team.
+ * @param line Line, without line terminator.
+ * @param len Length of @a line.
+ * @param sink Sink of the record, whose probe gets the number of each
+ *        exec before it is handled.
+ */
+static void run_team_run(run_team *team, const char *line, size_t len,
+                         run_sink *sink)
+{
+    unsigned g, i, spins = 0;
+    int stopped = 0;
+
+    team->line = line;
+    team->len = len;
+    __atomic_store_n(&team->running, team->count - 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&team->generation, 1, __ATOMIC_RELEASE);
+    run_group_run(team->groups[0]);
+    while (__atomic_load_n(&team->running, __ATOMIC_ACQUIRE) > 0) {
+        if (++spins == RUN_SPIN) {
+            spins = 0;
+            sched_yield();
+        }
+    }
+
+    for (g = 0; g < team->count; ++g) {
+        run_group *group = team->groups[g];
+
+        for (i = 0; i < group->count && !stopped; ++i) {
+            sink->probe->exec = group->calls[i].exec;
+            run_exec(sink, group->calls[i].function, group->calls[i].command);
+        }
+        if (group->scratch) {
+            run_group_count(group, !stopped);
+        }
+        stopped = stopped || group->stopped;
+    }
+}
+
+/**
+ * Stop the team of -L.
+ * @param team Team.
+ */
+static void run_team_stop(run_team *team)
+{
+    unsigned i;
+
+    team->closing = 1;
+    __atomic_add_fetch(&team->generation, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < team->count; ++i) {
+        if (i > 0) {
+            pthread_join(team->groups[i]->thread, NULL);
+        }
+        free(team->groups[i]->calls);
+        free(team->groups[i]->scratch);
+        free(team->groups[i]);
+    }
+    free(team->groups);
+    free(team);
+}
+
+/**
+ * Process a line read from input: archive it with -a, and filter it, or
+ * hand it to its shard with -m.
+ * @param program Loaded program, NULL if we are the reader of -r.
+ * @param line Line to process, which is modified.
+ * @param reply Reply to append commands to, or NULL.
+ */
+static void run_record(const vm_program *program, char *line,
+                       run_reply *reply)
+{
+    run_sink sink = { &Probe, reply, NULL, Fired };
+    size_t len = strcspn(line, "\r\n");
+
+    line[len] = '\0';
+    if (Archive) {
+        run_archive(line, len);
+    }
+    if (Shards) {
+        run_shards_add(Shards, line, len, reply);
+        return;
+    }
+    if (!Ring) {
+        program = run_current(program);
+    }
+    if (Team) {
+        run_team_run(Team, line, len, &sink);
+    } else {
+        run_filter(program, line, len, &sink);
+    }
+    if (Fired) {
+        run_fired(program, &sink);
+    }
+}
+
+/**
+ * Filter all the records in a file through the program.
+ * @param program Loaded program, NULL if we are the reader of -r.
+ * @param fp File to read.
+ */
+static void run_file(const vm_program *program, FILE *fp)
+{
+    char *line = NULL;
+    size_t len = 0;
+
+    while (getline(&line, &len, fp) != -1) {
+        run_record(program, line, NULL);
+    }
+    free(line);
+}
+
+/**
+ * Filter all the input files through the program.
+ * @param prog Name of this program.
+ * @param program Loaded program, or NULL when just pushing into Ring.
+ * @param argc Number of input files.
+ * @param argv Input files, standard input if there are none.
+ */
+static void run_files(const char *prog, const vm_program *program,
+                      int argc, char **argv)
+{
+    FILE *fp;
+
+    if (argc > 0) {
+        for (; argc > 0; ++argv, --argc) {
+            fp = fopen(argv[0], "r");
+            if (!fp) {
+                fprintf(stderr, "%s: error - can't open %s\n", prog, argv[0]);
+                exit(1);
+            }
+            run_file(program, fp);
+            fclose(fp);
+        }
+    } else {
+        run_file(program, stdin);
+    }
+}
+
+/**
+ * Filter all the records of the archives given as input files.
+ * @param prog Name of this program.
+ * @param program Loaded program.
+ * @param argc Number of archives, at least one.
+ * @param argv Archives.
+ */
+static void run_columns(const char *prog, const vm_program *program,
+                        int argc, char **argv)
+{
+    run_sink sink = { &Probe, NULL, NULL, NULL };
+    vm_columns *columns;
+
+    for (; argc > 0; ++argv, --argc) {
+        columns = vm_columns_open(argv[0]);
+        if (!columns || !vm_run_columns(run_current(program), columns,
+                                        &Probe, run_exec, &sink)) {
+            fprintf(stderr, "%s: error - can't filter %s\n", prog, argv[0]);
+            exit(1);
+        }
+        vm_columns_destroy(columns);
+    }
+}
+
+/**
+ * Body of a thread of -P: filter chunks, in order, until none is left.
+ * @param opaque Thread.
+ * @returns NULL.
+ */
+static void *run_worker_main(void *opaque)
+{
+    run_worker *worker = opaque;
+    run_pool *pool = worker->pool;
+    const vm_program *program = pool->program;
+    run_sink sink = { &worker->probe, NULL, NULL, NULL };
+    const char *line, *end, *eol, *cr;
+    run_chunk *chunk;
+    unsigned i;
+
+    if (Fired) {
+        sink.fired = vm_alloc((program->exec_count + 7) / 8 + 1);
+    }
+    for (;;) {
+        i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->count) {
+            break;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (i >= pool->written + pool->ahead) {
+            pthread_cond_wait(&pool->space, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        chunk = &pool->chunks[i];
+        sink.output = &chunk->output;
+        end = chunk->data + chunk->len;
+        for (line = chunk->data; line < end; line = eol + 1) {
+            eol = memchr(line, '\n', (size_t) (end - line));
+            if (!eol) {
+                eol = end;
+            }
+            cr = memchr(line, '\r', (size_t) (eol - line));
+            vm_run_line(program, line, (size_t) (((cr) ? cr : eol) - line),
+                        &worker->probe, run_exec, &sink);
+            if (sink.fired) {
+                run_fired(program, &sink);
+            }
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->done = 1;
+        pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(sink.fired);
+    return NULL;
+}
+
+/**
+ * Filter the input files with a pool of threads, and write what they
+ * print in input order.
+ * @param prog Name of this program.
+ * @param program Loaded program.
+ * @param threads Number of threads.
+ * @param argc Number of input files, at least one.
+ * @param argv Input files.
+ * @param stats Counters with a block for each thread, or NULL.
+ * @param traces Traces with a ring for each thread, or NULL.
+ */
+static void run_parallel(const char *prog, const vm_program *program,
+                         unsigned threads, int argc, char **argv,
+                         vm_stats *stats, vm_traces *traces)
+{
+    char **maps = vm_alloc((size_t) argc * sizeof (char *));
+    size_t *sizes = vm_alloc((size_t) argc * sizeof (size_t));
+    size_t total = 0, at, stop;
+    run_worker *workers;
+    run_pool pool;
+    const char *nl;
+    off_t size;
+    unsigned i;
+    int fd, k;
+
+    for (k = 0; k < argc; ++k) {
+        fd = open(argv[k], O_RDONLY);
+        size = (fd == -1) ? -1 : lseek(fd, 0, SEEK_END);
+        if (size == -1) {
+            fprintf(stderr, "%s: error - can't open %s\n", prog, argv[k]);
+            exit(1);
+        }
+        sizes[k] = (size_t) size;
+        if (size > 0) {
+            maps[k] = mmap(NULL, sizes[k], PROT_READ, MAP_PRIVATE, fd, 0);
+            if (maps[k] == MAP_FAILED) {
+                fprintf(stderr, "%s: error - can't map %s\n", prog, argv[k]);
+                exit(1);
+            }
+        }
+        close(fd);
+        total += sizes[k];
+    }
+
+    /* All chunks but the last of each file take at least RUN_CHUNK. */
+    memset(&pool, 0, sizeof (pool));
+    pool.program = program;
+    pool.chunks = vm_alloc((total / RUN_CHUNK + (size_t) argc) *
+                           sizeof (run_chunk));
+    pool.ahead = RUN_CHUNK_AHEAD * threads;
+    for (k = 0; k < argc; ++k) {
+        for (at = 0; at < sizes[k]; at = stop) {
+            stop = at + RUN_CHUNK;
+            if (stop >= sizes[k]) {
+                stop = sizes[k];
+            } else {
+                nl = memchr(maps[k] + stop - 1, '\n', sizes[k] - stop + 1);
+                stop = (nl) ? (size_t) (nl - maps[k]) + 1 : sizes[k];
+            }
+            pool.chunks[pool.count].data = maps[k] + at;
+            pool.chunks[pool.count].len = stop - at;
+            pool.count++;
+        }
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pthread_cond_init(&pool.space, NULL);
+
+    workers = vm_alloc(threads * sizeof (run_worker));
+    for (i = 0; i < threads; ++i) {
+        workers[i].pool = &pool;
+        workers[i].probe.sample = Probe.sample;
+        if (stats) {
+            workers[i].probe.counters = vm_stats_counters(stats, i);
+        }
+        if (traces) {
+            workers[i].probe.trace = vm_traces_ring(traces, i);
+        }
+        if (pthread_create(&workers[i].thread, NULL, run_worker_main,
+                           &workers[i])) {
+            fprintf(stderr, "%s: error - can't start thread\n", prog);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < pool.count; ++i) {
+        run_chunk *chunk = &pool.chunks[i];
+
+        pthread_mutex_lock(&pool.lock);
+        while (!chunk->done) {
+            pthread_cond_wait(&pool.done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        fwrite(chunk->output.data, 1, chunk->output.len, stdout);
+        free(chunk->output.data);
+        pthread_mutex_lock(&pool.lock);
+        pool.written++;
+        pthread_cond_broadcast(&pool.space);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    for (i = 0; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    pthread_cond_destroy(&pool.space);
+    pthread_cond_destroy(&pool.done);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.chunks);
+    for (k = 0; k < argc; ++k) {
+        if (sizes[k] > 0) {
+            munmap(maps[k], sizes[k]);
+        }
+    }
+    free(sizes);
+    free(maps);
+}
+
+/**
+ * Read input in a child process, and filter the records it pushes into
+ * a ring through the program.
+ * @param prog Name of this program.
+ * @param program Loaded program.
+ * @param argc Number of input files.
+ * @param argv Input files, standard input if there are none.
+ */
+static void run_ring(const char *prog, const vm_program *program,
+                     int argc, char **argv)
+{
+    vm_ring *ring = vm_ring_create(RUN_RING_SLOTS);
+    run_sink sink = { &Probe, NULL, NULL, NULL };
+    ucc_input_t input;
+    int status;
+    pid_t pid;
+
+    if (!ring) {
+        exit(1);
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "%s: error - can't fork\n", prog);
+        exit(1);
+    }
+    if (pid == 0) {
+        Ring = ring;
+        run_files(prog, NULL, argc, argv);
+        vm_ring_close(ring);
+        _exit(0);
+    }
+
+    while (vm_ring_pop(ring, &input)) {
+        vm_run(run_current(program), &input, &Probe, run_exec, &sink);
+    }
+    vm_ring_destroy(ring);
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        exit(1);
+    }
+}
+
+/**
+ * Receive records from a UNIX datagram socket, and reply to each of them.
+ * @param prog Name of this program.
+ * @param program Loaded program.
+ * @param path Socket path, which is replaced if it exists.
+ */
+static void run_listen(const char *prog, const vm_program *program,
+                       const char *path)
+{
+    static char records[RUN_BATCH][RUN_DATAGRAM + 1];
+    static run_reply replies[RUN_BATCH];
+    struct sockaddr_un addr, peers[RUN_BATCH];
+    struct mmsghdr in[RUN_BATCH], out[RUN_BATCH];
+    struct iovec iin[RUN_BATCH], iout[RUN_BATCH];
+    unsigned i;
+    int fd, n;
+
+    if (strlen(path) >= sizeof (addr.sun_path)) {
+        fprintf(stderr, "%s: error - socket path too long\n", prog);
+        exit(1);
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof (addr)) == -1) {
+        fprintf(stderr, "%s: error - can't listen on %s\n", prog, path);
+        exit(1);
+    }
+
+    for (;;) {
+        unsigned sent, count = 0;
+
+        memset(in, 0, sizeof (in));
+        for (i = 0; i < RUN_BATCH; ++i) {
+            iin[i].iov_base = records[i];
+            iin[i].iov_len = RUN_DATAGRAM;
+            in[i].msg_hdr.msg_iov = &iin[i];
+            in[i].msg_hdr.msg_iovlen = 1;
+            in[i].msg_hdr.msg_name = &peers[i];
+            in[i].msg_hdr.msg_namelen = sizeof (peers[i]);
+        }
+        n = recvmmsg(fd, in, RUN_BATCH, MSG_WAITFORONE, NULL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: error - can't receive records\n", prog);
+            exit(1);
+        }
+
+        for (i = 0; i < (unsigned) n; ++i) {
+            if (in[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                fprintf(stderr, "%s: record too long\n", prog);
+                continue;
+            }
+            records[i][in[i].msg_len] = '\0';
+            replies[i].len = 0;
+            run_record(program, records[i], &replies[i]);
+        }
+        /* With -m, replies are complete once the workers are done. */
+        if (Shards) {
+            run_shards_drain(Shards);
+        }
+        fflush(stdout);
+
+        memset(out, 0, sizeof (out));
+        for (i = 0; i < (unsigned) n; ++i) {
+            /* Unbound senders can't get a reply. */
+            if ((in[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+                in[i].msg_hdr.msg_namelen <= sizeof (sa_family_t)) {
+                continue;
+            }
+            iout[count].iov_base = replies[i].data;
+            iout[count].iov_len = replies[i].len;
+            out[count].msg_hdr.msg_iov = &iout[count];
+            out[count].msg_hdr.msg_iovlen = 1;
+            out[count].msg_hdr.msg_name = &peers[i];
+            out[count].msg_hdr.msg_namelen = in[i].msg_hdr.msg_namelen;
+            ++count;
+        }
+
+        for (sent = 0; sent < count; ) {
+            n = sendmmsg(fd, out + sent, count - sent, 0);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                /* A sender went away: drop its reply. */
+                ++sent;
+                continue;
+            }
+            sent += (unsigned) n;
+        }
+    }
+}
+
+/**
+ * Parse the count given to an option.
+ * @param arg Option argument.
+ * @param value In output, the count.
+ * @returns Non zero if @a arg is a whole number that fits, zero if not.
+ */
+static int run_count(const char *arg, unsigned *value)
+{
+    unsigned long count;
+    char *end;
+
+    /* strtoul() would take leading blanks and signs. */
+    if (*arg < '0' || *arg > '9') {
+        return 0;
+    }
+    errno = 0;
+    count = strtoul(arg, &end, 10);
+    if (*end != '\0' || errno != 0 || count > UINT_MAX) {
+        return 0;
+    }
+    *value = (unsigned) count;
+    return 1;
+}
+
+/**
+ * @}
+ */
+
+int main(int argc, char ** argv)
+{
+    char * prog = argv[0];
+    vm_plugins *plugins = vm_plugins_create();
+    vm_program *program;
+    const char *listen = NULL, *counters = NULL, *tracefile = NULL;
+    const char *archive = NULL;
+    vm_stats *stats = NULL;
+    vm_traces *traces = NULL;
+    int ring = 0, actions = 0, watch = 0, columns = 0, steal = 0;
+    int bitmap = 0, predicates = 0, tuples = 0, valid = 1;
+    unsigned jobs = 0, queue = RUN_QUEUE, shards = 0, key = 4, threads;
+    unsigned parallel = 0, team = 0, engine;
+    run_policy policy = RUN_SHED_NEWEST;
+    FILE *fp;
+    int ch;
+
+    while ((ch = getopt(argc, argv,
+                        "a:BcEej:k:L:m:np:P:q:rs:S:t:T:u:wx")) != -1) {
+        switch (ch) {
+            case 'a':
+                archive = optarg;
+                break;
+            case 'B':
+                predicates = 1;
+                break;
+            case 'c':
+                columns = 1;
+                break;
+            case 'E':
+                bitmap = 1;
+                break;
+            case 'e':
+                tuples = 1;
+                break;
+            case 'j':
+                valid &= run_count(optarg, &jobs);
+                break;
+            case 'k':
+                for (key = 0; key < VM_REGISTERS; ++key) {
+                    if (strcmp(optarg, RunKeys[key]) == 0) {
+                        break;
+                    }
+                }
+                if (key == VM_REGISTERS) {
+                    fprintf(stderr, "%s: error - unknown field %s\n", prog,
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 'L':
+                valid &= run_count(optarg, &team);
+                break;
+            case 'm':
+                valid &= run_count(optarg, &shards);
+                break;
+            case 'n':
+                DryRun = 1;
+                break;
+            case 'p':
+                if (!vm_plugins_open(plugins, optarg)) {
+                    exit(1);
+                }
+                actions = 1;
+                break;
+            case 'P':
+                valid &= run_count(optarg, &parallel);
+                break;
+            case 'q':
+                valid &= run_count(optarg, &queue);
+                break;
+            case 'r':
+                ring = 1;
+                break;
+            case 's':
+                counters = optarg;
+                break;
+            case 'S':
+                if (strcmp(optarg, "newest") == 0) {
+                    policy = RUN_SHED_NEWEST;
+                } else if (strcmp(optarg, "oldest") == 0) {
+                    policy = RUN_SHED_OLDEST;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    policy = RUN_SHED_SAMPLE;
+                } else {
+                    fprintf(stderr, "%s: error - unknown policy %s\n", prog,
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 't':
+                tracefile = optarg;
+                break;
+            case 'T':
+                valid &= run_count(optarg, &Probe.sample);
+                break;
+            case 'u':
+                listen = optarg;
+                break;
+            case 'w':
+                watch = 1;
+                break;
+            case 'x':
+                steal = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-BcEenrw] [-a archive] "
+                        "[-j jobs [-q queue] [-S policy]] "
+                        "[-L threads] [-m shards [-k field] [-x]] "
+                        "[-P threads] [-p plugin] "
+                        "[-s counters] [-t traces [-T sample]] [-u socket] "
+                        "program [file ...]\n", prog);
+                exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Counts must be whole numbers, that fit. Counters and traces are
+     * laid out after a single program. Archives are mapped, so they
+     * can't be read from standard input. Workers of -m don't switch
+     * programs, and the ring has a single consumer.
+     * Bitmaps are per record, in input order, for one program, and -P
+     * maps input files, and buffers what it prints. Groups of -L run
+     * lines whole, so plugin actions can't read their input. Programs
+     * linked by -w don't get predicates, nor tuples. */
+    if (argc < 1 || !valid || (listen && (argc > 1 || ring)) ||
+        (watch && (counters || tracefile)) || queue == 0 ||
+        (archive && (listen || ring || columns)) ||
+        (columns && (argc < 2 || listen || ring)) ||
+        (shards > 0 && (watch || ring || columns)) ||
+        (bitmap && (listen || ring || columns || watch || shards)) ||
+        (parallel > 0 && (argc < 2 || !(DryRun || bitmap) || listen ||
+                          ring || columns || watch || shards || archive)) ||
+        (team > 0 && (ring || columns || watch || shards || parallel ||
+                      (actions && !DryRun && !bitmap))) ||
+        ((predicates || tuples) && watch)) {
+        fprintf(stderr, "usage: %s [-BcEenrw] [-a archive] "
+                "[-j jobs [-q queue] [-S policy]] "
+                "[-L threads] [-m shards [-k field] [-x]] "
+                "[-P threads] [-p plugin] "
+                "[-s counters] [-t traces [-T sample]] [-u socket] "
+                "program [file ...]\n", prog);
+        exit(1);
+    }
+
+    if (watch) {
+        program = run_watch_start(prog, argv[0],
+                                  (DryRun || bitmap) ? NULL : plugins);
+    } else {
+        fp = fopen(argv[0], "r");
+        if (!fp) {
+            fprintf(stderr, "%s: error - can't open %s\n", prog, argv[0]);
+            exit(1);
+        }
+        program = vm_program_load(fp, (DryRun || bitmap) ? NULL : plugins);
+        fclose(fp);
+        if (!program) {
+            exit(1);
+        }
+        if (predicates) {
+            vm_program_predicates(program);
+        }
+        if (tuples) {
+            vm_program_tuples(program);
+        }
+    }
+    /* With -w, the reader of -r must split fields for any program. */
+    Live = (watch) ? VM_LIVE_ALL : program->live;
+    Lazy = DryRun || bitmap || !actions;
+    if (bitmap) {
+        Fired = vm_alloc((program->exec_count + 7) / 8 + 1);
+    }
+    threads = (shards) ? shards : (parallel) ? parallel : (team) ? team : 1;
+    engine = jobs > 0 && !DryRun && !bitmap;
+    if (team > 0 && program->fused) {
+        fprintf(stderr, "%s: error - can't split a fused program\n", prog);
+        exit(1);
+    }
+    ++argv, --argc;
+
+    if (counters) {
+        stats = vm_stats_create(counters, program, threads + engine);
+        if (!stats) {
+            exit(1);
+        }
+        Probe.counters = vm_stats_counters(stats, 0);
+    }
+    if (tracefile) {
+        traces = vm_traces_create(tracefile, threads, RUN_TRACE_WORDS);
+        if (!traces) {
+            exit(1);
+        }
+        Probe.trace = vm_traces_ring(traces, 0);
+        if (Probe.sample == 0) {
+            Probe.sample = RUN_SAMPLE;
+        }
+    }
+
+    if (engine) {
+        Engine = run_engine_start(prog, jobs, queue, policy, (stats) ?
+                                  vm_stats_counters(stats, threads) +
+                                  program->got_count + program->exec_count :
+                                  NULL, program->exec_count);
+    }
+
+    if (archive) {
+        Archive = vm_columns_create(archive);
+    }
+    if (shards > 0) {
+        Shards = run_shards_start(prog, program, shards, key, steal, stats,
+                                  traces);
+    }
+    if (team > 0) {
+        Team = run_team_start(prog, program, team, stats, traces);
+    }
+
+    if (listen) {
+        run_listen(prog, program, listen);
+    } else if (parallel) {
+        run_parallel(prog, program, parallel, argc, argv, stats, traces);
+    } else if (columns) {
+        run_columns(prog, program, argc, argv);
+    } else if (ring) {
+        run_ring(prog, program, argc, argv);
+    } else {
+        run_files(prog, program, argc, argv);
+    }
+
+    if (Shards) {
+        run_shards_stop(prog, Shards);
+    }
+    if (Team) {
+        run_team_stop(Team);
+    }
+    if (Engine) {
+        run_engine_stop(prog, Engine);
+    }
+    if (Archive && !vm_columns_finish(Archive)) {
+        exit(1);
+    }
+    if (stats) {
+        vm_stats_destroy(stats);
+    }
+    if (traces) {
+        vm_traces_destroy(traces);
+    }
+    if (Watch) {
+        /* The watcher may be compiling: let exit() reclaim everything. */
+        return 0;
+    }
+    free(Fired);
+    vm_program_destroy(program);
+    vm_plugins_destroy(plugins);
+    return 0;
+}
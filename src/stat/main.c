@@ -0,0 +1,202 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file stat/main.c
+ * Hit counters reader main file.
+ */
+
+#include<vm/vm.h>
+#include<unistd.h>
+
+/**
+ * @defgroup stat Hit counters reader
+ * @{
+ *
+ * The program <b>uccstat</b> reads a hit counters file, as written by
+ * <code>ucc-run -s</code> or by any program that uses vm_stats, and
+ * prints, for each function and for each exec, the total number of hits
+ * of all threads, and for each exec how many times its command was shed
+ * rather than executed. If commands were run from a queue, it prints how
+ * many, and the median and 99th percentile of how long they waited in
+ * it, as the power of two of microseconds that bounds them. Then it
+ * lists the functions and the execs that never fired.
+ *
+ * With <code>-i</code>, the counters are printed again every given number
+ * of seconds, together with the rate of hits per second since the last
+ * time, until the program is interrupted or, with <code>-c</code>, for
+ * the given number of times; percentiles are then those of the commands
+ * run since the last time.
+ */
+
+/**
+ * Format the bound of a percentile of the waits.
+ * @param counts Number of commands counted by each wait counter.
+ * @param total Number of commands.
+ * @param percent Percentile.
+ * @param buffer In output, the bound, e.g. "<1024" microseconds.
+ * @param size Size of @a buffer.
+ */
+static void stat_percentile(const unsigned long long *counts,
+                            unsigned long long total, unsigned percent,
+                            char *buffer, size_t size)
+{
+    unsigned long long rank = (total * percent + 99) / 100, seen = 0;
+    unsigned i;
+
+    if (total == 0) {
+        snprintf(buffer, size, "-");
+        return;
+    }
+    for (i = 0; i < VM_STATS_WAITS - 1; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            snprintf(buffer, size, "<%llu", 1ULL << i);
+            return;
+        }
+    }
+    snprintf(buffer, size, ">=%llu", 1ULL << (VM_STATS_WAITS - 2));
+}
+
+/**
+ * Print the counters.
+ * @param stats Counters.
+ * @param last Totals printed last time, updated on return, or NULL.
+ * @param interval Seconds since last time.
+ */
+static void stat_print(const vm_stats *stats, unsigned long long *last,
+                       unsigned interval)
+{
+    unsigned functions = vm_stats_functions(stats);
+    unsigned execs = vm_stats_execs(stats);
+    unsigned count = functions + execs;
+    unsigned waits = count + execs;
+    unsigned long long counts[VM_STATS_WAITS], runs = 0, ever = 0;
+    unsigned i, never = 0;
+    char shed[32], p50[32], p99[32];
+
+    for (i = 0; i < count; ++i) {
+        unsigned long long total = vm_stats_total(stats, i);
+
+        if (i == 0 || i == functions) {
+            printf("%12s %10s %12s  %s\n", "hits", "rate",
+                   (i == 0) ? "" : "shed", (i == 0) ? "function" : "exec");
+        }
+        shed[0] = '\0';
+        if (i >= functions) {
+            snprintf(shed, sizeof (shed), "%llu",
+                     vm_stats_total(stats, i + execs));
+        }
+        if (last) {
+            printf("%12llu %10.1f %12s  %s\n", total,
+                   (double) (total - last[i]) / interval, shed,
+                   stats->names[i]);
+            last[i] = total;
+        } else {
+            printf("%12llu %10s %12s  %s\n", total, "-", shed,
+                   stats->names[i]);
+        }
+        never += (total == 0);
+    }
+
+    for (i = 0; i < VM_STATS_WAITS; ++i) {
+        unsigned long long total = vm_stats_total(stats, waits + i);
+
+        counts[i] = (last) ? total - last[waits + i] : total;
+        runs += counts[i];
+        ever += total;
+        if (last) {
+            last[waits + i] = total;
+        }
+    }
+    if (ever > 0) {
+        stat_percentile(counts, runs, 50, p50, sizeof (p50));
+        stat_percentile(counts, runs, 99, p99, sizeof (p99));
+        printf("%12s %10s %12s  %s\n", "runs", "p50", "p99",
+               "queue wait, microseconds");
+        printf("%12llu %10s %12s\n", runs, p50, p99);
+    }
+
+    if (never > 0) {
+        printf("never fired:\n");
+        for (i = 0; i < count; ++i) {
+            if (vm_stats_total(stats, i) == 0) {
+                printf("    %s\n", stats->names[i]);
+            }
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * @}
+ */
+
+int main(int argc, char ** argv)
+{
+    char * prog = argv[0];
+    unsigned interval = 0, times = 0, count, i;
+    unsigned long long *last;
+    vm_stats *stats;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "c:i:")) != -1) {
+        switch (ch) {
+            case 'c':
+                times = (unsigned) atoi(optarg);
+                break;
+            case 'i':
+                interval = (unsigned) atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i seconds [-c count]] file\n",
+                        prog);
+                exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s [-i seconds [-c count]] file\n", prog);
+        exit(1);
+    }
+
+    stats = vm_stats_open(argv[0]);
+    if (!stats) {
+        exit(1);
+    }
+
+    if (interval == 0) {
+        stat_print(stats, NULL, 0);
+    } else {
+        count = vm_stats_functions(stats) + 2 * vm_stats_execs(stats) +
+                VM_STATS_WAITS;
+        last = vm_alloc(count * sizeof (unsigned long long));
+        for (i = 0; i < count; ++i) {
+            last[i] = vm_stats_total(stats, i);
+        }
+        for (i = 0; times == 0 || i < times; ++i) {
+            sleep(interval);
+            stat_print(stats, last, interval);
+        }
+        free(last);
+    }
+
+    vm_stats_destroy(stats);
+    return 0;
+}
@@ -0,0 +1,171 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file trace/main.c
+ * Execution traces dumper main file.
+ */
+
+#include<vm/vm.h>
+
+/**
+ * @defgroup trace Execution traces dumper
+ * @{
+ *
+ * The program <b>ucctrace</b> reads a traces file, as written by
+ * <code>ucc-run -t</code> or by any program that uses vm_traces, and
+ * prints the sampled records still held by the ring of each thread. For
+ * each record, it prints the instructions that were executed, in order,
+ * with the function that contains them, and the outcome of comparisons.
+ * Since traces hold instruction offsets only, the program that produced
+ * them must be given too.
+ */
+
+/**
+ * Print an instruction with its arguments.
+ * @param program Loaded program.
+ * @param insn Instruction.
+ */
+static void trace_insn(const vm_program *program, const vm_insn *insn)
+{
+    printf("%s", vm_opcode_name(insn->opcode));
+    switch (insn->opcode) {
+        case VM_EXEC:
+            printf(" \"%s\"", insn->string);
+            break;
+        case VM_CALL:
+            printf(" %s", program->got[insn->arg].name);
+            break;
+        case VM_EQ:
+        case VM_MAG:
+        case VM_MIN:
+        case VM_MAEQ:
+        case VM_MIEQ:
+        case VM_NEQ:
+        case VM_MATCH:
+        case VM_INNET:
+            printf(" $%u \"%s\"", insn->reg, insn->string);
+            break;
+        case VM_IEQ:
+        case VM_IMAG:
+        case VM_IMIN:
+        case VM_IMAEQ:
+        case VM_IMIEQ:
+        case VM_INEQ:
+        case VM_IN:
+            printf(" $%u %u", insn->reg, insn->arg);
+            break;
+        case VM_JTRUE:
+        case VM_JFALSE:
+        case VM_JMP:
+            printf(" %u", insn->arg);
+            break;
+        case VM_NOP:
+        case VM_RETURN:
+            break;
+    }
+}
+
+/**
+ * Print the records of a ring.
+ * @param program Loaded program that was traced.
+ * @param thread Thread number.
+ * @param words Words of the ring, from the oldest.
+ * @param count Number of words.
+ */
+static void trace_dump(const vm_program *program, unsigned thread,
+                       const unsigned *words, unsigned count)
+{
+    unsigned i = 0;
+
+    /* The oldest record may have been partly overwritten. */
+    while (i < count && words[i] != VM_TRACE_RECORD) {
+        ++i;
+    }
+
+    while (i + 1 < count) {
+        printf("thread %u record %u\n", thread, words[i + 1]);
+        for (i += 2; i < count && words[i] != VM_TRACE_RECORD; ++i) {
+            unsigned pc = words[i] >> 1;
+            const vm_insn *insn;
+
+            if (pc >= program->code_count) {
+                printf("    invalid offset %u: wrong program?\n", pc);
+                continue;
+            }
+            insn = &program->code[pc];
+            printf("    %-16s %5u  ",
+                   program->got[vm_program_function(program, pc)].name, pc);
+            trace_insn(program, insn);
+            if (insn->opcode >= VM_EQ && insn->opcode <= VM_INNET &&
+                i + 1 < count && words[i + 1] != VM_TRACE_RECORD) {
+                printf("  -> %s", (words[i + 1] & 1) ? "true" : "false");
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @}
+ */
+
+int main(int argc, char ** argv)
+{
+    char * prog = argv[0];
+    vm_program *program;
+    vm_traces *traces;
+    unsigned *words;
+    unsigned i;
+    FILE *fp;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s program traces\n", prog);
+        exit(1);
+    }
+
+    fp = fopen(argv[1], "r");
+    if (!fp) {
+        fprintf(stderr, "%s: error - can't open %s\n", prog, argv[1]);
+        exit(1);
+    }
+    program = vm_program_load(fp, NULL);
+    fclose(fp);
+    if (!program) {
+        exit(1);
+    }
+    if (program->got_count == 0) {
+        fprintf(stderr, "%s: error - program has no functions\n", prog);
+        exit(1);
+    }
+
+    traces = vm_traces_open(argv[2]);
+    if (!traces) {
+        exit(1);
+    }
+
+    for (i = 0; i < vm_traces_threads(traces); ++i) {
+        const vm_trace *trace = vm_traces_ring(traces, i);
+        words = vm_alloc(trace->size * sizeof (unsigned));
+        trace_dump(program, i, words, vm_trace_read(trace, words));
+        free(words);
+    }
+
+    vm_traces_destroy(traces);
+    vm_program_destroy(program);
+    return 0;
+}
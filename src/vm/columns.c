@@ -0,0 +1,441 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/columns.c
+ * Dictionary encoded record archives.
+ */
+
+#include<vm/vm.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+/**
+ * @defgroup vmcolumns Record archives
+ * @ingroup vm
+ * @{
+ * A columns file archives records so that they can be filtered again,
+ * e.g. when rules change, without parsing them again. Each of the
+ * VM_REGISTERS fields is stored as a column, with a dictionary of the
+ * distinct values of the field in the file, and one identifier for each
+ * record, that is the index of its value in the dictionary.
+ *
+ * The file starts with a header, that gives the number of records and
+ * the offsets of the parts of each column: the identifiers, 32 bits
+ * each; the offsets of the entries of the dictionary, one more than
+ * there are entries, relative to the bytes of the dictionary; and the
+ * bytes, in which each entry is followed by a NUL, so that it can be
+ * used in place as a C string. Each part starts on an 8 bytes boundary.
+ *
+ * The reader maps the file and checks the header and the dictionaries,
+ * but not the identifiers, which are checked as they are read: the
+ * columns that a program doesn't read are never touched. The writer
+ * keeps the dictionaries in memory, in a hash table, and spools the
+ * identifiers of each column into a temporary file, since the size of
+ * each column is only known at the end.
+ */
+
+/** Magic string at the beginning of a columns file. */
+#define VM_COLUMNS_MAGIC "ucccols1"
+
+/** Initial number of slots of the hash table of a dictionary. */
+#define VM_COLUMNS_SLOTS 1024
+
+/** Header of a columns file. */
+struct vm_columns_header {
+    /** Magic string, VM_COLUMNS_MAGIC. */
+    char magic[8];
+    /** Number of columns, VM_REGISTERS. */
+    unsigned long long registers;
+    /** Number of records. */
+    unsigned long long records;
+    /** Parts of each column, as offsets from the start of the file. */
+    struct {
+        /** Identifiers, one per record. */
+        unsigned long long ids;
+        /** Offsets of the entries, one more than there are entries. */
+        unsigned long long offsets;
+        /** Bytes of the entries, each followed by a NUL. */
+        unsigned long long bytes;
+        /** Number of entries. */
+        unsigned long long count;
+    } columns[VM_REGISTERS];
+};
+
+/** Dictionary of a column being written. */
+struct vm_columns_dict {
+    /** Hash table of entries, with the identifier plus one, or zero. */
+    unsigned *slots;
+    /** Number of slots, a power of two. */
+    unsigned size;
+    /** Number of entries. */
+    unsigned count;
+    /** Hash value of each entry. */
+    unsigned *hashes;
+    /** Offsets of the entries in bytes, count + 1 of them. */
+    unsigned long long *offsets;
+    /** Number of allocated hashes and offsets. */
+    unsigned capacity;
+    /** Bytes of the entries, each followed by a NUL. */
+    char *bytes;
+    /** Number of allocated bytes. */
+    size_t allocated;
+    /** Identifiers written so far, spooled in a temporary file. */
+    FILE *ids;
+};
+
+/**
+ * Hash bytes (FNV-1a).
+ * @param s Bytes to hash.
+ * @param len Number of bytes.
+ * @returns Hash value.
+ */
+static unsigned vm_columns_hash(const char *s, size_t len)
+{
+    unsigned hashval = 0x811c9dc5;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hashval = (hashval ^ (unsigned char) s[i]) * 0x01000193;
+    }
+    return hashval;
+}
+
+/**
+ * Reallocate memory, exiting if we run out of it.
+ * @param p Memory to reallocate, or NULL.
+ * @param size New size.
+ * @returns The reallocated memory.
+ */
+static void *vm_columns_grow(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * Get the identifier of a value in a dictionary, adding it if it is new.
+ * @param d Dictionary.
+ * @param field Value.
+ * @returns The identifier.
+ */
+static unsigned vm_columns_lookup(struct vm_columns_dict *d,
+                                  const vm_field *field)
+{
+    unsigned hash = vm_columns_hash(field->data, field->len), i, id;
+    unsigned long long at;
+
+    for (i = hash & (d->size - 1); d->slots[i]; i = (i + 1) & (d->size - 1)) {
+        id = d->slots[i] - 1;
+        at = d->offsets[id];
+        if (d->hashes[id] == hash &&
+            d->offsets[id + 1] - at - 1 == field->len &&
+            memcmp(d->bytes + at, field->data, field->len) == 0) {
+            return id;
+        }
+    }
+
+    id = d->count++;
+    if (d->count + 1 > d->capacity) {
+        d->capacity *= 2;
+        d->hashes = vm_columns_grow(d->hashes, d->capacity *
+                                    sizeof (unsigned));
+        d->offsets = vm_columns_grow(d->offsets, d->capacity *
+                                     sizeof (unsigned long long));
+    }
+    at = d->offsets[id];
+    while (at + field->len + 1 > d->allocated) {
+        d->allocated *= 2;
+        d->bytes = vm_columns_grow(d->bytes, d->allocated);
+    }
+    memcpy(d->bytes + at, field->data, field->len);
+    d->bytes[at + field->len] = '\0';
+    d->hashes[id] = hash;
+    d->offsets[id + 1] = at + field->len + 1;
+    d->slots[i] = id + 1;
+
+    /* Keep the table at most half full. */
+    if (2 * d->count > d->size) {
+        free(d->slots);
+        d->size *= 2;
+        d->slots = vm_alloc(d->size * sizeof (unsigned));
+        for (id = 0; id < d->count; ++id) {
+            for (i = d->hashes[id] & (d->size - 1); d->slots[i];
+                 i = (i + 1) & (d->size - 1))
+                ;
+            d->slots[i] = id + 1;
+        }
+    }
+    return d->count - 1;
+}
+
+/**
+ * Write bytes at the current offset of a file, padding them to 8 bytes.
+ * @param fd File.
+ * @param data Bytes to write.
+ * @param len Number of bytes.
+ * @param offset In input and output, the offset.
+ * @returns Non zero on success.
+ */
+static int vm_columns_put(int fd, const void *data, size_t len,
+                          unsigned long long *offset)
+{
+    static const char zeros[8];
+    size_t pad = (8 - len % 8) % 8;
+
+    if ((len > 0 && pwrite(fd, data, len, (off_t) *offset) != (ssize_t) len) ||
+        (pad > 0 && pwrite(fd, zeros, pad, (off_t) (*offset + len)) !=
+                    (ssize_t) pad)) {
+        return 0;
+    }
+    *offset += len + pad;
+    return 1;
+}
+
+/**
+ * Check that a part of a columns file is inside it.
+ * @param columns Mapped file.
+ * @param offset Offset of the part.
+ * @param count Number of elements.
+ * @param size Size of an element.
+ * @returns Non zero if the part is inside the file.
+ */
+static int vm_columns_inside(const vm_columns *columns,
+                             unsigned long long offset,
+                             unsigned long long count, size_t size)
+{
+    return offset <= columns->size && offset % 8 == 0 &&
+           count <= (columns->size - offset) / size;
+}
+
+/**
+ * @}
+ */
+
+vm_columns_writer *vm_columns_create(const char *path)
+{
+    vm_columns_writer *w = vm_alloc(sizeof (vm_columns_writer));
+    unsigned i;
+
+    w->path = vm_alloc(strlen(path) + 1);
+    strcpy(w->path, path);
+    w->dicts = vm_alloc(VM_REGISTERS * sizeof (struct vm_columns_dict));
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        struct vm_columns_dict *d = &w->dicts[i];
+
+        d->size = VM_COLUMNS_SLOTS;
+        d->slots = vm_alloc(d->size * sizeof (unsigned));
+        d->capacity = VM_COLUMNS_SLOTS;
+        d->hashes = vm_alloc(d->capacity * sizeof (unsigned));
+        d->offsets = vm_alloc(d->capacity * sizeof (unsigned long long));
+        d->allocated = VM_COLUMNS_SLOTS;
+        d->bytes = vm_alloc(d->allocated);
+        d->ids = tmpfile();
+        if (!d->ids) {
+            fprintf(stderr, "vm: can't create columns file %s\n", path);
+            w->failed = 1;
+        }
+    }
+    return w;
+}
+
+void vm_columns_add(vm_columns_writer *w, const vm_field *fields)
+{
+    static const vm_field empty = { "", 0 };
+    unsigned i, id;
+
+    for (i = 0; i < VM_REGISTERS && !w->failed; ++i) {
+        id = vm_columns_lookup(&w->dicts[i], (fields[i].data) ? &fields[i]
+                                                               : &empty);
+        if (fwrite(&id, sizeof (id), 1, w->dicts[i].ids) != 1) {
+            w->failed = 1;
+        }
+    }
+    w->records++;
+}
+
+int vm_columns_finish(vm_columns_writer *w)
+{
+    struct vm_columns_header header;
+    unsigned long long offset;
+    unsigned ids[1024], i;
+    size_t n;
+    int fd = -1, ok = !w->failed;
+
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, VM_COLUMNS_MAGIC, sizeof (header.magic));
+    header.registers = VM_REGISTERS;
+    header.records = w->records;
+
+    if (ok) {
+        fd = open(w->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = fd != -1;
+    }
+    offset = sizeof (header);
+    for (i = 0; i < VM_REGISTERS && ok; ++i) {
+        struct vm_columns_dict *d = &w->dicts[i];
+        unsigned long long at = offset;
+
+        /* Copy the spooled identifiers, then pad them. */
+        header.columns[i].ids = offset;
+        rewind(d->ids);
+        while (ok && (n = fread(ids, sizeof (unsigned), 1024, d->ids)) > 0) {
+            ok = pwrite(fd, ids, n * sizeof (unsigned), (off_t) at) ==
+                 (ssize_t) (n * sizeof (unsigned));
+            at += n * sizeof (unsigned);
+        }
+        ok = ok && !ferror(d->ids);
+        if (ok && at % 8 != 0) {
+            ok = pwrite(fd, "\0\0\0\0", 4, (off_t) at) == 4;
+            at += 4;
+        }
+        offset = at;
+
+        header.columns[i].count = d->count;
+        header.columns[i].offsets = offset;
+        ok = ok && vm_columns_put(fd, d->offsets, (d->count + 1) *
+                                  sizeof (unsigned long long), &offset);
+        header.columns[i].bytes = offset;
+        ok = ok && vm_columns_put(fd, d->bytes, d->offsets[d->count],
+                                  &offset);
+    }
+    ok = ok && pwrite(fd, &header, sizeof (header), 0) == sizeof (header);
+    if (fd != -1 && close(fd) == -1) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "vm: can't write columns file %s\n", w->path);
+    }
+
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        if (w->dicts[i].ids) {
+            fclose(w->dicts[i].ids);
+        }
+        free(w->dicts[i].slots);
+        free(w->dicts[i].hashes);
+        free(w->dicts[i].offsets);
+        free(w->dicts[i].bytes);
+    }
+    free(w->dicts);
+    free(w->path);
+    free(w);
+    return ok;
+}
+
+vm_columns *vm_columns_open(const char *path)
+{
+    const struct vm_columns_header *header;
+    vm_columns *columns;
+    struct stat st;
+    unsigned i;
+    int fd, ok;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "vm: can't open columns file %s\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof (*header)) {
+        close(fd);
+        fprintf(stderr, "vm: invalid columns file %s\n", path);
+        return NULL;
+    }
+    header = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "vm: can't map columns file %s\n", path);
+        return NULL;
+    }
+
+    columns = vm_alloc(sizeof (vm_columns));
+    columns->header = header;
+    columns->size = (size_t) st.st_size;
+    ok = memcmp(header->magic, VM_COLUMNS_MAGIC, sizeof (header->magic)) == 0 &&
+         header->registers == VM_REGISTERS;
+    for (i = 0; i < VM_REGISTERS && ok; ++i) {
+        const unsigned long long *offsets;
+        const char *bytes;
+        unsigned long long count = header->columns[i].count, k;
+
+        ok = count <= UINT_MAX &&
+             (count > 0 || header->records == 0) &&
+             vm_columns_inside(columns, header->columns[i].ids,
+                               header->records, sizeof (unsigned)) &&
+             vm_columns_inside(columns, header->columns[i].offsets,
+                               count + 1, sizeof (unsigned long long)) &&
+             vm_columns_inside(columns, header->columns[i].bytes, 0, 1);
+        if (!ok) {
+            break;
+        }
+
+        /* Entries must be in order, inside the file, and NUL terminated. */
+        offsets = (const unsigned long long *)
+                  ((const char *) header + header->columns[i].offsets);
+        bytes = (const char *) header + header->columns[i].bytes;
+        ok = offsets[0] == 0 &&
+             offsets[count] <= columns->size - header->columns[i].bytes;
+        for (k = 0; k < count && ok; ++k) {
+            ok = offsets[k] < offsets[k + 1] &&
+                 bytes[offsets[k + 1] - 1] == '\0';
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "vm: invalid columns file %s\n", path);
+        vm_columns_destroy(columns);
+        return NULL;
+    }
+    return columns;
+}
+
+void vm_columns_destroy(vm_columns *columns)
+{
+    munmap((void *) columns->header, columns->size);
+    free(columns);
+}
+
+unsigned long long vm_columns_records(const vm_columns *columns)
+{
+    return columns->header->records;
+}
+
+unsigned vm_columns_count(const vm_columns *columns, unsigned reg)
+{
+    return (unsigned) columns->header->columns[reg].count;
+}
+
+const unsigned *vm_columns_ids(const vm_columns *columns, unsigned reg)
+{
+    return (const unsigned *) ((const char *) columns->header +
+                               columns->header->columns[reg].ids);
+}
+
+void vm_columns_entry(const vm_columns *columns, unsigned reg, unsigned id,
+                      vm_field *field)
+{
+    const unsigned long long *offsets = (const unsigned long long *)
+        ((const char *) columns->header + columns->header->columns[reg].offsets);
+
+    field->data = (const char *) columns->header +
+                  columns->header->columns[reg].bytes + offsets[id];
+    field->len = (size_t) (offsets[id + 1] - offsets[id] - 1);
+}
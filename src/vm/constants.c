@@ -0,0 +1,299 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/constants.c
+ * Interned constants shared among programs.
+ */
+
+#include<vm/vm.h>
+#include<stddef.h>
+
+/**
+ * @defgroup vmconst Shared constants
+ * @ingroup vm
+ * @{
+ * Programs loaded with the same vm_constants share the strings of their
+ * instructions, the names of their functions and the sets of their
+ * constant pools: each distinct string and each distinct set is stored
+ * once, with a count of the references that programs hold to it, and is
+ * freed when the last program that references it is destroyed. Hence,
+ * many programs that share most of their rules cost their instructions,
+ * plus the constants that only they use.
+ *
+ * Strings are kept in a hash table, chained. Each string is preceded by
+ * its header, so that an instruction references the bytes directly, and
+ * releasing a string finds its header by pointer arithmetic. Since the
+ * strings of a set are interned first, two sets are equal if they have
+ * the same string pointers, once sorted: sets are kept in another hash
+ * table, keyed by those pointers, together with their perfect hash.
+ *
+ * Interning is not thread safe: loading and destroying programs that
+ * share constants must be serialized, while running them needs not.
+ */
+
+/** Header of an interned constant, chained in a hash table. */
+typedef struct vm_constant {
+    /** Next constant in the same bucket. */
+    struct vm_constant *next;
+    /** Number of references. */
+    unsigned refs;
+    /** Hash value. */
+    unsigned hash;
+} vm_constant;
+
+/** Interned string, followed by its bytes and by a NUL. */
+typedef struct vm_atom {
+    /** Header. */
+    vm_constant c;
+    /** Length, NUL excluded. */
+    size_t len;
+    /** String bytes. */
+    char string[];
+} vm_atom;
+
+/** Interned set. */
+typedef struct vm_shared_set {
+    /** Header. */
+    vm_constant c;
+    /** Interned strings of the set, sorted, holding one reference each. */
+    char **strings;
+    /** Set, with its perfect hash, which is what programs reference. */
+    vm_set set;
+} vm_shared_set;
+
+/** Initial number of buckets of each hash table. */
+#define VM_CONSTANTS_SIZE 256
+
+/**
+ * Hash bytes (FNV-1a).
+ * @param s Bytes to hash.
+ * @param len Number of bytes.
+ * @returns Hash value.
+ */
+static unsigned vm_constants_hash(const void *s, size_t len)
+{
+    const unsigned char *p = s;
+    unsigned hashval = 0x811c9dc5;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hashval = (hashval ^ p[i]) * 0x01000193;
+    }
+    return hashval;
+}
+
+/**
+ * Add a constant to a hash table, doubling its buckets if it is full.
+ * @param table In input and output, the buckets.
+ * @param size In input and output, the number of buckets, a power of two.
+ * @param count In input and output, the number of constants.
+ * @param c Constant to add.
+ */
+static void vm_constants_link(vm_constant ***table, unsigned *size,
+                              unsigned *count, vm_constant *c)
+{
+    unsigned i;
+
+    if (*count >= *size) {
+        vm_constant **buckets = vm_alloc(2 * *size * sizeof (vm_constant *));
+        for (i = 0; i < *size; ++i) {
+            vm_constant *e = (*table)[i], *next;
+            for (; (e); e = next) {
+                next = e->next;
+                e->next = buckets[e->hash & (2 * *size - 1)];
+                buckets[e->hash & (2 * *size - 1)] = e;
+            }
+        }
+        free(*table);
+        *table = buckets;
+        *size *= 2;
+    }
+    c->next = (*table)[c->hash & (*size - 1)];
+    (*table)[c->hash & (*size - 1)] = c;
+    (*count)++;
+}
+
+/**
+ * Remove a constant from a hash table.
+ * @param table Buckets.
+ * @param size Number of buckets.
+ * @param count In input and output, the number of constants.
+ * @param c Constant to remove.
+ */
+static void vm_constants_unlink(vm_constant **table, unsigned size,
+                                unsigned *count, vm_constant *c)
+{
+    vm_constant **p = &table[c->hash & (size - 1)];
+
+    while (*p != c) {
+        p = &(*p)->next;
+    }
+    *p = c->next;
+    (*count)--;
+}
+
+/**
+ * Compare two strings referenced by a vector, for qsort().
+ * @param a Pointer to first string.
+ * @param b Pointer to second string.
+ * @returns Less than, equal to or greater than zero, like strcmp().
+ */
+static int vm_constants_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * @}
+ */
+
+vm_constants *vm_constants_create(void)
+{
+    vm_constants *constants = vm_alloc(sizeof (vm_constants));
+
+    constants->string_size = constants->set_size = VM_CONSTANTS_SIZE;
+    constants->strings = vm_alloc(VM_CONSTANTS_SIZE * sizeof (void *));
+    constants->sets = vm_alloc(VM_CONSTANTS_SIZE * sizeof (void *));
+    return constants;
+}
+
+void vm_constants_destroy(vm_constants *constants)
+{
+    free(constants->strings);
+    free(constants->sets);
+    free(constants);
+}
+
+char *vm_constants_intern(vm_constants *constants, const char *string,
+                          size_t len)
+{
+    unsigned hash = vm_constants_hash(string, len);
+    vm_constant *c;
+    vm_atom *atom;
+
+    for (c = constants->strings[hash & (constants->string_size - 1)]; (c);
+         c = c->next) {
+        atom = (vm_atom *) c;
+        if (c->hash == hash && atom->len == len &&
+            memcmp(atom->string, string, len) == 0) {
+            c->refs++;
+            return atom->string;
+        }
+    }
+
+    atom = vm_alloc(sizeof (vm_atom) + len + 1);
+    atom->c.refs = 1;
+    atom->c.hash = hash;
+    atom->len = len;
+    memcpy(atom->string, string, len);
+    vm_constants_link(&constants->strings, &constants->string_size,
+                      &constants->string_count, &atom->c);
+    constants->bytes += sizeof (vm_atom) + len + 1;
+    return atom->string;
+}
+
+void vm_constants_release(vm_constants *constants, const char *string)
+{
+    vm_atom *atom = (vm_atom *) (string - offsetof(vm_atom, string));
+
+    if (--atom->c.refs > 0) {
+        return;
+    }
+    vm_constants_unlink(constants->strings, constants->string_size,
+                        &constants->string_count, &atom->c);
+    constants->bytes -= sizeof (vm_atom) + atom->len + 1;
+    free(atom);
+}
+
+char *vm_constants_retain(char *string)
+{
+    vm_atom *atom = (vm_atom *) (string - offsetof(vm_atom, string));
+
+    atom->c.refs++;
+    return string;
+}
+
+vm_set *vm_constants_set(vm_constants *constants, char **strings,
+                         unsigned count)
+{
+    vm_shared_set *s;
+    vm_constant *c;
+    unsigned hash, i;
+
+    qsort(strings, count, sizeof (char *), vm_constants_compare);
+    hash = vm_constants_hash(strings, count * sizeof (char *));
+
+    for (c = constants->sets[hash & (constants->set_size - 1)]; (c);
+         c = c->next) {
+        s = (vm_shared_set *) c;
+        if (c->hash == hash && s->set.count == count &&
+            memcmp(s->strings, strings, count * sizeof (char *)) == 0) {
+            /* The set already holds references to the strings. */
+            for (i = 0; i < count; ++i) {
+                vm_constants_release(constants, strings[i]);
+            }
+            c->refs++;
+            return &s->set;
+        }
+    }
+
+    s = vm_alloc(sizeof (vm_shared_set));
+    s->c.refs = 1;
+    s->c.hash = hash;
+    s->strings = vm_alloc(count * sizeof (char *));
+    memcpy(s->strings, strings, count * sizeof (char *));
+    s->set.count = count;
+    s->set.table = vm_alloc(count * sizeof (char *));
+    memcpy(s->set.table, strings, count * sizeof (char *));
+    vm_set_build(&s->set);
+    vm_constants_link(&constants->sets, &constants->set_size,
+                      &constants->set_count, &s->c);
+    constants->bytes += sizeof (vm_shared_set) +
+                        count * (2 * sizeof (char *) + sizeof (int));
+    return &s->set;
+}
+
+void vm_constants_release_set(vm_constants *constants, vm_set *set)
+{
+    vm_shared_set *s = (vm_shared_set *) ((char *) set -
+                                          offsetof(vm_shared_set, set));
+    unsigned i;
+
+    if (--s->c.refs > 0) {
+        return;
+    }
+    vm_constants_unlink(constants->sets, constants->set_size,
+                        &constants->set_count, &s->c);
+    for (i = 0; i < set->count; ++i) {
+        vm_constants_release(constants, s->strings[i]);
+    }
+    constants->bytes -= sizeof (vm_shared_set) +
+                        set->count * (2 * sizeof (char *) + sizeof (int));
+    free(s->strings);
+    free(set->table);
+    free(set->displacements);
+    free(s);
+}
+
+vm_set *vm_constants_retain_set(vm_set *set)
+{
+    vm_shared_set *s = (vm_shared_set *) ((char *) set -
+                                          offsetof(vm_shared_set, set));
+
+    s->c.refs++;
+    return set;
+}
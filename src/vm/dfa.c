@@ -0,0 +1,471 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/dfa.c
+ * Combined DFA for pattern matching.
+ */
+
+#include<vm/vm.h>
+
+/**
+ * @defgroup vmdfa Pattern matching
+ * @ingroup vm
+ * @{
+ * Patterns are globs that must match the whole field: <code>*</code>
+ * matches any sequence, <code>?</code> matches any character,
+ * <code>[...]</code> matches a character class (<code>[!...]</code> is
+ * its complement, ranges are allowed) and a backslash quotes the next
+ * character.
+ *
+ * All the patterns tested against the same register are compiled into
+ * a single DFA, using the subset construction. Each NFA state is a pair
+ * (pattern, position), where position is the number of glob elements
+ * matched so far; therefore a DFA state is a set of such pairs, which we
+ * represent as a bit vector. Each DFA state carries a bit vector of the
+ * patterns that accept when input ends in that state.
+ *
+ * To keep the transition table small, bytes that no character class can
+ * tell apart are merged into the same byte class, so that the table has
+ * one column per byte class rather than 256 columns.
+ *
+ * State zero is the dead state: once there, no pattern may match, and
+ * vm_dfa_scan() stops reading the field.
+ */
+
+/** Maximum number of DFA states for a register. */
+#define VM_DFA_MAX_STATES 65536
+
+/** Element of a glob pattern. */
+typedef struct vm_glob_elem {
+    /** Non zero for a star, which matches any sequence. */
+    int star;
+    /** Characters matched by this element, if it is not a star. */
+    unsigned char set[32];
+} vm_glob_elem;
+
+/** Parsed glob pattern. */
+typedef struct vm_glob {
+    /** Pattern elements. */
+    vm_glob_elem *elems;
+    /** Number of elements. */
+    unsigned count;
+    /** Number of the NFA state for position zero of this pattern. */
+    unsigned base;
+} vm_glob;
+
+/** DFA under construction. */
+typedef struct vm_dfa_builder {
+    /** Parsed patterns. */
+    vm_glob *globs;
+    /** Number of patterns. */
+    unsigned nglobs;
+    /** Number of NFA states. */
+    unsigned nstates;
+    /** Pattern that owns each NFA state. */
+    unsigned *owner;
+    /** Number of words of an NFA state set. */
+    unsigned words;
+    /** NFA state sets, one for each DFA state. */
+    unsigned long *sets;
+    /** Size of sets vector, in DFA states. */
+    unsigned size;
+    /** Hash table that maps a NFA state set to a DFA state plus one. */
+    unsigned *hash;
+    /** Size of hash table, which is a power of two. */
+    unsigned hash_size;
+} vm_dfa_builder;
+
+/**
+ * Parse a glob pattern.
+ * @param pattern Pattern to parse.
+ * @param glob In output, parsed pattern.
+ * @returns Non zero on success.
+ */
+static int vm_glob_parse(const char *pattern, vm_glob *glob)
+{
+    const unsigned char *p = (const unsigned char *) pattern;
+    unsigned c;
+
+    glob->elems = vm_alloc((strlen(pattern) + 1) * sizeof (vm_glob_elem));
+    glob->count = 0;
+
+    while (*p != '\0') {
+        vm_glob_elem *e = &glob->elems[glob->count];
+        memset(e, 0, sizeof (*e));
+
+        if (*p == '*') {
+            /* Consecutive stars are the same as a single star. */
+            if (glob->count == 0 || !e[-1].star) {
+                e->star = 1;
+                glob->count++;
+            }
+            ++p;
+            continue;
+        }
+
+        if (*p == '?') {
+            memset(e->set, 0xff, sizeof (e->set));
+            ++p;
+        } else if (*p == '[') {
+            int negate = 0;
+            ++p;
+            if (*p == '!' || *p == '^') {
+                negate = 1, ++p;
+            }
+            /* A closing bracket right after the opening is a literal. */
+            do {
+                unsigned lo, hi;
+                if (*p == '\0') {
+                    free(glob->elems);
+                    return 0;
+                }
+                lo = hi = *p++;
+                if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+                    hi = p[1];
+                    p += 2;
+                }
+                for (c = lo; c <= hi; ++c) {
+                    e->set[c / 8] |= 1 << (c % 8);
+                }
+            } while (*p != ']');
+            ++p;
+            if (negate) {
+                for (c = 0; c < sizeof (e->set); ++c) {
+                    e->set[c] = ~e->set[c];
+                }
+            }
+        } else {
+            if (*p == '\\' && p[1] != '\0') {
+                ++p;
+            }
+            e->set[*p / 8] |= 1 << (*p % 8);
+            ++p;
+        }
+        glob->count++;
+    }
+    return 1;
+}
+
+/**
+ * Add an NFA state to a set, following the empty transitions of stars.
+ * @param set NFA state set.
+ * @param glob Pattern.
+ * @param pos Position in pattern.
+ */
+static void vm_dfa_closure(unsigned long *set, const vm_glob *glob,
+                           unsigned pos)
+{
+    vm_bit_set(set, glob->base + pos);
+    while (pos < glob->count && glob->elems[pos].star) {
+        vm_bit_set(set, glob->base + ++pos);
+    }
+}
+
+/**
+ * Hash a NFA state set.
+ * @param set NFA state set.
+ * @param words Number of words in @a set.
+ * @returns Hash value.
+ */
+static unsigned vm_dfa_hash(const unsigned long *set, unsigned words)
+{
+    unsigned long hashval = 0;
+    unsigned i;
+
+    for (i = 0; i < words; ++i) {
+        hashval = (hashval ^ set[i]) * 0x100000001b3UL;
+    }
+    return (unsigned) (hashval ^ (hashval >> 32));
+}
+
+/**
+ * Look up a NFA state set, adding a new DFA state if it is not there.
+ * @param b DFA builder.
+ * @param set NFA state set.
+ * @param count In input and output, number of DFA states.
+ * @returns The DFA state, or VM_DFA_MAX_STATES if there are too many.
+ */
+static unsigned vm_dfa_state(vm_dfa_builder *b, const unsigned long *set,
+                             unsigned *count)
+{
+    unsigned mask = b->hash_size - 1, slot, i;
+    size_t bytes = b->words * sizeof (unsigned long);
+
+    for (slot = vm_dfa_hash(set, b->words) & mask; b->hash[slot];
+         slot = (slot + 1) & mask)
+    {
+        unsigned state = b->hash[slot] - 1;
+        if (memcmp(&b->sets[state * b->words], set, bytes) == 0) {
+            return state;
+        }
+    }
+
+    if (*count >= VM_DFA_MAX_STATES) {
+        return VM_DFA_MAX_STATES;
+    }
+    if (*count >= b->size) {
+        b->size *= 2;
+        b->sets = realloc(b->sets, b->size * bytes);
+        if (!b->sets) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(&b->sets[*count * b->words], set, bytes);
+    b->hash[slot] = ++(*count);
+
+    /* Keep the hash table at most half full. */
+    if (2 * *count > b->hash_size) {
+        free(b->hash);
+        b->hash_size *= 2;
+        b->hash = vm_alloc(b->hash_size * sizeof (unsigned));
+        mask = b->hash_size - 1;
+        for (i = 0; i < *count; ++i) {
+            slot = vm_dfa_hash(&b->sets[i * b->words], b->words) & mask;
+            while (b->hash[slot]) {
+                slot = (slot + 1) & mask;
+            }
+            b->hash[slot] = i + 1;
+        }
+    }
+    return *count - 1;
+}
+
+/**
+ * Compute byte classes, so that bytes in the same class are matched by
+ * the same glob elements.
+ * @param b DFA builder.
+ * @param dfa DFA whose classmap and nclasses are filled.
+ */
+static void vm_dfa_classes(const vm_dfa_builder *b, vm_dfa *dfa)
+{
+    unsigned p, i, c, n;
+
+    memset(dfa->classmap, 0, sizeof (dfa->classmap));
+    dfa->nclasses = 1;
+
+    for (p = 0; p < b->nglobs; ++p) {
+        for (i = 0; i < b->globs[p].count; ++i) {
+            const vm_glob_elem *e = &b->globs[p].elems[i];
+            unsigned short renumber[512];
+
+            if (e->star) {
+                continue;
+            }
+            /* Split each class in bytes inside and outside the set. */
+            memset(renumber, 0xff, sizeof (renumber));
+            for (c = 0, n = 0; c < 256; ++c) {
+                unsigned key = 2 * dfa->classmap[c] +
+                               ((e->set[c / 8] >> (c % 8)) & 1);
+                if (renumber[key] == 0xffff) {
+                    renumber[key] = n++;
+                }
+                dfa->classmap[c] = renumber[key];
+            }
+            dfa->nclasses = n;
+        }
+    }
+}
+
+/**
+ * Build the DFA for the patterns tested against a register.
+ * @param dfa DFA to build.
+ * @param patterns Patterns, indexed by their pattern number.
+ * @param count Number of patterns.
+ * @returns Non zero on success.
+ */
+static int vm_dfa_build_register(vm_dfa *dfa, char **patterns, unsigned count)
+{
+    vm_dfa_builder b;
+    unsigned long *next;
+    unsigned representative[256];
+    unsigned nstates, state, cls, p, w, c, trans_size;
+    int ok = 1;
+
+    memset(&b, 0, sizeof (b));
+    b.globs = vm_alloc(count * sizeof (vm_glob));
+    b.nglobs = count;
+    for (p = 0; p < count; ++p) {
+        if (!vm_glob_parse(patterns[p], &b.globs[p])) {
+            fprintf(stderr, "vm: invalid pattern \"%s\"\n", patterns[p]);
+            while (p-- > 0) {
+                free(b.globs[p].elems);
+            }
+            free(b.globs);
+            return 0;
+        }
+        b.globs[p].base = b.nstates;
+        b.nstates += b.globs[p].count + 1;
+    }
+    b.owner = vm_alloc(b.nstates * sizeof (unsigned));
+    for (p = 0; p < count; ++p) {
+        for (w = 0; w <= b.globs[p].count; ++w) {
+            b.owner[b.globs[p].base + w] = p;
+        }
+    }
+    b.words = VM_WORDS(b.nstates);
+    b.size = 64;
+    b.sets = vm_alloc(b.size * b.words * sizeof (unsigned long));
+    b.hash_size = 128;
+    b.hash = vm_alloc(b.hash_size * sizeof (unsigned));
+    next = vm_alloc(b.words * sizeof (unsigned long));
+
+    vm_dfa_classes(&b, dfa);
+    for (c = 256; c-- > 0; ) {
+        representative[dfa->classmap[c]] = c;
+    }
+
+    /* State zero is the dead state, state one is the start state. */
+    nstates = 0;
+    vm_dfa_state(&b, next, &nstates);
+    for (p = 0; p < count; ++p) {
+        vm_dfa_closure(next, &b.globs[p], 0);
+    }
+    vm_dfa_state(&b, next, &nstates);
+
+    trans_size = 0;
+    dfa->trans = NULL;
+    for (state = 0; state < nstates && ok; ++state) {
+        for (cls = 0; cls < dfa->nclasses; ++cls) {
+            unsigned target;
+
+            c = representative[cls];
+            memset(next, 0, b.words * sizeof (unsigned long));
+            for (w = 0; w < b.words; ++w) {
+                unsigned long bits = b.sets[state * b.words + w];
+                while (bits) {
+                    unsigned nfa = w * VM_BITS + __builtin_ctzl(bits);
+                    const vm_glob *g = &b.globs[b.owner[nfa]];
+                    const vm_glob_elem *e = &g->elems[nfa - g->base];
+
+                    bits &= bits - 1;
+                    if (nfa - g->base == g->count) {
+                        continue;
+                    }
+                    if (e->star) {
+                        vm_dfa_closure(next, g, nfa - g->base);
+                    } else if ((e->set[c / 8] >> (c % 8)) & 1) {
+                        vm_dfa_closure(next, g, nfa - g->base + 1);
+                    }
+                }
+            }
+            target = vm_dfa_state(&b, next, &nstates);
+            if (target == VM_DFA_MAX_STATES) {
+                fprintf(stderr, "vm: too many DFA states\n");
+                ok = 0;
+                break;
+            }
+            if (nstates > trans_size) {
+                trans_size = 2 * nstates;
+                dfa->trans = realloc(dfa->trans, trans_size * dfa->nclasses *
+                                                 sizeof (unsigned));
+                if (!dfa->trans) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            dfa->trans[state * dfa->nclasses + cls] = target;
+        }
+    }
+
+    if (ok) {
+        dfa->nstates = nstates;
+        dfa->words = VM_WORDS(count);
+        dfa->accepts = vm_alloc(nstates * dfa->words * sizeof (unsigned long));
+        for (state = 0; state < nstates; ++state) {
+            for (p = 0; p < count; ++p) {
+                const vm_glob *g = &b.globs[p];
+                if (vm_bit_test(&b.sets[state * b.words], g->base + g->count)) {
+                    vm_bit_set(&dfa->accepts[state * dfa->words], p);
+                }
+            }
+        }
+    } else {
+        free(dfa->trans);
+        dfa->trans = NULL;
+    }
+
+    for (p = 0; p < count; ++p) {
+        free(b.globs[p].elems);
+    }
+    free(b.globs);
+    free(b.owner);
+    free(b.sets);
+    free(b.hash);
+    free(next);
+    return ok;
+}
+
+/**
+ * @}
+ */
+
+int vm_dfa_build(vm_program *program)
+{
+    unsigned reg, i, j;
+
+    for (reg = 0; reg < VM_REGISTERS; ++reg) {
+        char **patterns = NULL;
+        unsigned count = 0;
+        int ok;
+
+        /* Number the distinct patterns tested against this register. */
+        for (i = 0; i < program->code_count; ++i) {
+            vm_insn *insn = &program->code[i];
+            if (insn->opcode != VM_MATCH || insn->reg != reg) {
+                continue;
+            }
+            for (j = 0; j < count; ++j) {
+                if (strcmp(patterns[j], insn->string) == 0) {
+                    break;
+                }
+            }
+            if (j == count) {
+                patterns = realloc(patterns, (count + 1) * sizeof (char *));
+                if (!patterns) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+                patterns[count++] = insn->string;
+            }
+            insn->arg = j;
+        }
+
+        if (count == 0) {
+            continue;
+        }
+        ok = vm_dfa_build_register(&program->dfa[reg], patterns, count);
+        free(patterns);
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const unsigned long *vm_dfa_scan(const vm_dfa *dfa, const char *string,
+                                 size_t len)
+{
+    const unsigned char *s = (const unsigned char *) string;
+    const unsigned char *end = s + len;
+    unsigned state = 1;
+
+    for (; s < end && state != 0; ++s) {
+        state = dfa->trans[state * dfa->nclasses + dfa->classmap[*s]];
+    }
+    return &dfa->accepts[state * dfa->words];
+}
@@ -0,0 +1,1050 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/loader.c
+ * Program loader.
+ */
+
+#define _GNU_SOURCE
+#include<vm/vm.h>
+#include<ctype.h>
+#include<errno.h>
+#include<limits.h>
+
+/**
+ * @defgroup vmloader Program loader
+ * @ingroup vm
+ * @{
+ * The loader reads the program one line at a time. A line that begins
+ * with a dot switches section, while other lines are interpreted
+ * according to the current section. Both compiler and optimizer output
+ * are accepted, because they only differ in whitespace.
+ *
+ * Vectors grow by doubling their size, as they do in the compiler. At the
+ * end, we check that all jump targets, function entry points and pool
+ * indices reference something that exists, so that vm_run() may trust
+ * the program and avoid bound checking.
+ *
+ * Programs loaded into the same constants may be linked into one, e.g.
+ * one for each source file, so that changing a file only requires to
+ * compile and load that file again, and to link. Linking copies the
+ * vectors, relocating locations, calls and pool indices, and takes new
+ * references to the constants; then, the DFA and the trie are built for
+ * the whole program, as they are by the loader.
+ */
+
+/** Sections of a program. */
+typedef enum vm_section {
+    /** No section seen yet. */
+    VM_SECT_NONE,
+    /** Global offset table. */
+    VM_SECT_GOT,
+    /** Constant pool. */
+    VM_SECT_POOL,
+    /** Code. */
+    VM_SECT_CODE
+} vm_section;
+
+/** Kind of arguments taken by an instruction. */
+typedef enum vm_args {
+    /** No arguments. */
+    VM_ARGS_NONE,
+    /** A string. */
+    VM_ARGS_STRING,
+    /** A function name. */
+    VM_ARGS_FUNCTION,
+    /** A register and a string. */
+    VM_ARGS_REG_STRING,
+    /** A register and a number. */
+    VM_ARGS_REG_NUMBER,
+    /** A register and a constant pool entry. */
+    VM_ARGS_REG_POOL,
+    /** A location. */
+    VM_ARGS_LOCATION
+} vm_args;
+
+/** Description of an instruction. */
+typedef struct vm_insn_info {
+    /** Instruction name. */
+    const char *name;
+    /** Instruction opcode. */
+    vm_opcode opcode;
+    /** Kind of arguments. */
+    vm_args args;
+} vm_insn_info;
+
+/** Instruction set. */
+static const vm_insn_info VmInsnInfo[] = {
+    { "VM_NOP", VM_NOP, VM_ARGS_NONE },
+    { "VM_EXEC", VM_EXEC, VM_ARGS_STRING },
+    { "VM_CALL", VM_CALL, VM_ARGS_FUNCTION },
+    { "VM_EQ", VM_EQ, VM_ARGS_REG_STRING },
+    { "VM_MAG", VM_MAG, VM_ARGS_REG_STRING },
+    { "VM_MIN", VM_MIN, VM_ARGS_REG_STRING },
+    { "VM_MAEQ", VM_MAEQ, VM_ARGS_REG_STRING },
+    { "VM_MIEQ", VM_MIEQ, VM_ARGS_REG_STRING },
+    { "VM_NEQ", VM_NEQ, VM_ARGS_REG_STRING },
+    { "VM_IEQ", VM_IEQ, VM_ARGS_REG_NUMBER },
+    { "VM_IMAG", VM_IMAG, VM_ARGS_REG_NUMBER },
+    { "VM_IMIN", VM_IMIN, VM_ARGS_REG_NUMBER },
+    { "VM_IMAEQ", VM_IMAEQ, VM_ARGS_REG_NUMBER },
+    { "VM_IMIEQ", VM_IMIEQ, VM_ARGS_REG_NUMBER },
+    { "VM_INEQ", VM_INEQ, VM_ARGS_REG_NUMBER },
+    { "VM_IN", VM_IN, VM_ARGS_REG_POOL },
+    { "VM_MATCH", VM_MATCH, VM_ARGS_REG_STRING },
+    { "VM_INNET", VM_INNET, VM_ARGS_REG_STRING },
+    { "VM_JTRUE", VM_JTRUE, VM_ARGS_LOCATION },
+    { "VM_JFALSE", VM_JFALSE, VM_ARGS_LOCATION },
+    { "VM_JMP", VM_JMP, VM_ARGS_LOCATION },
+    { "VM_RETURN", VM_RETURN, VM_ARGS_NONE },
+    { NULL, VM_NOP, VM_ARGS_NONE }
+};
+
+/** Loader state. */
+typedef struct vm_loader {
+    /** Program being loaded. */
+    vm_program *program;
+    /** Current section. */
+    vm_section section;
+    /** Current line number, for error messages. */
+    unsigned lineno;
+    /** Size of got vector. */
+    unsigned got_size;
+    /** Size of pool vector. */
+    unsigned pool_size;
+    /** Size of code vector. */
+    unsigned code_size;
+    /** Hash table of functions by name: index in got plus one, or zero. */
+    unsigned *functions;
+    /** Size of functions table, which is a power of two. */
+    unsigned functions_size;
+} vm_loader;
+
+/**
+ * Grow a vector, if needed, so that it may contain one more element.
+ * @param base Vector.
+ * @param count Number of elements in vector.
+ * @param size In input and output, size of vector.
+ * @param elem Size of an element.
+ * @returns The vector, possibly moved.
+ */
+static void *vm_loader_grow(void *base, unsigned count, unsigned *size,
+                            size_t elem)
+{
+    if (count < *size) {
+        return base;
+    }
+    *size = (*size) ? 2 * (*size) : 16;
+    base = realloc(base, *size * elem);
+    if (!base) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset((char *) base + count * elem, 0, (*size - count) * elem);
+    return base;
+}
+
+/**
+ * Extract next token from a line. A token is either a quoted string,
+ * quotes included, or a sequence of non blank characters.
+ * @param cursor In input and output, current position in line.
+ * @returns The token, or NULL at end of line.
+ */
+static char *vm_loader_token(char **cursor)
+{
+    char *p = *cursor, *token;
+
+    while (isspace((unsigned char) *p)) {
+        ++p;
+    }
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    token = p;
+    if (*p == '"') {
+        p = strchr(p + 1, '"');
+        if (!p) {
+            return NULL;
+        }
+        ++p;
+    } else {
+        while (*p != '\0' && !isspace((unsigned char) *p)) {
+            ++p;
+        }
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return token;
+}
+
+/**
+ * Parse an unsigned number.
+ * @param token Token to parse.
+ * @param value In output, the number.
+ * @returns Non zero on success.
+ */
+static int vm_loader_number(const char *token, unsigned *value)
+{
+    unsigned long number;
+    char *end;
+
+    if (!token || !isdigit((unsigned char) *token)) {
+        return 0;
+    }
+    errno = 0;
+    number = strtoul(token, &end, 10);
+    if (errno == ERANGE || number > UINT_MAX) {
+        return 0;
+    }
+    *value = (unsigned) number;
+    return *end == '\0';
+}
+
+/**
+ * Parse a register name.
+ * @param token Token to parse.
+ * @param reg In output, register number.
+ * @returns Non zero on success.
+ */
+static int vm_loader_register(const char *token, unsigned *reg)
+{
+    if (!token || token[0] != '$' || !vm_loader_number(token + 1, reg)) {
+        return 0;
+    }
+    return *reg < VM_REGISTERS;
+}
+
+/**
+ * Parse a quoted string.
+ * @param constants Constants to intern the string into.
+ * @param token Token to parse.
+ * @returns The interned string, without quotes, or NULL on error.
+ */
+static char *vm_loader_string(vm_constants *constants, const char *token)
+{
+    size_t len;
+
+    if (!token || token[0] != '"') {
+        return NULL;
+    }
+    len = strlen(token);
+    if (len < 2 || token[len - 1] != '"') {
+        return NULL;
+    }
+    return vm_constants_intern(constants, token + 1, len - 2);
+}
+
+/**
+ * Hash a function name (FNV-1a).
+ * @param name Function name.
+ * @returns Hash value.
+ */
+static unsigned vm_loader_hash(const char *name)
+{
+    const unsigned char *p = (const unsigned char *) name;
+    unsigned hash = 0x811c9dc5;
+
+    for (; *p != '\0'; ++p) {
+        hash = (hash ^ *p) * 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Find a function in the global offset table by name.
+ * @param l Loader state.
+ * @param name Function name.
+ * @returns Slot of the function in the hash table, or of the empty slot
+ *          where it would go.
+ */
+static unsigned vm_loader_function(const vm_loader *l, const char *name)
+{
+    unsigned mask = l->functions_size - 1, slot;
+
+    for (slot = vm_loader_hash(name) & mask; l->functions[slot];
+         slot = (slot + 1) & mask) {
+        if (strcmp(l->program->got[l->functions[slot] - 1].name,
+                   name) == 0) {
+            break;
+        }
+    }
+    return slot;
+}
+
+/**
+ * Parse a line in the global offset table.
+ * @param l Loader state.
+ * @param cursor Line contents.
+ * @returns Non zero on success.
+ */
+static int vm_loader_got(vm_loader *l, char *cursor)
+{
+    vm_program *p = l->program;
+    char *name = vm_loader_token(&cursor), *token;
+    unsigned start;
+    unsigned i;
+    int local = 0;
+
+    if (!name || !vm_loader_number(vm_loader_token(&cursor), &start)) {
+        return 0;
+    }
+    token = vm_loader_token(&cursor);
+    if (token) {
+        if (strcmp(token, "static") != 0 || vm_loader_token(&cursor)) {
+            return 0;
+        }
+        local = 1;
+    }
+    p->got = vm_loader_grow(p->got, p->got_count, &l->got_size,
+                            sizeof (vm_function));
+    p->got[p->got_count].name = vm_constants_intern(p->constants, name,
+                                                    strlen(name));
+    p->got[p->got_count].start = start;
+    p->got[p->got_count].local = local;
+    p->got_count++;
+
+    /* Keep the table of names at most half full. */
+    if (2 * p->got_count > l->functions_size) {
+        free(l->functions);
+        l->functions_size = (l->functions_size) ? 2 * l->functions_size : 64;
+        l->functions = vm_alloc(l->functions_size * sizeof (unsigned));
+        for (i = 0; i + 1 < p->got_count; ++i) {
+            l->functions[vm_loader_function(l, p->got[i].name)] = i + 1;
+        }
+    }
+    i = vm_loader_function(l, p->got[p->got_count - 1].name);
+    if (l->functions[i]) {
+        fprintf(stderr, "vm: function %s defined twice\n", name);
+        return 0;
+    }
+    l->functions[i] = p->got_count;
+    return 1;
+}
+
+/**
+ * Compare two strings referenced by a vector, for qsort().
+ * @param a Pointer to first string.
+ * @param b Pointer to second string.
+ * @returns Less than, equal to or greater than zero, like strcmp().
+ */
+static int vm_loader_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Compare two pointers referenced by a vector, for qsort().
+ * @param a Pointer to first pointer.
+ * @param b Pointer to second pointer.
+ * @returns Less than, equal to or greater than zero.
+ */
+static int vm_loader_compare_pointers(const void *a, const void *b)
+{
+    const char *p = *(char * const *) a, *q = *(char * const *) b;
+
+    return (p > q) - (p < q);
+}
+
+/**
+ * Parse a line in the constant pool.
+ * @param l Loader state.
+ * @param cursor Line contents.
+ * @returns Non zero on success.
+ */
+static int vm_loader_pool(vm_loader *l, char *cursor)
+{
+    vm_program *p = l->program;
+    unsigned index, size = 0, count = 0, i;
+    char *token, *string, **strings = NULL;
+    int ok = 1;
+
+    if (!vm_loader_number(vm_loader_token(&cursor), &index) ||
+        index != p->pool_count)
+    {
+        return 0;
+    }
+    while ((token = vm_loader_token(&cursor))) {
+        string = vm_loader_string(p->constants, token);
+        if (!string) {
+            ok = 0;
+            break;
+        }
+        strings = vm_loader_grow(strings, count, &size, sizeof (char *));
+        strings[count++] = string;
+    }
+
+    /* Perfect hashing requires distinct strings: since they are
+     * interned, equal strings are equal pointers. */
+    if (ok && count > 0) {
+        qsort(strings, count, sizeof (char *), vm_loader_compare);
+        for (i = 1; i < count && strings[i - 1] != strings[i]; ++i)
+            ;
+        ok = i >= count;
+    } else {
+        ok = 0;
+    }
+    if (!ok) {
+        for (i = 0; i < count; ++i) {
+            vm_constants_release(p->constants, strings[i]);
+        }
+        free(strings);
+        return 0;
+    }
+
+    p->pool = vm_loader_grow(p->pool, p->pool_count, &l->pool_size,
+                             sizeof (vm_set *));
+    p->pool[p->pool_count++] = vm_constants_set(p->constants, strings, count);
+    free(strings);
+    return 1;
+}
+
+/**
+ * Parse a line in the code.
+ * @param l Loader state.
+ * @param cursor Line contents.
+ * @returns Non zero on success.
+ */
+static int vm_loader_code(vm_loader *l, char *cursor)
+{
+    vm_program *p = l->program;
+    const vm_insn_info *info;
+    unsigned offset;
+    char *token;
+    vm_insn *insn;
+
+    if (!vm_loader_number(vm_loader_token(&cursor), &offset) ||
+        offset != p->code_count)
+    {
+        return 0;
+    }
+    token = vm_loader_token(&cursor);
+    if (!token) {
+        return 0;
+    }
+    for (info = VmInsnInfo; info->name; ++info) {
+        if (strcmp(info->name, token) == 0) {
+            break;
+        }
+    }
+    if (!info->name) {
+        return 0;
+    }
+
+    p->code = vm_loader_grow(p->code, p->code_count, &l->code_size,
+                             sizeof (vm_insn));
+    insn = &p->code[p->code_count++];
+    insn->opcode = info->opcode;
+
+    switch (info->args) {
+        case VM_ARGS_NONE:
+            break;
+        case VM_ARGS_STRING:
+            insn->string = vm_loader_string(p->constants,
+                                            vm_loader_token(&cursor));
+            if (!insn->string) {
+                return 0;
+            }
+            if (insn->opcode == VM_EXEC) {
+                insn->reg = p->exec_count++;
+            }
+            break;
+        case VM_ARGS_FUNCTION:
+            /* The global offset table always precedes the code. */
+            token = vm_loader_token(&cursor);
+            if (!token || p->got_count == 0) {
+                return 0;
+            }
+            insn->arg = l->functions[vm_loader_function(l, token)];
+            if (insn->arg == 0) {
+                return 0;
+            }
+            insn->arg--;
+            break;
+        case VM_ARGS_REG_STRING:
+            if (!vm_loader_register(vm_loader_token(&cursor), &insn->reg)) {
+                return 0;
+            }
+            insn->string = vm_loader_string(p->constants,
+                                            vm_loader_token(&cursor));
+            if (!insn->string) {
+                return 0;
+            }
+            insn->arg = (unsigned) strlen(insn->string);
+            p->live |= 1U << insn->reg;
+            break;
+        case VM_ARGS_REG_NUMBER:
+        case VM_ARGS_REG_POOL:
+            if (!vm_loader_register(vm_loader_token(&cursor), &insn->reg) ||
+                !vm_loader_number(vm_loader_token(&cursor), &insn->arg))
+            {
+                return 0;
+            }
+            p->live |= 1U << insn->reg;
+            break;
+        case VM_ARGS_LOCATION:
+            if (!vm_loader_number(vm_loader_token(&cursor), &insn->arg)) {
+                return 0;
+            }
+            break;
+    }
+
+    return vm_loader_token(&cursor) == NULL;
+}
+
+/**
+ * Find the function that contains each instruction, e.g. of a fused
+ * program. The code of each function starts at its entry point and ends
+ * at the next one.
+ * @param p Loaded program, whose entry points have already been checked.
+ * @param owners In output, the function of each instruction.
+ */
+static void vm_loader_owners(const vm_program *p, unsigned *owners)
+{
+    unsigned f, pc, owner = 0;
+
+    for (pc = 0; pc < p->code_count; ++pc) {
+        owners[pc] = UINT_MAX;
+    }
+    for (f = p->got_count; f-- > 0;) {
+        owners[p->got[f].start] = f;
+    }
+    for (pc = 0; pc < p->code_count; ++pc) {
+        if (owners[pc] != UINT_MAX) {
+            owner = owners[pc];
+        }
+        owners[pc] = owner;
+    }
+}
+
+/**
+ * Visit the call graph depth first, looking for cycles.
+ * @param p Loaded program.
+ * @param f Function to visit.
+ * @param first For each function, offset of its callees in @a calls; the
+ *        callees of the last function end at @a first[p->got_count].
+ * @param calls Callees of all functions.
+ * @param state For each function: zero if not visited yet, one if being
+ *        visited, two if visited.
+ * @returns Non zero if no cycle is reachable from @a f.
+ */
+static int vm_loader_visit(const vm_program *p, unsigned f,
+                           const unsigned *first, const unsigned *calls,
+                           unsigned char *state)
+{
+    unsigned i;
+
+    state[f] = 1;
+    for (i = first[f]; i < first[f + 1]; ++i) {
+        if (state[calls[i]] == 1) {
+            fprintf(stderr, "vm: function %s: recursive call to %s\n",
+                    p->got[f].name, p->got[calls[i]].name);
+            return 0;
+        }
+        if (state[calls[i]] == 0 &&
+            !vm_loader_visit(p, calls[i], first, calls, state)) {
+            return 0;
+        }
+    }
+    state[f] = 2;
+    return 1;
+}
+
+/**
+ * Check that no function calls itself, directly or not. Since code is
+ * not split into functions, the callees of a function are the VM_CALL
+ * instructions reachable from its entry point. In a fused program, the
+ * code of a non static function is only followed up to the entry of the
+ * next one, which can't be called and so can't be part of a cycle.
+ * @param p Loaded program, whose locations have already been checked.
+ * @returns Non zero if the call graph is acyclic.
+ */
+static int vm_loader_check_calls(const vm_program *p)
+{
+    unsigned *mark = vm_alloc(p->code_count * sizeof (unsigned));
+    unsigned *todo = vm_alloc(p->code_count * sizeof (unsigned));
+    unsigned *first = vm_alloc((p->got_count + 1) * sizeof (unsigned));
+    unsigned char *state = vm_alloc(p->got_count);
+    unsigned *calls = NULL, ncalls = 0, size = 0, f, i;
+    int ok = 1;
+
+    for (f = 0; f < p->got_count; ++f) {
+        unsigned ntodo = 0;
+
+        first[f] = ncalls;
+        mark[p->got[f].start] = f + 1;
+        todo[ntodo++] = p->got[f].start;
+        while (ntodo > 0) {
+            unsigned pc = todo[--ntodo], next[2], n = 0;
+            const vm_insn *insn = &p->code[pc];
+
+            switch (insn->opcode) {
+                case VM_RETURN:
+                    break;
+                case VM_JMP:
+                    next[n++] = insn->arg;
+                    break;
+                case VM_JTRUE:
+                case VM_JFALSE:
+                    next[n++] = insn->arg;
+                    next[n++] = pc + 1;
+                    break;
+                case VM_CALL:
+                    calls = vm_loader_grow(calls, ncalls, &size,
+                                           sizeof (unsigned));
+                    calls[ncalls++] = insn->arg;
+                    next[n++] = pc + 1;
+                    break;
+                default:
+                    next[n++] = pc + 1;
+                    break;
+            }
+            for (i = 0; i < n; ++i) {
+                if (p->owner && !p->got[f].local && next[i] < p->code_count &&
+                    p->owner[next[i]] != f &&
+                    p->got[p->owner[next[i]]].start == next[i] &&
+                    !p->got[p->owner[next[i]]].local) {
+                    continue;
+                }
+                if (next[i] < p->code_count && mark[next[i]] != f + 1) {
+                    mark[next[i]] = f + 1;
+                    todo[ntodo++] = next[i];
+                }
+            }
+        }
+    }
+    first[p->got_count] = ncalls;
+
+    for (f = 0; f < p->got_count && ok; ++f) {
+        if (state[f] == 0) {
+            ok = vm_loader_visit(p, f, first, calls, state);
+        }
+    }
+
+    free(calls);
+    free(state);
+    free(first);
+    free(todo);
+    free(mark);
+    return ok;
+}
+
+/**
+ * Check that a loaded program references existing code and pool entries
+ * and, if it is fused, record the function of each instruction.
+ * @param p Loaded program.
+ * @returns Non zero if the program is consistent.
+ */
+static int vm_loader_check(vm_program *p)
+{
+    unsigned i;
+
+    if (p->code_count == 0) {
+        fprintf(stderr, "vm: program has no code\n");
+        return 0;
+    }
+    if (p->code[p->code_count - 1].opcode != VM_RETURN &&
+        p->code[p->code_count - 1].opcode != VM_JMP)
+    {
+        fprintf(stderr, "vm: code does not end with VM_RETURN\n");
+        return 0;
+    }
+    for (i = 0; i < p->got_count; ++i) {
+        if (p->got[i].start >= p->code_count) {
+            fprintf(stderr, "vm: function %s: invalid entry point %u\n",
+                    p->got[i].name, p->got[i].start);
+            return 0;
+        }
+    }
+    if (p->fused) {
+        p->owner = vm_alloc(p->code_count * sizeof (unsigned));
+        vm_loader_owners(p, p->owner);
+    }
+    for (i = 0; i < p->code_count; ++i) {
+        const vm_insn *insn = &p->code[i];
+        switch (insn->opcode) {
+            case VM_JTRUE:
+            case VM_JFALSE:
+            case VM_JMP:
+                if (insn->arg >= p->code_count) {
+                    fprintf(stderr, "vm: %u: invalid location %u\n", i,
+                            insn->arg);
+                    return 0;
+                }
+                break;
+            case VM_CALL:
+                if (p->fused && !p->got[insn->arg].local) {
+                    fprintf(stderr, "vm: %u: call to fused function %s\n",
+                            i, p->got[insn->arg].name);
+                    return 0;
+                }
+                break;
+            case VM_IN:
+                if (insn->arg >= p->pool_count) {
+                    fprintf(stderr, "vm: %u: invalid pool entry %u\n", i,
+                            insn->arg);
+                    return 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return vm_loader_check_calls(p);
+}
+
+/**
+ * Load a program.
+ * @param fp File containing compiler or optimizer output.
+ * @param plugins Plugins, or NULL.
+ * @param constants Constants to intern strings and sets into.
+ * @param shared Non zero if @a constants are shared with other programs,
+ *        zero if they belong to the program.
+ * @returns The loaded program, or NULL on error.
+ */
+static vm_program *vm_loader_load(FILE *fp, const vm_plugins *plugins,
+                                  vm_constants *constants, int shared)
+{
+    vm_loader loader;
+    char *line = NULL;
+    size_t len = 0;
+
+    memset(&loader, 0, sizeof (loader));
+    loader.program = vm_alloc(sizeof (vm_program));
+    loader.program->constants = constants;
+    loader.program->shared = shared;
+
+    while (getline(&line, &len, fp) != -1) {
+        char *cursor = line, *token;
+        int ok = 1;
+
+        loader.lineno++;
+        while (isspace((unsigned char) *cursor)) {
+            ++cursor;
+        }
+        if (*cursor == '\0') {
+            continue;
+        }
+
+        if (*cursor == '.') {
+            token = vm_loader_token(&cursor);
+            if (strcmp(token, ".got") == 0) {
+                loader.section = VM_SECT_GOT;
+                while (ok && (token = vm_loader_token(&cursor))) {
+                    if (strcmp(token, "first") == 0 &&
+                        !loader.program->first) {
+                        loader.program->first = 1;
+                    } else if (strcmp(token, "fused") == 0 &&
+                               !loader.program->fused) {
+                        loader.program->fused = 1;
+                    } else {
+                        ok = 0;
+                    }
+                }
+            } else if (strcmp(token, ".pool") == 0) {
+                loader.section = VM_SECT_POOL;
+            } else if (strcmp(token, ".code") == 0) {
+                loader.section = VM_SECT_CODE;
+            } else {
+                ok = 0;
+            }
+        } else {
+            switch (loader.section) {
+                case VM_SECT_NONE:
+                    ok = 0;
+                    break;
+                case VM_SECT_GOT:
+                    ok = vm_loader_got(&loader, cursor);
+                    break;
+                case VM_SECT_POOL:
+                    ok = vm_loader_pool(&loader, cursor);
+                    break;
+                case VM_SECT_CODE:
+                    ok = vm_loader_code(&loader, cursor);
+                    break;
+            }
+        }
+
+        if (!ok) {
+            fprintf(stderr, "vm: syntax error at line %u\n", loader.lineno);
+            free(line);
+            free(loader.functions);
+            vm_program_destroy(loader.program);
+            return NULL;
+        }
+    }
+    free(line);
+    free(loader.functions);
+
+    if (!vm_loader_check(loader.program) || !vm_dfa_build(loader.program) ||
+        !vm_trie_build(loader.program) ||
+        (plugins && !vm_plugins_resolve(loader.program, plugins)))
+    {
+        vm_program_destroy(loader.program);
+        return NULL;
+    }
+    return loader.program;
+}
+
+/**
+ * @}
+ */
+
+unsigned vm_program_function(const vm_program *program, unsigned pc)
+{
+    unsigned i, owner = 0;
+
+    if (program->owner) {
+        return program->owner[pc];
+    }
+
+    for (i = 1; i < program->got_count; ++i) {
+        if (program->got[i].start <= pc &&
+            (program->got[owner].start > pc ||
+             program->got[i].start > program->got[owner].start)) {
+            owner = i;
+        }
+    }
+    return owner;
+}
+
+void vm_program_partition(const vm_program *program, unsigned groups,
+                          unsigned *bounds)
+{
+    unsigned *owners, *costs, f, g, pc;
+    unsigned long long total = 0, sum = 0;
+
+    costs = vm_alloc((program->got_count + 1) * sizeof (unsigned));
+    if (program->got_count > 0) {
+        owners = vm_alloc(program->code_count * sizeof (unsigned));
+        vm_loader_owners(program, owners);
+        for (pc = 0; pc < program->code_count; ++pc) {
+            costs[owners[pc]]++;
+        }
+        /* Static functions run as part of their callers. */
+        for (pc = 0; pc < program->code_count; ++pc) {
+            if (program->code[pc].opcode == VM_CALL &&
+                program->got[program->code[pc].arg].local &&
+                !program->got[owners[pc]].local) {
+                costs[owners[pc]] += costs[program->code[pc].arg];
+            }
+        }
+        free(owners);
+    }
+    for (f = 0; f < program->got_count; ++f) {
+        if (!program->got[f].local) {
+            total += costs[f];
+        }
+    }
+
+    /* Cut where the running cost reaches each multiple of the share. */
+    bounds[0] = 0;
+    for (f = 0, g = 1; g < groups; ++g) {
+        while (f < program->got_count && sum * groups < total * g) {
+            if (!program->got[f].local) {
+                sum += costs[f];
+            }
+            ++f;
+        }
+        bounds[g] = f;
+    }
+    bounds[groups] = program->got_count;
+    free(costs);
+}
+
+const char *vm_opcode_name(vm_opcode opcode)
+{
+    const vm_insn_info *info;
+
+    for (info = VmInsnInfo; info->name; ++info) {
+        if (info->opcode == opcode) {
+            break;
+        }
+    }
+    return (info->name) ? info->name : "VM_UNKNOWN";
+}
+
+vm_program *vm_program_load(FILE *fp, const vm_plugins *plugins)
+{
+    return vm_loader_load(fp, plugins, vm_constants_create(), 0);
+}
+
+vm_program *vm_program_load_shared(FILE *fp, const vm_plugins *plugins,
+                                   vm_constants *constants)
+{
+    return vm_loader_load(fp, plugins, constants, 1);
+}
+
+vm_program *vm_program_link(vm_program *const *programs, unsigned count,
+                            vm_constants *constants)
+{
+    vm_program *p = vm_alloc(sizeof (vm_program));
+    unsigned i, j, got = 0, pool = 0, code = 0, exec = 0;
+    char **names;
+
+    p->constants = constants;
+    p->shared = 1;
+    for (i = 0; i < count; ++i) {
+        if (programs[i]->constants != constants) {
+            fprintf(stderr, "vm: can't link programs with private "
+                    "constants\n");
+            free(p);
+            return NULL;
+        }
+        if (programs[i]->fused) {
+            fprintf(stderr, "vm: can't link fused programs\n");
+            free(p);
+            return NULL;
+        }
+        if (i > 0 && programs[i]->first != programs[0]->first) {
+            fprintf(stderr, "vm: can't link programs with and without "
+                    "first match\n");
+            free(p);
+            return NULL;
+        }
+        p->got_count += programs[i]->got_count;
+        p->pool_count += programs[i]->pool_count;
+        p->code_count += programs[i]->code_count;
+        p->exec_count += programs[i]->exec_count;
+        p->live |= programs[i]->live;
+    }
+    p->first = count > 0 && programs[0]->first;
+
+    /* Function names are interned: equal names are equal pointers. */
+    names = vm_alloc((p->got_count + 1) * sizeof (char *));
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < programs[i]->got_count; ++j) {
+            names[got++] = programs[i]->got[j].name;
+        }
+    }
+    qsort(names, got, sizeof (char *), vm_loader_compare_pointers);
+    for (i = 1; i < got; ++i) {
+        if (names[i - 1] == names[i]) {
+            fprintf(stderr, "vm: function %s defined twice\n", names[i]);
+            free(names);
+            free(p);
+            return NULL;
+        }
+    }
+    free(names);
+
+    p->got = vm_alloc((p->got_count + 1) * sizeof (vm_function));
+    p->pool = vm_alloc((p->pool_count + 1) * sizeof (vm_set *));
+    p->code = vm_alloc((p->code_count + 1) * sizeof (vm_insn));
+    for (got = 0, i = 0; i < count; ++i) {
+        const vm_program *q = programs[i];
+
+        for (j = 0; j < q->got_count; ++j) {
+            p->got[got + j] = q->got[j];
+            p->got[got + j].name = vm_constants_retain(q->got[j].name);
+            p->got[got + j].start += code;
+        }
+        for (j = 0; j < q->pool_count; ++j) {
+            p->pool[pool + j] = vm_constants_retain_set(q->pool[j]);
+        }
+        for (j = 0; j < q->code_count; ++j) {
+            vm_insn *insn = &p->code[code + j];
+
+            *insn = q->code[j];
+            if (insn->string) {
+                vm_constants_retain(insn->string);
+            }
+            switch (insn->opcode) {
+                case VM_EXEC:
+                    insn->reg += exec;
+                    break;
+                case VM_CALL:
+                    insn->arg += got;
+                    break;
+                case VM_IN:
+                    insn->arg += pool;
+                    break;
+                case VM_JTRUE:
+                case VM_JFALSE:
+                case VM_JMP:
+                    insn->arg += code;
+                    break;
+                default:
+                    break;
+            }
+        }
+        got += q->got_count;
+        pool += q->pool_count;
+        code += q->code_count;
+        exec += q->exec_count;
+    }
+
+    if (!vm_dfa_build(p) || !vm_trie_build(p)) {
+        vm_program_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+void vm_program_destroy(vm_program *program)
+{
+    vm_constants *constants = program->constants;
+    int shared = program->shared;
+    unsigned i;
+
+    for (i = 0; i < program->got_count; ++i) {
+        vm_constants_release(constants, program->got[i].name);
+    }
+    for (i = 0; i < program->pool_count; ++i) {
+        vm_constants_release_set(constants, program->pool[i]);
+    }
+    for (i = 0; i < program->code_count; ++i) {
+        if (program->code[i].string) {
+            vm_constants_release(constants, program->code[i].string);
+        }
+    }
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        free(program->dfa[i].trans);
+        free(program->dfa[i].accepts);
+    }
+    free(program->trie.nodes);
+    free(program->trie.matches);
+    free(program->got);
+    free(program->pool);
+    free(program->code);
+    free(program->owner);
+    if (program->predicates) {
+        for (i = 0; i < VM_REGISTERS; ++i) {
+            free(program->predicates->strings[i].slots);
+            free(program->predicates->numbers[i].slots);
+        }
+        free(program->predicates->predicates);
+        free(program->predicates->tests);
+        free(program->predicates->others);
+        free(program->predicates);
+    }
+    if (program->tuples) {
+        for (i = 0; i < program->tuples->shape_count; ++i) {
+            free(program->tuples->shapes[i].slots);
+        }
+        free(program->tuples->tuples);
+        free(program->tuples->shapes);
+        free(program->tuples->classified);
+        free(program->tuples);
+    }
+    free(program);
+    if (!shared) {
+        vm_constants_destroy(constants);
+    }
+}
@@ -0,0 +1,149 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/plugin.c
+ * In process exec actions.
+ */
+
+#include<vm/vm.h>
+#include<ctype.h>
+#include<dlfcn.h>
+
+/**
+ * @defgroup vmplugin Plugin actions
+ * @ingroup vm
+ * @{
+ * A command written as <code>plugin:name args</code> is not run with the
+ * shell: the loader looks up the symbol <code>ucc_plugin_name</code> in
+ * the shared objects opened with vm_plugins_open(), in the order in which
+ * they were opened, and stores the resulting function pointer into the
+ * instruction. Then, each <code>VM_EXEC</code> of that instruction is a
+ * plain function call, which receives the input record and the rest of
+ * the command line, without the blanks that separate it from the name.
+ *
+ * An action that can't be resolved is an error, so that a typo doesn't
+ * turn into a shell command at run time.
+ */
+
+/** Prefix of the symbol exported by plugins for each action. */
+#define VM_PLUGIN_SYMBOL "ucc_plugin_"
+
+/**
+ * Look up an action in the opened plugins.
+ * @param plugins Opened plugins.
+ * @param name Action name.
+ * @param len Action name length.
+ * @returns The action, or NULL if no plugin exports it.
+ */
+static vm_plugin_action vm_plugins_lookup(const vm_plugins *plugins,
+                                          const char *name, size_t len)
+{
+    char symbol[128];
+    unsigned i;
+
+    if (len >= sizeof (symbol) - sizeof (VM_PLUGIN_SYMBOL)) {
+        return NULL;
+    }
+    strcpy(symbol, VM_PLUGIN_SYMBOL);
+    strncat(symbol, name, len);
+
+    for (i = 0; i < plugins->count; ++i) {
+        void *sym = dlsym(plugins->handles[i], symbol);
+        if (sym) {
+            return (vm_plugin_action) sym;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @}
+ */
+
+vm_plugins *vm_plugins_create(void)
+{
+    return vm_alloc(sizeof (vm_plugins));
+}
+
+int vm_plugins_open(vm_plugins *plugins, const char *path)
+{
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle) {
+        fprintf(stderr, "vm: can't open plugin %s: %s\n", path, dlerror());
+        return 0;
+    }
+    plugins->handles = realloc(plugins->handles,
+                               (plugins->count + 1) * sizeof (void *));
+    if (!plugins->handles) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    plugins->handles[plugins->count++] = handle;
+    return 1;
+}
+
+void vm_plugins_destroy(vm_plugins *plugins)
+{
+    unsigned i;
+
+    for (i = 0; i < plugins->count; ++i) {
+        dlclose(plugins->handles[i]);
+    }
+    free(plugins->handles);
+    free(plugins);
+}
+
+int vm_plugins_resolve(vm_program *program, const vm_plugins *plugins)
+{
+    size_t scheme = strlen(VM_PLUGIN_SCHEME);
+    unsigned i;
+
+    for (i = 0; i < program->code_count; ++i) {
+        vm_insn *insn = &program->code[i];
+        const char *name, *args;
+        size_t len;
+
+        if (insn->opcode != VM_EXEC ||
+            strncmp(insn->string, VM_PLUGIN_SCHEME, scheme) != 0) {
+            continue;
+        }
+        name = insn->string + scheme;
+        for (len = 0; isalnum((unsigned char) name[len]) || name[len] == '_';
+             ++len)
+            ;
+        args = name + len;
+        while (isspace((unsigned char) *args)) {
+            ++args;
+        }
+        if (len == 0 || (args == name + len && *args != '\0')) {
+            fprintf(stderr, "vm: %u: invalid plugin command \"%s\"\n", i,
+                    insn->string);
+            return 0;
+        }
+        insn->action = vm_plugins_lookup(plugins, name, len);
+        if (!insn->action) {
+            fprintf(stderr, "vm: %u: unknown plugin action \"%.*s\"\n", i,
+                    (int) len, name);
+            return 0;
+        }
+        insn->arg = (unsigned) (args - insn->string);
+        /* The action may read any field of the input record. */
+        program->live = VM_LIVE_ALL;
+    }
+    return 1;
+}
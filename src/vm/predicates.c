@@ -0,0 +1,285 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/predicates.c
+ * Distinct comparisons of a program, evaluated once per record.
+ */
+
+#include<vm/vm.h>
+#include<limits.h>
+
+/**
+ * @defgroup vmpred Predicates
+ * @ingroup vm
+ * @{
+ * Rules written by hand, or generated, compare the same register with
+ * the same constant over and over: the comparison instructions of a
+ * program are many, while the distinct predicates they test are few.
+ * vm_program_predicates() numbers the distinct ones, so that a record
+ * evaluates them all into a bit vector before running any function, and
+ * each comparison instruction becomes the test of one bit, negated for
+ * VM_NEQ and VM_INEQ, which share the predicate of VM_EQ and VM_IEQ.
+ *
+ * The equalities of a register are kept in a hash table, keyed by their
+ * constant: a single lookup of the field finds the one equality that
+ * holds, if any, and all the others are false. The other predicates,
+ * i.e. orderings, sets, patterns and networks, are evaluated one by one,
+ * although patterns and networks of a register still scan the field
+ * only once.
+ */
+
+/** Initial number of slots of the table of distinct predicates. */
+#define VM_PREDICATES_SIZE 256
+
+/**
+ * Hash bytes (FNV-1a), continuing from a previous hash.
+ * @param hash Previous hash, or the FNV offset basis.
+ * @param s Bytes to hash.
+ * @param len Number of bytes.
+ * @returns Hash value.
+ */
+static unsigned vm_predicates_hash(unsigned hash, const void *s, size_t len)
+{
+    const unsigned char *p = s;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Hash a number, for the table of number equalities.
+ * @param number Number.
+ * @returns Hash value.
+ */
+static unsigned vm_predicates_hash_number(unsigned number)
+{
+    return number * 2654435761U;
+}
+
+/**
+ * Tell whether a predicate compares a register with a string, whose
+ * length is its argument.
+ * @param opcode Canonical opcode.
+ * @returns Non zero for string comparisons.
+ */
+static int vm_predicates_stringy(vm_opcode opcode)
+{
+    return opcode >= VM_EQ && opcode <= VM_MIEQ;
+}
+
+/**
+ * Hash a predicate, for the table of distinct predicates.
+ * @param p Predicate.
+ * @returns Hash value.
+ */
+static unsigned vm_predicates_hash_predicate(const vm_predicate *p)
+{
+    unsigned hash = 0x811c9dc5;
+
+    hash = vm_predicates_hash(hash, &p->opcode, sizeof (p->opcode));
+    hash = vm_predicates_hash(hash, &p->reg, sizeof (p->reg));
+    hash = vm_predicates_hash(hash, &p->arg, sizeof (p->arg));
+    if (vm_predicates_stringy(p->opcode)) {
+        hash = vm_predicates_hash(hash, p->string, p->arg);
+    }
+    return hash;
+}
+
+/**
+ * Tell whether two predicates are the same.
+ * @param a First predicate.
+ * @param b Second predicate.
+ * @returns Non zero if they are.
+ */
+static int vm_predicates_same(const vm_predicate *a, const vm_predicate *b)
+{
+    return a->opcode == b->opcode && a->reg == b->reg && a->arg == b->arg &&
+           (!vm_predicates_stringy(a->opcode) ||
+            memcmp(a->string, b->string, a->arg) == 0);
+}
+
+/**
+ * Build the table of the equalities of a register.
+ * @param p Predicates, whose distinct predicates are numbered.
+ * @param table Table to build.
+ * @param opcode VM_EQ or VM_IEQ.
+ * @param reg Register.
+ */
+static void vm_predicates_table(const vm_predicates *p,
+                                vm_predicate_table *table, vm_opcode opcode,
+                                unsigned reg)
+{
+    unsigned i, count = 0, slot, hash;
+
+    for (i = 0; i < p->count; ++i) {
+        count += p->predicates[i].opcode == opcode &&
+                 p->predicates[i].reg == reg;
+    }
+    if (count == 0) {
+        return;
+    }
+    /* At most half full, so that misses stop early. */
+    for (table->size = 4; table->size < 2 * count; table->size *= 2) {
+    }
+    table->slots = vm_alloc(table->size * sizeof (unsigned));
+    for (i = 0; i < p->count; ++i) {
+        const vm_predicate *q = &p->predicates[i];
+
+        if (q->opcode != opcode || q->reg != reg) {
+            continue;
+        }
+        hash = (opcode == VM_EQ)
+               ? vm_predicates_hash(0x811c9dc5, q->string, q->arg)
+               : vm_predicates_hash_number(q->arg);
+        for (slot = hash & (table->size - 1); table->slots[slot];
+             slot = (slot + 1) & (table->size - 1)) {
+        }
+        table->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * @}
+ */
+
+void vm_program_predicates(vm_program *program)
+{
+    vm_predicates *p;
+    vm_predicate key;
+    unsigned *table, size = VM_PREDICATES_SIZE, pc, slot, hash, i, reg;
+    unsigned allocated = 0, index;
+
+    if (program->predicates) {
+        return;
+    }
+    p = vm_alloc(sizeof (vm_predicates));
+    p->tests = vm_alloc((program->code_count + 1) * sizeof (unsigned));
+    table = vm_alloc(size * sizeof (unsigned));
+
+    for (pc = 0; pc < program->code_count; ++pc) {
+        const vm_insn *insn = &program->code[pc];
+        int negated = 0;
+
+        if (insn->opcode < VM_EQ || insn->opcode > VM_INNET) {
+            continue;
+        }
+        key.opcode = insn->opcode;
+        if (key.opcode == VM_NEQ || key.opcode == VM_INEQ) {
+            key.opcode = (key.opcode == VM_NEQ) ? VM_EQ : VM_IEQ;
+            negated = 1;
+        }
+        key.reg = insn->reg;
+        key.arg = insn->arg;
+        key.string = insn->string;
+
+        hash = vm_predicates_hash_predicate(&key);
+        for (slot = hash & (size - 1); table[slot];
+             slot = (slot + 1) & (size - 1)) {
+            if (vm_predicates_same(&p->predicates[table[slot] - 1], &key)) {
+                break;
+            }
+        }
+        if (table[slot]) {
+            index = table[slot] - 1;
+        } else {
+            if (p->count == allocated) {
+                allocated = (allocated) ? 2 * allocated : 64;
+                p->predicates = realloc(p->predicates,
+                                        allocated * sizeof (vm_predicate));
+                if (!p->predicates) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            index = p->count++;
+            p->predicates[index] = key;
+            table[slot] = index + 1;
+            if (key.reg >= p->registers) {
+                p->registers = key.reg + 1;
+            }
+            /* Keep the table at most half full. */
+            if (2 * p->count > size) {
+                free(table);
+                size *= 2;
+                table = vm_alloc(size * sizeof (unsigned));
+                for (i = 0; i < p->count; ++i) {
+                    hash = vm_predicates_hash_predicate(&p->predicates[i]);
+                    for (slot = hash & (size - 1); table[slot];
+                         slot = (slot + 1) & (size - 1)) {
+                    }
+                    table[slot] = i + 1;
+                }
+            }
+        }
+        p->tests[pc] = (index << 1) | (unsigned) negated;
+    }
+    free(table);
+
+    p->others = vm_alloc((p->count + 1) * sizeof (unsigned));
+    for (i = 0; i < p->count; ++i) {
+        if (p->predicates[i].opcode != VM_EQ &&
+            p->predicates[i].opcode != VM_IEQ) {
+            p->others[p->other_count++] = i;
+        }
+    }
+    for (reg = 0; reg < VM_REGISTERS; ++reg) {
+        vm_predicates_table(p, &p->strings[reg], VM_EQ, reg);
+        vm_predicates_table(p, &p->numbers[reg], VM_IEQ, reg);
+    }
+    program->predicates = p;
+}
+
+unsigned vm_predicates_string(const vm_predicates *predicates, unsigned reg,
+                              const char *data, size_t len)
+{
+    const vm_predicate_table *table = &predicates->strings[reg];
+    unsigned slot;
+
+    if (table->size == 0) {
+        return UINT_MAX;
+    }
+    for (slot = vm_predicates_hash(0x811c9dc5, data, len) & (table->size - 1);
+         table->slots[slot]; slot = (slot + 1) & (table->size - 1)) {
+        const vm_predicate *p = &predicates->predicates[table->slots[slot] -
+                                                        1];
+        if (p->arg == len && memcmp(p->string, data, len) == 0) {
+            return table->slots[slot] - 1;
+        }
+    }
+    return UINT_MAX;
+}
+
+unsigned vm_predicates_number(const vm_predicates *predicates, unsigned reg,
+                              unsigned number)
+{
+    const vm_predicate_table *table = &predicates->numbers[reg];
+    unsigned slot;
+
+    if (table->size == 0) {
+        return UINT_MAX;
+    }
+    for (slot = vm_predicates_hash_number(number) & (table->size - 1);
+         table->slots[slot]; slot = (slot + 1) & (table->size - 1)) {
+        if (predicates->predicates[table->slots[slot] - 1].arg == number) {
+            return table->slots[slot] - 1;
+        }
+    }
+    return UINT_MAX;
+}
@@ -0,0 +1,345 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/ring.c
+ * Shared memory record ring.
+ */
+
+#define _GNU_SOURCE
+#include<vm/vm.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<sys/eventfd.h>
+#include<sys/mman.h>
+
+/**
+ * @defgroup vmring Shared memory ring
+ * @ingroup vm
+ * @{
+ * A ring is a memfd holding a header followed by a power of two number
+ * of fixed-size slots. Each slot is one record: a fixed-size header with
+ * the offset of each field, followed by an inline area with the strings
+ * of the fields. The producer copies the record into the slot at head,
+ * and publishes it advancing head; the consumer reads fields in place,
+ * and releases the slot advancing tail. Since each index is written by
+ * one side only, no lock is needed: just acquire and release ordering.
+ *
+ * A side that finds the ring empty (or full) raises its waiting flag,
+ * checks the ring again, and sleeps reading an eventfd. The other side
+ * writes the eventfd only if it finds the flag raised after moving its
+ * index, that is, only when the ring goes from empty to non-empty (or
+ * from full to non-full) while somebody waits: otherwise, records flow
+ * without any system call.
+ */
+
+/** Size of a slot, including its header. */
+#define VM_RING_SLOT 256
+
+/** Size of the string area of a slot. */
+#define VM_RING_DATA (VM_RING_SLOT - VM_REGISTERS * sizeof (uint16_t))
+
+/** Size of a cache line, to keep the two indices apart. */
+#define VM_RING_LINE 64
+
+/** Ring header, at the beginning of shared memory. */
+struct vm_ring_header {
+    /** Number of slots, a power of two. */
+    unsigned count;
+    /** Non zero once the producer is done. */
+    unsigned closed;
+    /** Index of the next slot to fill, written by the producer. */
+    unsigned head __attribute__((aligned(VM_RING_LINE)));
+    /** Non zero while the producer sleeps waiting for space. */
+    unsigned producer_waiting;
+    /** Index of the next slot to read, written by the consumer. */
+    unsigned tail __attribute__((aligned(VM_RING_LINE)));
+    /** Non zero while the consumer sleeps waiting for records. */
+    unsigned consumer_waiting;
+} __attribute__((aligned(VM_RING_LINE)));
+
+/** Ring slot, holding one record. */
+struct vm_ring_slot {
+    /** Offset of each field in data. */
+    uint16_t offsets[VM_REGISTERS];
+    /** Fields, NUL terminated. */
+    char data[VM_RING_DATA];
+};
+
+/**
+ * Map a ring.
+ * @param fd Ring memfd.
+ * @param size Size of the memfd.
+ * @param data_fd Eventfd to wake up the consumer.
+ * @param space_fd Eventfd to wake up the producer.
+ * @returns The ring, or NULL on error.
+ */
+static vm_ring *vm_ring_map(int fd, size_t size, int data_fd, int space_fd)
+{
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    vm_ring *ring;
+
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "vm: can't map ring\n");
+        return NULL;
+    }
+    ring = vm_alloc(sizeof (vm_ring));
+    ring->header = base;
+    ring->slots = (struct vm_ring_slot *) (ring->header + 1);
+    ring->size = size;
+    ring->fd = fd;
+    ring->data_fd = data_fd;
+    ring->space_fd = space_fd;
+    return ring;
+}
+
+/**
+ * Sleep until the other side wakes us up, unless the ring state that made
+ * us wait has already changed.
+ * @param ring Ring.
+ * @param waiting Our waiting flag.
+ * @param fd Our eventfd.
+ * @param index Index written by the other side.
+ * @param value Value of @a index that made us wait.
+ */
+static void vm_ring_sleep(vm_ring *ring, unsigned *waiting, int fd,
+                          unsigned *index, unsigned value)
+{
+    uint64_t count;
+
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(index, __ATOMIC_SEQ_CST) != value ||
+        __atomic_load_n(&ring->header->closed, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if (read(fd, &count, sizeof (count)) != sizeof (count)) {
+        __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * Wake up the other side, if it sleeps.
+ * @param waiting Its waiting flag.
+ * @param fd Its eventfd.
+ */
+static void vm_ring_wake(unsigned *waiting, int fd)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) &&
+        write(fd, &one, sizeof (one)) != sizeof (one))
+    {
+        fprintf(stderr, "vm: can't wake up ring peer\n");
+    }
+}
+
+/**
+ * Get a field of a slot. The producer lives in another process, so we
+ * don't trust offsets: a bad one reads as the empty string at the end of
+ * the string area, which the consumer has terminated.
+ * @param slot Slot.
+ * @param reg Register number of the field.
+ * @returns The field.
+ */
+static const char *vm_ring_field(const struct vm_ring_slot *slot,
+                                 unsigned reg)
+{
+    unsigned offset = slot->offsets[reg];
+
+    return slot->data + ((offset < VM_RING_DATA) ? offset : VM_RING_DATA - 1);
+}
+
+/**
+ * Release the slot returned by the last vm_ring_pop().
+ * @param ring Ring.
+ */
+static void vm_ring_release(vm_ring *ring)
+{
+    if (ring->held) {
+        __atomic_store_n(&ring->header->tail, ring->header->tail + 1,
+                         __ATOMIC_RELEASE);
+        ring->held = 0;
+        vm_ring_wake(&ring->header->producer_waiting, ring->space_fd);
+    }
+}
+
+/**
+ * @}
+ */
+
+vm_ring *vm_ring_create(unsigned count)
+{
+    unsigned n = 1;
+    size_t size;
+    int fd, data_fd, space_fd;
+    vm_ring *ring;
+
+    while (n < count) {
+        n *= 2;
+    }
+    size = sizeof (struct vm_ring_header) + n * sizeof (struct vm_ring_slot);
+
+    /* The producer is forked, not exec'd: commands run by the consumer
+     * must not inherit the ring. */
+    fd = memfd_create("ucc-ring", MFD_CLOEXEC);
+    if (fd == -1 || ftruncate(fd, (off_t) size) == -1) {
+        fprintf(stderr, "vm: can't create ring\n");
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    data_fd = eventfd(0, EFD_CLOEXEC);
+    space_fd = eventfd(0, EFD_CLOEXEC);
+    if (data_fd == -1 || space_fd == -1) {
+        fprintf(stderr, "vm: can't create ring eventfd\n");
+        close(fd);
+        if (data_fd != -1) {
+            close(data_fd);
+        }
+        if (space_fd != -1) {
+            close(space_fd);
+        }
+        return NULL;
+    }
+
+    ring = vm_ring_map(fd, size, data_fd, space_fd);
+    if (!ring) {
+        close(fd);
+        close(data_fd);
+        close(space_fd);
+        return NULL;
+    }
+    ring->header->count = n;
+    return ring;
+}
+
+vm_ring *vm_ring_attach(int fd, int data_fd, int space_fd)
+{
+    struct vm_ring_header header;
+    size_t size;
+
+    if (pread(fd, &header, sizeof (header), 0) != sizeof (header) ||
+        header.count == 0 || (header.count & (header.count - 1)) != 0)
+    {
+        fprintf(stderr, "vm: invalid ring\n");
+        return NULL;
+    }
+    size = sizeof (header) + header.count * sizeof (struct vm_ring_slot);
+    return vm_ring_map(fd, size, data_fd, space_fd);
+}
+
+void vm_ring_destroy(vm_ring *ring)
+{
+    munmap(ring->header, ring->size);
+    close(ring->fd);
+    close(ring->data_fd);
+    close(ring->space_fd);
+    free(ring);
+}
+
+int vm_ring_push(vm_ring *ring, const ucc_input_t *input)
+{
+    struct vm_ring_header *header = ring->header;
+    const char *fields[VM_REGISTERS];
+    struct vm_ring_slot *slot;
+    size_t len[VM_REGISTERS], total = 0;
+    unsigned head = header->head, i;
+    char *cursor;
+
+    fields[0] = input->monitor_type;
+    fields[1] = input->port;
+    fields[2] = input->group;
+    fields[3] = input->label;
+    fields[4] = input->hostname;
+    fields[5] = input->family;
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        len[i] = (fields[i]) ? strlen(fields[i]) : 0;
+        total += len[i] + 1;
+    }
+    if (total > VM_RING_DATA) {
+        return 0;
+    }
+
+    for (;;) {
+        unsigned tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+        if (head - tail < header->count) {
+            break;
+        }
+        vm_ring_sleep(ring, &header->producer_waiting, ring->space_fd,
+                      &header->tail, tail);
+    }
+
+    slot = &ring->slots[head & (header->count - 1)];
+    cursor = slot->data;
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        slot->offsets[i] = (uint16_t) (cursor - slot->data);
+        if (len[i] > 0) {
+            memcpy(cursor, fields[i], len[i]);
+        }
+        cursor[len[i]] = '\0';
+        cursor += len[i] + 1;
+    }
+
+    __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+    vm_ring_wake(&header->consumer_waiting, ring->data_fd);
+    return 1;
+}
+
+void vm_ring_close(vm_ring *ring)
+{
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+    vm_ring_wake(&ring->header->consumer_waiting, ring->data_fd);
+}
+
+int vm_ring_pop(vm_ring *ring, ucc_input_t *input)
+{
+    struct vm_ring_header *header = ring->header;
+    struct vm_ring_slot *slot;
+    unsigned tail;
+
+    vm_ring_release(ring);
+    tail = header->tail;
+    for (;;) {
+        unsigned head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            break;
+        }
+        if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+            /* The producer may have published before closing. */
+            if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != tail) {
+                break;
+            }
+            return 0;
+        }
+        vm_ring_sleep(ring, &header->consumer_waiting, ring->data_fd,
+                      &header->head, head);
+    }
+
+    slot = &ring->slots[tail & (header->count - 1)];
+    slot->data[VM_RING_DATA - 1] = '\0';
+    input->monitor_type = vm_ring_field(slot, 0);
+    input->port = vm_ring_field(slot, 1);
+    input->group = vm_ring_field(slot, 2);
+    input->label = vm_ring_field(slot, 3);
+    input->hostname = vm_ring_field(slot, 4);
+    input->family = vm_ring_field(slot, 5);
+    ring->held = 1;
+    return 1;
+}
@@ -0,0 +1,1445 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/rules.hpp
+ * Rules compiled into C++ at compile time.
+ */
+
+#pragma once
+#include<vm/ucc.hpp>
+#include<arpa/inet.h>
+#include<climits>
+#include<cstddef>
+#include<cstring>
+#include<stdexcept>
+#include<string_view>
+#include<type_traits>
+#include<utility>
+
+/**
+ * @defgroup vmrules Compile time rules
+ * @ingroup vm
+ * @{
+ * A C++17 front end, header only, that compiles rules written in the
+ * language of the compiler while the C++ program is being compiled, so
+ * that no program file is loaded at run time:
+ *
+ * <pre>
+ * static constexpr auto rules = ucc::compile(R"(
+ *     ssh (e) { if (e.port == 22) exec ("/sbin/audit"); }
+ * )");
+ * ...
+ * ucc::evaluate<rules>(records, sink);
+ * </pre>
+ *
+ * ucc::compile() is a constexpr function that does the work of the
+ * compiler: it parses the source, generates the same code, with the same
+ * backpatching, and makes the checks that the compiler and the loader
+ * make, so that errors in the rules are compile errors of the C++
+ * program. The global offset table is ordered like the compiler does, and
+ * the second argument selects first match mode, like <code>-f</code>.
+ *
+ * ucc::evaluate() turns the code into C++: there is one function
+ * template for each instruction offset, whose opcode, register and
+ * operands are template constants, so that each comparison is a test of
+ * a field against a literal, jumps are calls to the function of their
+ * target, and calls to static functions are calls to their entry point.
+ * Since jumps only go forward and calls are not recursive, the compiler
+ * may inline most of a function into a single decision tree. Each
+ * instruction offset is a level of template nesting, so very long
+ * functions may need a bigger <code>-ftemplate-depth</code>.
+ *
+ * The results are those of vm_run_fields(), with the sink called as for
+ * ucc::program::evaluate(). Pattern and network matching test one
+ * pattern, or network, at a time, rather than building a DFA or a trie,
+ * which pays when few of them are tested against the same field.
+ */
+
+namespace ucc {
+
+/** Instruction of compiled rules, like vm_insn. */
+struct rule_insn {
+    /** Opcode. */
+    vm_opcode opcode = VM_NOP;
+    /** Register number. */
+    unsigned reg = 0;
+    /** Location, function, number, first string of a set or network. */
+    unsigned arg = 0;
+    /** Offset of the string operand in the source text. */
+    unsigned string = 0;
+    /** Length of the string operand, or number of strings of a set. */
+    unsigned len = 0;
+    /** Next instruction of a backpatch list, plus one, or zero. */
+    unsigned next = 0;
+};
+
+/** Function of compiled rules, like vm_function. */
+struct rule_function {
+    /** Offset of the name in the source text. */
+    unsigned name = 0;
+    /** Length of the name. */
+    unsigned len = 0;
+    /** Entry point. */
+    unsigned start = 0;
+    /** Past the last instruction. */
+    unsigned end = 0;
+    /** Non zero for static functions. */
+    bool local = false;
+};
+
+/** String of compiled rules, for sets. */
+struct rule_string {
+    /** Offset in the source text. */
+    unsigned offset = 0;
+    /** Length. */
+    unsigned len = 0;
+};
+
+/** Network of compiled rules, IPv4 networks being mapped into IPv6. */
+struct rule_net {
+    /** Address, with host bits cleared. */
+    unsigned char addr[16] = {};
+    /** Prefix length in bits. */
+    unsigned len = 0;
+};
+
+/**
+ * Compiled rules, as returned by compile(). Capacities are bound to the
+ * length of the source, which is the template argument.
+ */
+template<std::size_t N>
+struct rules {
+    /** Copy of the source, which strings reference. */
+    char text[N] = {};
+    /** Code. */
+    rule_insn code[2 * N + 1] = {};
+    /** Number of instructions. */
+    unsigned code_count = 0;
+    /** Global offset table, in the order in which it is run. */
+    rule_function got[N / 4 + 1] = {};
+    /** Number of functions. */
+    unsigned got_count = 0;
+    /** Strings of all sets. */
+    rule_string strings[N / 2 + 1] = {};
+    /** Number of strings. */
+    unsigned string_count = 0;
+    /** Networks. */
+    rule_net nets[N / 8 + 1] = {};
+    /** Number of networks. */
+    unsigned net_count = 0;
+    /** Non zero in first match mode. */
+    bool first = false;
+
+    /**
+     * Get a string of the source text.
+     * @param offset Offset of the string.
+     * @param len Length of the string.
+     * @returns The string.
+     */
+    constexpr std::string_view view(unsigned offset, unsigned len) const
+    {
+        return std::string_view(text + offset, len);
+    }
+};
+
+namespace detail {
+
+/** Tokens, like those of the scanner. */
+enum class rule_token {
+    END, STRING, NUMBER, ID, IF, ELSE, EXEC, STATIC, IN, INNET, TO, TC,
+    GO, GC, PV, P, CM, AND, OR, NOT, EQ, MAG, MIN, MAEQ, MIEQ, NEQ, MATCH
+};
+
+/** Value of a condition: a field, a string or a number. */
+struct rule_value {
+    /** Token, which is ID for fields. */
+    rule_token kind = rule_token::END;
+    /** Register, for fields. */
+    unsigned reg = 0;
+    /** Offset in the source text, quotes excluded for strings. */
+    unsigned offset = 0;
+    /** Length. */
+    unsigned len = 0;
+};
+
+/** Code fragment and its backpatch lists, like p_node. */
+struct rule_node {
+    /** First instruction. */
+    unsigned code = 0;
+    /** Jumps to patch with the location of the true branch. */
+    unsigned truelist = 0;
+    /** Jumps to patch with the location of the false branch. */
+    unsigned falselist = 0;
+    /** Jumps to patch with the location of what follows. */
+    unsigned nextlist = 0;
+};
+
+/**
+ * Report an error in the rules: during constant evaluation, this makes
+ * compile() fail to compile.
+ * @param what Error message.
+ */
+[[noreturn]] inline void rule_error(const char *what)
+{
+    throw std::invalid_argument(what);
+}
+
+/**
+ * Parse an element of a glob pattern, like vm_glob_parse() does.
+ * @param pattern Pattern.
+ * @param pos Position of the element, updated to the next one.
+ * @param c Character to test.
+ * @param valid In output, false if the pattern is invalid.
+ * @returns Non zero if the element matches @a c.
+ */
+constexpr bool rule_glob_elem(std::string_view pattern, std::size_t &pos,
+                              unsigned char c, bool &valid)
+{
+    unsigned char x = (unsigned char) pattern[pos++];
+
+    if (x == '?') {
+        return true;
+    }
+    if (x == '[') {
+        bool negate = false, in = false;
+        if (pos < pattern.size() &&
+            (pattern[pos] == '!' || pattern[pos] == '^')) {
+            negate = true, ++pos;
+        }
+        /* A closing bracket right after the opening is a literal. */
+        do {
+            if (pos >= pattern.size()) {
+                valid = false;
+                return false;
+            }
+            unsigned lo = (unsigned char) pattern[pos++], hi = lo;
+            if (pos + 1 < pattern.size() && pattern[pos] == '-' &&
+                pattern[pos + 1] != ']') {
+                hi = (unsigned char) pattern[pos + 1];
+                pos += 2;
+            }
+            in = in || (lo <= c && c <= hi);
+        } while (pos >= pattern.size() || pattern[pos] != ']');
+        ++pos;
+        return in != negate;
+    }
+    if (x == '\\' && pos < pattern.size()) {
+        x = (unsigned char) pattern[pos++];
+    }
+    return x == c;
+}
+
+/**
+ * Check that a glob pattern is valid.
+ * @param pattern Pattern.
+ * @returns Non zero if it is valid.
+ */
+constexpr bool rule_glob_valid(std::string_view pattern)
+{
+    std::size_t pos = 0;
+    bool valid = true;
+
+    while (valid && pos < pattern.size()) {
+        if (pattern[pos] == '*') {
+            ++pos;
+        } else {
+            rule_glob_elem(pattern, pos, 0, valid);
+        }
+    }
+    return valid;
+}
+
+/**
+ * Match a whole field against a valid glob pattern, backtracking to the
+ * last star on failure.
+ * @param pattern Pattern.
+ * @param field Field.
+ * @returns Non zero if the field matches.
+ */
+constexpr bool rule_glob_match(std::string_view pattern,
+                               std::string_view field)
+{
+    std::size_t p = 0, i = 0, star = std::string_view::npos, mark = 0;
+    bool valid = true;
+
+    while (i < field.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            while (p < pattern.size() && pattern[p] == '*') {
+                ++p;
+            }
+            star = p, mark = i;
+            continue;
+        }
+        if (p < pattern.size()) {
+            std::size_t next = p;
+            if (rule_glob_elem(pattern, next, (unsigned char) field[i],
+                               valid)) {
+                p = next, ++i;
+                continue;
+            }
+        }
+        if (star == std::string_view::npos) {
+            return false;
+        }
+        p = star, i = ++mark;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+/**
+ * Parse an IPv4 address, like inet_pton() does.
+ * @param s Address.
+ * @param addr In output, four bytes.
+ * @returns Non zero on success.
+ */
+constexpr bool rule_pton4(std::string_view s, unsigned char *addr)
+{
+    unsigned octets = 0, value = 0;
+    bool digit = false;
+
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        char ch = s[i];
+        if (ch >= '0' && ch <= '9') {
+            if (digit && value == 0) {
+                return false;
+            }
+            value = value * 10 + (unsigned) (ch - '0');
+            if (value > 255) {
+                return false;
+            }
+            if (!digit) {
+                if (++octets > 4) {
+                    return false;
+                }
+                digit = true;
+            }
+            addr[octets - 1] = (unsigned char) value;
+        } else if (ch == '.' && digit) {
+            if (octets == 4) {
+                return false;
+            }
+            digit = false, value = 0;
+        } else {
+            return false;
+        }
+    }
+    return octets == 4;
+}
+
+/**
+ * Parse an IPv6 address, like inet_pton() does.
+ * @param s Address.
+ * @param addr In output, sixteen bytes.
+ * @returns Non zero on success.
+ */
+constexpr bool rule_pton6(std::string_view s, unsigned char *addr)
+{
+    unsigned char tmp[16] = {};
+    std::size_t i = 0, tp = 0, token = 0, colon = 16;
+    unsigned digits = 0, value = 0;
+
+    if (s.empty()) {
+        return false;
+    }
+    if (s[0] == ':') {
+        if (s.size() < 2 || s[1] != ':') {
+            return false;
+        }
+        ++i;
+    }
+    token = i;
+    while (i < s.size()) {
+        char ch = s[i++];
+        int digit = (ch >= '0' && ch <= '9') ? ch - '0'
+                  : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10
+                  : (ch >= 'A' && ch <= 'F') ? ch - 'A' + 10 : -1;
+        if (digit >= 0) {
+            if (digits == 4) {
+                return false;
+            }
+            value = (value << 4) | (unsigned) digit;
+            ++digits;
+            continue;
+        }
+        if (ch == ':') {
+            token = i;
+            if (digits == 0) {
+                if (colon != 16) {
+                    return false;
+                }
+                colon = tp;
+                continue;
+            }
+            if (i == s.size() || tp + 2 > 16) {
+                return false;
+            }
+            tmp[tp++] = (unsigned char) (value >> 8);
+            tmp[tp++] = (unsigned char) value;
+            digits = 0, value = 0;
+            continue;
+        }
+        if (ch == '.' && tp + 4 <= 16 &&
+            rule_pton4(s.substr(token), tmp + tp)) {
+            tp += 4, digits = 0;
+            break;
+        }
+        return false;
+    }
+    if (digits > 0) {
+        if (tp + 2 > 16) {
+            return false;
+        }
+        tmp[tp++] = (unsigned char) (value >> 8);
+        tmp[tp++] = (unsigned char) value;
+    }
+    if (colon != 16) {
+        /* Move what follows the double colon to the end. */
+        std::size_t n = tp - colon;
+        if (tp == 16) {
+            return false;
+        }
+        for (std::size_t k = 0; k < n; ++k) {
+            tmp[15 - k] = tmp[tp - 1 - k];
+        }
+        for (std::size_t k = colon; k < 16 - n; ++k) {
+            tmp[k] = 0;
+        }
+        tp = 16;
+    }
+    if (tp != 16) {
+        return false;
+    }
+    for (std::size_t k = 0; k < 16; ++k) {
+        addr[k] = tmp[k];
+    }
+    return true;
+}
+
+/**
+ * Parse an address, mapping IPv4 addresses into IPv6, like
+ * vm_addr_parse() does.
+ * @param s Address.
+ * @param addr In output, the address.
+ * @param plen In output, the address length in bits, as written.
+ * @returns Non zero on success.
+ */
+constexpr bool rule_addr_parse(std::string_view s, unsigned char *addr,
+                               unsigned &plen)
+{
+    if (rule_pton4(s, addr + 12)) {
+        for (unsigned i = 0; i < 12; ++i) {
+            addr[i] = (i < 10) ? 0 : 0xff;
+        }
+        plen = 32;
+        return true;
+    }
+    if (rule_pton6(s, addr)) {
+        plen = 128;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parse a network, like vm_net_parse() does.
+ * @param s Network, an address and an optional prefix length.
+ * @param net In output, the network.
+ * @returns Non zero on success.
+ */
+constexpr bool rule_net_parse(std::string_view s, rule_net &net)
+{
+    std::size_t slash = s.find('/');
+    unsigned plen = 0, bits = 0;
+
+    if (s.size() >= 64 ||
+        !rule_addr_parse(s.substr(0, slash), net.addr, plen)) {
+        return false;
+    }
+    bits = plen;
+    if (slash != std::string_view::npos) {
+        if (slash + 1 == s.size()) {
+            return false;
+        }
+        bits = 0;
+        for (std::size_t i = slash + 1; i < s.size(); ++i) {
+            if (s[i] < '0' || s[i] > '9' || bits > plen) {
+                return false;
+            }
+            bits = bits * 10 + (unsigned) (s[i] - '0');
+        }
+        if (bits > plen) {
+            return false;
+        }
+    }
+    net.len = 128 - plen + bits;
+
+    /* Clear host bits. */
+    for (unsigned i = net.len; i < 128; ++i) {
+        net.addr[i / 8] &= (unsigned char) ~(1 << (7 - i % 8));
+    }
+    return true;
+}
+
+/**
+ * Hash a function name, like sym_table_hash() does.
+ * @param name Name.
+ * @returns Hash value.
+ */
+constexpr unsigned rule_hash(std::string_view name)
+{
+    unsigned hashval = 0;
+
+    for (char c : name) {
+        hashval = (unsigned) c + 31 * hashval;
+    }
+    return hashval % 101;
+}
+
+/**
+ * Compiler of rules, a recursive descent parser that accepts the same
+ * language as parser.y, resolving its conflicts the way bison does, and
+ * that generates the same code.
+ */
+template<std::size_t N>
+class rule_compiler {
+public:
+    /**
+     * Start compiling.
+     * @param source Source, NUL terminated.
+     * @param out Rules to fill.
+     */
+    constexpr rule_compiler(const char (&source)[N], rules<N> &out)
+        : out_(out)
+    {
+        for (std::size_t i = 0; i < N && source[i] != '\0'; ++i) {
+            out_.text[i] = source[i];
+            size_ = i + 1;
+        }
+    }
+
+    /** Parse all functions, then resolve calls and order functions. */
+    constexpr void run()
+    {
+        next();
+        while (token_ != rule_token::END) {
+            function();
+        }
+        link();
+    }
+
+private:
+    /** @returns The current token as a string. */
+    constexpr std::string_view lexeme() const
+    {
+        return out_.view(start_, len_);
+    }
+
+    /** Read the next token, skipping blanks and comments. */
+    constexpr void next()
+    {
+        const char *t = out_.text;
+
+        for (;;) {
+            while (pos_ < size_ && (t[pos_] == ' ' || t[pos_] == '\t' ||
+                                    t[pos_] == '\r' || t[pos_] == '\n')) {
+                ++pos_;
+            }
+            if (pos_ + 1 < size_ && t[pos_] == '/' && t[pos_ + 1] == '/') {
+                while (pos_ < size_ && t[pos_] != '\n' && t[pos_] != '\r') {
+                    ++pos_;
+                }
+            } else if (pos_ + 1 < size_ && t[pos_] == '/' &&
+                       t[pos_ + 1] == '*') {
+                pos_ += 2;
+                while (pos_ < size_ &&
+                       !(t[pos_] == '*' && pos_ + 1 < size_ &&
+                         t[pos_ + 1] == '/')) {
+                    ++pos_;
+                }
+                pos_ = (pos_ < size_) ? pos_ + 2 : size_;
+            } else {
+                break;
+            }
+        }
+
+        start_ = (unsigned) pos_;
+        if (pos_ == size_) {
+            token_ = rule_token::END, len_ = 0;
+            return;
+        }
+        char c = t[pos_++];
+        char d = (pos_ < size_) ? t[pos_] : '\0';
+        if (c == '"') {
+            while (pos_ < size_ && t[pos_] != '"') {
+                ++pos_;
+            }
+            if (pos_ == size_) {
+                rule_error("ucc: unterminated string");
+            }
+            token_ = rule_token::STRING, ++pos_;
+        } else if (c >= '0' && c <= '9') {
+            while (pos_ < size_ && t[pos_] >= '0' && t[pos_] <= '9') {
+                ++pos_;
+            }
+            token_ = rule_token::NUMBER;
+        } else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+                   c == '_') {
+            while (pos_ < size_ && ((t[pos_] >= 'A' && t[pos_] <= 'Z') ||
+                                    (t[pos_] >= 'a' && t[pos_] <= 'z') ||
+                                    (t[pos_] >= '0' && t[pos_] <= '9') ||
+                                    t[pos_] == '_')) {
+                ++pos_;
+            }
+            std::string_view word(t + start_, pos_ - start_);
+            token_ = (word == "if") ? rule_token::IF
+                   : (word == "else") ? rule_token::ELSE
+                   : (word == "exec") ? rule_token::EXEC
+                   : (word == "static") ? rule_token::STATIC
+                   : (word == "in") ? rule_token::IN
+                   : (word == "in_net") ? rule_token::INNET
+                   : rule_token::ID;
+        } else if (c == '&' && d == '&') {
+            token_ = rule_token::AND, ++pos_;
+        } else if (c == '|' && d == '|') {
+            token_ = rule_token::OR, ++pos_;
+        } else if (c == '=' && d == '=') {
+            token_ = rule_token::EQ, ++pos_;
+        } else if (c == '!' && d == '=') {
+            token_ = rule_token::NEQ, ++pos_;
+        } else if (c == '>' && d == '=') {
+            token_ = rule_token::MAEQ, ++pos_;
+        } else if (c == '<' && d == '=') {
+            token_ = rule_token::MIEQ, ++pos_;
+        } else {
+            switch (c) {
+                case '(': token_ = rule_token::TO; break;
+                case ')': token_ = rule_token::TC; break;
+                case '{': token_ = rule_token::GO; break;
+                case '}': token_ = rule_token::GC; break;
+                case ';': token_ = rule_token::PV; break;
+                case '.': token_ = rule_token::P; break;
+                case ',': token_ = rule_token::CM; break;
+                case '!': token_ = rule_token::NOT; break;
+                case '>': token_ = rule_token::MAG; break;
+                case '<': token_ = rule_token::MIN; break;
+                case '~': token_ = rule_token::MATCH; break;
+                default: rule_error("ucc: invalid character");
+            }
+        }
+        len_ = (unsigned) pos_ - start_;
+    }
+
+    /**
+     * Consume a token.
+     * @param token Expected token.
+     */
+    constexpr void expect(rule_token token)
+    {
+        if (token_ != token) {
+            rule_error("ucc: syntax error");
+        }
+        next();
+    }
+
+    /**
+     * Append an instruction.
+     * @param opcode Opcode.
+     * @returns Its offset.
+     */
+    constexpr unsigned emit(vm_opcode opcode)
+    {
+        if (out_.code_count == sizeof (out_.code) / sizeof (out_.code[0])) {
+            rule_error("ucc: too much code");
+        }
+        out_.code[out_.code_count].opcode = opcode;
+        return out_.code_count++;
+    }
+
+    /**
+     * Merge two backpatch lists, like bp_merge().
+     * @param a List.
+     * @param b List.
+     * @returns The merged list.
+     */
+    constexpr unsigned merge(unsigned a, unsigned b)
+    {
+        unsigned i = a;
+
+        if (!a) {
+            return b;
+        }
+        while (out_.code[i - 1].next) {
+            i = out_.code[i - 1].next;
+        }
+        out_.code[i - 1].next = b;
+        return a;
+    }
+
+    /**
+     * Patch all the jumps of a list, like bp_backpatch().
+     * @param list List.
+     * @param location Target location.
+     */
+    constexpr void backpatch(unsigned list, unsigned location)
+    {
+        for (unsigned i = list; i; i = out_.code[i - 1].next) {
+            out_.code[i - 1].arg = location;
+        }
+    }
+
+    /**
+     * Generate a statement followed by a jump to what follows.
+     * @param opcode Opcode of the statement.
+     * @returns The statement node.
+     */
+    constexpr rule_node simple(vm_opcode opcode)
+    {
+        rule_node node;
+        node.code = emit(opcode);
+        node.nextlist = emit(VM_JMP) + 1;
+        return node;
+    }
+
+    /** Parse a function, and install it. */
+    constexpr void function()
+    {
+        bool local = token_ == rule_token::STATIC;
+        rule_node body;
+        unsigned name = 0, len = 0, i = 0;
+
+        if (local) {
+            next();
+        }
+        name = start_, len = len_;
+        expect(rule_token::ID);
+        expect(rule_token::TO);
+        expect(rule_token::ID);
+        expect(rule_token::TC);
+        expect(rule_token::GO);
+        body = this->body();
+        expect(rule_token::GC);
+
+        backpatch(body.nextlist, emit(VM_RETURN));
+        for (i = 0; i < out_.got_count; ++i) {
+            if (out_.view(out_.got[i].name, out_.got[i].len) ==
+                out_.view(name, len)) {
+                rule_error("ucc: function already exists");
+            }
+        }
+        if (out_.got_count == sizeof (out_.got) / sizeof (out_.got[0])) {
+            rule_error("ucc: too many functions");
+        }
+        rule_function &f = out_.got[out_.got_count++];
+        f.name = name, f.len = len, f.local = local;
+        f.start = body.code, f.end = out_.code_count;
+    }
+
+    /**
+     * Parse a body: a statement, a block, an empty statement or nothing,
+     * followed by any number of statements, which are shifted into the
+     * innermost body as bison does.
+     * @returns The body node.
+     */
+    constexpr rule_node body()
+    {
+        rule_node node;
+
+        switch (token_) {
+            case rule_token::IF:
+            case rule_token::EXEC:
+            case rule_token::ID:
+                node = statement();
+                break;
+            case rule_token::GO:
+                next();
+                node = body();
+                expect(rule_token::GC);
+                break;
+            case rule_token::PV:
+                next();
+                node = simple(VM_NOP);
+                break;
+            default:
+                node = simple(VM_NOP);
+                break;
+        }
+        while (token_ == rule_token::IF || token_ == rule_token::EXEC ||
+               token_ == rule_token::ID) {
+            rule_node more = statement();
+            backpatch(node.nextlist, more.code);
+            node.nextlist = more.nextlist;
+        }
+        return node;
+    }
+
+    /**
+     * Parse an if, an exec or a call.
+     * @returns The statement node.
+     */
+    constexpr rule_node statement()
+    {
+        rule_node node;
+
+        if (token_ == rule_token::IF) {
+            rule_node cond, then;
+            next();
+            expect(rule_token::TO);
+            cond = conditions();
+            expect(rule_token::TC);
+            then = body();
+            node.code = cond.code;
+            backpatch(cond.truelist, then.code);
+            if (token_ == rule_token::ELSE) {
+                next();
+                rule_node other = body();
+                backpatch(cond.falselist, other.code);
+                node.nextlist = merge(then.nextlist, other.nextlist);
+            } else {
+                node.nextlist = merge(cond.falselist, then.nextlist);
+            }
+        } else if (token_ == rule_token::EXEC) {
+            unsigned string = 0, len = 0;
+            next();
+            expect(rule_token::TO);
+            string = start_ + 1, len = len_ - 2;
+            expect(rule_token::STRING);
+            expect(rule_token::TC);
+            expect(rule_token::PV);
+            node = simple(VM_EXEC);
+            out_.code[node.code].string = string;
+            out_.code[node.code].len = len;
+        } else {
+            unsigned name = start_, len = len_;
+            expect(rule_token::ID);
+            expect(rule_token::TO);
+            expect(rule_token::ID);
+            expect(rule_token::TC);
+            expect(rule_token::PV);
+            node = simple(VM_CALL);
+            out_.code[node.code].string = name;
+            out_.code[node.code].len = len;
+        }
+        return node;
+    }
+
+    /**
+     * Parse conditions. Since negation has the highest precedence and the
+     * right operand of && and || is a single condition, conditions are
+     * negated conditions chained from left to right.
+     * @returns The conditions node.
+     */
+    constexpr rule_node conditions()
+    {
+        rule_node node = negation();
+
+        while (token_ == rule_token::AND || token_ == rule_token::OR) {
+            bool conj = token_ == rule_token::AND;
+            rule_node r;
+            next();
+            r = condition();
+            if (conj) {
+                backpatch(node.truelist, r.code);
+                node.falselist = merge(node.falselist, r.falselist);
+                node.truelist = r.truelist;
+            } else {
+                backpatch(node.falselist, r.code);
+                node.truelist = merge(node.truelist, r.truelist);
+                node.falselist = r.falselist;
+            }
+        }
+        return node;
+    }
+
+    /**
+     * Parse a condition, possibly negated.
+     * @returns The condition node.
+     */
+    constexpr rule_node negation()
+    {
+        if (token_ == rule_token::NOT) {
+            next();
+            rule_node node = negation();
+            unsigned list = node.truelist;
+            node.truelist = node.falselist;
+            node.falselist = list;
+            return node;
+        }
+        return condition();
+    }
+
+    /**
+     * Parse a comparison, a set membership test or a parenthesized
+     * condition.
+     * @returns The condition node.
+     */
+    constexpr rule_node condition()
+    {
+        rule_token op = rule_token::END;
+        rule_value l, r;
+        rule_node node;
+
+        if (token_ == rule_token::TO) {
+            next();
+            node = conditions();
+            expect(rule_token::TC);
+            return node;
+        }
+
+        l = value();
+        op = token_;
+        if (op == rule_token::IN) {
+            next();
+            if (l.kind != rule_token::ID) {
+                rule_error("ucc: left operand of in must be a field");
+            }
+            node.code = emit(VM_IN);
+            out_.code[node.code].reg = l.reg;
+            out_.code[node.code].arg = out_.string_count;
+            expect(rule_token::TO);
+            for (;;) {
+                if (token_ != rule_token::STRING) {
+                    rule_error("ucc: syntax error");
+                }
+                if (out_.string_count == sizeof (out_.strings) /
+                                         sizeof (out_.strings[0])) {
+                    rule_error("ucc: too many strings");
+                }
+                out_.strings[out_.string_count].offset = start_ + 1;
+                out_.strings[out_.string_count].len = len_ - 2;
+                ++out_.string_count;
+                ++out_.code[node.code].len;
+                next();
+                if (token_ != rule_token::CM) {
+                    break;
+                }
+                next();
+            }
+            expect(rule_token::TC);
+        } else {
+            vm_opcode opcode = (op == rule_token::EQ) ? VM_EQ
+                             : (op == rule_token::MAG) ? VM_MAG
+                             : (op == rule_token::MIN) ? VM_MIN
+                             : (op == rule_token::MAEQ) ? VM_MAEQ
+                             : (op == rule_token::MIEQ) ? VM_MIEQ
+                             : (op == rule_token::NEQ) ? VM_NEQ
+                             : (op == rule_token::MATCH) ? VM_MATCH
+                             : (op == rule_token::INNET) ? VM_INNET
+                             : VM_NOP;
+            if (opcode == VM_NOP) {
+                rule_error("ucc: condition is not a comparison");
+            }
+            next();
+            r = value();
+            node.code = compare(opcode, l, r);
+        }
+
+        node.truelist = emit(VM_JTRUE) + 1;
+        node.falselist = emit(VM_JFALSE) + 1;
+        return node;
+    }
+
+    /**
+     * Generate a comparison, checking its operands like the compiler and
+     * the loader do.
+     * @param opcode String comparison opcode.
+     * @param l Left operand.
+     * @param r Right operand.
+     * @returns The comparison offset.
+     */
+    constexpr unsigned compare(vm_opcode opcode, const rule_value &l,
+                               const rule_value &r)
+    {
+        unsigned offset = 0;
+
+        if (l.kind == rule_token::NUMBER || r.kind == rule_token::NUMBER) {
+            unsigned long number = 0;
+            if (l.kind != rule_token::ID || r.kind != rule_token::NUMBER) {
+                rule_error("ucc: numeric comparison needs a field on the "
+                           "left and a number on the right");
+            }
+            for (unsigned i = 0; i < r.len; ++i) {
+                number = number * 10 +
+                         (unsigned long) (out_.text[r.offset + i] - '0');
+                if (number > UINT_MAX) {
+                    rule_error("ucc: number out of range");
+                }
+            }
+            switch (opcode) {
+                case VM_EQ: opcode = VM_IEQ; break;
+                case VM_MAG: opcode = VM_IMAG; break;
+                case VM_MIN: opcode = VM_IMIN; break;
+                case VM_MAEQ: opcode = VM_IMAEQ; break;
+                case VM_MIEQ: opcode = VM_IMIEQ; break;
+                case VM_NEQ: opcode = VM_INEQ; break;
+                default: rule_error("ucc: invalid numeric operand");
+            }
+            offset = emit(opcode);
+            out_.code[offset].reg = l.reg;
+            out_.code[offset].arg = (unsigned) number;
+            return offset;
+        }
+
+        if (l.kind != rule_token::ID || r.kind != rule_token::STRING) {
+            rule_error("ucc: comparison needs a field on the left and a "
+                       "string on the right");
+        }
+        offset = emit(opcode);
+        out_.code[offset].reg = l.reg;
+        out_.code[offset].string = r.offset;
+        out_.code[offset].len = r.len;
+        if (opcode == VM_MATCH && !rule_glob_valid(out_.view(r.offset,
+                                                             r.len))) {
+            rule_error("ucc: invalid pattern");
+        }
+        if (opcode == VM_INNET) {
+            if (out_.net_count == sizeof (out_.nets) / sizeof (out_.nets[0])) {
+                rule_error("ucc: too many networks");
+            }
+            if (!rule_net_parse(out_.view(r.offset, r.len),
+                                out_.nets[out_.net_count])) {
+                rule_error("ucc: invalid network");
+            }
+            out_.code[offset].arg = out_.net_count++;
+        }
+        return offset;
+    }
+
+    /**
+     * Parse a value: a string, a number or a field.
+     * @returns The value.
+     */
+    constexpr rule_value value()
+    {
+        rule_value v;
+
+        v.kind = token_, v.offset = start_, v.len = len_;
+        if (token_ == rule_token::STRING) {
+            v.offset = start_ + 1, v.len = len_ - 2;
+            next();
+        } else if (token_ == rule_token::NUMBER) {
+            next();
+        } else {
+            std::string_view field;
+            expect(rule_token::ID);
+            expect(rule_token::P);
+            field = lexeme();
+            expect(rule_token::ID);
+            v.reg = (field == "monitor_type") ? 0
+                  : (field == "port") ? 1
+                  : (field == "group") ? 2
+                  : (field == "label") ? 3
+                  : (field == "hostname") ? 4
+                  : (field == "family") ? 5
+                  : VM_REGISTERS;
+            if (v.reg == VM_REGISTERS) {
+                rule_error("ucc: invalid field name");
+            }
+        }
+        return v;
+    }
+
+    /**
+     * Check whether a function calls itself, directly or not.
+     * @param f Function.
+     * @param state For each function: zero if not visited yet, one if
+     *        being visited, two if visited.
+     */
+    constexpr void visit(unsigned f, unsigned char *state) const
+    {
+        state[f] = 1;
+        for (unsigned i = out_.got[f].start; i < out_.got[f].end; ++i) {
+            if (out_.code[i].opcode != VM_CALL) {
+                continue;
+            }
+            unsigned callee = out_.code[i].arg;
+            if (state[callee] == 1) {
+                rule_error("ucc: recursive call");
+            }
+            if (state[callee] == 0) {
+                visit(callee, state);
+            }
+        }
+        state[f] = 2;
+    }
+
+    /**
+     * Order the global offset table like code_generate() does, resolve
+     * calls and check that no function is recursive.
+     */
+    constexpr void link()
+    {
+        rules<N> &p = out_;
+        rule_function got[sizeof (p.got) / sizeof (p.got[0])] = {};
+        unsigned char state[sizeof (p.got) / sizeof (p.got[0])] = {};
+        unsigned count = 0;
+
+        /* Functions are installed in front of their hash bucket, while
+         * first match mode sorts them by entry point. */
+        if (p.first) {
+            for (unsigned i = 0; i < p.got_count; ++i) {
+                got[count++] = p.got[i];
+            }
+        } else {
+            for (unsigned h = 0; h < 101; ++h) {
+                for (unsigned i = p.got_count; i-- > 0;) {
+                    if (rule_hash(p.view(p.got[i].name, p.got[i].len)) == h) {
+                        got[count++] = p.got[i];
+                    }
+                }
+            }
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            p.got[i] = got[i];
+        }
+
+        for (unsigned i = 0; i < p.code_count; ++i) {
+            rule_insn &insn = p.code[i];
+            if (insn.opcode != VM_CALL) {
+                continue;
+            }
+            for (insn.arg = 0; insn.arg < p.got_count; ++insn.arg) {
+                if (p.view(p.got[insn.arg].name, p.got[insn.arg].len) ==
+                    p.view(insn.string, insn.len)) {
+                    break;
+                }
+            }
+            if (insn.arg == p.got_count) {
+                rule_error("ucc: function does not exist");
+            }
+        }
+        for (unsigned i = 0; i < p.got_count; ++i) {
+            if (state[i] == 0) {
+                visit(i, state);
+            }
+        }
+    }
+
+    /** Rules being compiled. */
+    rules<N> &out_;
+    /** Length of the source. */
+    std::size_t size_ = 0;
+    /** Position of the scanner. */
+    std::size_t pos_ = 0;
+    /** Current token. */
+    rule_token token_ = rule_token::END;
+    /** Offset of the current token. */
+    unsigned start_ = 0;
+    /** Length of the current token. */
+    unsigned len_ = 0;
+};
+
+/** State of the record being filtered, like vm_record. */
+template<typename Sink>
+struct rule_state {
+    /** Sink. */
+    Sink *sink = nullptr;
+    /** Record being filtered. */
+    const record *current = nullptr;
+    /** Function being run against the record. */
+    std::string_view function;
+    /** Numeric value of each field, valid if parsed says so. */
+    unsigned numbers[VM_REGISTERS] = {};
+    /** For each field: zero if not parsed yet, positive if it is a
+     *  number, negative if it is not. */
+    signed char parsed[VM_REGISTERS] = {};
+    /** Address of each field, valid if looked says so. */
+    unsigned char addrs[VM_REGISTERS][16] = {};
+    /** For each field: zero if not parsed yet, positive if it is an
+     *  address, negative if it is not. */
+    signed char looked[VM_REGISTERS] = {};
+};
+
+/**
+ * Get the field mapped on a register.
+ * @param r Record.
+ * @returns The field.
+ */
+template<unsigned Reg>
+std::string_view rule_field(const record &r) noexcept
+{
+    if constexpr (Reg == 0) {
+        return r.monitor_type;
+    } else if constexpr (Reg == 1) {
+        return r.port;
+    } else if constexpr (Reg == 2) {
+        return r.group;
+    } else if constexpr (Reg == 3) {
+        return r.label;
+    } else if constexpr (Reg == 4) {
+        return r.hostname;
+    } else {
+        return r.family;
+    }
+}
+
+/**
+ * Parse a field as a decimal number, the first time it is needed, like
+ * vm_record_number() does.
+ * @param s Record state.
+ * @returns Non zero if the field holds a number.
+ */
+template<unsigned Reg, typename State>
+bool rule_number(State &s) noexcept
+{
+    if (!s.parsed[Reg]) {
+        std::string_view field = rule_field<Reg>(*s.current);
+        unsigned number = 0;
+
+        s.parsed[Reg] = (field.size() > 0) ? 1 : -1;
+        for (char c : field) {
+            unsigned digit = (unsigned) (c - '0');
+            if (c < '0' || c > '9' || number > (UINT_MAX - digit) / 10) {
+                s.parsed[Reg] = -1;
+                break;
+            }
+            number = number * 10 + digit;
+        }
+        s.numbers[Reg] = number;
+    }
+    return s.parsed[Reg] > 0;
+}
+
+/**
+ * Parse a field as an address, the first time it is needed, like
+ * vm_trie_lookup() does.
+ * @param s Record state.
+ * @returns Non zero if the field holds an address.
+ */
+template<unsigned Reg, typename State>
+bool rule_address(State &s) noexcept
+{
+    if (!s.looked[Reg]) {
+        std::string_view field = rule_field<Reg>(*s.current);
+        unsigned char *addr = s.addrs[Reg];
+        char buf[64];
+
+        s.looked[Reg] = -1;
+        if (field.size() < sizeof (buf) &&
+            !std::memchr(field.data(), '\0', field.size())) {
+            std::memcpy(buf, field.data(), field.size());
+            buf[field.size()] = '\0';
+            if (inet_pton(AF_INET, buf, addr + 12) == 1) {
+                std::memset(addr, 0, 10);
+                addr[10] = addr[11] = 0xff;
+                s.looked[Reg] = 1;
+            } else if (inet_pton(AF_INET6, buf, addr) == 1) {
+                s.looked[Reg] = 1;
+            }
+        }
+    }
+    return s.looked[Reg] > 0;
+}
+
+/**
+ * Test whether an address belongs to a network.
+ * @param addr Address.
+ * @param net Network.
+ * @returns Non zero if it does.
+ */
+inline bool rule_net_contains(const unsigned char *addr,
+                              const rule_net &net) noexcept
+{
+    unsigned bytes = net.len / 8, bits = net.len % 8;
+
+    if (std::memcmp(addr, net.addr, bytes) != 0) {
+        return false;
+    }
+    return bits == 0 ||
+           ((addr[bytes] ^ net.addr[bytes]) &
+            (unsigned char) (0xff << (8 - bits))) == 0;
+}
+
+/**
+ * Test a field against the strings of a set.
+ * @param field Field.
+ * @returns Non zero if the field equals one of them.
+ */
+template<const auto &Rules, unsigned First, std::size_t... I>
+bool rule_in(std::string_view field, std::index_sequence<I...>) noexcept
+{
+    return (... || (field == Rules.view(Rules.strings[First + I].offset,
+                                        Rules.strings[First + I].len)));
+}
+
+/**
+ * Run a comparison.
+ * @param s Record state.
+ * @returns The trueflag.
+ */
+template<const auto &Rules, unsigned Pc, typename State>
+bool rule_test(State &s) noexcept
+{
+    constexpr rule_insn insn = Rules.code[Pc];
+    constexpr std::string_view string = Rules.view(insn.string, insn.len);
+    std::string_view field = rule_field<insn.reg>(*s.current);
+
+    if constexpr (insn.opcode == VM_EQ) {
+        return field == string;
+    } else if constexpr (insn.opcode == VM_MAG) {
+        return field.compare(string) > 0;
+    } else if constexpr (insn.opcode == VM_MIN) {
+        return field.compare(string) < 0;
+    } else if constexpr (insn.opcode == VM_MAEQ) {
+        return field.compare(string) >= 0;
+    } else if constexpr (insn.opcode == VM_MIEQ) {
+        return field.compare(string) <= 0;
+    } else if constexpr (insn.opcode == VM_NEQ) {
+        return field != string;
+    } else if constexpr (insn.opcode == VM_IEQ) {
+        return rule_number<insn.reg>(s) && s.numbers[insn.reg] == insn.arg;
+    } else if constexpr (insn.opcode == VM_IMAG) {
+        return rule_number<insn.reg>(s) && s.numbers[insn.reg] > insn.arg;
+    } else if constexpr (insn.opcode == VM_IMIN) {
+        return rule_number<insn.reg>(s) && s.numbers[insn.reg] < insn.arg;
+    } else if constexpr (insn.opcode == VM_IMAEQ) {
+        return rule_number<insn.reg>(s) && s.numbers[insn.reg] >= insn.arg;
+    } else if constexpr (insn.opcode == VM_IMIEQ) {
+        return rule_number<insn.reg>(s) && s.numbers[insn.reg] <= insn.arg;
+    } else if constexpr (insn.opcode == VM_INEQ) {
+        return !rule_number<insn.reg>(s) || s.numbers[insn.reg] != insn.arg;
+    } else if constexpr (insn.opcode == VM_IN) {
+        return rule_in<Rules, insn.arg>(field,
+                                        std::make_index_sequence<insn.len>());
+    } else if constexpr (insn.opcode == VM_MATCH) {
+        return rule_glob_match(string, field);
+    } else {
+        static_assert(insn.opcode == VM_INNET, "not a comparison");
+        return rule_address<insn.reg>(s) &&
+               rule_net_contains(s.addrs[insn.reg], Rules.nets[insn.arg]);
+    }
+}
+
+/**
+ * Run the instruction at an offset, and the ones that follow it, like
+ * vm_run_function() does.
+ * @param s Record state.
+ * @param trueflag Outcome of the last comparison.
+ * @returns Non zero if the record is done, in first match mode.
+ */
+template<const auto &Rules, unsigned Pc, typename State>
+bool rule_run(State &s, bool trueflag)
+{
+    constexpr rule_insn insn = Rules.code[Pc];
+
+    if constexpr (insn.opcode == VM_NOP) {
+        return rule_run<Rules, Pc + 1>(s, trueflag);
+    } else if constexpr (insn.opcode == VM_EXEC) {
+        (*s.sink)(*s.current, s.function, Rules.view(insn.string, insn.len));
+        if constexpr (Rules.first) {
+            return true;
+        } else {
+            return rule_run<Rules, Pc + 1>(s, trueflag);
+        }
+    } else if constexpr (insn.opcode == VM_CALL) {
+        if (rule_run<Rules, Rules.got[insn.arg].start>(s, false)) {
+            return true;
+        }
+        return rule_run<Rules, Pc + 1>(s, trueflag);
+    } else if constexpr (insn.opcode == VM_JTRUE) {
+        if (trueflag) {
+            return rule_run<Rules, insn.arg>(s, trueflag);
+        }
+        return rule_run<Rules, Pc + 1>(s, trueflag);
+    } else if constexpr (insn.opcode == VM_JFALSE) {
+        if (!trueflag) {
+            return rule_run<Rules, insn.arg>(s, trueflag);
+        }
+        return rule_run<Rules, Pc + 1>(s, trueflag);
+    } else if constexpr (insn.opcode == VM_JMP) {
+        return rule_run<Rules, insn.arg>(s, trueflag);
+    } else if constexpr (insn.opcode == VM_RETURN) {
+        return false;
+    } else {
+        return rule_run<Rules, Pc + 1>(s, rule_test<Rules, Pc>(s));
+    }
+}
+
+/**
+ * Run a function of the global offset table, unless it is static.
+ * @param s Record state.
+ * @returns Non zero if the record is done, in first match mode.
+ */
+template<const auto &Rules, std::size_t I, typename State>
+bool rule_top(State &s)
+{
+    constexpr rule_function f = Rules.got[I];
+
+    if constexpr (f.local) {
+        return false;
+    } else {
+        s.function = Rules.view(f.name, f.len);
+        return rule_run<Rules, f.start>(s, false);
+    }
+}
+
+/**
+ * Filter a record through all the non static functions.
+ * @param s Record state.
+ */
+template<const auto &Rules, typename State, std::size_t... I>
+void rule_record(State &s, std::index_sequence<I...>)
+{
+    (void) (... || rule_top<Rules, I>(s));
+}
+
+} // namespace detail
+
+/**
+ * Compile rules, at compile time when the result is constexpr.
+ * @param source Rules, in the language of the compiler.
+ * @param first Non zero for first match mode.
+ * @returns The compiled rules.
+ * @throws std::invalid_argument if the rules are not valid, which is a
+ *         compile error during constant evaluation.
+ */
+template<std::size_t N>
+constexpr rules<N> compile(const char (&source)[N], bool first = false)
+{
+    rules<N> out;
+    out.first = first;
+    detail::rule_compiler<N> compiler(source, out);
+    compiler.run();
+    return out;
+}
+
+/**
+ * Filter records through compiled rules, like program::evaluate().
+ * @param records Records to filter.
+ * @param sink Called as sink(record, function, command) for each exec.
+ */
+template<const auto &Rules, typename Sink>
+void evaluate(record_span records, Sink &&sink)
+{
+    using sink_type = std::remove_reference_t<Sink>;
+
+    for (const record &r : records) {
+        detail::rule_state<sink_type> s;
+        s.sink = &sink;
+        s.current = &r;
+        detail::rule_record<Rules>(
+            s, std::make_index_sequence<Rules.got_count>());
+    }
+}
+
+} // namespace ucc
+
+/**
+ * @}
+ */
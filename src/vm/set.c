@@ -0,0 +1,172 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/set.c
+ * Perfect hashing of constant pool sets.
+ */
+
+#include<vm/vm.h>
+
+/**
+ * @defgroup vmset Perfect hashing
+ * @ingroup vm
+ * @{
+ * We use the <i>hash and displace</i> technique. Strings are first split
+ * into N buckets, where N is the number of strings, using a hash with the
+ * default seed. Then buckets are processed from the biggest to the
+ * smallest: for each bucket we look for a seed (the displacement) that
+ * maps all its strings into free slots of the table, and we store it in
+ * the displacements vector. Buckets with a single string don't need a
+ * seed: we put the string into any free slot, and we store the slot
+ * number, as a negative value, in place of the displacement.
+ *
+ * Lookup computes the bucket, reads its displacement and computes the
+ * slot: then, one strcmp() tells whether the string belongs to the set.
+ */
+
+/**
+ * Hash a string (FNV-1a with seed). Low bits of FNV depend on low bits
+ * of the seed only, so we mix the result before returning it: otherwise
+ * most seeds would map a bucket in the same way.
+ * @param seed Seed, zero means default seed.
+ * @param s String to hash.
+ * @param len Length of @a s.
+ * @returns Hash value.
+ */
+static unsigned vm_set_hash(unsigned seed, const char *s, size_t len)
+{
+    unsigned hashval = (seed) ? seed : 0x01000193;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hashval = (hashval ^ (unsigned char) s[i]) * 0x01000193;
+    }
+    hashval ^= hashval >> 16;
+    hashval *= 0x85ebca6b;
+    hashval ^= hashval >> 13;
+    hashval *= 0xc2b2ae35;
+    hashval ^= hashval >> 16;
+    return hashval;
+}
+
+/** Hash bucket, used while building the perfect hash. */
+typedef struct vm_set_bucket {
+    /** Bucket number. */
+    unsigned index;
+    /** Number of strings in the bucket. */
+    unsigned count;
+    /** Offset of the first string of this bucket in sorted vector. */
+    unsigned first;
+} vm_set_bucket;
+
+/**
+ * Compare two buckets by decreasing size, for qsort().
+ * @param a Pointer to first bucket.
+ * @param b Pointer to second bucket.
+ * @returns Less than, equal to or greater than zero.
+ */
+static int vm_set_bucket_compare(const void *a, const void *b)
+{
+    const vm_set_bucket *x = a, *y = b;
+
+    if (x->count != y->count) {
+        return (x->count > y->count) ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @}
+ */
+
+void vm_set_build(vm_set *set)
+{
+    unsigned n = set->count, i, j, k, free_slot;
+    vm_set_bucket *buckets = vm_alloc(n * sizeof (vm_set_bucket));
+    unsigned *slots = vm_alloc(n * sizeof (unsigned));
+    char **sorted = vm_alloc(n * sizeof (char *));
+    char **table = vm_alloc(n * sizeof (char *));
+
+    set->displacements = vm_alloc(n * sizeof (int));
+
+    /* Split strings into buckets, and sort them by bucket. */
+    for (i = 0; i < n; ++i) {
+        buckets[i].index = i;
+    }
+    for (i = 0; i < n; ++i) {
+        buckets[vm_set_hash(0, set->table[i], strlen(set->table[i])) % n]
+            .count++;
+    }
+    for (i = 0, k = 0; i < n; ++i) {
+        buckets[i].first = k;
+        k += buckets[i].count;
+        buckets[i].count = 0;
+    }
+    for (i = 0; i < n; ++i) {
+        vm_set_bucket *b = &buckets[vm_set_hash(0, set->table[i],
+                                                strlen(set->table[i])) % n];
+        sorted[b->first + b->count++] = set->table[i];
+    }
+    qsort(buckets, n, sizeof (vm_set_bucket), vm_set_bucket_compare);
+
+    /* Find a displacement for each bucket with more than one string. */
+    for (i = 0; i < n && buckets[i].count > 1; ++i) {
+        vm_set_bucket *b = &buckets[i];
+        unsigned seed = 1;
+
+        for (j = 0; j < b->count; ) {
+            slots[j] = vm_set_hash(seed, sorted[b->first + j],
+                                   strlen(sorted[b->first + j])) % n;
+            for (k = 0; k < j && slots[k] != slots[j]; ++k)
+                ;
+            if (table[slots[j]] != NULL || k < j) {
+                ++seed, j = 0;
+            } else {
+                ++j;
+            }
+        }
+        for (j = 0; j < b->count; ++j) {
+            table[slots[j]] = sorted[b->first + j];
+        }
+        set->displacements[b->index] = (int) seed;
+    }
+
+    /* Put remaining single string buckets into free slots. */
+    for (free_slot = 0; i < n && buckets[i].count == 1; ++i) {
+        while (table[free_slot] != NULL) {
+            ++free_slot;
+        }
+        table[free_slot] = sorted[buckets[i].first];
+        set->displacements[buckets[i].index] = -(int) free_slot - 1;
+    }
+
+    free(set->table);
+    set->table = table;
+    free(sorted);
+    free(slots);
+    free(buckets);
+}
+
+int vm_set_contains(const vm_set *set, const char *string, size_t len)
+{
+    int d = set->displacements[vm_set_hash(0, string, len) % set->count];
+    unsigned slot = (d < 0) ? (unsigned) (-d - 1)
+                            : vm_set_hash((unsigned) d, string, len) %
+                                  set->count;
+    return strnlen(set->table[slot], len + 1) == len &&
+           memcmp(set->table[slot], string, len) == 0;
+}
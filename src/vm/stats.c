@@ -0,0 +1,279 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/stats.c
+ * Hit counters in shared memory.
+ */
+
+#include<vm/vm.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+
+/**
+ * @defgroup vmstats Hit counters
+ * @ingroup vm
+ * @{
+ * Counters live in a file mapped in shared memory, so that another
+ * process, e.g. <b>uccstat</b>, can read them while the program runs.
+ * The file starts with a header, followed by the names of the counters
+ * and by one block of counters for each thread. Each block starts on its
+ * own cache line and takes a whole number of them, so that a thread
+ * bumps its counters with plain increments, without atomic instructions
+ * and without sharing cache lines with the others. Readers sum the
+ * blocks of all threads: a counter may be read while it is being
+ * incremented, which is harmless for statistics.
+ *
+ * There is one counter for each function in the global offset table,
+ * counting how many times the function was entered, either by vm_run()
+ * or by a call, followed by one for each <code>VM_EXEC</code>, in code
+ * order. An exec is named after the function that contains it, its
+ * offset and its command line. Then, there is one more counter for each
+ * exec, that the caller bumps when it sheds the command under overload,
+ * rather than executing it, using the exec number left in vm_probe; the
+ * shed counters have no names of their own. Last, there are
+ * VM_STATS_WAITS counters of the commands that the caller runs, by how
+ * long they waited in its queue, in powers of two of microseconds, from
+ * which readers get the percentiles of the wait.
+ */
+
+/** Magic string at the beginning of a counters file. */
+#define VM_STATS_MAGIC "uccstat3"
+
+/** Number of counters in a cache line. */
+#define VM_STATS_LINE (64 / sizeof (unsigned long long))
+
+/** Header of a counters file. */
+struct vm_stats_header {
+    /** Magic string, VM_STATS_MAGIC. */
+    char magic[8];
+    /** Number of threads. */
+    unsigned threads;
+    /** Number of function counters. */
+    unsigned functions;
+    /** Number of exec counters. */
+    unsigned execs;
+    /** Number of counters in the block of each thread. */
+    unsigned stride;
+    /** Offset of the names, NUL terminated and in counter order. */
+    unsigned names;
+    /** Offset of the counters of the first thread. */
+    unsigned counters;
+};
+
+/**
+ * Get the name of the function that contains an instruction.
+ * @param program Loaded program.
+ * @param pc Instruction offset.
+ * @returns The function name.
+ */
+static const char *vm_stats_owner(const vm_program *program, unsigned pc)
+{
+    if (program->got_count == 0) {
+        return "?";
+    }
+    return program->got[vm_program_function(program, pc)].name;
+}
+
+/**
+ * Map a counters file, and index its names.
+ * @param fd Open file.
+ * @param prot Protection, as for mmap().
+ * @returns The counters, or NULL if the file is not valid.
+ */
+static vm_stats *vm_stats_map(int fd, int prot)
+{
+    struct vm_stats_header *header;
+    vm_stats *stats;
+    const char *name, *end;
+    unsigned i, count;
+    off_t size;
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t) sizeof (*header)) {
+        return NULL;
+    }
+    header = mmap(NULL, (size_t) size, prot, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        return NULL;
+    }
+    count = header->functions + header->execs;
+    if (memcmp(header->magic, VM_STATS_MAGIC, sizeof (header->magic)) != 0 ||
+        header->stride < count + header->execs + VM_STATS_WAITS ||
+        header->names < sizeof (*header) ||
+        header->names > header->counters || header->counters > size ||
+        header->counters % sizeof (unsigned long long) != 0 ||
+        (size - header->counters) / sizeof (unsigned long long) /
+            header->stride < header->threads)
+    {
+        munmap(header, (size_t) size);
+        return NULL;
+    }
+
+    stats = vm_alloc(sizeof (vm_stats));
+    stats->header = header;
+    stats->size = (size_t) size;
+    stats->names = vm_alloc((count + 1) * sizeof (char *));
+    name = (const char *) header + header->names;
+    end = (const char *) header + header->counters;
+    for (i = 0; i < count; ++i) {
+        stats->names[i] = name;
+        name = memchr(name, '\0', (size_t) (end - name));
+        if (!name) {
+            vm_stats_destroy(stats);
+            return NULL;
+        }
+        ++name;
+    }
+    return stats;
+}
+
+/**
+ * @}
+ */
+
+vm_stats *vm_stats_create(const char *path, const vm_program *program,
+                          unsigned threads)
+{
+    struct vm_stats_header header;
+    char *names, *cursor;
+    size_t size = 0;
+    vm_stats *stats;
+    unsigned i;
+    int fd, ok;
+
+    /* Write the names first, and map the file when it is complete. */
+    for (i = 0; i < program->got_count; ++i) {
+        size += strlen(program->got[i].name) + 1;
+    }
+    for (i = 0; i < program->code_count; ++i) {
+        if (program->code[i].opcode == VM_EXEC) {
+            size += strlen(vm_stats_owner(program, i)) +
+                    strlen(program->code[i].string) + 16;
+        }
+    }
+    cursor = names = vm_alloc(size + 1);
+    for (i = 0; i < program->got_count; ++i) {
+        cursor += sprintf(cursor, "%s", program->got[i].name) + 1;
+    }
+    for (i = 0; i < program->code_count; ++i) {
+        if (program->code[i].opcode == VM_EXEC) {
+            cursor += sprintf(cursor, "%s:%u \"%s\"",
+                              vm_stats_owner(program, i),
+                              i, program->code[i].string) + 1;
+        }
+    }
+    size = (size_t) (cursor - names);
+
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, VM_STATS_MAGIC, sizeof (header.magic));
+    header.threads = (threads) ? threads : 1;
+    header.functions = program->got_count;
+    header.execs = program->exec_count;
+    /* Round up to whole cache lines. */
+    header.stride = (header.functions + 2 * header.execs + VM_STATS_WAITS +
+                     VM_STATS_LINE - 1) / VM_STATS_LINE * VM_STATS_LINE;
+    header.names = sizeof (header);
+    header.counters = (unsigned) ((header.names + size + 63) / 64 * 64);
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = fd != -1 &&
+         ftruncate(fd, (off_t) header.counters + (off_t) header.threads *
+                       header.stride * sizeof (unsigned long long)) != -1 &&
+         pwrite(fd, &header, sizeof (header), 0) == sizeof (header) &&
+         pwrite(fd, names, size, header.names) == (ssize_t) size;
+    free(names);
+    stats = (ok) ? vm_stats_map(fd, PROT_READ | PROT_WRITE) : NULL;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!stats) {
+        fprintf(stderr, "vm: can't create counters file %s\n", path);
+    }
+    return stats;
+}
+
+vm_stats *vm_stats_open(const char *path)
+{
+    vm_stats *stats;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "vm: can't open counters file %s\n", path);
+        return NULL;
+    }
+    stats = vm_stats_map(fd, PROT_READ);
+    close(fd);
+    if (!stats) {
+        fprintf(stderr, "vm: invalid counters file %s\n", path);
+    }
+    return stats;
+}
+
+void vm_stats_destroy(vm_stats *stats)
+{
+    munmap(stats->header, stats->size);
+    free(stats->names);
+    free(stats);
+}
+
+unsigned vm_stats_functions(const vm_stats *stats)
+{
+    return stats->header->functions;
+}
+
+unsigned vm_stats_execs(const vm_stats *stats)
+{
+    return stats->header->execs;
+}
+
+unsigned vm_stats_wait(unsigned long long usec)
+{
+    unsigned wait = 0;
+
+    while (usec > 0 && wait < VM_STATS_WAITS - 1) {
+        usec >>= 1;
+        ++wait;
+    }
+    return wait;
+}
+
+unsigned long long *vm_stats_counters(vm_stats *stats, unsigned thread)
+{
+    const struct vm_stats_header *header = stats->header;
+    char *base = (char *) stats->header + header->counters;
+
+    if (thread >= header->threads) {
+        return NULL;
+    }
+    return (unsigned long long *) base + thread * header->stride;
+}
+
+unsigned long long vm_stats_total(const vm_stats *stats, unsigned index)
+{
+    const struct vm_stats_header *header = stats->header;
+    const unsigned long long *counters = (const unsigned long long *)
+        ((const char *) stats->header + header->counters);
+    unsigned long long total = 0;
+    unsigned i;
+
+    for (i = 0; i < header->threads; ++i) {
+        total += counters[i * header->stride + index];
+    }
+    return total;
+}
@@ -0,0 +1,204 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/trace.c
+ * Sampled execution traces in shared memory.
+ */
+
+#include<vm/vm.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+
+/**
+ * @defgroup vmtrace Execution traces
+ * @ingroup vm
+ * @{
+ * Traces live in a file mapped in shared memory, with a ring of words
+ * for each thread, so that another process, e.g. <b>ucctrace</b>, can
+ * read them while the program runs. Each ring has a single writer, the
+ * thread that owns it, which stores a word and then advances the ring
+ * head with release ordering. A reader copies the last words of the
+ * ring, then reads the head again: the words that the writer may have
+ * overwritten in the meanwhile are thrown away. No lock is needed, and
+ * the writer never waits for readers.
+ *
+ * A sampled record is written as VM_TRACE_RECORD, followed by the number
+ * of the record, counting from zero for each vm_probe, followed by one
+ * word for each instruction that was executed: the instruction offset,
+ * shifted left by one, and the trueflag as it was before executing the
+ * instruction. Hence the outcome of a comparison is the low bit of the
+ * word that follows it.
+ */
+
+/** Magic string at the beginning of a traces file. */
+#define VM_TRACE_MAGIC "ucctrc1"
+
+/** Header of a traces file. */
+struct vm_traces_header {
+    /** Magic string, VM_TRACE_MAGIC. */
+    char magic[8];
+    /** Number of threads. */
+    unsigned threads;
+    /** Number of words of each ring, a power of two. */
+    unsigned size;
+};
+
+/**
+ * Get the size of the ring of each thread, including its header.
+ * @param size Number of words of the ring.
+ * @returns Size in bytes, a multiple of the cache line size.
+ */
+static size_t vm_trace_bytes(unsigned size)
+{
+    return (sizeof (vm_trace) + size * sizeof (unsigned) + 63) / 64 * 64;
+}
+
+/**
+ * Map a traces file.
+ * @param fd Open file.
+ * @param prot Protection, as for mmap().
+ * @returns The traces, or NULL if the file is not valid.
+ */
+static vm_traces *vm_traces_map(int fd, int prot)
+{
+    struct vm_traces_header *header;
+    vm_traces *traces;
+    off_t size;
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 64) {
+        return NULL;
+    }
+    header = mmap(NULL, (size_t) size, prot, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        return NULL;
+    }
+    if (memcmp(header->magic, VM_TRACE_MAGIC, sizeof (header->magic)) != 0 ||
+        header->size == 0 || (header->size & (header->size - 1)) != 0 ||
+        (size - 64) / vm_trace_bytes(header->size) < header->threads)
+    {
+        munmap(header, (size_t) size);
+        return NULL;
+    }
+    traces = vm_alloc(sizeof (vm_traces));
+    traces->header = header;
+    traces->size = (size_t) size;
+    return traces;
+}
+
+/**
+ * @}
+ */
+
+vm_traces *vm_traces_create(const char *path, unsigned threads,
+                            unsigned size)
+{
+    struct vm_traces_header header;
+    vm_traces *traces;
+    unsigned i, n = 1;
+    int fd, ok;
+
+    while (n < size) {
+        n *= 2;
+    }
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, VM_TRACE_MAGIC, sizeof (header.magic));
+    header.threads = (threads) ? threads : 1;
+    header.size = n;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = fd != -1 &&
+         ftruncate(fd, (off_t) (64 + header.threads * vm_trace_bytes(n))) !=
+             -1 &&
+         pwrite(fd, &header, sizeof (header), 0) == sizeof (header);
+    traces = (ok) ? vm_traces_map(fd, PROT_READ | PROT_WRITE) : NULL;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!traces) {
+        fprintf(stderr, "vm: can't create traces file %s\n", path);
+        return NULL;
+    }
+    for (i = 0; i < header.threads; ++i) {
+        vm_traces_ring(traces, i)->size = n;
+    }
+    return traces;
+}
+
+vm_traces *vm_traces_open(const char *path)
+{
+    vm_traces *traces;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "vm: can't open traces file %s\n", path);
+        return NULL;
+    }
+    traces = vm_traces_map(fd, PROT_READ);
+    close(fd);
+    if (!traces) {
+        fprintf(stderr, "vm: invalid traces file %s\n", path);
+    }
+    return traces;
+}
+
+void vm_traces_destroy(vm_traces *traces)
+{
+    munmap(traces->header, traces->size);
+    free(traces);
+}
+
+unsigned vm_traces_threads(const vm_traces *traces)
+{
+    return traces->header->threads;
+}
+
+vm_trace *vm_traces_ring(vm_traces *traces, unsigned thread)
+{
+    if (thread >= traces->header->threads) {
+        return NULL;
+    }
+    return (vm_trace *) ((char *) traces->header + 64 +
+                         thread * vm_trace_bytes(traces->header->size));
+}
+
+unsigned vm_trace_read(const vm_trace *trace, unsigned *words)
+{
+    unsigned long long head, first, again;
+    unsigned size = trace->size, i;
+
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    first = (head > size) ? head - size : 0;
+    for (i = 0; first + i < head; ++i) {
+        words[i] = trace->words[(first + i) & (size - 1)];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* Throw away what the writer may have overwritten while we copied. */
+    again = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    if (again > size && again - size > first) {
+        unsigned lost = (unsigned) (again - size - first);
+        if (lost >= i) {
+            return 0;
+        }
+        memmove(words, words + lost, (i - lost) * sizeof (unsigned));
+        i -= lost;
+    }
+    return i;
+}
@@ -0,0 +1,361 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/trie.c
+ * Radix trie for network matching.
+ */
+
+#include<vm/vm.h>
+#include<arpa/inet.h>
+
+/**
+ * @defgroup vmtrie Network matching
+ * @ingroup vm
+ * @{
+ * All the networks referenced by <code>VM_INNET</code> instructions are
+ * stored into one compressed binary radix trie (a Patricia trie), where
+ * each node is a prefix and only nodes where two branches fork, or where
+ * a network ends, are kept. IPv4 networks are stored as IPv4-mapped IPv6
+ * networks (<code>::ffff:0:0/96</code>), so that one trie serves both
+ * address families.
+ *
+ * The networks that contain an address are exactly the networks found
+ * walking the trie from the root towards the address. For this reason,
+ * when the trie is built, each node gets a bit vector of all the networks
+ * that end in it or in one of its ancestors: a lookup just returns the
+ * bit vector of the deepest node that matches the address, and testing
+ * a network is testing a bit.
+ */
+
+/** Number of bytes of an address. */
+#define VM_ADDR_BYTES 16
+
+/** Number of bits of an address. */
+#define VM_ADDR_BITS (8 * VM_ADDR_BYTES)
+
+/**
+ * Get a bit of an address.
+ * @param addr Address.
+ * @param bit Bit number, zero is the most significant one.
+ * @returns The bit value.
+ */
+static inline unsigned vm_addr_bit(const unsigned char *addr, unsigned bit)
+{
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/**
+ * Check whether two addresses share the first @a len bits.
+ * @param a Address.
+ * @param b Address.
+ * @param len Prefix length.
+ * @returns Non zero if the prefixes are equal.
+ */
+static int vm_addr_prefix_equal(const unsigned char *a, const unsigned char *b,
+                                unsigned len)
+{
+    unsigned char mask;
+
+    if (memcmp(a, b, len / 8) != 0) {
+        return 0;
+    }
+    if (len % 8 == 0) {
+        return 1;
+    }
+    mask = (unsigned char) (0xff << (8 - len % 8));
+    return ((a[len / 8] ^ b[len / 8]) & mask) == 0;
+}
+
+/**
+ * Compute the length of the common prefix of two addresses.
+ * @param a Address.
+ * @param b Address.
+ * @param max Maximum length to consider.
+ * @returns Common prefix length.
+ */
+static unsigned vm_addr_common(const unsigned char *a, const unsigned char *b,
+                               unsigned max)
+{
+    unsigned len = 0;
+
+    while (len < max && vm_addr_bit(a, len) == vm_addr_bit(b, len)) {
+        ++len;
+    }
+    return len;
+}
+
+/**
+ * Parse an address, mapping IPv4 addresses into IPv6.
+ * @param string Address to parse.
+ * @param addr In output, the address.
+ * @param plen In output, the address length in bits, as written.
+ * @returns Non zero on success.
+ */
+static int vm_addr_parse(const char *string, unsigned char *addr,
+                         unsigned *plen)
+{
+    static const unsigned char mapped[12] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+    };
+
+    if (inet_pton(AF_INET, string, addr + 12) == 1) {
+        memcpy(addr, mapped, sizeof (mapped));
+        *plen = 32;
+        return 1;
+    }
+    if (inet_pton(AF_INET6, string, addr) == 1) {
+        *plen = VM_ADDR_BITS;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Parse a network, written as address/length.
+ * @param string Network to parse.
+ * @param addr In output, the network address with host bits cleared.
+ * @param len In output, the prefix length, as an IPv6 prefix.
+ * @returns Non zero on success.
+ */
+static int vm_net_parse(const char *string, unsigned char *addr,
+                        unsigned *len)
+{
+    char buf[64], *slash, *end;
+    unsigned plen, bits, i;
+
+    if (strlen(string) >= sizeof (buf)) {
+        return 0;
+    }
+    strcpy(buf, string);
+    slash = strchr(buf, '/');
+    if (slash) {
+        *slash++ = '\0';
+    }
+    if (!vm_addr_parse(buf, addr, &plen)) {
+        return 0;
+    }
+    bits = plen;
+    if (slash) {
+        bits = (unsigned) strtoul(slash, &end, 10);
+        if (*slash == '\0' || *end != '\0' || bits > plen) {
+            return 0;
+        }
+    }
+    *len = VM_ADDR_BITS - plen + bits;
+
+    /* Clear host bits. */
+    for (i = *len; i < VM_ADDR_BITS; ++i) {
+        addr[i / 8] &= (unsigned char) ~(1 << (7 - i % 8));
+    }
+    return 1;
+}
+
+/**
+ * Allocate a trie node.
+ * @param trie Trie.
+ * @param addr Node prefix.
+ * @param len Node prefix length.
+ * @returns Index of the new node.
+ */
+static int vm_trie_node_create(vm_trie *trie, const unsigned char *addr,
+                               unsigned len)
+{
+    vm_trie_node *node;
+
+    if (trie->count >= trie->size) {
+        trie->size = (trie->size) ? 2 * trie->size : 64;
+        trie->nodes = realloc(trie->nodes, trie->size * sizeof (vm_trie_node));
+        if (!trie->nodes) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    node = &trie->nodes[trie->count];
+    memset(node, 0, sizeof (*node));
+    memcpy(node->addr, addr, VM_ADDR_BYTES);
+    node->len = len;
+    node->child[0] = node->child[1] = -1;
+    return (int) trie->count++;
+}
+
+/**
+ * Insert a network into the trie.
+ * @param trie Trie.
+ * @param addr Network address.
+ * @param len Prefix length.
+ * @returns Index of the node where the network ends.
+ */
+static int vm_trie_insert(vm_trie *trie, const unsigned char *addr,
+                          unsigned len)
+{
+    int n = 0;
+
+    for (;;) {
+        unsigned bit, common;
+        int c, mid;
+
+        if (trie->nodes[n].len == len) {
+            return n;
+        }
+        bit = vm_addr_bit(addr, trie->nodes[n].len);
+        c = trie->nodes[n].child[bit];
+        if (c < 0) {
+            c = vm_trie_node_create(trie, addr, len);
+            trie->nodes[n].child[bit] = c;
+            return c;
+        }
+
+        common = vm_addr_common(addr, trie->nodes[c].addr,
+                                (len < trie->nodes[c].len)
+                                    ? len : trie->nodes[c].len);
+        if (common == trie->nodes[c].len) {
+            n = c;
+            continue;
+        }
+
+        /* Split the edge towards c with a node for the common prefix. */
+        mid = vm_trie_node_create(trie, addr, common);
+        trie->nodes[mid].child[vm_addr_bit(trie->nodes[c].addr, common)] = c;
+        trie->nodes[n].child[bit] = mid;
+        if (common == len) {
+            return mid;
+        }
+        c = vm_trie_node_create(trie, addr, len);
+        trie->nodes[mid].child[vm_addr_bit(addr, common)] = c;
+        return c;
+    }
+}
+
+/**
+ * Propagate the matches bit vector of a node to its descendants.
+ * @param trie Trie.
+ * @param n Node index.
+ */
+static void vm_trie_fill(vm_trie *trie, int n)
+{
+    const unsigned long *matches = &trie->matches[(unsigned) n * trie->words];
+    unsigned i, w;
+
+    for (i = 0; i < 2; ++i) {
+        int c = trie->nodes[n].child[i];
+        if (c >= 0) {
+            unsigned long *child = &trie->matches[(unsigned) c * trie->words];
+            for (w = 0; w < trie->words; ++w) {
+                child[w] |= matches[w];
+            }
+            vm_trie_fill(trie, c);
+        }
+    }
+}
+
+/**
+ * @}
+ */
+
+int vm_trie_build(vm_program *program)
+{
+    vm_trie *trie = &program->trie;
+    unsigned char zero[VM_ADDR_BYTES], addr[VM_ADDR_BYTES];
+    char **nets = NULL;
+    unsigned i, j, len;
+    int *owner;
+
+    /* Number the distinct networks referenced by the program. */
+    for (i = 0; i < program->code_count; ++i) {
+        vm_insn *insn = &program->code[i];
+        if (insn->opcode != VM_INNET) {
+            continue;
+        }
+        for (j = 0; j < trie->nnets; ++j) {
+            if (strcmp(nets[j], insn->string) == 0) {
+                break;
+            }
+        }
+        if (j == trie->nnets) {
+            nets = realloc(nets, (trie->nnets + 1) * sizeof (char *));
+            if (!nets) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            nets[trie->nnets++] = insn->string;
+        }
+        insn->arg = j;
+    }
+    if (trie->nnets == 0) {
+        return 1;
+    }
+
+    memset(zero, 0, sizeof (zero));
+    vm_trie_node_create(trie, zero, 0);
+    owner = vm_alloc(trie->nnets * sizeof (int));
+    for (i = 0; i < trie->nnets; ++i) {
+        if (!vm_net_parse(nets[i], addr, &len)) {
+            fprintf(stderr, "vm: invalid network \"%s\"\n", nets[i]);
+            free(owner);
+            free(nets);
+            return 0;
+        }
+        owner[i] = vm_trie_insert(trie, addr, len);
+    }
+    free(nets);
+
+    trie->words = VM_WORDS(trie->nnets);
+    trie->matches = vm_alloc((trie->count + 1) * trie->words *
+                             sizeof (unsigned long));
+    for (i = 0; i < trie->nnets; ++i) {
+        vm_bit_set(&trie->matches[(unsigned) owner[i] * trie->words], i);
+    }
+    free(owner);
+    vm_trie_fill(trie, 0);
+    return 1;
+}
+
+const unsigned long *vm_trie_lookup(const vm_trie *trie, const char *string,
+                                    size_t len)
+{
+    unsigned char addr[VM_ADDR_BYTES];
+    char buf[64];
+    unsigned plen;
+    int n = 0;
+
+    /* The extra bit vector past the last node is all zeros. Addresses
+     * are short, and inet_pton() wants a terminated copy. */
+    if (len >= sizeof (buf) || memchr(string, '\0', len)) {
+        return &trie->matches[trie->count * trie->words];
+    }
+    memcpy(buf, string, len);
+    buf[len] = '\0';
+    if (!vm_addr_parse(buf, addr, &plen)) {
+        return &trie->matches[trie->count * trie->words];
+    }
+
+    for (;;) {
+        const vm_trie_node *node = &trie->nodes[n];
+        int c;
+
+        if (node->len == VM_ADDR_BITS) {
+            break;
+        }
+        c = node->child[vm_addr_bit(addr, node->len)];
+        if (c < 0 || !vm_addr_prefix_equal(addr, trie->nodes[c].addr,
+                                           trie->nodes[c].len)) {
+            break;
+        }
+        n = c;
+    }
+    return &trie->matches[(unsigned) n * trie->words];
+}
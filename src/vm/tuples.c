@@ -0,0 +1,267 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/tuples.c
+ * Tuple space classifier of exact match functions.
+ */
+
+#include<vm/vm.h>
+
+/**
+ * @defgroup vmtuples Tuple space
+ * @ingroup vm
+ * @{
+ * Many rules just compare a few fields with constants, e.g. hostname,
+ * port and label, and run some commands if they are all equal. The
+ * optimizer emits each of them as a chain of VM_EQ or VM_IEQ, each
+ * followed by a VM_JFALSE to the final VM_RETURN, and then the execs.
+ * Running them one after another costs a comparison, at least, for each
+ * function, while a record may only match the functions whose constants
+ * are its own fields.
+ *
+ * Functions that compare the same registers, the same way, share a
+ * shape: for each shape, a hash table maps the constants, hashed in
+ * register order, to the functions that test them. A record looks up
+ * its own fields in the table of each shape, hence it pays a probe for
+ * each shape rather than a comparison for each function. The functions
+ * it finds run as usual, comparisons included, so that the classifier
+ * only decides which functions to skip, and can't change what runs.
+ *
+ * Fields compared as numbers, with VM_IEQ, are hashed by their value,
+ * so that e.g. <code>022</code> finds the functions that test 22; a
+ * record whose field is not a number finds none of the shapes that
+ * compare that field as a number.
+ */
+
+/**
+ * Recognize an exact match function, and get its shape.
+ * @param program Loaded program.
+ * @param start Entry point of the function.
+ * @param regs In output, registers compared.
+ * @param numbers In output, registers compared as numbers.
+ * @returns Number of comparisons, zero if the function doesn't qualify.
+ */
+static unsigned vm_tuples_shape(const vm_program *program, unsigned start,
+                                unsigned *regs, unsigned *numbers)
+{
+    const vm_insn *code = program->code;
+    unsigned pc = start, count = 0, ret = 0;
+
+    *regs = *numbers = 0;
+    while (pc + 1 < program->code_count &&
+           (code[pc].opcode == VM_EQ || code[pc].opcode == VM_IEQ) &&
+           code[pc + 1].opcode == VM_JFALSE) {
+        if ((*regs & (1U << code[pc].reg)) ||
+            (count > 0 && code[pc + 1].arg != ret)) {
+            return 0;
+        }
+        ret = code[pc + 1].arg;
+        *regs |= 1U << code[pc].reg;
+        if (code[pc].opcode == VM_IEQ) {
+            *numbers |= 1U << code[pc].reg;
+        }
+        count++;
+        pc += 2;
+    }
+    if (count == 0 || ret < pc) {
+        return 0;
+    }
+    for (; pc < ret; ++pc) {
+        if (code[pc].opcode != VM_EXEC) {
+            return 0;
+        }
+    }
+    return (code[ret].opcode == VM_RETURN) ? count : 0;
+}
+
+/**
+ * Get the constants of an exact match function, as the fields and the
+ * numbers of a record that it would match.
+ * @param program Loaded program.
+ * @param start Entry point of the function.
+ * @param fields In output, the string constant of each register.
+ * @param numbers In output, the number constant of each register.
+ */
+static void vm_tuples_constants(const vm_program *program, unsigned start,
+                                vm_field *fields, unsigned *numbers)
+{
+    const vm_insn *insn;
+
+    for (insn = &program->code[start]; insn->opcode != VM_EXEC &&
+         insn->opcode != VM_RETURN; insn += 2) {
+        if (insn->opcode == VM_EQ) {
+            fields[insn->reg].data = insn->string;
+            fields[insn->reg].len = insn->arg;
+        } else {
+            numbers[insn->reg] = insn->arg;
+        }
+    }
+}
+
+/**
+ * Hash the fields of a shape (FNV-1a), in register order.
+ * @param shape Shape.
+ * @param fields Fields, for registers compared as strings.
+ * @param numbers Numbers, for registers compared as numbers.
+ * @returns Hash value.
+ */
+static unsigned vm_tuples_hash(const vm_shape *shape, const vm_field *fields,
+                               const unsigned *numbers)
+{
+    const unsigned char *p;
+    unsigned hash = 0x811c9dc5, reg;
+    size_t i, len;
+
+    for (reg = 0; reg < VM_REGISTERS; ++reg) {
+        if (!(shape->regs & (1U << reg))) {
+            continue;
+        }
+        if (shape->numbers & (1U << reg)) {
+            p = (const unsigned char *) &numbers[reg];
+            len = sizeof (numbers[reg]);
+        } else {
+            p = (const unsigned char *) fields[reg].data;
+            len = fields[reg].len;
+        }
+        for (i = 0; i < len; i++) {
+            hash = (hash ^ p[i]) * 0x01000193;
+        }
+        hash = (hash ^ 0xff) * 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Tell whether a record matches an exact match function.
+ * @param program Loaded program.
+ * @param start Entry point of the function.
+ * @param fields Fields of the record.
+ * @param numbers Numeric values of the fields.
+ * @returns Non zero if all the comparisons of the function hold.
+ */
+static int vm_tuples_equal(const vm_program *program, unsigned start,
+                           const vm_field *fields, const unsigned *numbers)
+{
+    const vm_insn *insn;
+
+    for (insn = &program->code[start]; insn->opcode != VM_EXEC &&
+         insn->opcode != VM_RETURN; insn += 2) {
+        if (insn->opcode == VM_EQ) {
+            if (fields[insn->reg].len != insn->arg ||
+                memcmp(fields[insn->reg].data, insn->string, insn->arg)) {
+                return 0;
+            }
+        } else if (numbers[insn->reg] != insn->arg) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @}
+ */
+
+void vm_program_tuples(vm_program *program)
+{
+    vm_tuples *t;
+    vm_field fields[VM_REGISTERS];
+    unsigned numbers[VM_REGISTERS], regs, nums, f, s, slot, *counts;
+
+    if (program->tuples || program->fused) {
+        return;
+    }
+    t = vm_alloc(sizeof (vm_tuples));
+    t->tuples = vm_alloc((program->got_count + 1) * sizeof (vm_tuple));
+    t->shapes = vm_alloc((program->got_count + 1) * sizeof (vm_shape));
+    t->classified = vm_alloc((VM_WORDS(program->got_count) + 1) *
+                             sizeof (unsigned long));
+    counts = vm_alloc((program->got_count + 1) * sizeof (unsigned));
+
+    for (f = 0; f < program->got_count; ++f) {
+        if (program->got[f].local ||
+            !vm_tuples_shape(program, program->got[f].start, &regs, &nums)) {
+            continue;
+        }
+        for (s = 0; s < t->shape_count; ++s) {
+            if (t->shapes[s].regs == regs && t->shapes[s].numbers == nums) {
+                break;
+            }
+        }
+        if (s == t->shape_count) {
+            t->shapes[s].regs = regs;
+            t->shapes[s].numbers = nums;
+            t->shape_count++;
+        }
+        counts[s]++;
+        t->tuples[t->count].function = f;
+        t->tuples[t->count].shape = s;
+        t->count++;
+        vm_bit_set(t->classified, f);
+        t->regs |= regs;
+        t->numbers |= nums;
+    }
+
+    /* At most half full, so that misses stop early. */
+    for (s = 0; s < t->shape_count; ++s) {
+        for (t->shapes[s].size = 4; t->shapes[s].size < 2 * counts[s];
+             t->shapes[s].size *= 2) {
+        }
+        t->shapes[s].slots = vm_alloc(t->shapes[s].size * sizeof (unsigned));
+    }
+    for (f = 0; f < t->count; ++f) {
+        vm_tuple *tuple = &t->tuples[f];
+        vm_shape *shape = &t->shapes[tuple->shape];
+
+        vm_tuples_constants(program, program->got[tuple->function].start,
+                            fields, numbers);
+        tuple->hash = vm_tuples_hash(shape, fields, numbers);
+        for (slot = tuple->hash & (shape->size - 1); shape->slots[slot];
+             slot = (slot + 1) & (shape->size - 1)) {
+        }
+        shape->slots[slot] = f + 1;
+    }
+    free(counts);
+    program->tuples = t;
+}
+
+void vm_tuples_lookup(const vm_program *program, const vm_field *fields,
+                      const unsigned *numbers, unsigned valid,
+                      unsigned long *matched)
+{
+    const vm_tuples *t = program->tuples;
+    unsigned s, slot, hash;
+
+    for (s = 0; s < t->shape_count; ++s) {
+        const vm_shape *shape = &t->shapes[s];
+
+        if ((shape->numbers & valid) != shape->numbers) {
+            continue;
+        }
+        hash = vm_tuples_hash(shape, fields, numbers);
+        for (slot = hash & (shape->size - 1); shape->slots[slot];
+             slot = (slot + 1) & (shape->size - 1)) {
+            const vm_tuple *tuple = &t->tuples[shape->slots[slot] - 1];
+
+            if (tuple->hash == hash &&
+                vm_tuples_equal(program, program->got[tuple->function].start,
+                                fields, numbers)) {
+                vm_bit_set(matched, tuple->function);
+            }
+        }
+    }
+}
@@ -0,0 +1,231 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/ucc.hpp
+ * Virtual machine C++ interface.
+ */
+
+#pragma once
+#include<vm/vm.h>
+#include<cstddef>
+#include<cstdio>
+#include<stdexcept>
+#include<string_view>
+
+/**
+ * @defgroup vmcxx C++ interface
+ * @ingroup vm
+ * @{
+ * A C++17 interface, header only, for programs that keep record fields
+ * as string views into their own buffers: records are passed to the
+ * virtual machine through vm_run_fields(), with no copy and no heap
+ * allocation per call. Each exec is handed to a sink, that is any
+ * callable taking the record, the function name and the command line.
+ * The sink is called from C code, so it must not throw.
+ */
+
+namespace ucc {
+
+/** Input record, whose fields are mapped on VM registers. */
+struct record {
+    /** Mapped on register $0. */
+    std::string_view monitor_type;
+    /** Mapped on register $1. */
+    std::string_view port;
+    /** Mapped on register $2. */
+    std::string_view group;
+    /** Mapped on register $3. */
+    std::string_view label;
+    /** Mapped on register $4. */
+    std::string_view hostname;
+    /** Mapped on register $5. */
+    std::string_view family;
+};
+
+/**
+ * Contiguous sequence of records, like std::span<const record>, which
+ * converts to it, as does any container with data() and size().
+ */
+class record_span {
+public:
+    /**
+     * Build a span from a pointer and a size.
+     * @param data First record.
+     * @param size Number of records.
+     */
+    record_span(const record *data, std::size_t size) noexcept
+        : data_(data), size_(size) {}
+
+    /**
+     * Build a span over a contiguous container.
+     * @param records Container, e.g. std::vector or std::array.
+     */
+    template<typename Records>
+    record_span(const Records &records) noexcept
+        : data_(records.data()), size_(records.size()) {}
+
+    /** @returns First record. */
+    const record *begin() const noexcept { return data_; }
+
+    /** @returns Past the last record. */
+    const record *end() const noexcept { return data_ + size_; }
+
+private:
+    /** First record. */
+    const record *data_;
+    /** Number of records. */
+    std::size_t size_;
+};
+
+/** Loaded program, owning its vm_program. */
+class program {
+public:
+    /**
+     * Load a program.
+     * @param path File containing compiler or optimizer output.
+     * @param plugins Plugins that provide plugin actions, or nullptr to
+     *        hand plugin commands to the sink, like the others.
+     * @param constants Constants shared with other programs, or nullptr
+     *        for constants of this program only.
+     * @throws std::runtime_error if the program can't be loaded.
+     */
+    explicit program(const char *path, const vm_plugins *plugins = nullptr,
+                     vm_constants *constants = nullptr)
+    {
+        std::FILE *fp = std::fopen(path, "r");
+        if (!fp) {
+            throw std::runtime_error("ucc: can't open program");
+        }
+        program_ = (constants) ? vm_program_load_shared(fp, plugins, constants)
+                               : vm_program_load(fp, plugins);
+        std::fclose(fp);
+        if (!program_) {
+            throw std::runtime_error("ucc: can't load program");
+        }
+    }
+
+    /** Destroy the program. */
+    ~program()
+    {
+        if (program_) {
+            vm_program_destroy(program_);
+        }
+    }
+
+    /**
+     * Take over another program.
+     * @param other Program, left empty.
+     */
+    program(program &&other) noexcept : program_(other.program_)
+    {
+        other.program_ = nullptr;
+    }
+
+    /**
+     * Take over another program, destroying ours.
+     * @param other Program, left empty.
+     * @returns This program.
+     */
+    program &operator=(program &&other) noexcept
+    {
+        if (this != &other) {
+            if (program_) {
+                vm_program_destroy(program_);
+            }
+            program_ = other.program_;
+            other.program_ = nullptr;
+        }
+        return *this;
+    }
+
+    program(const program &) = delete;
+    program &operator=(const program &) = delete;
+
+    /** @returns The loaded program, for the C interface. */
+    const vm_program *get() const noexcept { return program_; }
+
+    /**
+     * Filter records through the program, like vm_run(). A program may be
+     * shared among threads, each with its own probe.
+     * @param records Records to filter.
+     * @param sink Called as sink(record, function, command) for each exec.
+     * @param probe Instrumentation of the calling thread, or nullptr.
+     */
+    template<typename Sink>
+    void evaluate(record_span records, Sink &&sink,
+                  vm_probe *probe = nullptr) const
+    {
+        context<Sink> ctx{&sink, nullptr};
+        vm_field fields[VM_REGISTERS];
+
+        for (const record &r : records) {
+            set(fields[0], r.monitor_type);
+            set(fields[1], r.port);
+            set(fields[2], r.group);
+            set(fields[3], r.label);
+            set(fields[4], r.hostname);
+            set(fields[5], r.family);
+            ctx.current = &r;
+            vm_run_fields(program_, fields, probe, &exec<Sink>, &ctx);
+        }
+    }
+
+private:
+    /** State passed to exec() through the opaque pointer. */
+    template<typename Sink>
+    struct context {
+        /** Sink. */
+        Sink *sink;
+        /** Record being filtered. */
+        const record *current;
+    };
+
+    /**
+     * Point a field to a string view.
+     * @param field Field.
+     * @param view String view.
+     */
+    static void set(vm_field &field, std::string_view view) noexcept
+    {
+        field.data = view.data();
+        field.len = view.size();
+    }
+
+    /**
+     * Handler for VM_EXEC instructions, forwarding to the sink.
+     * @param opaque Pointer to a context.
+     * @param function Function being run against the record.
+     * @param command Command line.
+     */
+    template<typename Sink>
+    static void exec(void *opaque, const vm_function *function,
+                     const char *command)
+    {
+        context<Sink> *ctx = static_cast<context<Sink> *>(opaque);
+        (*ctx->sink)(*ctx->current, std::string_view(function->name),
+                     std::string_view(command));
+    }
+
+    /** Loaded program, nullptr once moved from. */
+    vm_program *program_;
+};
+
+} // namespace ucc
+
+/**
+ * @}
+ */
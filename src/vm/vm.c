@@ -0,0 +1,758 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/vm.c
+ * Virtual machine interpreter.
+ */
+
+#include<vm/vm.h>
+#include<limits.h>
+
+/**
+ * @defgroup vmimpl Interpreter
+ * @ingroup vm
+ * @{
+ * The interpreter is a plain switch over the opcode. Comparison
+ * instructions set the trueflag, that is tested by the following
+ * conditional jump. Since the loader has already checked all locations
+ * and pool indices, we don't check them again here.
+ *
+ * A record given as a line, to vm_run_line(), is split lazily: fields
+ * are located left to right, up to the register being read, the first
+ * time a comparison reads it. A record that is done after looking at
+ * its first fields never scans the rest of the line, and nothing is
+ * copied or NUL terminated.
+ *
+ * The records of an archive, given to vm_run_columns(), share the state
+ * of each distinct value of a field: its parsed number, patterns and
+ * networks are kept next to the dictionary entry, loaded into the record
+ * before running it, and stored back after, so that each is computed
+ * at most once per archive.
+ *
+ * With predicates, a record evaluates all of them before running any
+ * function, into a bit vector on the stack, and comparison instructions
+ * test their bit before the switch: fields are decoded up to the last
+ * register that predicates read, rather than lazily.
+ *
+ * With a tuple space classifier, a record looks up the functions it may
+ * match before running any, and the loop over the global offset table
+ * skips the classified functions that it didn't find.
+ */
+
+/** State of the record being filtered. */
+typedef struct vm_record {
+    /** Input record, for plugin actions, or NULL. */
+    const ucc_input_t *input;
+    /** Instrumentation of the calling thread, or NULL. */
+    vm_probe *probe;
+    /** VM registers. */
+    vm_field regs[VM_REGISTERS];
+    /** Number of leading registers that are set: the others are located
+     *  in line the first time they are read. */
+    unsigned decoded;
+    /** Rest of the line, past the field of the last set register. */
+    const char *line;
+    /** End of the line. */
+    const char *end;
+    /** Patterns matched by each register, NULL if not scanned yet. */
+    const unsigned long *matches[VM_REGISTERS];
+    /** Networks containing each register, NULL if not looked up yet. */
+    const unsigned long *nets[VM_REGISTERS];
+    /** Numeric value of each register, valid if parsed says so. */
+    unsigned numbers[VM_REGISTERS];
+    /** For each register: zero if not parsed yet, positive if it is a
+     *  number, negative if it is not. */
+    signed char parsed[VM_REGISTERS];
+} vm_record;
+
+/** State of a distinct value of a field in an archive. */
+typedef struct vm_value {
+    /** Value, pointing into the archive. */
+    vm_field field;
+    /** Patterns matched by the value, NULL if not scanned yet. */
+    const unsigned long *matches;
+    /** Networks containing the value, NULL if not looked up yet. */
+    const unsigned long *nets;
+    /** Numeric value, valid if parsed says so. */
+    unsigned number;
+    /** Zero if not parsed yet, positive if a number, negative if not. */
+    signed char parsed;
+} vm_value;
+
+/**
+ * Forget what was computed about the registers of the previous record.
+ * @param record Record.
+ */
+static void vm_record_clear(vm_record *record)
+{
+    memset(record->matches, 0, sizeof (record->matches));
+    memset(record->nets, 0, sizeof (record->nets));
+    memset(record->parsed, 0, sizeof (record->parsed));
+}
+
+/**
+ * Locate the fields of a line, up to a register.
+ * @param record Record being filtered, given as a line.
+ * @param reg Register number, not set yet.
+ */
+static void vm_record_decode(vm_record *record, unsigned reg)
+{
+    const char *p = record->line, *end = record->end;
+
+    /* Missing fields are empty. */
+    for (; record->decoded <= reg; record->decoded++) {
+        const char *tab = memchr(p, '\t', (size_t) (end - p));
+        record->regs[record->decoded].data = p;
+        record->regs[record->decoded].len = (size_t) (((tab) ? tab : end) - p);
+        p = (tab) ? tab + 1 : end;
+    }
+    record->line = p;
+}
+
+/**
+ * Parse a register as a decimal number, the first time it is needed.
+ * A field that is not a number, or that is too big, compares unequal
+ * to any number, and neither major nor minor than it.
+ * @param record Record being filtered.
+ * @param reg Register number.
+ * @returns Non zero if the register holds a number.
+ */
+static int vm_record_number(vm_record *record, unsigned reg)
+{
+    if (!record->parsed[reg]) {
+        const char *s = record->regs[reg].data;
+        size_t i, len = record->regs[reg].len;
+        unsigned number = 0;
+
+        record->parsed[reg] = (len > 0) ? 1 : -1;
+        for (i = 0; i < len; i++) {
+            unsigned digit = (unsigned) (s[i] - '0');
+            if (s[i] < '0' || s[i] > '9' ||
+                number > (UINT_MAX - digit) / 10) {
+                record->parsed[reg] = -1;
+                break;
+            }
+            number = number * 10 + digit;
+        }
+        record->numbers[reg] = number;
+    }
+    return record->parsed[reg] > 0;
+}
+
+/**
+ * Compare a field with a string, like strcmp() does.
+ * @param field Field.
+ * @param string String.
+ * @param len Length of @a string.
+ * @returns Less than, equal to or greater than zero.
+ */
+static inline int vm_field_compare(const vm_field *field, const char *string,
+                                   size_t len)
+{
+    int diff = memcmp(field->data, string, (field->len < len) ? field->len
+                                                              : len);
+    if (diff != 0) {
+        return diff;
+    }
+    return (field->len > len) - (field->len < len);
+}
+
+/**
+ * Append a word to a trace ring.
+ * @param trace Ring.
+ * @param word Word to append.
+ */
+static inline void vm_trace_put(vm_trace *trace, unsigned word)
+{
+    unsigned long long head = trace->head;
+
+    trace->words[head & (trace->size - 1)] = word;
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the function a record is being run against, which changes along
+ * the code of a fused program.
+ * @param program Loaded program.
+ * @param function Function the record was being run against.
+ * @param pc Offset of the current instruction.
+ * @returns The non static function that contains @a pc, if the program is
+ *          fused, or @a function.
+ */
+static inline const vm_function *vm_run_owner(const vm_program *program,
+                                              const vm_function *function,
+                                              unsigned pc)
+{
+    if (program->owner && !program->got[program->owner[pc]].local) {
+        return &program->got[program->owner[pc]];
+    }
+    return function;
+}
+
+/**
+ * Count a record into the non static functions of a fused program that
+ * start at an instruction. Empty functions start where the next one
+ * does, and the instruction belongs to the first of them, so the others
+ * follow it in the global offset table, maybe past static functions,
+ * whose code is elsewhere.
+ * @param program Fused program.
+ * @param pc Offset of the first instruction of a function.
+ * @param counters Hit counters.
+ */
+static void vm_run_enter(const vm_program *program, unsigned pc,
+                         unsigned long long *counters)
+{
+    const vm_function *got = program->got;
+    unsigned f;
+
+    for (f = program->owner[pc]; f < program->got_count &&
+         (got[f].local || got[f].start == pc); ++f) {
+        if (!got[f].local) {
+            counters[f]++;
+        }
+    }
+}
+
+/**
+ * Evaluate a predicate that is not an equality.
+ * @param program Loaded program.
+ * @param record Record being filtered, whose register is decoded.
+ * @param p Predicate.
+ * @returns Non zero if it holds.
+ */
+static int vm_record_predicate(const vm_program *program, vm_record *record,
+                               const vm_predicate *p)
+{
+    const vm_field *field = &record->regs[p->reg];
+
+    switch (p->opcode) {
+        case VM_MAG:
+            return vm_field_compare(field, p->string, p->arg) > 0;
+        case VM_MIN:
+            return vm_field_compare(field, p->string, p->arg) < 0;
+        case VM_MAEQ:
+            return vm_field_compare(field, p->string, p->arg) >= 0;
+        case VM_MIEQ:
+            return vm_field_compare(field, p->string, p->arg) <= 0;
+        case VM_IMAG:
+            return vm_record_number(record, p->reg) &&
+                   record->numbers[p->reg] > p->arg;
+        case VM_IMIN:
+            return vm_record_number(record, p->reg) &&
+                   record->numbers[p->reg] < p->arg;
+        case VM_IMAEQ:
+            return vm_record_number(record, p->reg) &&
+                   record->numbers[p->reg] >= p->arg;
+        case VM_IMIEQ:
+            return vm_record_number(record, p->reg) &&
+                   record->numbers[p->reg] <= p->arg;
+        case VM_IN:
+            return vm_set_contains(program->pool[p->arg], field->data,
+                                   field->len);
+        case VM_MATCH:
+            if (!record->matches[p->reg]) {
+                record->matches[p->reg] = vm_dfa_scan(&program->dfa[p->reg],
+                                                      field->data,
+                                                      field->len);
+            }
+            return vm_bit_test(record->matches[p->reg], p->arg);
+        case VM_INNET:
+            if (!record->nets[p->reg]) {
+                record->nets[p->reg] = vm_trie_lookup(&program->trie,
+                                                      field->data,
+                                                      field->len);
+            }
+            return vm_bit_test(record->nets[p->reg], p->arg);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Evaluate all the predicates of a program against a record.
+ * @param program Loaded program, with predicates.
+ * @param record Record being filtered.
+ * @param bits In output, the outcome of each predicate.
+ */
+static void vm_record_predicates(const vm_program *program,
+                                 vm_record *record, unsigned long *bits)
+{
+    const vm_predicates *p = program->predicates;
+    unsigned i, found;
+
+    memset(bits, 0, VM_WORDS(p->count) * sizeof (unsigned long));
+    if (p->registers > record->decoded) {
+        vm_record_decode(record, p->registers - 1);
+    }
+    for (i = 0; i < p->registers; ++i) {
+        found = vm_predicates_string(p, i, record->regs[i].data,
+                                     record->regs[i].len);
+        if (found != UINT_MAX) {
+            vm_bit_set(bits, found);
+        }
+        if (p->numbers[i].size > 0 && vm_record_number(record, i)) {
+            found = vm_predicates_number(p, i, record->numbers[i]);
+            if (found != UINT_MAX) {
+                vm_bit_set(bits, found);
+            }
+        }
+    }
+    for (i = 0; i < p->other_count; ++i) {
+        if (vm_record_predicate(program, record,
+                                &p->predicates[p->others[i]])) {
+            vm_bit_set(bits, p->others[i]);
+        }
+    }
+}
+
+/**
+ * Find the classified functions that a record may match.
+ * @param program Loaded program, with a tuple space classifier.
+ * @param record Record being filtered.
+ * @param matched In output, one bit for each function found, indexed
+ *        like the global offset table.
+ */
+static void vm_record_tuples(const vm_program *program, vm_record *record,
+                             unsigned long *matched)
+{
+    const vm_tuples *tuples = program->tuples;
+    unsigned reg, last = 0, valid = 0;
+
+    memset(matched, 0, VM_WORDS(program->got_count) * sizeof (unsigned long));
+    for (reg = 0; reg < VM_REGISTERS; ++reg) {
+        if (tuples->regs & (1U << reg)) {
+            last = reg;
+        }
+    }
+    if (last >= record->decoded) {
+        vm_record_decode(record, last);
+    }
+    for (reg = 0; reg < VM_REGISTERS; ++reg) {
+        if ((tuples->numbers & (1U << reg)) && vm_record_number(record, reg)) {
+            valid |= 1U << reg;
+        }
+    }
+    vm_tuples_lookup(program, record->regs, record->numbers, valid, matched);
+}
+
+/**
+ * Run a function.
+ * @param program Loaded program.
+ * @param function Function being run against the record.
+ * @param pc Entry point of the function to run, which differs from the
+ *        one of @a function when running a called function.
+ * @param record Record being filtered.
+ * @param bits Outcome of the predicates of the program, or NULL to run
+ *        comparison instructions.
+ * @param counters Hit counters, or NULL.
+ * @param trace Trace ring, if the record is sampled, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ * @returns Non zero if the record is done, in first match mode.
+ */
+static int vm_run_function(const vm_program *program,
+                            const vm_function *function, unsigned pc,
+                            vm_record *record, const unsigned long *bits,
+                            unsigned long long *counters, vm_trace *trace,
+                            vm_exec_handler handler, void *opaque)
+{
+    const vm_field *regs = record->regs;
+    const vm_insn *code = program->code;
+    const unsigned *owner = (counters) ? program->owner : NULL;
+    int trueflag = 0;
+
+    for (;;) {
+        const vm_insn *insn = &code[pc];
+        /* Fused functions are entered by reaching their start. */
+        if (owner && program->got[owner[pc]].start == pc) {
+            vm_run_enter(program, pc, counters);
+        }
+        if (trace) {
+            vm_trace_put(trace, (pc << 1) | (unsigned) trueflag);
+        }
+        if (bits && insn->opcode >= VM_EQ && insn->opcode <= VM_INNET) {
+            unsigned test = program->predicates->tests[pc];
+            trueflag = vm_bit_test(bits, test >> 1) ^ (int) (test & 1);
+            ++pc;
+            continue;
+        }
+        if (insn->reg >= record->decoded && insn->opcode >= VM_EQ &&
+            insn->opcode <= VM_INNET) {
+            vm_record_decode(record, insn->reg);
+        }
+        switch (insn->opcode) {
+            case VM_NOP:
+                break;
+            case VM_EXEC:
+                if (counters) {
+                    counters[program->got_count + insn->reg]++;
+                }
+                if (insn->action) {
+                    insn->action(record->input, insn->string + insn->arg);
+                } else {
+                    if (record->probe) {
+                        record->probe->exec = insn->reg;
+                    }
+                    function = vm_run_owner(program, function, pc);
+                    handler(opaque, function, insn->string);
+                }
+                if (program->first) {
+                    return 1;
+                }
+                break;
+            case VM_CALL:
+                if (counters) {
+                    counters[insn->arg]++;
+                }
+                function = vm_run_owner(program, function, pc);
+                if (vm_run_function(program, function,
+                                    program->got[insn->arg].start, record,
+                                    bits, counters, trace, handler,
+                                    opaque)) {
+                    return 1;
+                }
+                break;
+            case VM_EQ:
+                trueflag = regs[insn->reg].len == insn->arg &&
+                           memcmp(regs[insn->reg].data, insn->string,
+                                  insn->arg) == 0;
+                break;
+            case VM_MAG:
+                trueflag = vm_field_compare(&regs[insn->reg], insn->string,
+                                            insn->arg) > 0;
+                break;
+            case VM_MIN:
+                trueflag = vm_field_compare(&regs[insn->reg], insn->string,
+                                            insn->arg) < 0;
+                break;
+            case VM_MAEQ:
+                trueflag = vm_field_compare(&regs[insn->reg], insn->string,
+                                            insn->arg) >= 0;
+                break;
+            case VM_MIEQ:
+                trueflag = vm_field_compare(&regs[insn->reg], insn->string,
+                                            insn->arg) <= 0;
+                break;
+            case VM_NEQ:
+                trueflag = regs[insn->reg].len != insn->arg ||
+                           memcmp(regs[insn->reg].data, insn->string,
+                                  insn->arg) != 0;
+                break;
+            case VM_IEQ:
+                trueflag = vm_record_number(record, insn->reg) &&
+                           record->numbers[insn->reg] == insn->arg;
+                break;
+            case VM_IMAG:
+                trueflag = vm_record_number(record, insn->reg) &&
+                           record->numbers[insn->reg] > insn->arg;
+                break;
+            case VM_IMIN:
+                trueflag = vm_record_number(record, insn->reg) &&
+                           record->numbers[insn->reg] < insn->arg;
+                break;
+            case VM_IMAEQ:
+                trueflag = vm_record_number(record, insn->reg) &&
+                           record->numbers[insn->reg] >= insn->arg;
+                break;
+            case VM_IMIEQ:
+                trueflag = vm_record_number(record, insn->reg) &&
+                           record->numbers[insn->reg] <= insn->arg;
+                break;
+            case VM_INEQ:
+                trueflag = !vm_record_number(record, insn->reg) ||
+                           record->numbers[insn->reg] != insn->arg;
+                break;
+            case VM_IN:
+                trueflag = vm_set_contains(program->pool[insn->arg],
+                                           regs[insn->reg].data,
+                                           regs[insn->reg].len);
+                break;
+            case VM_MATCH:
+                if (!record->matches[insn->reg]) {
+                    record->matches[insn->reg] = vm_dfa_scan(
+                        &program->dfa[insn->reg], regs[insn->reg].data,
+                        regs[insn->reg].len);
+                }
+                trueflag = vm_bit_test(record->matches[insn->reg], insn->arg);
+                break;
+            case VM_INNET:
+                if (!record->nets[insn->reg]) {
+                    record->nets[insn->reg] = vm_trie_lookup(
+                        &program->trie, regs[insn->reg].data,
+                        regs[insn->reg].len);
+                }
+                trueflag = vm_bit_test(record->nets[insn->reg], insn->arg);
+                break;
+            case VM_JTRUE:
+                if (trueflag) {
+                    pc = insn->arg;
+                    continue;
+                }
+                break;
+            case VM_JFALSE:
+                if (!trueflag) {
+                    pc = insn->arg;
+                    continue;
+                }
+                break;
+            case VM_JMP:
+                pc = insn->arg;
+                continue;
+            case VM_RETURN:
+                return 0;
+        }
+        ++pc;
+    }
+}
+
+/**
+ * Filter a record through the non static functions of a program in a
+ * range of the global offset table or, if it is fused, through the first
+ * one, which goes on with the others.
+ * @param program Loaded program.
+ * @param record Record, whose registers are set, as well as what is
+ *        already known about them.
+ * @param first First function of the range.
+ * @param last Function past the range.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ * @returns Non zero if stopped at an exec, in first match mode.
+ */
+static int vm_run_record(const vm_program *program, vm_record *record,
+                         unsigned first, unsigned last, vm_probe *probe,
+                         vm_exec_handler handler, void *opaque)
+{
+    unsigned long long *counters = NULL;
+    const vm_predicates *predicates = program->predicates;
+    unsigned long bits[(predicates) ? VM_WORDS(predicates->count) + 1 : 1];
+    const vm_tuples *tuples = program->tuples;
+    unsigned long matched[(tuples) ? VM_WORDS(program->got_count) + 1 : 1];
+    vm_trace *trace = NULL;
+    unsigned i;
+
+    if (probe) {
+        counters = probe->counters;
+        if (probe->trace && probe->countdown-- == 0) {
+            probe->countdown = (probe->sample) ? probe->sample - 1 : 0;
+            trace = probe->trace;
+            vm_trace_put(trace, VM_TRACE_RECORD);
+            vm_trace_put(trace, probe->records);
+        }
+        probe->records++;
+    }
+
+    record->probe = probe;
+    if (predicates) {
+        vm_record_predicates(program, record, bits);
+    }
+    if (tuples) {
+        vm_record_tuples(program, record, matched);
+    }
+
+    for (i = first; i < last; ++i) {
+        if (program->got[i].local) {
+            continue;
+        }
+        if (counters && !program->fused) {
+            counters[i]++;
+        }
+        if (tuples && vm_bit_test(tuples->classified, i) &&
+            !vm_bit_test(matched, i)) {
+            continue;
+        }
+        if (vm_run_function(program, &program->got[i], program->got[i].start,
+                            record, (predicates) ? bits : NULL, counters,
+                            trace, handler, opaque)) {
+            return 1;
+        }
+        if (program->fused) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @}
+ */
+
+void *vm_alloc(size_t size)
+{
+    void *p = calloc(1, size);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+void vm_run(const vm_program *program, const ucc_input_t *input,
+            vm_probe *probe, vm_exec_handler handler, void *opaque)
+{
+    const char *fields[VM_REGISTERS];
+    vm_record record;
+    unsigned i;
+
+    fields[0] = input->monitor_type;
+    fields[1] = input->port;
+    fields[2] = input->group;
+    fields[3] = input->label;
+    fields[4] = input->hostname;
+    fields[5] = input->family;
+
+    /* Missing fields compare as empty strings, and so do dead ones,
+     * that are never read. */
+    record.input = input;
+    record.decoded = VM_REGISTERS;
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        if (fields[i] && (program->live & (1U << i))) {
+            record.regs[i].data = fields[i];
+            record.regs[i].len = strlen(fields[i]);
+        } else {
+            record.regs[i].data = "";
+            record.regs[i].len = 0;
+        }
+    }
+    vm_record_clear(&record);
+    vm_run_record(program, &record, 0, program->got_count, probe, handler,
+                  opaque);
+}
+
+void vm_run_fields(const vm_program *program, const vm_field *fields,
+                   vm_probe *probe, vm_exec_handler handler, void *opaque)
+{
+    vm_record record;
+    unsigned i;
+
+    record.input = NULL;
+    record.decoded = VM_REGISTERS;
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        record.regs[i].data = (fields[i].data) ? fields[i].data : "";
+        record.regs[i].len = (fields[i].data) ? fields[i].len : 0;
+    }
+    vm_record_clear(&record);
+    vm_run_record(program, &record, 0, program->got_count, probe, handler,
+                  opaque);
+}
+
+void vm_run_line(const vm_program *program, const char *line, size_t len,
+                 vm_probe *probe, vm_exec_handler handler, void *opaque)
+{
+    vm_record record;
+
+    record.input = NULL;
+    record.decoded = 0;
+    record.line = line;
+    record.end = line + len;
+    vm_record_clear(&record);
+    vm_run_record(program, &record, 0, program->got_count, probe, handler,
+                  opaque);
+}
+
+int vm_run_group(const vm_program *program, const char *line, size_t len,
+                 unsigned first, unsigned last, vm_probe *probe,
+                 vm_exec_handler handler, void *opaque)
+{
+    vm_record record;
+
+    record.input = NULL;
+    record.decoded = 0;
+    record.line = line;
+    record.end = line + len;
+    vm_record_clear(&record);
+    return vm_run_record(program, &record, first, last, probe, handler,
+                         opaque);
+}
+
+int vm_run_columns(const vm_program *program, const vm_columns *columns,
+                   vm_probe *probe, vm_exec_handler handler, void *opaque)
+{
+    static const vm_value empty = { { "", 0 }, NULL, NULL, 0, -1 };
+    const unsigned *ids[VM_REGISTERS];
+    vm_value *values[VM_REGISTERS];
+    unsigned long long records = vm_columns_records(columns), n;
+    unsigned count[VM_REGISTERS], i, id;
+    ucc_input_t input;
+    vm_record record;
+    int ok = 1;
+
+    /* Registers that the program doesn't read stay empty, and their
+     * columns are never touched. */
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        count[i] = vm_columns_count(columns, i);
+        ids[i] = vm_columns_ids(columns, i);
+        values[i] = NULL;
+        if (program->live & (1U << i)) {
+            values[i] = vm_alloc((count[i] + 1) * sizeof (vm_value));
+            for (id = 0; id < count[i]; ++id) {
+                vm_columns_entry(columns, i, id, &values[i][id].field);
+            }
+        }
+    }
+
+    record.input = &input;
+    record.decoded = VM_REGISTERS;
+    for (n = 0; n < records && ok; ++n) {
+        const vm_value *v[VM_REGISTERS];
+
+        for (i = 0; i < VM_REGISTERS; ++i) {
+            v[i] = &empty;
+            if (values[i]) {
+                id = ids[i][n];
+                if (id >= count[i]) {
+                    fprintf(stderr, "vm: record %llu: invalid value\n", n);
+                    ok = 0;
+                    break;
+                }
+                v[i] = &values[i][id];
+            }
+            record.regs[i] = v[i]->field;
+            record.matches[i] = v[i]->matches;
+            record.nets[i] = v[i]->nets;
+            record.numbers[i] = v[i]->number;
+            record.parsed[i] = v[i]->parsed;
+        }
+        if (!ok) {
+            break;
+        }
+        input.monitor_type = record.regs[0].data;
+        input.port = record.regs[1].data;
+        input.group = record.regs[2].data;
+        input.label = record.regs[3].data;
+        input.hostname = record.regs[4].data;
+        input.family = record.regs[5].data;
+        vm_run_record(program, &record, 0, program->got_count, probe,
+                      handler, opaque);
+
+        /* Keep what the record computed for the next ones. */
+        for (i = 0; i < VM_REGISTERS; ++i) {
+            if (values[i]) {
+                vm_value *value = &values[i][ids[i][n]];
+                value->matches = record.matches[i];
+                value->nets = record.nets[i];
+                value->number = record.numbers[i];
+                value->parsed = record.parsed[i];
+            }
+        }
+    }
+
+    for (i = 0; i < VM_REGISTERS; ++i) {
+        free(values[i]);
+    }
+    return ok;
+}
@@ -0,0 +1,1198 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file vm/vm.h
+ * Virtual machine main header.
+ */
+
+#include<string.h>
+#include<stdlib.h>
+#include<stdio.h>
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup vm Virtual machine
+ * @{
+ *
+ * The <b>virtual machine</b> loads the <i>assembly-like output language</i>,
+ * as produced either by the compiler or by the optimizer, and evaluates it
+ * against input records. Each record is a ucc_input_t, whose fields are
+ * mapped on VM registers <code>$0</code>...<code>$5</code>, and is filtered
+ * through all the functions in the global offset table, in order.
+ *
+ * Loading a program is the only moment in which we parse text: afterwards
+ * the program is a read-only vector of vm_insn, whose arguments have been
+ * resolved into register numbers, code offsets and pool indices. For this
+ * reason, a loaded program may be shared among many threads, provided that
+ * each of them brings its own input record.
+ *
+ * The loader is hand-written, rather than generated with flex and bison,
+ * because the virtual machine is meant to be linked into other programs,
+ * e.g. a network daemon, and we don't want to clash with their own yylex()
+ * and yyparse(), nor to depend on global parser state.
+ *
+ * The constant pool contains sets of strings, referenced by the set
+ * membership instruction <code>VM_IN</code>. For each set, the loader
+ * builds a minimal perfect hash, so that membership is tested computing
+ * two hashes and comparing at most one string, regardless of set size.
+ *
+ * Likewise, all the patterns tested by <code>VM_MATCH</code> against the
+ * same register are compiled into a single DFA at load time. The first
+ * <code>VM_MATCH</code> that reads a register scans the field once, and
+ * remembers which patterns matched: the following ones, for the same
+ * record and register, just test a bit.
+ *
+ * In the same way, all the networks tested by <code>VM_INNET</code> are
+ * stored into a single radix trie: the field is parsed as an address and
+ * looked up once per record, and each test reads a bit of the result.
+ *
+ * A function may call another one with <code>VM_CALL</code>, whose
+ * argument is resolved into an index in the global offset table at load
+ * time. Static functions are only run when called; the loader rejects
+ * programs in which a function calls itself, directly or not, so that
+ * the call depth is bounded by the number of functions.
+ *
+ * A program whose global offset table is marked <code>first</code> runs
+ * in first match mode: functions are run in the order in which they are
+ * listed, and the first <code>VM_EXEC</code> ends the record.
+ *
+ * A program whose global offset table is marked <code>fused</code>, as
+ * written by <code>optimizer -l</code>, has its non static functions
+ * chained into a single stream of code, in order: a record enters the
+ * first one only, and runs through to the single final
+ * <code>VM_RETURN</code>. Non static functions may not be called. The
+ * loader records which function each instruction belongs to, so that an
+ * exec is still handed the function that contains it, and so that hit
+ * counters count a non static function each time that a record reaches
+ * its start, as if the program were not fused.
+ *
+ * Numeric comparisons, <code>VM_IEQ</code> and friends, carry their
+ * constant already parsed into the instruction. The field is converted
+ * to a number the first time that a numeric comparison reads it, and
+ * the result is kept for the rest of the record, so that each of the
+ * following comparisons is a single integer compare.
+ *
+ * A command written as <code>plugin:name</code>, optionally followed by
+ * arguments, may be resolved at load time into a function exported by a
+ * shared object, which is then called in process, instead of handing the
+ * command to the exec handler. Since a loaded program may be shared among
+ * threads, so may the actions: they must be reentrant.
+ *
+ * Records may also be handed to the virtual machine through a shared
+ * memory ring, vm_ring, that a producer in another process fills without
+ * system calls: the consumer gets a ucc_input_t whose fields point right
+ * into shared memory.
+ *
+ * Each thread may count how many times each function is entered, and
+ * how many times each <code>VM_EXEC</code> runs, into its own block of a
+ * vm_stats file, passing it to vm_run() inside a vm_probe. A probe may
+ * also sample one record every so many, and write the path it takes
+ * through the program into the thread's ring of a vm_traces file; the
+ * other records pay just a predicted branch for each instruction.
+ *
+ * Many programs may be loaded into the same process sharing a
+ * vm_constants: their strings, function names and sets are interned
+ * there, and reference counted, so that memory grows with the distinct
+ * constants, while each program keeps its own instructions and pool.
+ *
+ * Internally, fields are handled as vm_field, a pointer and a length, so
+ * that a record may also be given with vm_run_fields(), with fields that
+ * are not NUL terminated, e.g. pointing into a packet buffer. This is
+ * what the C++ interface in <code>vm/ucc.hpp</code> does.
+ *
+ * The loader records in vm_program which registers the program reads.
+ * vm_run() doesn't measure the fields of the others, and a producer may
+ * leave them out, e.g. of the records it pushes into a vm_ring. A record
+ * may also be given as a whole line to vm_run_line(), that locates each
+ * field the first time it is read.
+ *
+ * Records may be archived into a vm_columns file, where each field is a
+ * column of identifiers into a dictionary of its distinct values, to
+ * filter them again later with vm_run_columns(): fields point into the
+ * mapped dictionaries, and each distinct value is parsed as a number,
+ * scanned for patterns and looked up in networks once per file, rather
+ * than once per record. Columns that the program doesn't read are not
+ * touched.
+ *
+ * A loaded program may be switched to predicates with
+ * vm_program_predicates(): the distinct comparisons of the whole program
+ * are evaluated once per record into a bit vector, and each comparison
+ * instruction then just tests its bit. Equalities against the strings,
+ * or the numbers, of a register are all evaluated with one hash lookup,
+ * so that a record pays for each distinct predicate at most once, rather
+ * than for each instruction that tests it.
+ *
+ * With vm_program_tuples(), the functions that only run their execs if
+ * some fields equal some constants are classified by tuple space: they
+ * are grouped by the fields they compare, into a hash table for each
+ * such shape, keyed by the constants. A record probes each table once,
+ * and only the functions it finds run, while the others are skipped.
+ */
+
+/** Number of VM registers. */
+#define VM_REGISTERS 6
+
+/** Live register mask with all registers live. */
+#define VM_LIVE_ALL ((1U << VM_REGISTERS) - 1)
+
+/** Number of bits in a bit vector word. */
+#define VM_BITS (8 * sizeof (unsigned long))
+
+/** Number of words needed for a bit vector of @a _n_ bits. */
+#define VM_WORDS(_n_) (((_n_) + VM_BITS - 1) / VM_BITS)
+
+/**
+ * Test a bit in a bit vector.
+ * @param v Bit vector.
+ * @param bit Bit number.
+ * @returns Non zero if the bit is set.
+ */
+static inline int vm_bit_test(const unsigned long *v, unsigned bit)
+{
+    return (v[bit / VM_BITS] >> (bit % VM_BITS)) & 1;
+}
+
+/**
+ * Set a bit in a bit vector.
+ * @param v Bit vector.
+ * @param bit Bit number.
+ */
+static inline void vm_bit_set(unsigned long *v, unsigned bit)
+{
+    v[bit / VM_BITS] |= 1UL << (bit % VM_BITS);
+}
+
+/** Input record, whose fields are mapped on VM registers. */
+typedef struct ucc_input_t {
+    /** Mapped on register $0. */
+    const char *monitor_type;
+    /** Mapped on register $1. */
+    const char *port;
+    /** Mapped on register $2. */
+    const char *group;
+    /** Mapped on register $3. */
+    const char *label;
+    /** Mapped on register $4. */
+    const char *hostname;
+    /** Mapped on register $5. */
+    const char *family;
+} ucc_input_t;
+
+/** Field of a record, which needs not be NUL terminated. */
+typedef struct vm_field {
+    /** Field bytes; may be NULL if @a len is zero. */
+    const char *data;
+    /** Number of bytes. */
+    size_t len;
+} vm_field;
+
+/** Prefix of the commands that run a plugin action. */
+#define VM_PLUGIN_SCHEME "plugin:"
+
+/**
+ * Plugin action, exported by plugins as <code>ucc_plugin_</code>name.
+ * @param input Input record, or NULL if the record was given to
+ *        vm_run_fields(), whose fields might not be NUL terminated.
+ * @param args Arguments that follow the action name in the command.
+ */
+typedef void (*vm_plugin_action)(const ucc_input_t *input, const char *args);
+
+/** Available assembly instructions. */
+typedef enum vm_opcode {
+    /** Do nothing instruction. */
+    VM_NOP,
+    /** Execute an external program. */
+    VM_EXEC,
+    /** Call another function. */
+    VM_CALL,
+    /** Set trueflag if two strings equal. */
+    VM_EQ,
+    /** Set trueflag if the first string is major than the second. */
+    VM_MAG,
+    /** Set trueflag if the first string is minor than the second. */
+    VM_MIN,
+    /** Set trueflag if the first string is not minor than the second. */
+    VM_MAEQ,
+    /** Set trueflag if the first string is not major than the second. */
+    VM_MIEQ,
+    /** Set trueflag if two strings differ. */
+    VM_NEQ,
+    /** Set trueflag if two numbers equal. */
+    VM_IEQ,
+    /** Set trueflag if the first number is major than the second. */
+    VM_IMAG,
+    /** Set trueflag if the first number is minor than the second. */
+    VM_IMIN,
+    /** Set trueflag if the first number is not minor than the second. */
+    VM_IMAEQ,
+    /** Set trueflag if the first number is not major than the second. */
+    VM_IMIEQ,
+    /** Set trueflag if two numbers differ. */
+    VM_INEQ,
+    /** Set trueflag if string belongs to a set in the constant pool. */
+    VM_IN,
+    /** Set trueflag if string matches a glob pattern. */
+    VM_MATCH,
+    /** Set trueflag if string is an address inside a network. */
+    VM_INNET,
+    /** Jump to location if trueflag is set. */
+    VM_JTRUE,
+    /** Jump to location if trueflag isn't set. */
+    VM_JFALSE,
+    /** Jump to location. */
+    VM_JMP,
+    /** Return from function. */
+    VM_RETURN
+} vm_opcode;
+
+/** Loaded assembly instruction. */
+typedef struct vm_insn {
+    /** Instruction opcode. */
+    vm_opcode opcode;
+    /** Register, for comparison instructions, or exec number, counting
+     *  from zero in code order, for VM_EXEC. */
+    unsigned reg;
+    /** Location to jump to, function to call, pool entry, pattern or
+     *  network number, constant for numeric comparisons, string length
+     *  for string comparisons, or offset of the arguments in the command
+     *  of a plugin action. */
+    unsigned arg;
+    /** String argument, without quotes, for comparison and exec. */
+    char *string;
+    /** Plugin action run by VM_EXEC, or NULL to use the exec handler. */
+    vm_plugin_action action;
+} vm_insn;
+
+/** Entry in the global offset table. */
+typedef struct vm_function {
+    /** Function name. */
+    char *name;
+    /** Offset of the first instruction of this function. */
+    unsigned start;
+    /** Non zero for static functions, that only run when called. */
+    int local;
+} vm_function;
+
+/** Constant pool entry: a set of strings with its perfect hash. */
+typedef struct vm_set {
+    /** Number of strings in this set. */
+    unsigned count;
+    /** Strings in this set, without quotes, indexed by their hash. */
+    char **table;
+    /** Displacement for each hash bucket (negative means direct slot). */
+    int *displacements;
+} vm_set;
+
+/** Combined DFA for the patterns tested against a register. */
+typedef struct vm_dfa {
+    /** Number of states, zero if no pattern uses this register. */
+    unsigned nstates;
+    /** Number of byte classes. */
+    unsigned nclasses;
+    /** Maps each byte to its byte class. */
+    unsigned char classmap[256];
+    /** Transition table, indexed by state and byte class. */
+    unsigned *trans;
+    /** Number of words of each accepting patterns bit vector. */
+    unsigned words;
+    /** Accepting patterns bit vector, for each state. */
+    unsigned long *accepts;
+} vm_dfa;
+
+/** Node of the network radix trie. */
+typedef struct vm_trie_node {
+    /** Node prefix, as an IPv6 address. */
+    unsigned char addr[16];
+    /** Node prefix length. */
+    unsigned len;
+    /** Children indices, for next bit zero and one, or -1. */
+    int child[2];
+} vm_trie_node;
+
+/** Radix trie for the networks tested by the program. */
+typedef struct vm_trie {
+    /** Nodes, the first one is the root. */
+    vm_trie_node *nodes;
+    /** Number of nodes. */
+    unsigned count;
+    /** Size of nodes vector. */
+    unsigned size;
+    /** Number of distinct networks. */
+    unsigned nnets;
+    /** Number of words of each matching networks bit vector. */
+    unsigned words;
+    /** Matching networks bit vector, for each node plus an empty one. */
+    unsigned long *matches;
+} vm_trie;
+
+/** Set of opened plugins. */
+typedef struct vm_plugins {
+    /** Handles of the shared objects, in the order they were opened. */
+    void **handles;
+    /** Number of opened shared objects. */
+    unsigned count;
+} vm_plugins;
+
+/** Single producer, single consumer ring of records in shared memory. */
+typedef struct vm_ring {
+    /** Shared header, followed by the slots. */
+    struct vm_ring_header *header;
+    /** Record slots. */
+    struct vm_ring_slot *slots;
+    /** Size of the mapping. */
+    size_t size;
+    /** Memfd holding the ring, to share it with the other side. */
+    int fd;
+    /** Eventfd used to wake up the consumer. */
+    int data_fd;
+    /** Eventfd used to wake up the producer. */
+    int space_fd;
+    /** Non zero if the consumer holds the slot at tail. */
+    int held;
+} vm_ring;
+
+/** Record archive being written. */
+typedef struct vm_columns_writer {
+    /** Path of the file, written when finished. */
+    char *path;
+    /** Dictionary of each column, with its spooled identifiers. */
+    struct vm_columns_dict *dicts;
+    /** Number of records added. */
+    unsigned long long records;
+    /** Non zero if writing failed. */
+    int failed;
+} vm_columns_writer;
+
+/** Record archive, mapped in memory. */
+typedef struct vm_columns {
+    /** Mapped file, starting with its header. */
+    const struct vm_columns_header *header;
+    /** Size of the mapping. */
+    size_t size;
+} vm_columns;
+
+/** Constants interned for the programs that share them. */
+typedef struct vm_constants {
+    /** Hash table of interned strings. */
+    struct vm_constant **strings;
+    /** Number of buckets of strings, a power of two. */
+    unsigned string_size;
+    /** Number of interned strings. */
+    unsigned string_count;
+    /** Hash table of interned sets. */
+    struct vm_constant **sets;
+    /** Number of buckets of sets, a power of two. */
+    unsigned set_size;
+    /** Number of interned sets. */
+    unsigned set_count;
+    /** Bytes taken by interned strings and sets. */
+    size_t bytes;
+} vm_constants;
+
+/** Distinct comparison of a program, with vm_program_predicates(). */
+typedef struct vm_predicate {
+    /** Comparison opcode; VM_NEQ and VM_INEQ are tested as VM_EQ and
+     *  VM_IEQ, negated. */
+    vm_opcode opcode;
+    /** Register. */
+    unsigned reg;
+    /** Argument, as in vm_insn. */
+    unsigned arg;
+    /** String argument, as in vm_insn. */
+    const char *string;
+} vm_predicate;
+
+/** Hash table of the equalities against a register, open addressing. */
+typedef struct vm_predicate_table {
+    /** Number of slots, a power of two, zero if there are none. */
+    unsigned size;
+    /** Number of the predicate in each slot, plus one; zero if empty. */
+    unsigned *slots;
+} vm_predicate_table;
+
+/** Predicates of a program, evaluated once per record. */
+typedef struct vm_predicates {
+    /** Distinct predicates. */
+    vm_predicate *predicates;
+    /** Number of distinct predicates. */
+    unsigned count;
+    /** For each comparison instruction, twice the number of its predicate,
+     *  plus one if its outcome is the negation of the predicate. */
+    unsigned *tests;
+    /** String equalities, VM_EQ, of each register. */
+    vm_predicate_table strings[VM_REGISTERS];
+    /** Number equalities, VM_IEQ, of each register. */
+    vm_predicate_table numbers[VM_REGISTERS];
+    /** Predicates that are not equalities, evaluated one by one. */
+    unsigned *others;
+    /** Number of predicates that are not equalities. */
+    unsigned other_count;
+    /** Number of leading registers that predicates read. */
+    unsigned registers;
+} vm_predicates;
+
+/** Function classified by tuple space. */
+typedef struct vm_tuple {
+    /** Index of the function in the global offset table. */
+    unsigned function;
+    /** Shape of the function. */
+    unsigned shape;
+    /** Hash value of its constants. */
+    unsigned hash;
+} vm_tuple;
+
+/** Fields compared by classified functions, with their hash table. */
+typedef struct vm_shape {
+    /** Registers compared, one bit each, starting from $0. */
+    unsigned regs;
+    /** Registers compared as numbers, with VM_IEQ, rather than strings. */
+    unsigned numbers;
+    /** Number of slots, a power of two. */
+    unsigned size;
+    /** Tuple in each slot, plus one; zero if empty. Tuples with the same
+     *  constants take a slot each. */
+    unsigned *slots;
+} vm_shape;
+
+/** Tuple space classifier of a program. */
+typedef struct vm_tuples {
+    /** Classified functions. */
+    vm_tuple *tuples;
+    /** Number of classified functions. */
+    unsigned count;
+    /** Shapes. */
+    vm_shape *shapes;
+    /** Number of shapes. */
+    unsigned shape_count;
+    /** Classified functions, one bit for each entry of the global offset
+     *  table. */
+    unsigned long *classified;
+    /** Registers compared by some shape. */
+    unsigned regs;
+    /** Registers compared as numbers by some shape. */
+    unsigned numbers;
+} vm_tuples;
+
+/** Loaded program. */
+typedef struct vm_program {
+    /** Global offset table. */
+    vm_function *got;
+    /** Number of entries in global offset table. */
+    unsigned got_count;
+    /** Constant pool, whose sets are interned in constants. */
+    vm_set **pool;
+    /** Number of entries in constant pool. */
+    unsigned pool_count;
+    /** Code vector. */
+    vm_insn *code;
+    /** Number of instructions in code vector. */
+    unsigned code_count;
+    /** Pattern matching DFA, for each register. */
+    vm_dfa dfa[VM_REGISTERS];
+    /** Network matching trie. */
+    vm_trie trie;
+    /** Non zero if a record stops at the first VM_EXEC (first match). */
+    int first;
+    /** Non zero if non static functions are chained into one (fused). */
+    int fused;
+    /** For each instruction of a fused program, the function that contains
+     *  it; NULL if the program is not fused. */
+    unsigned *owner;
+    /** Number of VM_EXEC instructions. */
+    unsigned exec_count;
+    /** Registers read by the program, one bit each, starting from $0;
+     *  all of them, VM_LIVE_ALL, if it runs plugin actions. */
+    unsigned live;
+    /** Constants referenced by this program. */
+    vm_constants *constants;
+    /** Non zero if constants are shared with other programs. */
+    int shared;
+    /** Predicates, or NULL to run comparison instructions one by one. */
+    vm_predicates *predicates;
+    /** Tuple space classifier, or NULL to run every function. */
+    vm_tuples *tuples;
+} vm_program;
+
+/** Number of wait counters of a counters file, see vm_stats_wait(). */
+#define VM_STATS_WAITS 32
+
+/** Hit counters file, mapped in shared memory. */
+typedef struct vm_stats {
+    /** Mapped file, starting with its header. */
+    struct vm_stats_header *header;
+    /** Size of the mapping. */
+    size_t size;
+    /** Name of each counter, pointing into the mapping. */
+    const char **names;
+} vm_stats;
+
+/** Trace word that starts a record, followed by the record number. */
+#define VM_TRACE_RECORD 0xffffffffU
+
+/** Trace ring of a thread, in shared memory. */
+typedef struct vm_trace {
+    /** Number of words ever written: the ring holds the last ones. */
+    unsigned long long head;
+    /** Number of words of the ring, a power of two. */
+    unsigned size;
+    /** Trace words, see vm_trace_read(). */
+    unsigned words[];
+} vm_trace;
+
+/** Traces file, mapped in shared memory. */
+typedef struct vm_traces {
+    /** Mapped file, starting with its header. */
+    struct vm_traces_header *header;
+    /** Size of the mapping. */
+    size_t size;
+} vm_traces;
+
+/** Per thread instrumentation of vm_run(). */
+typedef struct vm_probe {
+    /** Hit counters of this thread, from vm_stats_counters(), or NULL. */
+    unsigned long long *counters;
+    /** Trace ring of this thread, from vm_traces_ring(), or NULL. */
+    vm_trace *trace;
+    /** Trace one record every this many, at least one. */
+    unsigned sample;
+    /** Records to skip before tracing the next one. */
+    unsigned countdown;
+    /** Number of records run with this probe. */
+    unsigned records;
+    /** Number of the exec being handled, set before calling the exec
+     *  handler, e.g. to count its command as shed. */
+    unsigned exec;
+} vm_probe;
+
+/**
+ * Handler invoked for each VM_EXEC instruction that doesn't run a plugin
+ * action.
+ * @param opaque Opaque pointer passed to vm_run().
+ * @param function Function being run against the record: when the
+ *        instruction belongs to a called function, this is the caller.
+ * @param command Command line to execute.
+ */
+typedef void (*vm_exec_handler)(void *opaque, const vm_function *function,
+                                const char *command);
+
+/**
+ * Load a program.
+ * @param fp File containing compiler or optimizer output.
+ * @param plugins Plugins that provide the actions of plugin commands, or
+ *        NULL to hand such commands to the exec handler, like the others.
+ * @returns The loaded program, or NULL on error.
+ */
+extern vm_program *vm_program_load(FILE *fp, const vm_plugins *plugins);
+
+/**
+ * Load a program, interning its constants into a shared vm_constants.
+ * @param fp File containing compiler or optimizer output.
+ * @param plugins Plugins, as for vm_program_load(), or NULL.
+ * @param constants Constants shared with other programs.
+ * @returns The loaded program, or NULL on error.
+ */
+extern vm_program *vm_program_load_shared(FILE *fp, const vm_plugins *plugins,
+                                          vm_constants *constants);
+
+/**
+ * Link programs into one, whose global offset table lists the functions
+ * of each program in turn. The programs are left alone, and must all be
+ * loaded with vm_program_load_shared() into the same constants, that the
+ * linked program references too. Programs that call functions of each
+ * other can't be linked, since the compiler resolves calls.
+ * @param programs Programs to link.
+ * @param count Number of programs.
+ * @param constants Constants shared by @a programs.
+ * @returns The linked program, or NULL if two programs define the same
+ *          function, or if they don't agree on first match mode.
+ */
+extern vm_program *vm_program_link(vm_program *const *programs,
+                                   unsigned count, vm_constants *constants);
+
+/**
+ * Destroy a program, releasing its references to constants.
+ * @param program Program returned by vm_program_load() or
+ *        vm_program_load_shared().
+ */
+extern void vm_program_destroy(vm_program *program);
+
+/**
+ * Create an empty set of constants.
+ * @returns The new set.
+ */
+extern vm_constants *vm_constants_create(void);
+
+/**
+ * Destroy a set of constants. Programs that share it must be destroyed
+ * before.
+ * @param constants Set returned by vm_constants_create().
+ */
+extern void vm_constants_destroy(vm_constants *constants);
+
+/**
+ * Intern a string, taking a reference to it.
+ * @param constants Constants.
+ * @param string String, which needs not be NUL terminated.
+ * @param len Length of @a string.
+ * @returns The interned string, NUL terminated, not to be modified.
+ */
+extern char *vm_constants_intern(vm_constants *constants, const char *string,
+                                 size_t len);
+
+/**
+ * Release a reference to an interned string, freeing it with the last.
+ * @param constants Constants.
+ * @param string String returned by vm_constants_intern().
+ */
+extern void vm_constants_release(vm_constants *constants, const char *string);
+
+/**
+ * Take another reference to an interned string.
+ * @param string String returned by vm_constants_intern().
+ * @returns @a string.
+ */
+extern char *vm_constants_retain(char *string);
+
+/**
+ * Intern a set, taking a reference to it.
+ * @param constants Constants.
+ * @param strings Distinct interned strings, whose references pass to
+ *        the set; the vector is sorted, and may be freed on return.
+ * @param count Number of strings, at least one.
+ * @returns The interned set, with its perfect hash.
+ */
+extern vm_set *vm_constants_set(vm_constants *constants, char **strings,
+                                unsigned count);
+
+/**
+ * Release a reference to an interned set, freeing it with the last.
+ * @param constants Constants.
+ * @param set Set returned by vm_constants_set().
+ */
+extern void vm_constants_release_set(vm_constants *constants, vm_set *set);
+
+/**
+ * Take another reference to an interned set.
+ * @param set Set returned by vm_constants_set().
+ * @returns @a set.
+ */
+extern vm_set *vm_constants_retain_set(vm_set *set);
+
+/**
+ * Filter a record through all the non static functions of a program, in
+ * order. In first match mode, stop at the first VM_EXEC.
+ * @param program Loaded program.
+ * @param input Input record.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ */
+extern void vm_run(const vm_program *program, const ucc_input_t *input,
+                   vm_probe *probe, vm_exec_handler handler, void *opaque);
+
+/**
+ * Like vm_run(), for a record given as a vector of fields, that are not
+ * copied and need not be NUL terminated. Plugin actions get a NULL input.
+ * @param program Loaded program.
+ * @param fields The VM_REGISTERS fields of the record, in register order.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ */
+extern void vm_run_fields(const vm_program *program, const vm_field *fields,
+                          vm_probe *probe, vm_exec_handler handler,
+                          void *opaque);
+
+/**
+ * Like vm_run_fields(), for a record given as a line whose fields are
+ * separated by tabs; fields past the sixth are ignored, missing ones are
+ * empty. The line is not copied nor modified, and is split lazily, so
+ * that fields after the last one read by the program are never scanned.
+ * Plugin actions get a NULL input.
+ * @param program Loaded program.
+ * @param line Record line, without line terminator.
+ * @param len Length of @a line.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ */
+extern void vm_run_line(const vm_program *program, const char *line,
+                        size_t len, vm_probe *probe, vm_exec_handler handler,
+                        void *opaque);
+
+/**
+ * Like vm_run_line(), through the non static functions in a range of the
+ * global offset table only, e.g. as computed by vm_program_partition(),
+ * so that threads may filter the same record through different groups of
+ * functions at once. Ranges must not split a fused program.
+ * @param program Loaded program.
+ * @param line Record line, without line terminator.
+ * @param len Length of @a line.
+ * @param first First function of the range.
+ * @param last Function past the range.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ * @returns Non zero if the record stopped at an exec in first match mode,
+ *          so that the groups past this one would not have run.
+ */
+extern int vm_run_group(const vm_program *program, const char *line,
+                        size_t len, unsigned first, unsigned last,
+                        vm_probe *probe, vm_exec_handler handler,
+                        void *opaque);
+
+/**
+ * Like vm_run(), for each record of an archive, in order. Plugin actions
+ * get an input whose fields point into the archive.
+ * @param program Loaded program.
+ * @param columns Archive.
+ * @param probe Instrumentation of the calling thread, or NULL.
+ * @param handler Handler for VM_EXEC instructions.
+ * @param opaque Opaque pointer passed to @a handler.
+ * @returns Non zero on success, zero if the archive references a value
+ *          that is not in its dictionary.
+ */
+extern int vm_run_columns(const vm_program *program, const vm_columns *columns,
+                          vm_probe *probe, vm_exec_handler handler,
+                          void *opaque);
+
+/**
+ * Build the perfect hash of a set.
+ * @param set Set whose table contains @a set->count distinct strings, in
+ *        no particular order; on return, they are indexed by their hash.
+ */
+extern void vm_set_build(vm_set *set);
+
+/**
+ * Test set membership.
+ * @param set Set built with vm_set_build().
+ * @param string String to look for.
+ * @param len Length of @a string.
+ * @returns Non zero if @a string belongs to @a set.
+ */
+extern int vm_set_contains(const vm_set *set, const char *string, size_t len);
+
+/**
+ * Build the pattern matching DFA for each register, and number the
+ * patterns referenced by VM_MATCH instructions.
+ * @param program Loaded program.
+ * @returns Non zero on success.
+ */
+extern int vm_dfa_build(vm_program *program);
+
+/**
+ * Run a DFA over a string.
+ * @param dfa DFA built with vm_dfa_build().
+ * @param string String to scan.
+ * @param len Length of @a string.
+ * @returns Bit vector of the patterns that match @a string.
+ */
+extern const unsigned long *vm_dfa_scan(const vm_dfa *dfa,
+                                        const char *string, size_t len);
+
+/**
+ * Build the network matching trie, and number the networks referenced
+ * by VM_INNET instructions.
+ * @param program Loaded program.
+ * @returns Non zero on success.
+ */
+extern int vm_trie_build(vm_program *program);
+
+/**
+ * Look up the networks that contain an address.
+ * @param trie Trie built with vm_trie_build().
+ * @param string Address to look up; if it is not an address, it is not
+ *        contained in any network.
+ * @param len Length of @a string.
+ * @returns Bit vector of the networks that contain @a string.
+ */
+extern const unsigned long *vm_trie_lookup(const vm_trie *trie,
+                                           const char *string, size_t len);
+
+/**
+ * Create an empty set of plugins.
+ * @returns The new set.
+ */
+extern vm_plugins *vm_plugins_create(void);
+
+/**
+ * Open a plugin.
+ * @param plugins Set of plugins.
+ * @param path Path of the shared object, as accepted by dlopen().
+ * @returns Non zero on success.
+ */
+extern int vm_plugins_open(vm_plugins *plugins, const char *path);
+
+/**
+ * Close all the plugins of a set, and destroy it. Programs that use their
+ * actions must be destroyed before.
+ * @param plugins Set returned by vm_plugins_create().
+ */
+extern void vm_plugins_destroy(vm_plugins *plugins);
+
+/**
+ * Resolve the actions of plugin commands.
+ * @param program Loaded program.
+ * @param plugins Opened plugins.
+ * @returns Non zero on success, zero if an action can't be found.
+ */
+extern int vm_plugins_resolve(vm_program *program, const vm_plugins *plugins);
+
+/**
+ * Create a ring.
+ * @param count Number of slots, rounded up to a power of two.
+ * @returns The ring, or NULL on error.
+ */
+extern vm_ring *vm_ring_create(unsigned count);
+
+/**
+ * Attach to a ring created by another process, e.g. using descriptors
+ * inherited or received over a UNIX socket.
+ * @param fd Ring memfd.
+ * @param data_fd Eventfd used to wake up the consumer.
+ * @param space_fd Eventfd used to wake up the producer.
+ * @returns The ring, or NULL on error.
+ */
+extern vm_ring *vm_ring_attach(int fd, int data_fd, int space_fd);
+
+/**
+ * Unmap a ring and close its descriptors.
+ * @param ring Ring.
+ */
+extern void vm_ring_destroy(vm_ring *ring);
+
+/**
+ * Copy a record into the ring, waiting while it is full. Producer only.
+ * @param ring Ring.
+ * @param input Record; missing fields are stored as empty strings.
+ * @returns Non zero on success, zero if the record doesn't fit a slot.
+ */
+extern int vm_ring_push(vm_ring *ring, const ucc_input_t *input);
+
+/**
+ * Tell the consumer that no more records will be pushed. Producer only.
+ * @param ring Ring.
+ */
+extern void vm_ring_close(vm_ring *ring);
+
+/**
+ * Get the next record, waiting while the ring is empty. Consumer only.
+ * The slot of the record is released by the next call.
+ * @param ring Ring.
+ * @param input In output, the record, pointing into shared memory.
+ * @returns Non zero on success, zero if the ring is closed and empty.
+ */
+extern int vm_ring_pop(vm_ring *ring, ucc_input_t *input);
+
+/**
+ * Create a hit counters file for a program, with all counters at zero.
+ * @param path File path, e.g. under /dev/shm; the file is replaced.
+ * @param program Loaded program.
+ * @param threads Number of threads that will count.
+ * @returns The counters, or NULL on error.
+ */
+extern vm_stats *vm_stats_create(const char *path, const vm_program *program,
+                                 unsigned threads);
+
+/**
+ * Open a hit counters file for reading.
+ * @param path File path.
+ * @returns The counters, or NULL on error.
+ */
+extern vm_stats *vm_stats_open(const char *path);
+
+/**
+ * Unmap a hit counters file.
+ * @param stats Counters.
+ */
+extern void vm_stats_destroy(vm_stats *stats);
+
+/**
+ * Get the number of function counters, that come first.
+ * @param stats Counters.
+ * @returns Number of functions.
+ */
+extern unsigned vm_stats_functions(const vm_stats *stats);
+
+/**
+ * Get the number of exec counters, that follow function ones. They are
+ * followed by as many shed counters, in the same order, and then by
+ * VM_STATS_WAITS wait counters.
+ * @param stats Counters.
+ * @returns Number of execs.
+ */
+extern unsigned vm_stats_execs(const vm_stats *stats);
+
+/**
+ * Get the wait counter that counts a command run after waiting a given
+ * time: counter 0 counts waits under a microsecond, counter <i>i</i>
+ * waits of at least 2<sup><i>i</i> - 1</sup> microseconds and under
+ * 2<sup><i>i</i></sup>, and the last one all the longer waits too.
+ * @param usec Wait, in microseconds.
+ * @returns The counter, from zero, after the shed counters.
+ */
+extern unsigned vm_stats_wait(unsigned long long usec);
+
+/**
+ * Get the counters block of a thread, to be set into its vm_probe.
+ * @param stats Counters created with vm_stats_create().
+ * @param thread Thread number.
+ * @returns The block, or NULL if @a thread is out of range.
+ */
+extern unsigned long long *vm_stats_counters(vm_stats *stats,
+                                             unsigned thread);
+
+/**
+ * Sum a counter over all threads.
+ * @param stats Counters.
+ * @param index Counter number.
+ * @returns The total.
+ */
+extern unsigned long long vm_stats_total(const vm_stats *stats,
+                                         unsigned index);
+
+/**
+ * Create a traces file, with an empty ring for each thread.
+ * @param path File path, e.g. under /dev/shm; the file is replaced.
+ * @param threads Number of threads that will trace.
+ * @param size Number of words of each ring, rounded up to a power of two.
+ * @returns The traces, or NULL on error.
+ */
+extern vm_traces *vm_traces_create(const char *path, unsigned threads,
+                                   unsigned size);
+
+/**
+ * Open a traces file for reading.
+ * @param path File path.
+ * @returns The traces, or NULL on error.
+ */
+extern vm_traces *vm_traces_open(const char *path);
+
+/**
+ * Unmap a traces file.
+ * @param traces Traces.
+ */
+extern void vm_traces_destroy(vm_traces *traces);
+
+/**
+ * Get the number of threads of a traces file.
+ * @param traces Traces.
+ * @returns Number of rings.
+ */
+extern unsigned vm_traces_threads(const vm_traces *traces);
+
+/**
+ * Get the ring of a thread, to be set into its vm_probe.
+ * @param traces Traces.
+ * @param thread Thread number.
+ * @returns The ring, or NULL if @a thread is out of range.
+ */
+extern vm_trace *vm_traces_ring(vm_traces *traces, unsigned thread);
+
+/**
+ * Copy the words of a ring, while its thread may be writing it. The
+ * first record may be incomplete: skip to the first VM_TRACE_RECORD.
+ * Each instruction is a word holding its offset, shifted left by one,
+ * and the trueflag before it was executed.
+ * @param trace Ring.
+ * @param words Vector of at least @a trace->size words, filled with the
+ *        last words of the ring, from the oldest.
+ * @returns Number of words copied.
+ */
+extern unsigned vm_trace_read(const vm_trace *trace, unsigned *words);
+
+/**
+ * Start writing a record archive.
+ * @param path File to write when the archive is finished.
+ * @returns The writer.
+ */
+extern vm_columns_writer *vm_columns_create(const char *path);
+
+/**
+ * Add a record to an archive.
+ * @param writer Writer.
+ * @param fields The VM_REGISTERS fields of the record, in register order;
+ *        missing fields, with NULL data, are archived as empty.
+ */
+extern void vm_columns_add(vm_columns_writer *writer, const vm_field *fields);
+
+/**
+ * Write an archive and destroy its writer.
+ * @param writer Writer.
+ * @returns Non zero on success.
+ */
+extern int vm_columns_finish(vm_columns_writer *writer);
+
+/**
+ * Map a record archive.
+ * @param path File written by vm_columns_finish().
+ * @returns The archive, or NULL on error.
+ */
+extern vm_columns *vm_columns_open(const char *path);
+
+/**
+ * Unmap a record archive.
+ * @param columns Archive.
+ */
+extern void vm_columns_destroy(vm_columns *columns);
+
+/**
+ * Get the number of records in an archive.
+ * @param columns Archive.
+ * @returns Number of records.
+ */
+extern unsigned long long vm_columns_records(const vm_columns *columns);
+
+/**
+ * Get the number of distinct values of a column.
+ * @param columns Archive.
+ * @param reg Register number.
+ * @returns Number of entries in the dictionary of @a reg.
+ */
+extern unsigned vm_columns_count(const vm_columns *columns, unsigned reg);
+
+/**
+ * Get the identifiers of a column, one for each record, not checked.
+ * @param columns Archive.
+ * @param reg Register number.
+ * @returns Identifiers, in the mapping.
+ */
+extern const unsigned *vm_columns_ids(const vm_columns *columns,
+                                      unsigned reg);
+
+/**
+ * Get an entry of the dictionary of a column.
+ * @param columns Archive.
+ * @param reg Register number.
+ * @param id Identifier, less than vm_columns_count().
+ * @param field In output, the value, NUL terminated in the mapping.
+ */
+extern void vm_columns_entry(const vm_columns *columns, unsigned reg,
+                             unsigned id, vm_field *field);
+
+/**
+ * Find the function that contains an instruction, that is the one with
+ * the greatest start not past it.
+ * @param program Loaded program, with at least one function.
+ * @param pc Instruction offset.
+ * @returns Index of the function in the global offset table.
+ */
+extern unsigned vm_program_function(const vm_program *program, unsigned pc);
+
+/**
+ * Partition the functions of a program into groups of consecutive ones,
+ * in global offset table order, that cost about the same: the cost of a
+ * non static function is its number of instructions, plus those of the
+ * static functions that it calls; static functions cost nothing. A group
+ * may be empty, e.g. if there are more groups than functions.
+ * @param program Loaded program.
+ * @param groups Number of groups, at least one.
+ * @param bounds In output, @a groups + 1 offsets into the global offset
+ *        table: group <i>i</i> goes from @a bounds[i] up to, excluded,
+ *        @a bounds[i + 1].
+ */
+extern void vm_program_partition(const vm_program *program, unsigned groups,
+                                 unsigned *bounds);
+
+/**
+ * Switch a program to predicates: collect its distinct comparisons, so
+ * that vm_run() and the like evaluate each of them once per record, and
+ * run comparison instructions as tests of their outcome. This pays off
+ * when many instructions compare the same register with the same
+ * constants, and doesn't when most records are done after a few
+ * comparisons. Must not be called while the program is running.
+ * @param program Loaded program.
+ */
+extern void vm_program_predicates(vm_program *program);
+
+/**
+ * Look up the string equality, VM_EQ, of a register with a value.
+ * @param predicates Predicates of a program.
+ * @param reg Register.
+ * @param data Value.
+ * @param len Length of @a data.
+ * @returns Number of the predicate, or UINT_MAX if there is none.
+ */
+extern unsigned vm_predicates_string(const vm_predicates *predicates,
+                                     unsigned reg, const char *data,
+                                     size_t len);
+
+/**
+ * Look up the number equality, VM_IEQ, of a register with a value.
+ * @param predicates Predicates of a program.
+ * @param reg Register.
+ * @param number Value.
+ * @returns Number of the predicate, or UINT_MAX if there is none.
+ */
+extern unsigned vm_predicates_number(const vm_predicates *predicates,
+                                     unsigned reg, unsigned number);
+
+/**
+ * Classify by tuple space the non static functions of a program that are
+ * conjunctions of equalities, VM_EQ or VM_IEQ, of distinct registers
+ * with constants, each followed by a VM_JFALSE to the final VM_RETURN,
+ * followed by VM_EXEC instructions only: that is what the optimizer
+ * emits for a single if statement whose condition is such a conjunction.
+ * Then, vm_run() and the like skip those functions unless the tuple space
+ * finds them, while counting them as entered; traces don't show the
+ * skipped functions. Fused programs are left alone. Must not be called
+ * while the program is running.
+ * @param program Loaded program.
+ */
+extern void vm_program_tuples(vm_program *program);
+
+/**
+ * Find the classified functions whose constants equal the fields of a
+ * record.
+ * @param program Loaded program, with a tuple space classifier.
+ * @param fields Fields of the record, decoded for the registers that
+ *        some shape compares.
+ * @param numbers Numeric value of the fields, for the registers that
+ *        some shape compares as numbers.
+ * @param valid Registers whose field is a number, one bit each.
+ * @param matched In output, one bit set for each function found, indexed
+ *        like the global offset table; other bits are left alone.
+ */
+extern void vm_tuples_lookup(const vm_program *program,
+                             const vm_field *fields, const unsigned *numbers,
+                             unsigned valid, unsigned long *matched);
+
+/**
+ * Get the name of an opcode.
+ * @param opcode Opcode.
+ * @returns The name, as written in assembly.
+ */
+extern const char *vm_opcode_name(vm_opcode opcode);
+
+/**
+ * Allocate memory, exiting if we run out of it.
+ * @param size Size of memory block.
+ * @returns Zero filled memory block.
+ */
+extern void *vm_alloc(size_t size);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,210 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file testing/constants.c
+ * Check the reference counts of vm_constants, and the sharing of the
+ * constants of the programs given as arguments.
+ *
+ * Strings and sets interned twice must be the same, and must be freed
+ * with their last reference only. Each program is loaded twice into the
+ * same constants: the copies must reference the same strings and sets,
+ * and the second must add nothing. Once all the programs are destroyed,
+ * the constants must be empty. Failures are printed, and make the exit
+ * status non zero.
+ */
+
+#include<vm/vm.h>
+
+/** Number of strings interned at once, more than a table starts with. */
+#define CHECK_STRINGS 1000
+
+/** Exit status, set to one by check(). */
+static int Status;
+
+/**
+ * Print a failure, if a condition doesn't hold.
+ * @param ok Condition.
+ * @param what What is being checked.
+ * @param name Program, or the name of the check.
+ */
+static void check(int ok, const char *what, const char *name)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s)\n", what, name);
+        Status = 1;
+    }
+}
+
+/**
+ * Check that constants hold nothing.
+ * @param constants Constants.
+ * @param name Program, or the name of the check.
+ */
+static void check_empty(const vm_constants *constants, const char *name)
+{
+    check(constants->string_count == 0 && constants->set_count == 0 &&
+          constants->bytes == 0, "constants not released", name);
+}
+
+/**
+ * Check strings and sets interned directly.
+ * @param constants Empty constants, left empty.
+ */
+static void check_intern(vm_constants *constants)
+{
+    char *strings[CHECK_STRINGS], *set[2], *a, *b;
+    char buffer[32];
+    vm_set *s, *t;
+    size_t bytes;
+    unsigned i;
+
+    a = vm_constants_intern(constants, "abc", 3);
+    b = vm_constants_intern(constants, "abcdef", 3);
+    check(a == b && strcmp(a, "abc") == 0 &&
+          constants->string_count == 1, "string interned twice", "intern");
+    bytes = constants->bytes;
+    vm_constants_release(constants, b);
+    check(constants->string_count == 1 && constants->bytes == bytes,
+          "string freed before its last reference", "intern");
+    check(vm_constants_retain(a) == a, "string retained", "intern");
+    vm_constants_release(constants, a);
+    vm_constants_release(constants, a);
+    check_empty(constants, "intern");
+
+    /* Enough strings to grow the table, each found again after. */
+    for (i = 0; i < CHECK_STRINGS; ++i) {
+        snprintf(buffer, sizeof (buffer), "string %u", i);
+        strings[i] = vm_constants_intern(constants, buffer, strlen(buffer));
+    }
+    check(constants->string_count == CHECK_STRINGS,
+          "strings interned", "grow");
+    for (i = 0; i < CHECK_STRINGS; ++i) {
+        snprintf(buffer, sizeof (buffer), "string %u", i);
+        a = vm_constants_intern(constants, buffer, strlen(buffer));
+        check(a == strings[i], "string found after growing", "grow");
+        vm_constants_release(constants, a);
+        vm_constants_release(constants, strings[i]);
+    }
+    check_empty(constants, "grow");
+
+    /* Sets are equal whatever the order of their strings, and hold the
+     * references to them. */
+    set[0] = vm_constants_intern(constants, "b", 1);
+    set[1] = vm_constants_intern(constants, "a", 1);
+    s = vm_constants_set(constants, set, 2);
+    set[0] = vm_constants_intern(constants, "a", 1);
+    set[1] = vm_constants_intern(constants, "b", 1);
+    t = vm_constants_set(constants, set, 2);
+    check(s == t && constants->set_count == 1 &&
+          constants->string_count == 2, "set interned twice", "set");
+    check(vm_set_contains(s, "a", 1) && vm_set_contains(s, "b", 1) &&
+          !vm_set_contains(s, "c", 1), "set members", "set");
+    check(vm_constants_retain_set(s) == s, "set retained", "set");
+    vm_constants_release_set(constants, s);
+    vm_constants_release_set(constants, t);
+    check(constants->set_count == 1 && constants->string_count == 2,
+          "set freed before its last reference", "set");
+    vm_constants_release_set(constants, s);
+    check_empty(constants, "set");
+}
+
+/**
+ * Load a program into shared constants.
+ * @param path File containing compiler or optimizer output.
+ * @param constants Constants.
+ * @returns The program, or NULL on error.
+ */
+static vm_program *load(const char *path, vm_constants *constants)
+{
+    vm_program *program = NULL;
+    FILE *fp = fopen(path, "r");
+
+    if (fp) {
+        program = vm_program_load_shared(fp, NULL, constants);
+        fclose(fp);
+    }
+    check(program != NULL, "can't load", path);
+    return program;
+}
+
+/**
+ * Check that two copies of a program share their constants.
+ * @param a Program.
+ * @param b Copy of @a a, loaded into the same constants.
+ * @param path Program file.
+ */
+static void check_shared(const vm_program *a, const vm_program *b,
+                         const char *path)
+{
+    unsigned i;
+
+    for (i = 0; i < a->got_count; ++i) {
+        check(a->got[i].name == b->got[i].name, "names shared", path);
+    }
+    for (i = 0; i < a->code_count; ++i) {
+        check(a->code[i].string == b->code[i].string, "strings shared",
+              path);
+    }
+    for (i = 0; i < a->pool_count; ++i) {
+        check(a->pool[i] == b->pool[i], "sets shared", path);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    vm_constants *constants = vm_constants_create();
+    vm_program **programs = vm_alloc(argc * sizeof (vm_program *));
+    int i;
+
+    check_intern(constants);
+
+    for (i = 1; i < argc; ++i) {
+        vm_program *copy;
+        size_t bytes;
+        unsigned strings, sets;
+
+        programs[i] = load(argv[i], constants);
+        if (!programs[i]) {
+            continue;
+        }
+        strings = constants->string_count;
+        sets = constants->set_count;
+        bytes = constants->bytes;
+        copy = load(argv[i], constants);
+        if (!copy) {
+            continue;
+        }
+        check(constants->string_count == strings &&
+              constants->set_count == sets && constants->bytes == bytes,
+              "copy adds constants", argv[i]);
+        check_shared(programs[i], copy, argv[i]);
+        vm_program_destroy(copy);
+        check(constants->string_count == strings &&
+              constants->set_count == sets && constants->bytes == bytes,
+              "copy releases constants of the first", argv[i]);
+    }
+    for (i = 1; i < argc; ++i) {
+        if (programs[i]) {
+            vm_program_destroy(programs[i]);
+        }
+    }
+    check_empty(constants, "programs");
+
+    free(programs);
+    vm_constants_destroy(constants);
+    return Status;
+}
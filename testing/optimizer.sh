@@ -0,0 +1,91 @@
+#!/bin/sh
+
+#
+# Check the compiler and the optimizer against the examples in this
+# directory: NAME.src compiles to NAME.pass1, which optimizes to
+# NAME.pass2 and, with functions fused by `optimizer -l', to NAME.pass2l.
+# Where NAME.cost exists, it is the cost report of `optimizer -c', and
+# budgets are checked at and just below each cost. Sources that the
+# compiler must reject are checked for the error they print.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-check.$$
+FAILED=0
+
+trap 'rm -f $TMP.out $TMP.err $TMP.src' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+for SRC in $DIR/*.src; do
+  NAME=${SRC%.src}
+  TEST=$(basename $NAME)
+
+  # Examples in first match mode say so in the global offset table.
+  FLAGS=""
+  if head -1 $NAME.pass1 | grep -q first; then
+    FLAGS=-f
+  fi
+  $BIN/compiler $FLAGS $SRC > $TMP.out && cmp -s $TMP.out $NAME.pass1     \
+    || fail "compiler $FLAGS $TEST.src"
+  $BIN/optimizer $NAME.pass1 > $TMP.out && cmp -s $TMP.out $NAME.pass2    \
+    || fail "optimizer $TEST.pass1"
+  $BIN/optimizer -l $NAME.pass1 > $TMP.out && cmp -s $TMP.out $NAME.pass2l \
+    || fail "optimizer -l $TEST.pass1"
+
+  if [ -f $NAME.cost ]; then
+    $BIN/optimizer -c $NAME.pass1 > $TMP.out 2> $TMP.err                  \
+      && cmp -s $TMP.out $NAME.pass2 && cmp -s $TMP.err $NAME.cost        \
+      || fail "optimizer -c $TEST.pass1"
+    for METRIC in insns compares bytes execs; do
+      COST=$(awk -v metric=$METRIC '
+        NR == 1 { for (i = 1; i <= NF; i++) if ($i == metric) column = i }
+        $1 == "record" { print $column }' $NAME.cost)
+      $BIN/optimizer -b $METRIC=$COST $NAME.pass1 > $TMP.out 2> $TMP.err  \
+        && cmp -s $TMP.out $NAME.pass2                                    \
+        || fail "optimizer -b $METRIC=$COST $TEST.pass1"
+      if [ $COST -gt 0 ]; then
+        $BIN/optimizer -b $METRIC=$((COST - 1)) $NAME.pass1 > $TMP.out    \
+          2> $TMP.err
+        if [ $? -ne 1 ] || [ -s $TMP.out ] ||                             \
+           ! grep -q "exceeds budget: $METRIC" $TMP.err; then
+          fail "optimizer -b $METRIC=$((COST - 1)) $TEST.pass1"
+        fi
+      fi
+    done
+  fi
+done
+
+# Each line is the error, then the source that causes it.
+while IFS='|' read -r ERROR SOURCE; do
+  printf '%s\n' "$SOURCE" > $TMP.src
+  if $BIN/compiler $TMP.src > $TMP.out 2> $TMP.err ||                     \
+     ! grep -qF "$ERROR" $TMP.err; then
+    fail "compiler accepts $SOURCE"
+  fi
+done << EOF
+recursive call: a -> a|a (e) { a (e); }
+recursive call: a -> b -> a|a (e) { b (e); } b (e) { a (e); }
+recursive call: b -> s -> b|b (e) { s (e); } static s (e) { b (e); }
+EOF
+
+# Budgets must be whole non negative numbers, of metrics that exist.
+for BUDGET in insns insns= insns=-1 insns=10x insns=x bogus=10 \
+              insns=99999999999999999999; do
+  if $BIN/optimizer -b $BUDGET $DIR/Call.pass1 > $TMP.out 2> $TMP.err ||  \
+     [ -s $TMP.out ] || ! grep -qF "invalid budget $BUDGET" $TMP.err; then
+    fail "optimizer accepts -b $BUDGET"
+  fi
+done
+
+exit $FAILED
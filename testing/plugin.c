@@ -0,0 +1,30 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file testing/plugin.c
+ * Plugin checked by plugin.sh, whose action <code>x</code> prints the
+ * hostname of the record and the arguments of the command.
+ */
+
+#include<vm/vm.h>
+#include<stdio.h>
+
+void ucc_plugin_x(const ucc_input_t *input, const char *args)
+{
+    printf("%s\t[%s]\n", (input && input->hostname) ? input->hostname : "",
+           args);
+}
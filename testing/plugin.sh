@@ -0,0 +1,80 @@
+#!/bin/sh
+
+#
+# Check plugin actions: ucc-run -p opens BUILDDIR/check-plugin.so, built
+# from plugin.c, and runs its action x in process, for each record that
+# fires a `plugin:x' command. An action that no plugin exports, or a
+# command that isn't an action, must make the program fail to load.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+PLUGIN=$BIN/check-plugin.so
+TMP=${TMPDIR:-/tmp}/ucc-plugin.$$
+FAILED=0
+
+trap 'rm -f $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+# Compile a source from standard input into $TMP.prog.
+compile()
+{
+  cat > $TMP.src
+  $BIN/compiler $TMP.src | $BIN/optimizer > $TMP.prog
+}
+
+compile << EOF
+ssh (e)
+{
+  exec ("plugin:x");
+  if (e.port == 22) {
+    exec ("plugin:x audit  22");
+  }
+}
+EOF
+printf 'ssh\t22\tadmin\tmajor\tbox1\tinet\n' > $TMP.rec
+printf 'web\t80\tops\tminor\tbox2\tinet\n' >> $TMP.rec
+printf 'box1\t[]\nbox1\t[audit  22]\nbox2\t[]\n' > $TMP.want
+
+$BIN/ucc-run -p $PLUGIN $TMP.prog $TMP.rec > $TMP.out 2> $TMP.err &&
+  cmp -s $TMP.out $TMP.want || fail "ucc-run -p"
+$BIN/ucc-run -r -p $PLUGIN $TMP.prog $TMP.rec > $TMP.out 2> $TMP.err &&
+  cmp -s $TMP.out $TMP.want || fail "ucc-run -r -p"
+sort $TMP.want > $TMP.sorted
+$BIN/ucc-run -m 2 -p $PLUGIN $TMP.prog $TMP.rec > $TMP.out 2> $TMP.err &&
+  sort $TMP.out | cmp -s - $TMP.sorted || fail "ucc-run -m 2 -p"
+
+# With -n, actions are printed like any other command.
+printf 'ssh\tplugin:x\nssh\tplugin:x audit  22\nssh\tplugin:x\n' > $TMP.want
+$BIN/ucc-run -n -p $PLUGIN $TMP.prog $TMP.rec > $TMP.out 2> $TMP.err &&
+  cmp -s $TMP.out $TMP.want || fail "ucc-run -n -p"
+
+# Each line is the error, then the command that causes it.
+while IFS='|' read -r ERROR COMMAND; do
+  printf 'ssh (e) { exec ("%s"); }\n' "$COMMAND" | compile
+  if $BIN/ucc-run -p $PLUGIN $TMP.prog $TMP.rec > $TMP.out 2> $TMP.err ||
+     [ -s $TMP.out ] || ! grep -qF "$ERROR" $TMP.err; then
+    fail "ucc-run -p accepts $COMMAND"
+  fi
+done << EOF
+unknown plugin action "y"|plugin:y
+unknown plugin action "x2"|plugin:x2 args
+invalid plugin command|plugin:x-y
+invalid plugin command|plugin:
+EOF
+
+if $BIN/ucc-run -p $TMP.missing.so $TMP.prog $TMP.rec > /dev/null \
+     2> $TMP.err || ! grep -q "can't open plugin" $TMP.err; then
+  fail "ucc-run -p with a missing plugin"
+fi
+
+exit $FAILED
@@ -0,0 +1,114 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file testing/program.cpp
+ * Filter records through a program loaded by vm/ucc.hpp, and print the
+ * commands like <code>ucc-run -n</code>.
+ *
+ * The program is given as the only argument. It is loaded twice, once
+ * on its own and once with shared constants, and the two must print the
+ * same; the first one is moved around before it runs, and a program that
+ * doesn't exist must throw. Records are read from standard input, one
+ * per line, with fields separated by tabs.
+ */
+
+#include<vm/ucc.hpp>
+#include<cstdio>
+#include<iostream>
+#include<stdexcept>
+#include<string>
+#include<utility>
+#include<vector>
+
+/**
+ * Filter records through a program.
+ * @param program Program.
+ * @param records Records.
+ * @returns What <code>ucc-run -n</code> prints.
+ */
+static std::string run(const ucc::program &program,
+                       ucc::record_span records)
+{
+    std::string out;
+
+    program.evaluate(records, [&](const ucc::record &,
+                                  std::string_view function,
+                                  std::string_view command) noexcept {
+        out.append(function);
+        out += '\t';
+        out.append(command);
+        out += '\n';
+    });
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> lines;
+    std::vector<ucc::record> records;
+    std::string line;
+
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s program\n", argv[0]);
+        return 1;
+    }
+    while (std::getline(std::cin, line)) {
+        lines.push_back(line);
+    }
+    for (const std::string &l : lines) {
+        std::string_view rest(l), fields[VM_REGISTERS];
+
+        for (std::string_view &field : fields) {
+            std::size_t tab = rest.find('\t');
+            field = rest.substr(0, tab);
+            rest = (tab == std::string_view::npos) ? rest.substr(rest.size())
+                                                   : rest.substr(tab + 1);
+        }
+        records.push_back({fields[0], fields[1], fields[2], fields[3],
+                           fields[4], fields[5]});
+    }
+
+    try {
+        ucc::program missing("/nonexistent/program");
+        std::fprintf(stderr, "%s: missing program loaded\n", argv[0]);
+        return 1;
+    } catch (const std::runtime_error &) {
+    }
+
+    ucc::program first(argv[1]);
+    ucc::program moved(std::move(first));
+    ucc::program program(argv[1]);
+    program = std::move(moved);
+    if (first.get() || moved.get() || !program.get()) {
+        std::fprintf(stderr, "%s: program not moved\n", argv[0]);
+        return 1;
+    }
+
+    vm_constants *constants = vm_constants_create();
+    std::string out = run(program, records);
+    {
+        ucc::program shared(argv[1], nullptr, constants);
+        if (run(shared, records) != out) {
+            std::fprintf(stderr, "%s: shared constants differ\n", argv[0]);
+            return 1;
+        }
+    }
+    vm_constants_destroy(constants);
+
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
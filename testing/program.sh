@@ -0,0 +1,40 @@
+#!/bin/sh
+
+#
+# Check the C++ interface of src/vm/ucc.hpp against the virtual machine:
+# BUILDDIR/check-program, built from program.cpp, must print for each
+# NAME.pass2 and NAME.pass2l in this directory, and the same records,
+# what `ucc-run -n' prints. RECORDS sets the number of records, 20000 by
+# default.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-program.$$
+RECORDS=${RECORDS:-20000}
+FAILED=0
+
+trap 'rm -f $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+sh $DIR/records.sh $RECORDS $DIR/*.pass2 > $TMP.rec
+
+for PROGRAM in $DIR/*.pass2 $DIR/*.pass2l; do
+  TEST=$(basename $PROGRAM)
+
+  $BIN/ucc-run -n $PROGRAM $TMP.rec > $TMP.ref &&
+    $BIN/check-program $PROGRAM < $TMP.rec > $TMP.out &&
+    cmp -s $TMP.out $TMP.ref || fail "ucc.hpp $TEST"
+done
+
+exit $FAILED
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+#
+# Print records for the given programs: fields are filled, mostly, with
+# the constants that their register is compared with, so that functions
+# fire, or else with the constants of other registers, or with values
+# that are off by one, malformed or missing. With the same awk, the same
+# arguments give the same records.
+#
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 count program ..."
+  exit 1
+fi
+
+RECORDS=$1
+shift
+
+awk -v records=$RECORDS '
+  function add(reg, value) {
+    values[reg, count[reg]++] = value
+    all[total++] = value
+  }
+  /^\./ { section = $1; next }
+  section == ".pool" {
+    for (i = 2; i <= NF; i++) {
+      gsub(/"/, "", $i)
+      all[total++] = $i
+    }
+  }
+  section == ".code" && $3 ~ /^\$/ {
+    reg = substr($3, 2)
+    value = $0
+    sub(/^[^$]*\$[0-9]+ /, "", value)
+    if (value ~ /^"/) {
+      gsub(/"/, "", value)
+      sub(/\/.*/, "", value)
+      gsub(/\*/, "a", value)
+      gsub(/\?/, "1", value)
+      gsub(/\[[^]]*\]/, "o", value)
+      add(reg, value)
+    } else {
+      add(reg, value - 1)
+      add(reg, value)
+      add(reg, value + 1)
+    }
+  }
+  END {
+    split("x|022|65536|4294967296|-1|10.1.255.1|fd00::1|a.example.org", junk,
+          "|")
+    srand(1)
+    for (r = 0; r < records; r++) {
+      fields = 6 - (rand() < 0.05) * int(rand() * 6)
+      line = ""
+      for (reg = 0; reg < fields; reg++) {
+        p = rand()
+        if (p < 0.7 && count[reg] > 0) {
+          value = values[reg, int(rand() * count[reg])]
+        } else if (p < 0.9) {
+          value = all[int(rand() * total)]
+        } else if (p < 0.95) {
+          value = junk[1 + int(rand() * 8)]
+        } else {
+          value = ""
+        }
+        line = line (reg ? "\t" : "") value
+      }
+      print line
+    }
+  }' "$@"
@@ -0,0 +1,74 @@
+/* Copyright 2007 Andrea Autiero, Simone Basso.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this client except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file testing/rules.cpp
+ * Filter records through rules compiled by vm/rules.hpp, and print the
+ * commands like <code>ucc-run -n</code>.
+ *
+ * UCC_SOURCE names a file that holds the rules as a raw string literal,
+ * and UCC_FIRST is true for first match mode; rules.sh builds this file
+ * once for each example. Records are read from standard input, one per
+ * line, with fields separated by tabs.
+ */
+
+#include<vm/rules.hpp>
+#include<cstdio>
+#include<iostream>
+#include<string>
+#include<vector>
+
+#ifndef UCC_FIRST
+#define UCC_FIRST false
+#endif
+
+static constexpr auto Rules = ucc::compile(
+#include UCC_SOURCE
+    , UCC_FIRST);
+
+int main()
+{
+    std::vector<std::string> lines;
+    std::vector<ucc::record> records;
+    std::string line, out;
+
+    while (std::getline(std::cin, line)) {
+        lines.push_back(line);
+    }
+    for (const std::string &l : lines) {
+        std::string_view rest(l), fields[VM_REGISTERS];
+
+        for (std::string_view &field : fields) {
+            std::size_t tab = rest.find('\t');
+            field = rest.substr(0, tab);
+            rest = (tab == std::string_view::npos) ? rest.substr(rest.size())
+                                                   : rest.substr(tab + 1);
+        }
+        records.push_back({fields[0], fields[1], fields[2], fields[3],
+                           fields[4], fields[5]});
+    }
+
+    ucc::evaluate<Rules>(records, [&](const ucc::record &,
+                                      std::string_view function,
+                                      std::string_view command) noexcept {
+        out.append(function);
+        out += '\t';
+        out.append(command);
+        out += '\n';
+    });
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
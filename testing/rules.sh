@@ -0,0 +1,53 @@
+#!/bin/sh
+
+#
+# Check the rules compiled at compile time by src/vm/rules.hpp against
+# the virtual machine: each NAME.src in this directory is built into
+# rules.cpp, with the C++17 compiler in CXX, c++ by default, and must
+# print for the same records what `ucc-run -n NAME.pass2' prints.
+# RECORDS sets the number of records, 20000 by default.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-rules.$$
+RECORDS=${RECORDS:-20000}
+CXX=${CXX:-c++}
+FAILED=0
+
+trap 'rm -f $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+sh $DIR/records.sh $RECORDS $DIR/*.pass2 > $TMP.rec
+
+for SRC in $DIR/*.src; do
+  NAME=${SRC%.src}
+  TEST=$(basename $NAME)
+
+  # Examples in first match mode say so in the global offset table.
+  FIRST=false
+  if head -1 $NAME.pass1 | grep -q first; then
+    FIRST=true
+  fi
+  { printf 'R"ucc('; cat $SRC; printf ')ucc"\n'; } > $TMP.inc
+  if ! $CXX -std=c++17 -O1 -I$DIR/../src -DUCC_SOURCE="\"$TMP.inc\"" \
+         -DUCC_FIRST=$FIRST $DIR/rules.cpp -o $TMP.bin; then
+    fail "$CXX rules.cpp ($TEST.src)"
+    continue
+  fi
+  $BIN/ucc-run -n $NAME.pass2 $TMP.rec > $TMP.ref &&
+    $TMP.bin < $TMP.rec > $TMP.out && cmp -s $TMP.out $TMP.ref \
+    || fail "rules.hpp $TEST.src"
+done
+
+exit $FAILED
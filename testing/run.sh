@@ -0,0 +1,223 @@
+#!/bin/sh
+
+#
+# Check the modes of ucc-run against plain `ucc-run -n', for each
+# NAME.pass2 in this directory, on records made of the constants that
+# the examples compare with. Modes that keep the input order must print
+# the same commands, in the same order; shards of -m print in their own
+# order, so their output is compared sorted. Commands of -j really run,
+# as echo of themselves, on fewer records. RECORDS sets the number of
+# records, 20000 by default.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-run.$$
+RECORDS=${RECORDS:-20000}
+FAILED=0
+
+trap 'rm -rf $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+# Run ucc-run with the given options, and compare what it prints with
+# plain -n.
+same()
+{
+  $BIN/ucc-run "$@" > $TMP.out 2> $TMP.err && cmp -s $TMP.out $TMP.ref \
+    || fail "ucc-run $* ($TEST.pass2)"
+}
+
+# Likewise, in any order.
+sorted()
+{
+  $BIN/ucc-run "$@" > $TMP.out 2> $TMP.err &&   \
+    sort $TMP.out | cmp -s - $TMP.sorted         \
+    || fail "ucc-run $* ($TEST.pass2)"
+}
+
+sh $DIR/records.sh $RECORDS $DIR/*.pass2 > $TMP.rec
+head -200 $TMP.rec > $TMP.few
+
+for PASS2 in $DIR/*.pass2; do
+  NAME=${PASS2%.pass2}
+  TEST=$(basename $NAME)
+
+  if ! $BIN/ucc-run -n $PASS2 $TMP.rec > $TMP.ref; then
+    fail "ucc-run -n $TEST.pass2"
+    continue
+  fi
+  sort $TMP.ref > $TMP.sorted
+
+  same -n -r $PASS2 $TMP.rec
+  same -n -B $PASS2 $TMP.rec
+  same -n -e $PASS2 $TMP.rec
+  same -n -B -e $PASS2 $TMP.rec
+  same -n -P 4 $PASS2 $TMP.rec
+  same -n -L 3 $PASS2 $TMP.rec
+  same -n -L 3 -B -e $PASS2 $TMP.rec
+  same -n $NAME.pass2l $TMP.rec
+  sorted -n -m 4 $PASS2 $TMP.rec
+  sorted -n -m 4 -x $PASS2 $TMP.rec
+  sorted -n -m 3 -k hostname $PASS2 $TMP.rec
+  sorted -n -m 3 -k port -x -B -e $PASS2 $TMP.rec
+
+  # Records read back from an archive are the same records.
+  same -n -a $TMP.cols $PASS2 $TMP.rec
+  same -n -c $PASS2 $TMP.cols
+  same -n -c -B -e $PASS2 $TMP.cols
+
+  # Bitmaps: the same with any mode, and, decoded into the commands of
+  # the execs, the same commands as -n, record by record.
+  if $BIN/ucc-run -E $PASS2 $TMP.rec > $TMP.bits &&
+     [ $(wc -l < $TMP.bits) -eq $RECORDS ]; then
+    for FLAGS in "-P 4" "-B -e" "-L 3"; do
+      $BIN/ucc-run -E $FLAGS $PASS2 $TMP.rec > $TMP.out &&
+        cmp -s $TMP.out $TMP.bits || fail "ucc-run -E $FLAGS ($TEST.pass2)"
+    done
+    N=0
+    while IFS= read -r LINE; do
+      N=$((N + 1))
+      printf '%s\n' "$LINE" > $TMP.one
+      $BIN/ucc-run -n $PASS2 $TMP.one | cut -f2 | sed "s/^/$N	/"
+    done < $TMP.few | sort -u > $TMP.want
+    head -200 $TMP.bits | awk '
+      function hex(digit) {
+        return index("0123456789abcdef", tolower(digit)) - 1
+      }
+      FNR == NR {
+        if (/^\./) {
+          section = $1
+        } else if (section == ".code" && $2 == "VM_EXEC") {
+          sub(/^[^"]*"/, "")
+          sub(/"$/, "")
+          execs[count++] = $0
+        }
+        next
+      }
+      {
+        for (i = 0; i < count; i++) {
+          byte = substr($0, 2 * int(i / 8) + 1, 2)
+          value = 16 * hex(substr(byte, 1, 1)) + hex(substr(byte, 2, 1))
+          if (int(value / 2 ^ (i % 8)) % 2) {
+            print FNR "\t" execs[i]
+          }
+        }
+      }' $PASS2 - | sort -u | cmp -s - $TMP.want \
+      || fail "ucc-run -E decoded ($TEST.pass2)"
+  else
+    fail "ucc-run -E $TEST.pass2"
+  fi
+
+  # Replies over the socket of -u, one record at a time.
+  if command -v perl > /dev/null; then
+    for FLAGS in "" "-m 4"; do
+      rm -f $TMP.sock
+      $BIN/ucc-run -n -u $TMP.sock $FLAGS $PASS2 > /dev/null &
+      PID=$!
+      perl -MSocket -e '
+        my ($server, $client, $records) = @ARGV;
+        $SIG{ALRM} = sub { die "timeout\n" };
+        alarm 60;
+        socket(S, PF_UNIX, SOCK_DGRAM, 0) or die;
+        unlink $client;
+        bind(S, pack_sockaddr_un($client)) or die;
+        my $to = pack_sockaddr_un($server);
+        open(R, "<", $records) or die;
+        while (<R>) {
+          chomp;
+          select(undef, undef, undef, 0.05)
+            until defined send(S, $_, 0, $to);
+          defined(recv(S, my $reply, 65536, 0)) or die;
+          print $reply;
+        }
+        unlink $client;' $TMP.sock $TMP.client $TMP.rec > $TMP.out
+      STATUS=$?
+      kill $PID
+      wait $PID 2> /dev/null
+      [ $STATUS -eq 0 ] && cmp -s $TMP.out $TMP.ref \
+        || fail "ucc-run -n -u $FLAGS ($TEST.pass2)"
+    done
+  fi
+
+  # Programs whose commands print themselves, run for real, with the
+  # queue of -j large enough that nothing is shed.
+  $BIN/ucc-run -n $PASS2 $TMP.few | cut -f2 | sort > $TMP.want
+  sed 's/VM_EXEC "\(.*\)"$/VM_EXEC "echo \1"/' $PASS2 > $TMP.echo
+  for FLAGS in "" "-j 1" "-j 4" "-j 4 -q 100000 -S oldest" \
+               "-j 4 -q 100000 -S sample" "-j 2 -m 2"; do
+    $BIN/ucc-run $FLAGS $TMP.echo $TMP.few > $TMP.out &&
+      sort $TMP.out | cmp -s - $TMP.want \
+      || fail "ucc-run $FLAGS ($TEST.pass2)"
+  done
+
+  # Sources of examples in first match mode need compiler -f, which -w
+  # doesn't pass.
+  if ! head -1 $NAME.pass1 | grep -q first; then
+    rm -rf $TMP.dir
+    mkdir $TMP.dir
+    cp $NAME.src $TMP.dir
+    PATH=$BIN:$PATH same -n -w $TMP.dir $TMP.rec
+  fi
+done
+
+# Commands inherit the descriptors of ucc-run, and none of those that it
+# opens for itself. Records come from standard input, which commands
+# inherit anyway.
+printf '.got\nfds 0\n.code\n0 VM_EXEC "ls /proc/$$/fd"\n1 VM_RETURN\n' \
+  > $TMP.fds
+printf 'ssh\t22\n' > $TMP.one
+sh -c 'ls /proc/$$/fd' < $TMP.one > $TMP.want
+for FLAGS in "-r"; do
+  $BIN/ucc-run $FLAGS $TMP.fds < $TMP.one > $TMP.out &&
+    cmp -s $TMP.out $TMP.want || fail "ucc-run $FLAGS leaks descriptors"
+done
+rm -rf $TMP.dir
+mkdir $TMP.dir
+printf 'fds (e)\n{\n  exec ("ls /proc/$$/fd");\n}\n' > $TMP.dir/fds.src
+PATH=$BIN:$PATH $BIN/ucc-run -w $TMP.dir < $TMP.one > $TMP.out &&
+  cmp -s $TMP.out $TMP.want || fail "ucc-run -w leaks descriptors"
+if command -v perl > /dev/null; then
+  rm -f $TMP.sock
+  $BIN/ucc-run -u $TMP.sock $TMP.fds < $TMP.one > $TMP.out &
+  PID=$!
+  perl -MSocket -e '
+    my ($server, $client) = @ARGV;
+    $SIG{ALRM} = sub { die "timeout\n" };
+    alarm 60;
+    socket(S, PF_UNIX, SOCK_DGRAM, 0) or die;
+    unlink $client;
+    bind(S, pack_sockaddr_un($client)) or die;
+    my $to = pack_sockaddr_un($server);
+    select(undef, undef, undef, 0.05)
+      until defined send(S, "ssh\t22", 0, $to);
+    defined(recv(S, my $reply, 65536, 0)) or die;
+    unlink $client;' $TMP.sock $TMP.client
+  STATUS=$?
+  kill $PID
+  wait $PID 2> /dev/null
+  [ $STATUS -eq 0 ] && cmp -s $TMP.out $TMP.want \
+    || fail "ucc-run -u leaks descriptors"
+fi
+
+# Counts must be whole numbers, that fit.
+for FLAGS in "-j x" "-j -1" "-j 4x" "-j 99999999999" "-q 0" "-q +5" \
+             "-n -m x" "-n -m -2" "-n -m 2k" "-n -P x" "-n -P -4" \
+             "-n -P 4.5" "-n -L x" "-n -L -3" "-n -L 3," \
+             "-n -t $TMP.trace -T x" "-n -t $TMP.trace -T -7"; do
+  if $BIN/ucc-run $FLAGS $DIR/Call.pass2 /dev/null > $TMP.out 2> $TMP.err ||
+     ! grep -q '^usage: ' $TMP.err; then
+    fail "ucc-run accepts $FLAGS"
+  fi
+done
+
+exit $FAILED
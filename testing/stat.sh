@@ -0,0 +1,161 @@
+#!/bin/sh
+
+#
+# Check the counters of ucc-run -s, as uccstat prints them, for each
+# NAME.pass2 in this directory: the hits of the execs of each command
+# must add up to the times `ucc-run -n' prints the command, the never
+# fired list must hold the counters with no hits, and every mode, as
+# well as NAME.pass2l, must count the same. Commands of -j really run,
+# as echo of themselves, on fewer records and with a queue so short that
+# most are shed: for each command, those that ran and those shed must
+# add up to the hits, with any policy, and each that ran must have its
+# wait counted. RECORDS sets the number of records, 20000 by default.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-stat.$$
+RECORDS=${RECORDS:-20000}
+FAILED=0
+
+trap 'rm -f $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+# Print the hits of the execs in the output of uccstat, added up by
+# command, then the counters with no hits, then the never fired list.
+execs()
+{
+  awk '
+    $NF == "function" { section = "function"; next }
+    $NF == "exec" { section = "exec"; next }
+    $1 == "runs" { section = ""; getline; next }
+    /^never fired:$/ { section = "never"; next }
+    section == "never" && NF > 0 { sub(/^ */, ""); never[++n] = $0; next }
+    section != "" && NF > 0 {
+      hits = $1
+      sub(/^ *[0-9]+ +[-0-9.]+ +[0-9]* +/, "")
+      if (hits == 0) {
+        zero[++z] = $0
+      }
+      if (section == "exec" && hits > 0) {
+        command = $0
+        sub(/^[^"]*"/, "", command)
+        sub(/"$/, "", command)
+        sum[command] += hits
+      }
+    }
+    END {
+      for (command in sum) {
+        print sum[command] "\t" command | "sort"
+      }
+      close("sort")
+      for (i = 1; i <= z; i++) {
+        print "zero\t" zero[i]
+      }
+      for (i = 1; i <= n; i++) {
+        print "never\t" never[i]
+      }
+    }' "$@"
+}
+
+# Print the commands in the output of uccstat, each with the hits of
+# its execs less the shed ones, then the total shed, then the number of
+# commands whose wait was counted.
+ran()
+{
+  awk '
+    $NF == "exec" { section = 1; next }
+    $1 == "runs" { section = 0; getline; runs = $1; next }
+    /^never fired:$/ { section = 0 }
+    section && NF > 0 {
+      hits = $1
+      lost = $3
+      shed += lost
+      sub(/^[^"]*"/, "")
+      sub(/"$/, "")
+      if (hits > lost) {
+        ran[$0] += hits - lost
+      }
+    }
+    END {
+      for (command in ran) {
+        print ran[command] "\t" command | "sort"
+      }
+      close("sort")
+      print "shed\t" shed + 0
+      print "runs\t" runs + 0
+    }' "$@"
+}
+
+sh $DIR/records.sh $RECORDS $DIR/*.pass2 > $TMP.rec
+head -200 $TMP.rec > $TMP.few
+
+for PASS2 in $DIR/*.pass2; do
+  NAME=${PASS2%.pass2}
+  TEST=$(basename $NAME)
+
+  if ! $BIN/ucc-run -n -s $TMP.stats $PASS2 $TMP.rec > $TMP.ref ||
+     ! $BIN/uccstat $TMP.stats > $TMP.stat; then
+    fail "ucc-run -s $TEST.pass2"
+    continue
+  fi
+  execs $TMP.stat > $TMP.execs
+  cut -f2 $TMP.ref | sort | uniq -c | sed 's/^ *\([0-9]*\) /\1	/' |
+    sort > $TMP.want
+  grep -v '^zero	\|^never	' $TMP.execs | cmp -s - $TMP.want \
+    || fail "uccstat exec hits ($TEST.pass2)"
+  sed -n 's/^zero	//p' $TMP.execs > $TMP.zero
+  sed -n 's/^never	//p' $TMP.execs | cmp -s - $TMP.zero \
+    || fail "uccstat never fired ($TEST.pass2)"
+
+  for FLAGS in "-r" "-B -e" "-P 4" "-L 3" "-m 4" "-m 3 -k port -x"; do
+    $BIN/ucc-run -n -s $TMP.stats $FLAGS $PASS2 $TMP.rec > /dev/null \
+      2> $TMP.err &&
+      $BIN/uccstat $TMP.stats | cmp -s - $TMP.stat \
+      || fail "ucc-run -s $FLAGS ($TEST.pass2)"
+  done
+
+  # Fused, functions count the same, and so do the execs of a command.
+  sed -n '1,/exec$/p' $TMP.stat > $TMP.functions
+  if $BIN/ucc-run -n -s $TMP.stats $NAME.pass2l $TMP.rec > /dev/null &&
+     $BIN/uccstat $TMP.stats > $TMP.fused; then
+    sed -n '1,/exec$/p' $TMP.fused | cmp -s - $TMP.functions \
+      || fail "uccstat function hits ($TEST.pass2l)"
+    execs $TMP.fused | grep -v '^zero	\|^never	' | cmp -s - $TMP.want \
+      || fail "uccstat exec hits ($TEST.pass2l)"
+  else
+    fail "ucc-run -s $TEST.pass2l"
+  fi
+
+  sed 's/VM_EXEC "\(.*\)"$/VM_EXEC "echo \1"/' $PASS2 > $TMP.echo
+  FIRED=$($BIN/ucc-run -n $PASS2 $TMP.few | wc -l)
+  for FLAGS in "-S newest" "-S oldest" "-S sample" "-S newest -m 2"; do
+    if ! $BIN/ucc-run -s $TMP.stats -j 1 -q 2 $FLAGS $TMP.echo $TMP.few \
+           > $TMP.out 2> $TMP.err; then
+      fail "ucc-run -j 1 -q 2 $FLAGS ($TEST.pass2)"
+      continue
+    fi
+    SHED=$(sed -n 's/.*: shed \([0-9]*\) of [0-9]* commands$/\1/p' $TMP.err)
+    { sed 's/^/echo /' $TMP.out | sort | uniq -c |
+        sed 's/^ *\([0-9]*\) /\1	/' | sort
+      echo "shed	${SHED:-0}"
+      echo "runs	$(($(wc -l < $TMP.out)))"; } > $TMP.want
+    $BIN/uccstat $TMP.stats | ran | cmp -s - $TMP.want \
+      || fail "uccstat shed -j 1 -q 2 $FLAGS ($TEST.pass2)"
+    if [ $FIRED -gt 20 ] && [ ${SHED:-0} -eq 0 ]; then
+      fail "ucc-run -j 1 -q 2 $FLAGS sheds nothing ($TEST.pass2)"
+    fi
+  done
+done
+
+exit $FAILED
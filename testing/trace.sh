@@ -0,0 +1,76 @@
+#!/bin/sh
+
+#
+# Check the traces of ucc-run -t, as ucctrace prints them, for each
+# NAME.pass2 in this directory: with -T 1 every record is traced, in
+# order, and the execs of the traces are the commands that `ucc-run -n'
+# prints, in the same order; with -T 7 only every seventh record is;
+# with -m, the threads together trace every record once.
+#
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 builddir"
+  exit 1
+fi
+
+BIN=$1
+DIR=$(cd $(dirname $0) && pwd)
+TMP=${TMPDIR:-/tmp}/ucc-trace.$$
+RECORDS=200
+FAILED=0
+
+trap 'rm -f $TMP.*' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  FAILED=1
+}
+
+# Print the commands of the execs in the output of ucctrace.
+execs()
+{
+  awk '$3 == "VM_EXEC" { sub(/^[^"]*"/, ""); sub(/"$/, ""); print }' "$@"
+}
+
+# Print the headers that ucctrace prints for one record every STEP, out
+# of COUNT, traced by a single thread.
+numbers()
+{
+  awk -v step=$1 -v count=$2 \
+    'BEGIN { for (i = 0; i < count; i += step) print "thread 0 record " i }'
+}
+
+sh $DIR/records.sh $RECORDS $DIR/*.pass2 > $TMP.rec
+
+for PASS2 in $DIR/*.pass2; do
+  NAME=${PASS2%.pass2}
+  TEST=$(basename $NAME)
+
+  if ! $BIN/ucc-run -n -t $TMP.trace -T 1 $PASS2 $TMP.rec > $TMP.ref ||
+     ! $BIN/ucctrace $PASS2 $TMP.trace > $TMP.out; then
+    fail "ucc-run -t $TEST.pass2"
+    continue
+  fi
+  numbers 1 $RECORDS > $TMP.want
+  grep '^thread' $TMP.out | cmp -s - $TMP.want \
+    || fail "ucctrace -T 1 records ($TEST.pass2)"
+  cut -f2 $TMP.ref > $TMP.want
+  execs $TMP.out | cmp -s - $TMP.want \
+    || fail "ucctrace -T 1 execs ($TEST.pass2)"
+
+  $BIN/ucc-run -n -t $TMP.trace -T 7 $PASS2 $TMP.rec > /dev/null &&
+    $BIN/ucctrace $PASS2 $TMP.trace | grep '^thread' > $TMP.out &&
+    numbers 7 $RECORDS | cmp -s - $TMP.out \
+    || fail "ucctrace -T 7 records ($TEST.pass2)"
+
+  # Records hashed to threads are numbered by each thread.
+  sort $TMP.want > $TMP.sorted
+  $BIN/ucc-run -n -m 4 -t $TMP.trace -T 1 $PASS2 $TMP.rec > /dev/null &&
+    $BIN/ucctrace $PASS2 $TMP.trace > $TMP.out &&
+    [ $(grep -c '^thread' $TMP.out) -eq $RECORDS ] &&
+    execs $TMP.out | sort | cmp -s - $TMP.sorted \
+    || fail "ucctrace -m 4 ($TEST.pass2)"
+done
+
+exit $FAILED